@@ -0,0 +1,20 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Wall-clock helpers for the bench_* programs. They print figures and never fail, since the
+// numbers depend on the machine; run them by hand when touching a hot path.
+
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static inline double bench_mb_per_s(uint64_t bytes, uint64_t ns) {
+    return ns ? (double)bytes * 1000.0 / ns : 0;
+}
+
+#endif
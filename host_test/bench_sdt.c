@@ -0,0 +1,113 @@
+// Compression ratio of the swinging-door filter against the error of rebuilding the series
+// from the kept rows, across deadbands, on pressure traces shaped like the field data: quiet
+// water, tides, pump cycles and a noisy sensor. Also the cost per sample.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "sdt.c"
+
+#define SAMPLES   (30 * 24 * 30)    // A month of 2-minute samples
+#define HEARTBEAT (60 * 60)
+
+typedef struct {
+    uint32_t t;
+    double v;
+} point_t;
+
+static point_t samples[SAMPLES];
+static point_t kept[SAMPLES];
+static size_t n_kept;
+static uint32_t rng = 1;
+
+static double gauss(void) {
+    rng = rng * 1664525u + 1013904223u;
+    double u = (rng + 1.0) / 4294967297.0;
+    rng = rng * 1664525u + 1013904223u;
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * rng / 4294967296.0);
+}
+
+// Pressure in raw counts; the sensor rounds to whole counts
+static void make_trace(int kind) {
+    double pump = 0;
+    for (size_t i = 0; i < SAMPLES; i++) {
+        uint32_t t = 1767225600 + i * 120;
+        double v = 101325;
+        switch (kind) {
+        case 0:         // Still water
+            v += 3 * gauss();
+            break;
+        case 1:         // Tidal, about a metre of head twice a day
+            v += 5000 * sin(2 * M_PI * t / 44712.0) + 5 * gauss();
+            break;
+        case 2:         // Pump on for an hour in four
+            if (i % 120 == 0) pump = 3000;
+            if (i % 120 == 30) pump = 0;
+            v += pump + 10 * gauss();
+            break;
+        default:        // Noisy sensor on slow drift
+            v += i * 0.05 + 40 * gauss();
+            break;
+        }
+        samples[i].t = t;
+        samples[i].v = round(v);
+    }
+}
+
+static void compress(double deadband) {
+    sdt_t s = {0};
+    point_t held = {0};
+    n_kept = 0;
+    for (size_t i = 0; i < SAMPLES; i++) {
+        unsigned emit = sdt_add(&s, deadband, HEARTBEAT, samples[i].t, samples[i].v, false);
+        if (emit & SDT_EMIT_HELD) kept[n_kept++] = held;
+        if (emit & SDT_EMIT_NEW) {
+            kept[n_kept++] = samples[i];
+        } else {
+            held = samples[i];
+        }
+    }
+    if (sdt_flush(&s)) kept[n_kept++] = held;
+}
+
+static void rebuild_error(double *max, double *rms) {
+    double worst = 0, sum = 0;
+    size_t k = 0;
+    for (size_t i = 0; i < SAMPLES; i++) {
+        while (k + 1 < n_kept && kept[k + 1].t <= samples[i].t) k++;
+        double rebuilt = kept[k].v;
+        if (kept[k].t != samples[i].t && k + 1 < n_kept) {
+            double f = (double)(samples[i].t - kept[k].t) / (kept[k + 1].t - kept[k].t);
+            rebuilt = kept[k].v + f * (kept[k + 1].v - kept[k].v);
+        }
+        double err = fabs(rebuilt - samples[i].v);
+        if (err > worst) worst = err;
+        sum += err * err;
+    }
+    *max = worst;
+    *rms = sqrt(sum / SAMPLES);
+}
+
+int main(void) {
+    const char *kinds[] = {"still", "tidal", "pump", "noisy"};
+    double deadbands[] = {1, 5, 20, 50, 200, 1000};
+    printf("%-8s %8s %8s %9s %9s %9s\n", "trace", "deadband", "kept", "ratio", "max err", "rms err");
+    for (int kind = 0; kind < 4; kind++) {
+        make_trace(kind);
+        for (size_t d = 0; d < sizeof(deadbands) / sizeof(deadbands[0]); d++) {
+            double max, rms;
+            compress(deadbands[d]);
+            rebuild_error(&max, &rms);
+            printf("%-8s %8.0f %8zu %8.1f:1 %9.1f %9.2f\n", kinds[kind], deadbands[d], n_kept, (double)SAMPLES / n_kept,
+                   max, rms);
+        }
+    }
+
+    enum { REPEAT = 200 };
+    make_trace(1);
+    uint64_t start = bench_now_ns();
+    for (int r = 0; r < REPEAT; r++) compress(50);
+    uint64_t ns = bench_now_ns() - start;
+    printf("sdt_add: %.1f ns per sample\n", (double)ns / REPEAT / SAMPLES);
+    return 0;
+}
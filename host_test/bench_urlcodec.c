@@ -0,0 +1,51 @@
+// Table-driven URL codecs against the isxdigit/strtol versions they replaced, on a short
+// portal status message, a registration field and a long escape-heavy string
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "url_ref.h"
+#include "urlcodec.c"
+
+#define REPEAT 200000
+
+typedef size_t (*ref_fn)(const char *, char *, size_t);
+typedef esp_err_t (*codec_fn)(const char *, char *, size_t);
+
+static void run(const char *label, const char *in, codec_fn codec, ref_fn ref) {
+    static char out[4096];
+    size_t len = strlen(in);
+    volatile char sink = 0;
+
+    uint64_t start = bench_now_ns();
+    for (int r = 0; r < REPEAT; r++) {
+        ref(in, out, sizeof(out));
+        sink += out[0];
+    }
+    uint64_t ref_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (int r = 0; r < REPEAT; r++) {
+        codec(in, out, sizeof(out));
+        sink += out[0];
+    }
+    uint64_t ns = bench_now_ns() - start;
+
+    printf("%-24s %5zu bytes  old %7.1f MB/s  new %7.1f MB/s  x%.1f\n", label, len,
+           bench_mb_per_s((uint64_t)len * REPEAT, ref_ns), bench_mb_per_s((uint64_t)len * REPEAT, ns),
+           ns ? (double)ref_ns / ns : 0);
+}
+
+int main(void) {
+    static char long_plain[1025], long_escaped[1024 * 3 + 1];
+    for (int i = 0; i < 1024; i++) long_plain[i] = "abcdefghijklmnop-._~0123456789XYZ"[i % 33];
+    long_plain[1024] = '\0';
+    url_encode("caf\xc3\xa9 & th\xc3\xa9 = 100% / ok", long_escaped, sizeof(long_escaped));
+    while (strlen(long_escaped) < 1000) strcat(long_escaped, "%C3%A9+%26x");
+
+    run("decode status", "Connection%20Failed", url_decode, ref_url_decode);
+    run("decode escape-heavy", long_escaped, url_decode, ref_url_decode);
+    run("encode geoutm", "33T 500123E 4649776N", url_encode, ref_url_encode);
+    run("encode plain 1 KB", long_plain, url_encode, ref_url_encode);
+    run("encode escape-heavy", long_escaped, url_encode, ref_url_encode);
+    return 0;
+}
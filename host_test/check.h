@@ -0,0 +1,40 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Minimal assertions for the host tests. Failures are counted rather than aborting, so one
+// run reports all of them; main returns check_result().
+
+static int check_failures;
+
+#define CHECK(cond) CHECK_MSG(cond, "%s", #cond)
+
+#define CHECK_MSG(cond, fmt, ...) do { \
+        if (!(cond)) { \
+            check_failures++; \
+            fprintf(stderr, "%s:%d: " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+static inline int check_result(void) {
+    if (check_failures) fprintf(stderr, "%d check(s) failed\n", check_failures);
+    return check_failures != 0;
+}
+
+// Deterministic generator so failures reproduce from the printed seed
+static uint32_t check_rng = 2463534242u;
+
+static inline uint32_t check_rand(void) {
+    check_rng ^= check_rng << 13;
+    check_rng ^= check_rng >> 17;
+    check_rng ^= check_rng << 5;
+    return check_rng;
+}
+
+static inline uint32_t check_rand_below(uint32_t n) {
+    return n ? check_rand() % n : 0;
+}
+
+#endif
@@ -0,0 +1,260 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cJSON.h"
+
+// Just enough of cJSON for the host tests: strict RFC 8259 values, one per call, with
+// trailing bytes ignored as cJSON_ParseWithLength does. Strings are decoded to UTF-8; a \u0000
+// ends the string early, as in cJSON.
+
+#define MAX_DEPTH 1000
+
+typedef struct {
+    const char *p;
+    const char *end;
+    int depth;
+} reader_t;
+
+static void skip_space(reader_t *r) {
+    while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r')) r->p++;
+}
+
+static bool take(reader_t *r, const char *word) {
+    size_t n = strlen(word);
+    if ((size_t)(r->end - r->p) < n || memcmp(r->p, word, n) != 0) return false;
+    r->p += n;
+    return true;
+}
+
+static int hex4(const char *p) {
+    int v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= c - '0';
+        else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+        else return -1;
+    }
+    return v;
+}
+
+static size_t put_utf8(char *out, uint32_t cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | cp >> 6);
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | cp >> 12);
+        out[1] = (char)(0x80 | (cp >> 6 & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | cp >> 18);
+    out[1] = (char)(0x80 | (cp >> 12 & 0x3F));
+    out[2] = (char)(0x80 | (cp >> 6 & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// A string starting at the opening quote; the result is malloc'd
+static char *parse_string(reader_t *r) {
+    if (r->p >= r->end || *r->p != '"') return NULL;
+    const char *s = ++r->p;
+    while (s < r->end && *s != '"') s += *s == '\\' ? 2 : 1;
+    if (s >= r->end) return NULL;
+
+    char *out = malloc(s - r->p + 1);   // Escapes never grow
+    if (!out) return NULL;
+    size_t n = 0;
+    while (r->p < s) {
+        unsigned char c = (unsigned char)*r->p++;
+        if (c < 0x20) goto fail;
+        if (c != '\\') {
+            out[n++] = (char)c;
+            continue;
+        }
+        c = (unsigned char)*r->p++;
+        switch (c) {
+            case '"': case '\\': case '/': out[n++] = (char)c; break;
+            case 'b': out[n++] = '\b'; break;
+            case 'f': out[n++] = '\f'; break;
+            case 'n': out[n++] = '\n'; break;
+            case 'r': out[n++] = '\r'; break;
+            case 't': out[n++] = '\t'; break;
+            case 'u': {
+                if (s - r->p < 4) goto fail;
+                int cp = hex4(r->p);
+                r->p += 4;
+                if (cp < 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) goto fail;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    if (s - r->p < 6 || r->p[0] != '\\' || r->p[1] != 'u') goto fail;
+                    int lo = hex4(r->p + 2);
+                    if (lo < 0xDC00 || lo > 0xDFFF) goto fail;
+                    r->p += 6;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                }
+                n += put_utf8(out + n, (uint32_t)cp);
+                break;
+            }
+            default:
+                goto fail;
+        }
+    }
+    out[n] = '\0';
+    r->p = s + 1;
+    return out;
+fail:
+    free(out);
+    return NULL;
+}
+
+static bool parse_number(reader_t *r, cJSON *item) {
+    const char *p = r->p;
+    if (p < r->end && *p == '-') p++;
+    if (p >= r->end || *p < '0' || *p > '9') return false;
+    if (*p == '0') p++;
+    else while (p < r->end && *p >= '0' && *p <= '9') p++;
+    if (p < r->end && *p == '.') {
+        p++;
+        if (p >= r->end || *p < '0' || *p > '9') return false;
+        while (p < r->end && *p >= '0' && *p <= '9') p++;
+    }
+    if (p < r->end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < r->end && (*p == '+' || *p == '-')) p++;
+        if (p >= r->end || *p < '0' || *p > '9') return false;
+        while (p < r->end && *p >= '0' && *p <= '9') p++;
+    }
+
+    char num[64];
+    size_t len = p - r->p;
+    if (len >= sizeof(num)) return false;
+    memcpy(num, r->p, len);
+    num[len] = '\0';
+    item->type = cJSON_Number;
+    item->valuedouble = strtod(num, NULL);
+    item->valueint = item->valuedouble >= INT32_MAX ? INT32_MAX
+                   : item->valuedouble <= INT32_MIN ? INT32_MIN : (int)item->valuedouble;
+    r->p = p;
+    return true;
+}
+
+static bool parse_value(reader_t *r, cJSON *item);
+
+// Members of an object or elements of an array, after the opening bracket
+static bool parse_members(reader_t *r, cJSON *parent, bool object) {
+    char close = object ? '}' : ']';
+    skip_space(r);
+    if (r->p < r->end && *r->p == close) {
+        r->p++;
+        return true;
+    }
+
+    cJSON *last = NULL;
+    for (;;) {
+        cJSON *child = calloc(1, sizeof(cJSON));
+        if (!child) return false;
+        if (last) {
+            last->next = child;
+            child->prev = last;
+        } else {
+            parent->child = child;
+        }
+        last = child;
+        parent->child->prev = last;
+
+        skip_space(r);
+        if (object) {
+            child->string = parse_string(r);
+            if (!child->string) return false;
+            skip_space(r);
+            if (r->p >= r->end || *r->p != ':') return false;
+            r->p++;
+        }
+        if (!parse_value(r, child)) return false;
+        skip_space(r);
+        if (r->p >= r->end) return false;
+        if (*r->p == close) {
+            r->p++;
+            return true;
+        }
+        if (*r->p != ',') return false;
+        r->p++;
+    }
+}
+
+static bool parse_value(reader_t *r, cJSON *item) {
+    skip_space(r);
+    if (r->p >= r->end) return false;
+    switch (*r->p) {
+        case '{':
+        case '[': {
+            bool object = *r->p == '{';
+            if (++r->depth > MAX_DEPTH) return false;
+            r->p++;
+            item->type = object ? cJSON_Object : cJSON_Array;
+            bool ok = parse_members(r, item, object);
+            r->depth--;
+            return ok;
+        }
+        case '"':
+            item->type = cJSON_String;
+            item->valuestring = parse_string(r);
+            return item->valuestring != NULL;
+        case 't':
+            item->type = cJSON_True;
+            return take(r, "true");
+        case 'f':
+            item->type = cJSON_False;
+            return take(r, "false");
+        case 'n':
+            item->type = cJSON_NULL;
+            return take(r, "null");
+        default:
+            return parse_number(r, item);
+    }
+}
+
+cJSON *cJSON_ParseWithLength(const char *value, size_t buffer_length) {
+    if (!value) return NULL;
+    // Like cJSON, stop at a terminator inside the given length
+    const char *nul = memchr(value, '\0', buffer_length);
+    reader_t r = {.p = value, .end = nul ? nul : value + buffer_length};
+    cJSON *item = calloc(1, sizeof(cJSON));
+    if (!item) return NULL;
+    if (!parse_value(&r, item)) {
+        cJSON_Delete(item);
+        return NULL;
+    }
+    return item;
+}
+
+void cJSON_Delete(cJSON *item) {
+    while (item) {
+        cJSON *next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
+
+cJSON_bool cJSON_IsObject(const cJSON *item) {
+    return item && item->type == cJSON_Object;
+}
+
+cJSON_bool cJSON_IsString(const cJSON *item) {
+    return item && item->type == cJSON_String;
+}
+
+cJSON_bool cJSON_IsNumber(const cJSON *item) {
+    return item && item->type == cJSON_Number;
+}
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "check.h"
+#include "flash_sim.h"
+
+#define FLASH_SIM_PARTS 4
+
+jmp_buf flash_sim_cut;
+
+static esp_partition_t parts[FLASH_SIM_PARTS];
+static uint8_t *flash[FLASH_SIM_PARTS];
+static int part_count;
+static long cut_budget = -1;
+static unsigned long erases;
+
+void flash_sim_init(const char *label, size_t size) {
+    for (int i = 0; i < part_count; i++) free(flash[i]);
+    memset(parts, 0, sizeof(parts));
+    memset(flash, 0, sizeof(flash));
+    part_count = 0;
+    cut_budget = -1;
+    erases = 0;
+    flash_sim_add(ESP_PARTITION_TYPE_DATA, label, size);
+}
+
+const esp_partition_t *flash_sim_add(esp_partition_type_t type, const char *label, size_t size) {
+    if (part_count == FLASH_SIM_PARTS) return NULL;
+    esp_partition_t *part = &parts[part_count];
+    part->type = type;
+    part->address = part_count ? parts[part_count - 1].address + parts[part_count - 1].size : 0x10000;
+    part->size = size;
+    part->erase_size = FLASH_SIM_SECTOR;
+    strncpy(part->label, label, sizeof(part->label) - 1);
+    flash[part_count] = malloc(size);
+    memset(flash[part_count], 0xFF, size);
+    part_count++;
+    return part;
+}
+
+void flash_sim_arm_cut(long bytes) {
+    cut_budget = bytes;
+}
+
+uint8_t *flash_sim_data(void) {
+    return flash[0];
+}
+
+uint8_t *flash_sim_part_data(const esp_partition_t *part) {
+    long i = part - parts;
+    return i >= 0 && i < part_count ? flash[i] : NULL;
+}
+
+unsigned long flash_sim_erases(void) {
+    return erases;
+}
+
+// Counts one byte against the armed cut. Returns false when power is gone.
+static bool power_left(void) {
+    if (cut_budget < 0) return true;
+    if (cut_budget == 0) return false;
+    cut_budget--;
+    return true;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, int subtype, const char *label) {
+    (void)subtype;
+    for (int i = 0; i < part_count; i++) {
+        if (parts[i].type == type && (!label || strcmp(label, parts[i].label) == 0)) return &parts[i];
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t size) {
+    uint8_t *data = flash_sim_part_data(p);
+    if (!data || offset + size > p->size) return ESP_ERR_INVALID_ARG;
+    memcpy(dst, data + offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t size) {
+    uint8_t *data = flash_sim_part_data(p);
+    if (!data || offset + size > p->size) return ESP_ERR_INVALID_ARG;
+    const uint8_t *in = src;
+    for (size_t i = 0; i < size; i++) {
+        if (!power_left()) {
+            // Some bits of the byte being programmed made it
+            data[offset + i] &= in[i] | (uint8_t)check_rand();
+            cut_budget = -1;
+            longjmp(flash_sim_cut, 1);
+        }
+        data[offset + i] &= in[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size) {
+    uint8_t *data = flash_sim_part_data(p);
+    if (!data || offset % FLASH_SIM_SECTOR || size % FLASH_SIM_SECTOR || offset + size > p->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    erases += size / FLASH_SIM_SECTOR;
+    for (size_t i = 0; i < size; i++) {
+        if (!power_left()) {
+            cut_budget = -1;
+            longjmp(flash_sim_cut, 1);
+        }
+        data[offset + i] = 0xFF;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,29 @@
+#ifndef FLASH_SIM_H
+#define FLASH_SIM_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_partition.h"
+
+// NOR flash behind the esp_partition API: writes can only clear bits, erases work on whole
+// 4 KB sectors. A power cut can be armed to hit after a number of bytes have been written
+// or erased; the operation in progress stops part way, the last byte half programmed, and
+// control jumps to flash_sim_cut.
+
+#define FLASH_SIM_SECTOR 4096
+
+extern jmp_buf flash_sim_cut;
+
+// Starts over with a single data partition
+void flash_sim_init(const char *label, size_t size);
+// Adds a partition after the others; they share the cut budget
+const esp_partition_t *flash_sim_add(esp_partition_type_t type, const char *label, size_t size);
+// Cut after `bytes` more bytes are touched, or never for a negative count
+void flash_sim_arm_cut(long bytes);
+uint8_t *flash_sim_data(void);     // The first partition
+uint8_t *flash_sim_part_data(const esp_partition_t *part);
+unsigned long flash_sim_erases(void);
+
+#endif
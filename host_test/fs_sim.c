@@ -0,0 +1,267 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "fs_sim.h"
+
+#define FS_SIM_FILES   16
+#define FS_SIM_HANDLES 8
+
+typedef struct {
+    bool exists;
+    char name[64];
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t durable;     // Bytes that survive a power cut
+} sim_node_t;
+
+struct fs_sim_file {
+    bool open;
+    bool readable;
+    bool writable;
+    int node;
+    size_t pos;
+};
+
+jmp_buf fs_sim_cut;
+
+static sim_node_t nodes[FS_SIM_FILES];
+static FS_SIM_FILE handles[FS_SIM_HANDLES];
+static long cut_ops = -1;
+
+void fs_sim_reset(void) {
+    for (int i = 0; i < FS_SIM_FILES; i++) free(nodes[i].data);
+    memset(nodes, 0, sizeof(nodes));
+    memset(handles, 0, sizeof(handles));
+    cut_ops = -1;
+}
+
+void fs_sim_arm_cut(long ops) {
+    cut_ops = ops;
+}
+
+// What the card holds after power comes back
+static void crash(void) {
+    for (int i = 0; i < FS_SIM_FILES; i++) {
+        sim_node_t *n = &nodes[i];
+        if (!n->exists) continue;
+        size_t kept = n->durable + check_rand_below((uint32_t)(n->len - n->durable + 1));
+        if (kept > n->durable && check_rand_below(4) == 0) {
+            // Clusters allocated but never written back
+            for (size_t j = n->durable; j < kept; j++) n->data[j] = (char)check_rand();
+        }
+        n->len = kept;
+        n->durable = kept;
+    }
+    memset(handles, 0, sizeof(handles));
+    cut_ops = -1;
+    longjmp(fs_sim_cut, 1);
+}
+
+static void op(void) {
+    if (cut_ops < 0) return;
+    if (cut_ops == 0) crash();
+    cut_ops--;
+}
+
+static int find(const char *path) {
+    for (int i = 0; i < FS_SIM_FILES; i++) {
+        if (nodes[i].exists && strcmp(nodes[i].name, path) == 0) return i;
+    }
+    return -1;
+}
+
+static int create(const char *path) {
+    for (int i = 0; i < FS_SIM_FILES; i++) {
+        if (!nodes[i].exists) {
+            nodes[i].exists = true;
+            snprintf(nodes[i].name, sizeof(nodes[i].name), "%s", path);
+            nodes[i].len = 0;
+            nodes[i].durable = 0;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void put_bytes(sim_node_t *n, size_t pos, const void *data, size_t len) {
+    if (pos + len > n->cap) {
+        n->cap = (pos + len) * 2;
+        n->data = realloc(n->data, n->cap);
+    }
+    memcpy(n->data + pos, data, len);
+    if (pos + len > n->len) n->len = pos + len;
+}
+
+bool fs_sim_exists(const char *path) {
+    return find(path) >= 0;
+}
+
+bool fs_sim_put(const char *path, const void *data, size_t len) {
+    int i = find(path);
+    if (i < 0) i = create(path);
+    if (i < 0) return false;
+    nodes[i].len = 0;
+    put_bytes(&nodes[i], 0, data, len);
+    nodes[i].durable = len;
+    return true;
+}
+
+size_t fs_sim_get(const char *path, void *buf, size_t size) {
+    int i = find(path);
+    if (i < 0) return 0;
+    size_t n = nodes[i].len < size ? nodes[i].len : size;
+    memcpy(buf, nodes[i].data, n);
+    return n;
+}
+
+FS_SIM_FILE *fs_sim_fopen(const char *path, const char *mode) {
+    op();
+    int i = find(path);
+    bool append = mode[0] == 'a';
+    bool truncate = mode[0] == 'w';
+    if (i < 0) {
+        if (mode[0] == 'r') {
+            errno = ENOENT;
+            return NULL;
+        }
+        i = create(path);
+        if (i < 0) {
+            errno = ENOSPC;
+            return NULL;
+        }
+    }
+    if (truncate) {
+        nodes[i].len = 0;
+        nodes[i].durable = 0;
+    }
+
+    for (int h = 0; h < FS_SIM_HANDLES; h++) {
+        if (!handles[h].open) {
+            handles[h] = (FS_SIM_FILE){
+                .open = true,
+                .readable = mode[0] == 'r' || strchr(mode, '+'),
+                .writable = mode[0] != 'r' || strchr(mode, '+'),
+                .node = i,
+                .pos = append ? nodes[i].len : 0,
+            };
+            return &handles[h];
+        }
+    }
+    errno = EMFILE;
+    return NULL;
+}
+
+int fs_sim_fclose(FS_SIM_FILE *f) {
+    op();
+    if (f->writable) nodes[f->node].durable = nodes[f->node].len;
+    f->open = false;
+    return 0;
+}
+
+size_t fs_sim_fread(void *buf, size_t size, size_t count, FS_SIM_FILE *f) {
+    sim_node_t *n = &nodes[f->node];
+    if (!f->readable || size == 0 || f->pos >= n->len) return 0;
+    size_t items = (n->len - f->pos) / size;
+    if (items > count) items = count;
+    memcpy(buf, n->data + f->pos, items * size);
+    f->pos += items * size;
+    return items;
+}
+
+size_t fs_sim_fwrite(const void *buf, size_t size, size_t count, FS_SIM_FILE *f) {
+    if (!f->writable) return 0;
+    sim_node_t *n = &nodes[f->node];
+    if (cut_ops == 0) {
+        // Torn mid-write
+        put_bytes(n, f->pos, buf, check_rand_below((uint32_t)(size * count + 1)));
+        crash();
+    }
+    op();
+    if (f->pos > n->len) f->pos = n->len;
+    put_bytes(n, f->pos, buf, size * count);
+    f->pos += size * count;
+    return count;
+}
+
+int fs_sim_fprintf(FS_SIM_FILE *f, const char *fmt, ...) {
+    char text[512];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    if (len < 0 || (size_t)len >= sizeof(text)) return -1;
+    return fs_sim_fwrite(text, 1, len, f) == (size_t)len ? len : -1;
+}
+
+int fs_sim_fputs(const char *s, FS_SIM_FILE *f) {
+    size_t len = strlen(s);
+    return fs_sim_fwrite(s, 1, len, f) == len ? 0 : EOF;
+}
+
+char *fs_sim_fgets(char *buf, int size, FS_SIM_FILE *f) {
+    sim_node_t *n = &nodes[f->node];
+    int i = 0;
+    while (i < size - 1 && f->pos < n->len) {
+        char c = n->data[f->pos++];
+        buf[i++] = c;
+        if (c == '\n') break;
+    }
+    if (i == 0) return NULL;
+    buf[i] = '\0';
+    return buf;
+}
+
+int fs_sim_fflush(FS_SIM_FILE *f) {
+    (void)f;
+    op();
+    return 0;
+}
+
+int fs_sim_fseek(FS_SIM_FILE *f, long offset, int whence) {
+    long base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (long)f->pos : (long)nodes[f->node].len;
+    if (base + offset < 0) return -1;
+    f->pos = (size_t)(base + offset);
+    return 0;
+}
+
+long fs_sim_ftell(FS_SIM_FILE *f) {
+    return (long)f->pos;
+}
+
+int fs_sim_fileno(FS_SIM_FILE *f) {
+    return (int)(f - handles);
+}
+
+int fs_sim_fsync(int fd) {
+    op();
+    if (fd < 0 || fd >= FS_SIM_HANDLES || !handles[fd].open) return -1;
+    nodes[handles[fd].node].durable = nodes[handles[fd].node].len;
+    return 0;
+}
+
+int fs_sim_remove(const char *path) {
+    op();
+    int i = find(path);
+    if (i < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    nodes[i].exists = false;
+    return 0;
+}
+
+// FAT refuses to rename over an existing file
+int fs_sim_rename(const char *from, const char *to) {
+    op();
+    int i = find(from);
+    if (i < 0 || find(to) >= 0) {
+        errno = i < 0 ? ENOENT : EEXIST;
+        return -1;
+    }
+    snprintf(nodes[i].name, sizeof(nodes[i].name), "%s", to);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef FS_SIM_H
+#define FS_SIM_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A small in-memory file system standing in for FAT on the SD card, for code built with
+// fs_sim_redirect.h. Creating, truncating, removing and renaming take effect at once; file
+// data is only durable after fsync or fclose. A power cut can be armed to hit at the Nth
+// file operation: each file keeps its durable bytes plus a random part of the rest, which
+// may be garbage, and control jumps to fs_sim_cut.
+
+typedef struct fs_sim_file FS_SIM_FILE;
+
+extern jmp_buf fs_sim_cut;
+
+void fs_sim_reset(void);
+// Cut at the `ops`th file operation from now, or never for a negative count
+void fs_sim_arm_cut(long ops);
+bool fs_sim_exists(const char *path);
+// Direct access for tests, outside the cut accounting
+bool fs_sim_put(const char *path, const void *data, size_t len);
+size_t fs_sim_get(const char *path, void *buf, size_t size);
+
+FS_SIM_FILE *fs_sim_fopen(const char *path, const char *mode);
+int fs_sim_fclose(FS_SIM_FILE *f);
+size_t fs_sim_fread(void *buf, size_t size, size_t count, FS_SIM_FILE *f);
+size_t fs_sim_fwrite(const void *buf, size_t size, size_t count, FS_SIM_FILE *f);
+int fs_sim_fprintf(FS_SIM_FILE *f, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int fs_sim_fputs(const char *s, FS_SIM_FILE *f);
+char *fs_sim_fgets(char *buf, int size, FS_SIM_FILE *f);
+int fs_sim_fflush(FS_SIM_FILE *f);
+int fs_sim_fseek(FS_SIM_FILE *f, long offset, int whence);
+long fs_sim_ftell(FS_SIM_FILE *f);
+int fs_sim_fileno(FS_SIM_FILE *f);
+int fs_sim_fsync(int fd);
+int fs_sim_remove(const char *path);
+int fs_sim_rename(const char *from, const char *to);
+
+#endif
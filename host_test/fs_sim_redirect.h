@@ -0,0 +1,25 @@
+#ifndef FS_SIM_REDIRECT_H
+#define FS_SIM_REDIRECT_H
+
+// Include ahead of a module's source to run its stdio file access on fs_sim
+#include <stdio.h>
+#include <unistd.h>
+#include "fs_sim.h"
+
+#define FILE    FS_SIM_FILE
+#define fopen   fs_sim_fopen
+#define fclose  fs_sim_fclose
+#define fread   fs_sim_fread
+#define fwrite  fs_sim_fwrite
+#define fprintf fs_sim_fprintf
+#define fputs   fs_sim_fputs
+#define fgets   fs_sim_fgets
+#define fflush  fs_sim_fflush
+#define fseek   fs_sim_fseek
+#define ftell   fs_sim_ftell
+#define fileno  fs_sim_fileno
+#define fsync   fs_sim_fsync
+#define remove  fs_sim_remove
+#define rename  fs_sim_rename
+
+#endif
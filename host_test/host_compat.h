@@ -0,0 +1,28 @@
+#ifndef HOST_COMPAT_H
+#define HOST_COMPAT_H
+
+// Forced into every host test build: what newlib has and older glibc lacks
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // asprintf, which newlib declares without it
+#endif
+#include <string.h>
+
+#if defined(__GLIBC__) && !(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 38))
+static inline size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+static inline size_t strlcat(char *dst, const char *src, size_t size) {
+    size_t used = strnlen(dst, size);
+    if (used == size) return size + strlen(src);
+    return used + strlcpy(dst + used, src, size - used);
+}
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "http_client_sim.h"
+
+struct esp_http_client {
+    esp_http_client_config_t config;
+    http_client_sim_request_t req;
+    bool open;
+    bool answered;
+    char *body;
+    size_t body_cap;
+    size_t body_len;
+    size_t read_pos;
+};
+
+static http_client_sim_server_fn server;
+static void *server_ctx;
+static int refuse;
+static long drop_after = -1;
+static int requests;
+static int live;
+
+void http_client_sim_reset(http_client_sim_server_fn fn, void *ctx) {
+    server = fn;
+    server_ctx = ctx;
+    refuse = 0;
+    drop_after = -1;
+    requests = 0;
+    live = 0;
+}
+
+void http_client_sim_refuse(int n) {
+    refuse = n;
+}
+
+void http_client_sim_drop_after(long bytes) {
+    drop_after = bytes;
+}
+
+int http_client_sim_requests(void) {
+    return requests;
+}
+
+int http_client_sim_live(void) {
+    return live;
+}
+
+const char *http_client_sim_header(const http_client_sim_request_t *req, const char *name, char *buf, size_t len) {
+    size_t name_len = strlen(name);
+    for (const char *line = req->headers; *line;) {
+        const char *end = strchr(line, '\n');
+        if (!end) break;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *value = line + name_len + 1;
+            while (*value == ' ') value++;
+            size_t n = end - value < (long)len - 1 ? (size_t)(end - value) : len - 1;
+            memcpy(buf, value, n);
+            buf[n] = '\0';
+            return buf;
+        }
+        line = end + 1;
+    }
+    return NULL;
+}
+
+static void event(esp_http_client_handle_t client, esp_http_client_event_id_t id, void *data, int len) {
+    if (!client->config.event_handler) return;
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = client,
+        .data = data,
+        .data_len = len,
+        .user_data = client->config.user_data,
+    };
+    client->config.event_handler(&evt);
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) {
+    if (!config->url) return NULL;
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+    if (!client) return NULL;
+    client->config = *config;
+    strlcpy(client->req.url, config->url, sizeof(client->req.url));
+    client->req.method = config->method;
+    live++;
+    return client;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value) {
+    size_t used = strlen(client->req.headers);
+    int n = snprintf(client->req.headers + used, sizeof(client->req.headers) - used, "%s: %s\n", key, value);
+    return n > 0 && (size_t)n < sizeof(client->req.headers) - used ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url) {
+    strlcpy(client->req.url, url, sizeof(client->req.url));
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len) {
+    if (refuse > 0) {
+        refuse--;
+        event(client, HTTP_EVENT_ERROR, NULL, 0);
+        return ESP_FAIL;
+    }
+    free(client->body);
+    client->body_cap = write_len > 0 ? write_len : 0;
+    client->body = malloc(client->body_cap + 1);
+    client->body_len = 0;
+    client->read_pos = 0;
+    client->answered = false;
+    client->open = true;
+    event(client, HTTP_EVENT_ON_CONNECTED, NULL, 0);
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char *buffer, int len) {
+    if (!client->open || len < 0) return -1;
+    // Like the real client, writing past the length given to open is an error
+    if (client->body_len + len > client->body_cap) return -1;
+    memcpy(client->body + client->body_len, buffer, len);
+    client->body_len += len;
+    return len;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+    if (!client->open) return ESP_FAIL;
+    if (!client->answered) {
+        client->answered = true;
+        requests++;
+        client->req.body = client->body;
+        client->req.body_len = client->body_len;
+        client->req.status = 404;
+        client->req.reply = "";
+        client->req.reply_len = 0;
+        if (server) server(&client->req, server_ctx);
+    }
+    return client->req.reply_len;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+    return client->answered ? client->req.status : -1;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client) {
+    return client->answered ? (int64_t)client->req.reply_len : -1;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len) {
+    if (!client->open || !client->answered) return -1;
+    size_t n = client->req.reply_len - client->read_pos;
+    if ((size_t)len < n) n = len;
+    if (drop_after >= 0) {
+        if (drop_after == 0) {
+            client->open = false;
+            event(client, HTTP_EVENT_DISCONNECTED, NULL, 0);
+            return -1;
+        }
+        if ((size_t)drop_after < n) n = drop_after;
+        drop_after -= n;
+    }
+    memcpy(buffer, client->req.reply + client->read_pos, n);
+    client->read_pos += n;
+    if (n > 0) event(client, HTTP_EVENT_ON_DATA, buffer, n);
+    if (client->read_pos == client->req.reply_len) event(client, HTTP_EVENT_ON_FINISH, NULL, 0);
+    return n;
+}
+
+int esp_http_client_read_response(esp_http_client_handle_t client, char *buffer, int len) {
+    int total = 0;
+    while (total < len) {
+        int n = esp_http_client_read(client, buffer + total, len - total);
+        if (n < 0) return total ? total : -1;
+        if (n == 0) break;
+        total += n;
+    }
+    return total;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+    if (client->open) event(client, HTTP_EVENT_DISCONNECTED, NULL, 0);
+    client->open = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+    if (!client) return ESP_FAIL;
+    esp_http_client_close(client);
+    free(client->body);
+    free(client);
+    live--;
+    return ESP_OK;
+}
@@ -0,0 +1,39 @@
+#ifndef HTTP_CLIENT_SIM_H
+#define HTTP_CLIENT_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_http_client.h"
+
+// Server behind the esp_http_client API. Each request is handed to the test's server
+// function once the client has written its body and asks for the headers; the reply is read
+// back through the client as written by the server.
+
+typedef struct {
+    // Request
+    char url[256];
+    esp_http_client_method_t method;
+    char headers[512];          // "Name: value\n" lines as set by the client
+    const char *body;
+    size_t body_len;
+
+    // Reply, filled in by the server. reply must stay valid until the next request.
+    int status;
+    const char *reply;
+    size_t reply_len;
+} http_client_sim_request_t;
+
+typedef void (*http_client_sim_server_fn)(http_client_sim_request_t *req, void *ctx);
+
+void http_client_sim_reset(http_client_sim_server_fn server, void *ctx);
+// The next n connections fail to open, as with DNS, TCP or TLS errors
+void http_client_sim_refuse(int n);
+// The connection drops once this many more reply bytes were read, negative for never
+void http_client_sim_drop_after(long bytes);
+// Value of a request header, NULL if the client didn't set it
+const char *http_client_sim_header(const http_client_sim_request_t *req, const char *name, char *buf, size_t len);
+int http_client_sim_requests(void);
+// Clients initialised and not yet cleaned up
+int http_client_sim_live(void);
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "httpd_sim.h"
+
+void httpd_sim_begin(httpd_req_t *req, httpd_sim_exchange_t *ex, httpd_method_t method, const char *uri,
+                     char *out, size_t out_cap) {
+    memset(req, 0, sizeof(*req));
+    memset(ex, 0, sizeof(*ex));
+    req->method = method;
+    req->uri = uri;
+    req->sim = ex;
+    ex->fail_after = -1;
+    ex->status = 200;
+    strcpy(ex->status_line, "200 OK");
+    ex->out = out;
+    ex->out_cap = out_cap;
+    if (out && out_cap) out[0] = '\0';
+}
+
+void httpd_sim_body(httpd_req_t *req, const char *body) {
+    req->sim->body = body;
+    req->sim->body_pos = 0;
+    req->sim->body_len = strlen(body);
+    req->content_len = req->sim->body_len;
+}
+
+// Finds "name: value" in a block of lines, case-insensitively on the name
+static const char *find_header(const char *lines, const char *name, size_t *value_len) {
+    size_t name_len = strlen(name);
+    for (const char *p = lines; p && *p;) {
+        const char *eol = strchr(p, '\n');
+        size_t line_len = eol ? (size_t)(eol - p) : strlen(p);
+        if (line_len > name_len && p[name_len] == ':' && strncasecmp(p, name, name_len) == 0) {
+            const char *v = p + name_len + 1;
+            while (*v == ' ') v++;
+            *value_len = line_len - (v - p);
+            return v;
+        }
+        p = eol ? eol + 1 : NULL;
+    }
+    return NULL;
+}
+
+const char *httpd_sim_header(const httpd_sim_exchange_t *ex, const char *name, char *buf, size_t len) {
+    size_t value_len;
+    const char *v = find_header(ex->headers_out, name, &value_len);
+    if (!v || len == 0) return NULL;
+    if (value_len >= len) value_len = len - 1;
+    memcpy(buf, v, value_len);
+    buf[value_len] = '\0';
+    return buf;
+}
+
+// Copies like the IDF server: truncated but terminated, ESP_ERR_HTTPD_RESULT_TRUNC if it didn't fit
+static esp_err_t copy_out(const char *src, size_t src_len, char *buf, size_t len) {
+    if (len == 0) return ESP_ERR_INVALID_ARG;
+    size_t n = src_len < len ? src_len : len - 1;
+    memcpy(buf, src, n);
+    buf[n] = '\0';
+    return n < src_len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+int httpd_req_recv(httpd_req_t *req, char *buf, size_t len) {
+    httpd_sim_exchange_t *ex = req->sim;
+    if (ex->recv_timeouts > 0) {
+        ex->recv_timeouts--;
+        return HTTPD_SOCK_ERR_TIMEOUT;
+    }
+    size_t sent = ex->body_len < req->content_len ? ex->body_len : req->content_len;
+    size_t left = sent - ex->body_pos;
+    if (len > left) len = left;
+    if (ex->recv_max && len > ex->recv_max) len = ex->recv_max;
+    if (len == 0) return HTTPD_SOCK_ERR_FAIL;
+    memcpy(buf, ex->body + ex->body_pos, len);
+    ex->body_pos += len;
+    return (int)len;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf, size_t len) {
+    const char *q = strchr(req->uri, '?');
+    if (!q) return ESP_ERR_NOT_FOUND;
+    return copy_out(q + 1, strlen(q + 1), buf, len);
+}
+
+esp_err_t httpd_query_key_value(const char *query, const char *key, char *val, size_t len) {
+    size_t key_len = strlen(key);
+    for (const char *p = query; p && *p;) {
+        const char *end = strchr(p, '&');
+        size_t pair_len = end ? (size_t)(end - p) : strlen(p);
+        if (pair_len > key_len && p[key_len] == '=' && strncmp(p, key, key_len) == 0)
+            return copy_out(p + key_len + 1, pair_len - key_len - 1, val, len);
+        p = end ? end + 1 : NULL;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *val, size_t len) {
+    size_t value_len;
+    const char *v = find_header(req->sim->headers, field, &value_len);
+    if (!v) return ESP_ERR_NOT_FOUND;
+    return copy_out(v, value_len, val, len);
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status) {
+    httpd_sim_exchange_t *ex = req->sim;
+    snprintf(ex->status_line, sizeof(ex->status_line), "%s", status);
+    ex->status = atoi(status);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type) {
+    snprintf(req->sim->type, sizeof(req->sim->type), "%s", type);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field, const char *value) {
+    httpd_sim_exchange_t *ex = req->sim;
+    size_t used = strlen(ex->headers_out);
+    int n = snprintf(ex->headers_out + used, sizeof(ex->headers_out) - used, "%s: %s\n", field, value);
+    return n > 0 && (size_t)n < sizeof(ex->headers_out) - used ? ESP_OK : ESP_ERR_HTTPD_RESP_SEND;
+}
+
+static esp_err_t deliver(httpd_sim_exchange_t *ex, const char *buf, size_t len) {
+    if (ex->ended) {
+        ex->sends_after_end++;
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    if (ex->client_gone) return ESP_ERR_HTTPD_RESP_SEND;
+    if (ex->fail_after >= 0 && ex->out_len + len > (unsigned long long)ex->fail_after) {
+        ex->client_gone = true;
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+
+    if (ex->out && ex->out_len < ex->out_cap) {
+        size_t room = ex->out_cap - 1 - (size_t)ex->out_len;
+        size_t n = len < room ? len : room;
+        memcpy(ex->out + ex->out_len, buf, n);
+        ex->out[ex->out_len + n] = '\0';
+    }
+    ex->out_len += len;
+    ex->chunks++;
+    if (len > ex->max_chunk) ex->max_chunk = len;
+    if (ex->on_chunk) ex->on_chunk(buf, len, ex->chunk_ctx);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t len) {
+    httpd_sim_exchange_t *ex = req->sim;
+    if (len == HTTPD_RESP_USE_STRLEN) len = strlen(buf);
+    if (len == 0) {
+        if (ex->ended) {
+            ex->sends_after_end++;
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+        if (ex->client_gone) return ESP_ERR_HTTPD_RESP_SEND;
+        ex->ended = true;
+        return ESP_OK;
+    }
+    return deliver(ex, buf, (size_t)len);
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len) {
+    httpd_sim_exchange_t *ex = req->sim;
+    if (len == HTTPD_RESP_USE_STRLEN) len = buf ? (ssize_t)strlen(buf) : 0;
+    esp_err_t err = len ? deliver(ex, buf, (size_t)len) : ESP_OK;
+    if (err == ESP_OK && !ex->ended) ex->ended = true;
+    return err;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg) {
+    static const char *const lines[] = {
+        [HTTPD_400_BAD_REQUEST] = "400 Bad Request",
+        [HTTPD_404_NOT_FOUND] = "404 Not Found",
+        [HTTPD_408_REQ_TIMEOUT] = "408 Request Timeout",
+        [HTTPD_413_CONTENT_TOO_LARGE] = "413 Content Too Large",
+        [HTTPD_500_INTERNAL_SERVER_ERROR] = "500 Internal Server Error",
+    };
+    httpd_resp_set_status(req, lines[error]);
+    httpd_resp_set_type(req, "text/html");
+    return httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+}
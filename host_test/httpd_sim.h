@@ -0,0 +1,49 @@
+#ifndef HTTPD_SIM_H
+#define HTTPD_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_http_server.h"
+
+// Loopback for HTTP handlers: a request is built in memory, the handler runs on the calling
+// thread and everything it sends lands in the exchange, where the test reads it back.
+// Nothing here allocates, so handlers can be measured for heap use.
+
+typedef void (*httpd_sim_chunk_fn)(const char *data, size_t len, void *ctx);
+
+typedef struct httpd_sim_exchange {
+    // Request, filled in by httpd_sim_begin and the test
+    const char *headers;        // "Name: value\n" lines, or NULL
+    const char *body;
+    size_t body_len;            // What the client actually sends, normally req->content_len
+    size_t body_pos;
+    size_t recv_max;            // Each httpd_req_recv returns at most this much, 0 for no limit
+    int recv_timeouts;          // Calls that time out before data arrives, counted down
+    long long fail_after;       // The client goes away once this many body bytes went out, -1 never
+
+    // Response
+    int status;
+    char status_line[48];
+    char type[48];
+    char headers_out[768];      // "Name: value\n" lines as set
+    char *out;                  // Body as received, terminated; the rest is counted but dropped
+    size_t out_cap;
+    unsigned long long out_len;
+    size_t chunks;
+    size_t max_chunk;
+    bool ended;                 // Terminating chunk or a whole response went out
+    bool client_gone;
+    int sends_after_end;        // Anything sent once the response was over
+    httpd_sim_chunk_fn on_chunk;
+    void *chunk_ctx;
+} httpd_sim_exchange_t;
+
+// Prepares req for uri ("/path?query"). out may be NULL to count the body only.
+void httpd_sim_begin(httpd_req_t *req, httpd_sim_exchange_t *ex, httpd_method_t method, const char *uri,
+                     char *out, size_t out_cap);
+// Sets a POST body; content_len follows it
+void httpd_sim_body(httpd_req_t *req, const char *body);
+// Value of a response header set by the handler, NULL if absent
+const char *httpd_sim_header(const httpd_sim_exchange_t *ex, const char *name, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,87 @@
+#include <string.h>
+#include <openssl/evp.h>
+#include "mbedtls/ccm.h"
+#include "mbedtls/sha256.h"
+
+void mbedtls_ccm_init(mbedtls_ccm_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_ccm_free(mbedtls_ccm_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_ccm_setkey(mbedtls_ccm_context *ctx, mbedtls_cipher_id_t cipher, const unsigned char *key, unsigned int keybits) {
+    if (cipher != MBEDTLS_CIPHER_ID_AES || keybits != 128) return MBEDTLS_ERR_CCM_BAD_INPUT;
+    memcpy(ctx->key, key, keybits / 8);
+    ctx->keybits = keybits;
+    return 0;
+}
+
+// CCM in OpenSSL wants the lengths before the data: nonce and tag sizes, then the message length
+static EVP_CIPHER_CTX *ccm_start(const mbedtls_ccm_context *ctx, int enc, size_t length, const unsigned char *iv,
+                                 size_t iv_len, const unsigned char *ad, size_t ad_len, const unsigned char *tag,
+                                 size_t tag_len) {
+    EVP_CIPHER_CTX *evp = EVP_CIPHER_CTX_new();
+    int len;
+    if (!evp ||
+        !EVP_CipherInit_ex(evp, EVP_aes_128_ccm(), NULL, NULL, NULL, enc) ||
+        !EVP_CIPHER_CTX_ctrl(evp, EVP_CTRL_CCM_SET_IVLEN, (int)iv_len, NULL) ||
+        !EVP_CIPHER_CTX_ctrl(evp, EVP_CTRL_CCM_SET_TAG, (int)tag_len, (void *)tag) ||
+        !EVP_CipherInit_ex(evp, NULL, NULL, ctx->key, iv, enc) ||
+        !EVP_CipherUpdate(evp, NULL, &len, NULL, (int)length) ||
+        (ad_len && !EVP_CipherUpdate(evp, NULL, &len, ad, (int)ad_len))) {
+        EVP_CIPHER_CTX_free(evp);
+        return NULL;
+    }
+    return evp;
+}
+
+int mbedtls_ccm_encrypt_and_tag(mbedtls_ccm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len,
+                                const unsigned char *ad, size_t ad_len, const unsigned char *input,
+                                unsigned char *output, unsigned char *tag, size_t tag_len) {
+    EVP_CIPHER_CTX *evp = ccm_start(ctx, 1, length, iv, iv_len, ad, ad_len, NULL, tag_len);
+    int len;
+    int ok = evp &&
+             EVP_CipherUpdate(evp, output, &len, input, (int)length) &&
+             EVP_CipherFinal_ex(evp, output + len, &len) &&
+             EVP_CIPHER_CTX_ctrl(evp, EVP_CTRL_CCM_GET_TAG, (int)tag_len, tag);
+    EVP_CIPHER_CTX_free(evp);
+    return ok ? 0 : MBEDTLS_ERR_CCM_BAD_INPUT;
+}
+
+int mbedtls_ccm_auth_decrypt(mbedtls_ccm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len,
+                             const unsigned char *ad, size_t ad_len, const unsigned char *input,
+                             unsigned char *output, const unsigned char *tag, size_t tag_len) {
+    EVP_CIPHER_CTX *evp = ccm_start(ctx, 0, length, iv, iv_len, ad, ad_len, tag, tag_len);
+    if (!evp) return MBEDTLS_ERR_CCM_BAD_INPUT;
+    int len;
+    int ok = EVP_CipherUpdate(evp, output, &len, input, (int)length) > 0;
+    EVP_CIPHER_CTX_free(evp);
+    if (!ok) {
+        memset(output, 0, length);
+        return MBEDTLS_ERR_CCM_AUTH_FAILED;
+    }
+    return 0;
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx) {
+    ctx->md = EVP_MD_CTX_new();
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx) {
+    EVP_MD_CTX_free(ctx->md);
+    ctx->md = NULL;
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224) {
+    return EVP_DigestInit_ex(ctx->md, is224 ? EVP_sha224() : EVP_sha256(), NULL) ? 0 : -1;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen) {
+    return EVP_DigestUpdate(ctx->md, input, ilen) ? 0 : -1;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32]) {
+    return EVP_DigestFinal_ex(ctx->md, output, NULL) ? 0 : -1;
+}
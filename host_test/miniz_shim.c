@@ -0,0 +1,68 @@
+#include <string.h>
+#include "miniz.h"
+
+// zlib's allocations come out of the decompressor itself
+static voidpf arena_alloc(voidpf opaque, uInt items, uInt size) {
+    tinfl_decompressor *r = opaque;
+    size_t n = ((size_t)items * size + 15) & ~(size_t)15;
+    if (r->arena_used + n > sizeof(r->arena)) return Z_NULL;
+    voidpf p = r->arena + r->arena_used;
+    r->arena_used += n;
+    return p;
+}
+
+static void arena_free(voidpf opaque, voidpf p) {}
+
+void tinfl_init(tinfl_decompressor *r) {
+    memset(&r->z, 0, sizeof(r->z));
+    r->started = 0;
+    r->done = 0;
+    r->arena_used = 0;
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in_buf_next, size_t *in_buf_size,
+                              uint8_t *out_buf_start, uint8_t *out_buf_next, size_t *out_buf_size,
+                              uint32_t decomp_flags) {
+    // A wrapping output buffer doubles as the history window: a power of two, at least 32K
+    if (!(decomp_flags & TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF)) {
+        size_t total = (size_t)(out_buf_next - out_buf_start) + *out_buf_size;
+        if (out_buf_next < out_buf_start || total < TINFL_LZ_DICT_SIZE || (total & (total - 1))) {
+            *in_buf_size = *out_buf_size = 0;
+            return TINFL_STATUS_BAD_PARAM;
+        }
+    }
+
+    if (!r->started) {
+        r->z.zalloc = arena_alloc;
+        r->z.zfree = arena_free;
+        r->z.opaque = r;
+        int bits = (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? 15 : -15;
+        if (inflateInit2(&r->z, bits) != Z_OK) return TINFL_STATUS_FAILED;
+        r->started = 1;
+    }
+    if (r->done) {
+        *in_buf_size = *out_buf_size = 0;
+        return TINFL_STATUS_DONE;
+    }
+
+    r->z.next_in = (Bytef *)in_buf_next;
+    r->z.avail_in = *in_buf_size;
+    r->z.next_out = out_buf_next;
+    r->z.avail_out = *out_buf_size;
+    int ret = inflate(&r->z, Z_NO_FLUSH);
+    *in_buf_size -= r->z.avail_in;
+    *out_buf_size -= r->z.avail_out;
+
+    if (ret == Z_STREAM_END) {
+        r->done = 1;
+        return TINFL_STATUS_DONE;
+    }
+    if (ret == Z_DATA_ERROR) {
+        return r->z.msg && strcmp(r->z.msg, "incorrect data check") == 0 ? TINFL_STATUS_ADLER32_MISMATCH
+                                                                          : TINFL_STATUS_FAILED;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) return TINFL_STATUS_FAILED;
+    if (r->z.avail_out == 0) return TINFL_STATUS_HAS_MORE_OUTPUT;
+    return (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT
+                                                      : TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS;
+}
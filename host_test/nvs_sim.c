@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nvs.h"
+#include "nvs_sim.h"
+
+#define NVS_SIM_ENTRIES 64
+#define NVS_SIM_HANDLES 8
+
+typedef enum { TYPE_U8, TYPE_U16, TYPE_U32, TYPE_I32, TYPE_STR, TYPE_BLOB } entry_type_t;
+
+typedef struct {
+    bool used;
+    bool erased;            // Staged erase
+    char ns[16];
+    char key[16];
+    entry_type_t type;
+    size_t len;
+    unsigned char *data;
+} entry_t;
+
+typedef struct {
+    bool open;
+    bool writable;
+    char ns[16];
+    entry_t staged[NVS_SIM_ENTRIES];
+} handle_t;
+
+static entry_t store[NVS_SIM_ENTRIES];
+static handle_t handles[NVS_SIM_HANDLES];
+static long fail_in = -1;
+static int commits;
+
+static void clear(entry_t *entries) {
+    for (int i = 0; i < NVS_SIM_ENTRIES; i++) free(entries[i].data);
+    memset(entries, 0, sizeof(entry_t) * NVS_SIM_ENTRIES);
+}
+
+void nvs_sim_reset(void) {
+    clear(store);
+    for (int h = 0; h < NVS_SIM_HANDLES; h++) clear(handles[h].staged);
+    memset(handles, 0, sizeof(handles));
+    fail_in = -1;
+    commits = 0;
+}
+
+void nvs_sim_fail_write(long n) {
+    fail_in = n;
+}
+
+void nvs_sim_power_cut(void) {
+    for (int h = 0; h < NVS_SIM_HANDLES; h++) clear(handles[h].staged);
+}
+
+int nvs_sim_commits(void) {
+    return commits;
+}
+
+static entry_t *find(entry_t *entries, const char *ns, const char *key) {
+    for (int i = 0; i < NVS_SIM_ENTRIES; i++) {
+        if (entries[i].used && strcmp(entries[i].ns, ns) == 0 && strcmp(entries[i].key, key) == 0) return &entries[i];
+    }
+    return NULL;
+}
+
+static entry_t *slot(entry_t *entries, const char *ns, const char *key) {
+    entry_t *e = find(entries, ns, key);
+    if (e) return e;
+    for (int i = 0; i < NVS_SIM_ENTRIES; i++) {
+        if (!entries[i].used) {
+            e = &entries[i];
+            e->used = true;
+            snprintf(e->ns, sizeof(e->ns), "%s", ns);
+            snprintf(e->key, sizeof(e->key), "%s", key);
+            return e;
+        }
+    }
+    return NULL;
+}
+
+bool nvs_sim_has(const char *ns, const char *key) {
+    return find(store, ns, key) != NULL;
+}
+
+static handle_t *get_handle(nvs_handle_t handle) {
+    if (handle == 0 || handle > NVS_SIM_HANDLES || !handles[handle - 1].open) return NULL;
+    return &handles[handle - 1];
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *out) {
+    bool exists = false;
+    for (int i = 0; i < NVS_SIM_ENTRIES; i++) {
+        if (store[i].used && strcmp(store[i].ns, name) == 0) exists = true;
+    }
+    // Like the device, a namespace only comes into being when opened for writing
+    if (!exists && mode == NVS_READONLY) return ESP_ERR_NVS_NOT_FOUND;
+
+    for (int h = 0; h < NVS_SIM_HANDLES; h++) {
+        if (!handles[h].open) {
+            handles[h].open = true;
+            handles[h].writable = mode == NVS_READWRITE;
+            snprintf(handles[h].ns, sizeof(handles[h].ns), "%s", name);
+            *out = (nvs_handle_t)(h + 1);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    handle_t *h = get_handle(handle);
+    if (!h) return;
+    // Uncommitted writes are lost with the handle
+    clear(h->staged);
+    h->open = false;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    handle_t *h = get_handle(handle);
+    if (!h) return ESP_ERR_INVALID_ARG;
+    for (int i = 0; i < NVS_SIM_ENTRIES; i++) {
+        entry_t *s = &h->staged[i];
+        if (!s->used) continue;
+        entry_t *e = find(store, s->ns, s->key);
+        if (s->erased) {
+            if (e) {
+                free(e->data);
+                memset(e, 0, sizeof(*e));
+            }
+            continue;
+        }
+        if (!e) e = slot(store, s->ns, s->key);
+        if (!e) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        free(e->data);
+        e->type = s->type;
+        e->len = s->len;
+        e->data = malloc(s->len);
+        memcpy(e->data, s->data, s->len);
+    }
+    clear(h->staged);
+    commits++;
+    return ESP_OK;
+}
+
+static esp_err_t write_check(handle_t *h) {
+    if (!h) return ESP_ERR_INVALID_ARG;
+    if (!h->writable) return ESP_ERR_NVS_READ_ONLY;
+    if (fail_in == 0) {
+        fail_in = -1;
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    if (fail_in > 0) fail_in--;
+    return ESP_OK;
+}
+
+static esp_err_t set(nvs_handle_t handle, const char *key, entry_type_t type, const void *data, size_t len) {
+    handle_t *h = get_handle(handle);
+    esp_err_t err = write_check(h);
+    if (err != ESP_OK) return err;
+    entry_t *s = slot(h->staged, h->ns, key);
+    if (!s) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    free(s->data);
+    s->erased = false;
+    s->type = type;
+    s->len = len;
+    s->data = malloc(len ? len : 1);
+    memcpy(s->data, data, len);
+    return ESP_OK;
+}
+
+// Staged writes are visible to reads through the same handle
+static const entry_t *lookup(nvs_handle_t handle, const char *key, entry_type_t type) {
+    handle_t *h = get_handle(handle);
+    if (!h) return NULL;
+    const entry_t *e = find(h->staged, h->ns, key);
+    if (!e) e = find(store, h->ns, key);
+    if (!e || e->erased || e->type != type) return NULL;
+    return e;
+}
+
+static esp_err_t get(nvs_handle_t handle, const char *key, entry_type_t type, void *out, size_t len) {
+    const entry_t *e = lookup(handle, key, type);
+    if (!e) return ESP_ERR_NVS_NOT_FOUND;
+    memcpy(out, e->data, len);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    handle_t *h = get_handle(handle);
+    esp_err_t err = write_check(h);
+    if (err != ESP_OK) return err;
+    if (!find(h->staged, h->ns, key) && !find(store, h->ns, key)) return ESP_ERR_NVS_NOT_FOUND;
+    entry_t *s = slot(h->staged, h->ns, key);
+    if (!s) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    s->erased = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    handle_t *h = get_handle(handle);
+    esp_err_t err = write_check(h);
+    if (err != ESP_OK) return err;
+    for (int i = 0; i < NVS_SIM_ENTRIES; i++) {
+        if (store[i].used && strcmp(store[i].ns, h->ns) == 0) {
+            entry_t *s = slot(h->staged, h->ns, store[i].key);
+            if (s) s->erased = true;
+        }
+    }
+    for (int i = 0; i < NVS_SIM_ENTRIES; i++) {
+        if (h->staged[i].used) h->staged[i].erased = true;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value) {
+    return set(handle, key, TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value) {
+    return set(handle, key, TYPE_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+    return set(handle, key, TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value) {
+    return set(handle, key, TYPE_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value) {
+    return set(handle, key, TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    return set(handle, key, TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *value) {
+    return get(handle, key, TYPE_U8, value, sizeof(*value));
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *value) {
+    return get(handle, key, TYPE_U16, value, sizeof(*value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value) {
+    return get(handle, key, TYPE_U32, value, sizeof(*value));
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *value) {
+    return get(handle, key, TYPE_I32, value, sizeof(*value));
+}
+
+static esp_err_t get_sized(nvs_handle_t handle, const char *key, entry_type_t type, void *value, size_t *length) {
+    const entry_t *e = lookup(handle, key, type);
+    if (!e) return ESP_ERR_NVS_NOT_FOUND;
+    if (!value) {
+        *length = e->len;
+        return ESP_OK;
+    }
+    if (*length < e->len) return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(value, e->data, e->len);
+    *length = e->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *length) {
+    return get_sized(handle, key, TYPE_STR, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length) {
+    return get_sized(handle, key, TYPE_BLOB, value, length);
+}
@@ -0,0 +1,16 @@
+#ifndef NVS_SIM_H
+#define NVS_SIM_H
+
+#include <stdbool.h>
+
+// In-memory NVS behind stubs/nvs.h. Writes are staged per handle and only kept by nvs_commit,
+// which is all the API promises; IDF itself may write through sooner.
+void nvs_sim_reset(void);
+// The `n`th set or erase from now fails with ESP_ERR_NVS_NOT_ENOUGH_SPACE, negative for never
+void nvs_sim_fail_write(long n);
+// Drops writes not yet committed
+void nvs_sim_power_cut(void);
+int nvs_sim_commits(void);
+bool nvs_sim_has(const char *ns, const char *key);
+
+#endif
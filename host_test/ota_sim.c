@@ -0,0 +1,206 @@
+#include <string.h>
+#include "esp_rom_crc.h"
+#include "esp_image_format.h"
+#include "flash_sim.h"
+#include "ota_sim.h"
+
+static const esp_partition_t *slots[2];
+static esp_ota_img_states_t states[2];
+static int boot_slot;
+static int running;
+static bool restart_requested;
+static esp_app_desc_t running_desc;
+
+// Write session of esp_ota_begin; handle 0 is never handed out
+static struct {
+    esp_ota_handle_t handle;
+    int slot;
+    size_t written;
+} session;
+
+static int slot_of(const esp_partition_t *part) {
+    for (int i = 0; i < 2; i++) {
+        if (slots[i] && part == slots[i]) return i;
+    }
+    return -1;
+}
+
+static bool read_header(int slot, ota_sim_header_t *hdr) {
+    return esp_partition_read(slots[slot], 0, hdr, sizeof(*hdr)) == ESP_OK && hdr->magic == OTA_SIM_MAGIC &&
+           hdr->image_len >= sizeof(*hdr) && hdr->image_len <= slots[slot]->size;
+}
+
+static bool image_valid(int slot) {
+    ota_sim_header_t hdr;
+    if (!read_header(slot, &hdr)) return false;
+    const uint8_t *data = flash_sim_part_data(slots[slot]);
+    uint32_t crc = esp_rom_crc32_le(0, data + sizeof(hdr), hdr.image_len - sizeof(hdr));
+    return crc == hdr.crc;
+}
+
+static bool bootable(int slot) {
+    return states[slot] != ESP_OTA_IMG_INVALID && states[slot] != ESP_OTA_IMG_ABORTED && image_valid(slot);
+}
+
+void ota_sim_make_image(uint8_t *image, size_t len, const char *version) {
+    ota_sim_header_t hdr = {.magic = OTA_SIM_MAGIC, .image_len = len};
+    hdr.desc.magic_word = 0xABCD5432;
+    strlcpy(hdr.desc.version, version, sizeof(hdr.desc.version));
+    strlcpy(hdr.desc.project_name, "monitoringnode", sizeof(hdr.desc.project_name));
+    hdr.crc = esp_rom_crc32_le(0, image + sizeof(hdr), len - sizeof(hdr));
+    memcpy(image, &hdr, sizeof(hdr));
+}
+
+void ota_sim_init(const esp_partition_t *slot0, const esp_partition_t *slot1) {
+    slots[0] = slot0;
+    slots[1] = slot1;
+    // Flashed over serial: no otadata entries yet
+    states[0] = states[1] = ESP_OTA_IMG_UNDEFINED;
+    boot_slot = 0;
+    memset(&session, 0, sizeof(session));
+    ota_sim_reboot();
+}
+
+void ota_sim_reboot(void) {
+    restart_requested = false;
+    memset(&session, 0, sizeof(session));
+
+    int slot = boot_slot;
+    if (states[slot] == ESP_OTA_IMG_PENDING_VERIFY) {
+        // Reset before the app confirmed itself
+        states[slot] = ESP_OTA_IMG_ABORTED;
+    }
+    if (!bootable(slot)) {
+        slot = !slot;
+        boot_slot = slot;
+    }
+    if (states[slot] == ESP_OTA_IMG_NEW) states[slot] = ESP_OTA_IMG_PENDING_VERIFY;
+    running = slot;
+
+    ota_sim_header_t hdr;
+    memset(&running_desc, 0, sizeof(running_desc));
+    if (read_header(slot, &hdr)) running_desc = hdr.desc;
+}
+
+bool ota_sim_restart_requested(void) {
+    return restart_requested;
+}
+
+int ota_sim_running(void) {
+    return running;
+}
+
+esp_ota_img_states_t ota_sim_state(int slot) {
+    return states[slot];
+}
+
+const esp_app_desc_t *esp_app_get_description(void) {
+    return &running_desc;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void) {
+    return slots[running];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from) {
+    return slots[!running];
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle) {
+    int slot = slot_of(partition);
+    if (slot < 0) return ESP_ERR_INVALID_ARG;
+    if (slot == running) return ESP_ERR_OTA_PARTITION_CONFLICT;
+
+    esp_err_t err = esp_partition_erase_range(partition, 0, partition->size);
+    if (err != ESP_OK) return err;
+    // The old image is gone, and with it any otadata state for the slot
+    states[slot] = ESP_OTA_IMG_UNDEFINED;
+    session.handle++;
+    session.slot = slot;
+    session.written = 0;
+    *out_handle = session.handle;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size) {
+    if (handle == 0 || handle != session.handle) return ESP_ERR_INVALID_ARG;
+    if (session.written + size > slots[session.slot]->size) return ESP_ERR_INVALID_SIZE;
+    esp_err_t err = esp_partition_write(slots[session.slot], session.written, data, size);
+    if (err == ESP_OK) session.written += size;
+    return err;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle) {
+    if (handle == 0 || handle != session.handle) return ESP_ERR_NOT_FOUND;
+    session.handle = 0;
+    ota_sim_header_t hdr;
+    if (!read_header(session.slot, &hdr) || hdr.image_len > session.written || !image_valid(session.slot)) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle) {
+    if (handle == 0 || handle != session.handle) return ESP_ERR_NOT_FOUND;
+    session.handle = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+    int slot = slot_of(partition);
+    if (slot < 0) return ESP_ERR_INVALID_ARG;
+    if (!image_valid(slot)) return ESP_ERR_OTA_VALIDATE_FAILED;
+    boot_slot = slot;
+    if (slot != running) states[slot] = ESP_OTA_IMG_NEW;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition, esp_app_desc_t *app_desc) {
+    int slot = slot_of(partition);
+    ota_sim_header_t hdr;
+    if (slot < 0 || !read_header(slot, &hdr)) return ESP_ERR_NOT_FOUND;
+    *app_desc = hdr.desc;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *partition, esp_ota_img_states_t *ota_state) {
+    int slot = slot_of(partition);
+    if (slot < 0) return ESP_ERR_INVALID_ARG;
+    if (states[slot] == ESP_OTA_IMG_UNDEFINED) return ESP_ERR_NOT_FOUND;
+    *ota_state = states[slot];
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_last_invalid_partition(void) {
+    for (int i = 0; i < 2; i++) {
+        if (states[i] == ESP_OTA_IMG_INVALID || states[i] == ESP_OTA_IMG_ABORTED) return slots[i];
+    }
+    return NULL;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void) {
+    states[running] = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void) {
+    if (!bootable(!running)) return ESP_ERR_OTA_ROLLBACK_FAILED;
+    states[running] = ESP_OTA_IMG_INVALID;
+    boot_slot = !running;
+    // The real call restarts and never returns; the test reboots when it sees this
+    restart_requested = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_image_get_metadata(const esp_partition_pos_t *part, esp_image_metadata_t *metadata) {
+    for (int i = 0; i < 2; i++) {
+        ota_sim_header_t hdr;
+        if (slots[i] && slots[i]->address == part->offset) {
+            if (!read_header(i, &hdr)) return ESP_ERR_INVALID_RESPONSE;
+            metadata->start_addr = part->offset;
+            metadata->image_len = hdr.image_len;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
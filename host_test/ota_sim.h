@@ -0,0 +1,34 @@
+#ifndef OTA_SIM_H
+#define OTA_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_ota_ops.h"
+
+// Two app slots in flash_sim partitions, their otadata states and the bootloader's
+// rollback. Images use a made-up header in place of the ESP image format: a magic, the
+// image length and a CRC of the rest, then the app description at its usual offset.
+
+#define OTA_SIM_MAGIC 0x4F544131
+
+typedef struct {
+    uint32_t magic;
+    uint32_t image_len;     // Header included
+    uint32_t crc;           // esp_rom_crc32_le of the bytes after the header
+    uint8_t reserved[20];
+    esp_app_desc_t desc;
+} ota_sim_header_t;
+
+// Slot 0 runs a valid image already written to it; slot 1 is empty
+void ota_sim_init(const esp_partition_t *slot0, const esp_partition_t *slot1);
+// Writes the header into the first bytes of an image of len bytes
+void ota_sim_make_image(uint8_t *image, size_t len, const char *version);
+// A reset or deep-sleep wake: the bootloader picks the slot and handles rollback
+void ota_sim_reboot(void);
+// esp_ota_mark_app_invalid_rollback_and_reboot asked for a restart since the last reboot
+bool ota_sim_restart_requested(void);
+int ota_sim_running(void);
+esp_ota_img_states_t ota_sim_state(int slot);
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "rtos_sim.h"
+
+struct event_group {
+    EventBits_t bits;
+};
+
+static int64_t now_us;
+
+void rtos_sim_reset(void) {
+    now_us = 0;
+}
+
+void rtos_sim_advance_ms(uint32_t ms) {
+    now_us += (int64_t)ms * 1000;
+}
+
+int64_t esp_timer_get_time(void) {
+    return now_us;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(now_us / 1000 / portTICK_PERIOD_MS);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    now_us += (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    return calloc(1, sizeof(struct event_group));
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    group->bits |= bits;
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    EventBits_t before = group->bits;
+    group->bits &= ~bits;
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks) {
+    EventBits_t value = group->bits;
+    bool met = wait_for_all ? (value & bits) == bits : (value & bits) != 0;
+    if (!met) {
+        vTaskDelay(ticks);
+        return value;
+    }
+    if (clear_on_exit) group->bits &= ~bits;
+    return value;
+}
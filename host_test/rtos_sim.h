@@ -0,0 +1,10 @@
+#ifndef RTOS_SIM_H
+#define RTOS_SIM_H
+
+#include <stdint.h>
+
+// Simulated clock behind xTaskGetTickCount, vTaskDelay, event group timeouts and esp_timer
+void rtos_sim_reset(void);
+void rtos_sim_advance_ms(uint32_t ms);
+
+#endif
@@ -0,0 +1,89 @@
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sd_host.h"
+
+#define MOUNT "/sdcard/"
+
+sd_host_stats_t sd_host_stats;
+
+static char root[64];
+
+static void remove_all(void) {
+    DIR *dir = opendir(root);
+    if (!dir) return;
+    for (struct dirent *e; (e = readdir(dir));) {
+        if (e->d_name[0] == '.') continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", root, e->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+}
+
+static void cleanup(void) {
+    remove_all();
+    rmdir(root);
+}
+
+void sd_host_reset(void) {
+    if (!root[0]) {
+        strcpy(root, "/tmp/sd_host.XXXXXX");
+        if (!mkdtemp(root)) {
+            perror("mkdtemp");
+            exit(1);
+        }
+        atexit(cleanup);
+    }
+    remove_all();
+    memset(&sd_host_stats, 0, sizeof(sd_host_stats));
+}
+
+// Paths outside the card are used as they are
+const char *sd_host_path(const char *path) {
+    static char mapped[2][512];
+    static int next;
+    if (strncmp(path, MOUNT, strlen(MOUNT)) != 0) return path;
+    char *out = mapped[next++ % 2];
+    snprintf(out, sizeof(mapped[0]), "%s/%s", root, path + strlen(MOUNT));
+    return out;
+}
+
+long sd_host_size(const char *path) {
+    FILE *f = fopen(sd_host_path(path), "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+int sd_host_truncate(const char *path, long size) {
+    return truncate(sd_host_path(path), size);
+}
+
+FILE *sd_host_fopen(const char *path, const char *mode) {
+    return fopen(sd_host_path(path), mode);
+}
+
+size_t sd_host_fread(void *buf, size_t size, size_t count, FILE *f) {
+    sd_host_stats.freads++;
+    return fread(buf, size, count, f);
+}
+
+char *sd_host_fgets(char *buf, int size, FILE *f) {
+    char *line = fgets(buf, size, f);
+    if (line) sd_host_stats.lines++;
+    return line;
+}
+
+int sd_host_remove(const char *path) {
+    return remove(sd_host_path(path));
+}
+
+int sd_host_rename(const char *from, const char *to) {
+    char host_from[512];
+    snprintf(host_from, sizeof(host_from), "%s", sd_host_path(from));
+    return rename(host_from, sd_host_path(to));
+}
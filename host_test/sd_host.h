@@ -0,0 +1,31 @@
+#ifndef SD_HOST_H
+#define SD_HOST_H
+
+#include <stdio.h>
+
+// The SD card as a directory on the host, for code built with sd_host_redirect.h: paths under
+// /sdcard open real files in a fresh temporary directory, so modules run on the host's
+// stdio at full size. Reads are counted, to check how much of the card a lookup touches.
+
+typedef struct {
+    unsigned long freads;       // fread calls
+    unsigned long lines;        // fgets calls that returned a line
+} sd_host_stats_t;
+
+extern sd_host_stats_t sd_host_stats;
+
+// Empties the card; the directory is removed at exit
+void sd_host_reset(void);
+// Host path of a /sdcard path
+const char *sd_host_path(const char *path);
+long sd_host_size(const char *path);
+// Cuts a file short, as a reset part way through a write leaves it
+int sd_host_truncate(const char *path, long size);
+
+FILE *sd_host_fopen(const char *path, const char *mode);
+size_t sd_host_fread(void *buf, size_t size, size_t count, FILE *f);
+char *sd_host_fgets(char *buf, int size, FILE *f);
+int sd_host_remove(const char *path);
+int sd_host_rename(const char *from, const char *to);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef SD_HOST_REDIRECT_H
+#define SD_HOST_REDIRECT_H
+
+// Include ahead of a module's source to run its SD card file access on sd_host
+#include <stdio.h>
+#include "sd_host.h"
+
+#define fopen  sd_host_fopen
+#define fread  sd_host_fread
+#define fgets  sd_host_fgets
+#define remove sd_host_remove
+#define rename sd_host_rename
+
+#endif
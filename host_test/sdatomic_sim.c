@@ -0,0 +1,3 @@
+// sdatomic.c running on fs_sim
+#include "fs_sim_redirect.h"
+#include "sdatomic.c"
@@ -0,0 +1,42 @@
+#ifndef cJSON__h
+#define cJSON__h
+
+#include <stddef.h>
+
+// The cJSON calls the firmware makes, with the item layout and type flags of cJSON 1.7 so the
+// real library links against it too. Built from IDF when IDF_PATH is set, otherwise from
+// cjson_min.c.
+
+#define cJSON_Invalid (0)
+#define cJSON_False   (1 << 0)
+#define cJSON_True    (1 << 1)
+#define cJSON_NULL    (1 << 2)
+#define cJSON_Number  (1 << 3)
+#define cJSON_String  (1 << 4)
+#define cJSON_Array   (1 << 5)
+#define cJSON_Object  (1 << 6)
+#define cJSON_Raw     (1 << 7)
+
+typedef int cJSON_bool;
+
+typedef struct cJSON {
+    struct cJSON *next;
+    struct cJSON *prev;
+    struct cJSON *child;
+    int type;
+    char *valuestring;
+    int valueint;
+    double valuedouble;
+    char *string;
+} cJSON;
+
+cJSON *cJSON_ParseWithLength(const char *value, size_t buffer_length);
+void cJSON_Delete(cJSON *item);
+cJSON_bool cJSON_IsObject(const cJSON *item);
+cJSON_bool cJSON_IsString(const cJSON *item);
+cJSON_bool cJSON_IsNumber(const cJSON *item);
+
+#define cJSON_ArrayForEach(element, array) \
+    for (element = (array != NULL) ? (array)->child : NULL; element != NULL; element = element->next)
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef ADC_CALI_SCHEME_H
+#define ADC_CALI_SCHEME_H
+
+// Named by sensors.h only; the ADC is not simulated
+
+#endif
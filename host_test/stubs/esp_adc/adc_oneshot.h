@@ -0,0 +1,6 @@
+#ifndef ADC_ONESHOT_H
+#define ADC_ONESHOT_H
+
+// Named by sensors.h only; the ADC is not simulated
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef ESP_APP_DESC_H
+#define ESP_APP_DESC_H
+
+#include <stdint.h>
+
+// Read by ota_sim.c from the image in the running slot
+typedef struct {
+    uint32_t magic_word;
+    uint32_t secure_version;
+    uint32_t reserv1[2];
+    char version[32];
+    char project_name[32];
+} esp_app_desc_t;
+
+const esp_app_desc_t *esp_app_get_description(void);
+
+#endif
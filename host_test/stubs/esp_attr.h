@@ -0,0 +1,10 @@
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+// RTC memory is ordinary memory on the host; tests clear it to model a power cut
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_IRAM_ATTR
+#define IRAM_ATTR
+
+#endif
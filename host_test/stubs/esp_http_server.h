@@ -0,0 +1,69 @@
+#ifndef ESP_HTTP_SERVER_H
+#define ESP_HTTP_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "esp_err.h"
+
+// The parts of the IDF server the portal uses. Requests run in-process through httpd_sim.c.
+
+#define ESP_ERR_HTTPD_BASE          0xb000
+#define ESP_ERR_HTTPD_HANDLERS_FULL (ESP_ERR_HTTPD_BASE + 1)
+#define ESP_ERR_HTTPD_RESULT_TRUNC  (ESP_ERR_HTTPD_BASE + 4)
+#define ESP_ERR_HTTPD_RESP_SEND     (ESP_ERR_HTTPD_BASE + 6)
+
+#define HTTPD_RESP_USE_STRLEN -1
+#define HTTPD_SOCK_ERR_FAIL    -1
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+
+typedef void *httpd_handle_t;
+typedef enum { HTTP_GET, HTTP_POST } httpd_method_t;
+
+typedef enum {
+    HTTPD_400_BAD_REQUEST,
+    HTTPD_404_NOT_FOUND,
+    HTTPD_408_REQ_TIMEOUT,
+    HTTPD_413_CONTENT_TOO_LARGE,
+    HTTPD_500_INTERNAL_SERVER_ERROR,
+} httpd_err_code_t;
+
+struct httpd_sim_exchange;
+
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    int method;
+    const char *uri;
+    size_t content_len;
+    void *user_ctx;
+    struct httpd_sim_exchange *sim;
+} httpd_req_t;
+
+typedef struct {
+    const char *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *req);
+    void *user_ctx;
+} httpd_uri_t;
+
+int httpd_req_recv(httpd_req_t *req, char *buf, size_t len);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf, size_t len);
+esp_err_t httpd_query_key_value(const char *query, const char *key, char *val, size_t len);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *val, size_t len);
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field, const char *value);
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t len);
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg);
+
+static inline esp_err_t httpd_resp_sendstr(httpd_req_t *req, const char *str) {
+    return httpd_resp_send(req, str, str ? HTTPD_RESP_USE_STRLEN : 0);
+}
+
+static inline esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *req, const char *str) {
+    return httpd_resp_send_chunk(req, str, str ? HTTPD_RESP_USE_STRLEN : 0);
+}
+
+#endif
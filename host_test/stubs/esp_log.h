@@ -0,0 +1,21 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Logs are compiled out but their formats are still checked
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+
+#define ESP_LOG_HOST(tag, fmt, ...) do { if (0) { (void)(tag); printf(fmt, ##__VA_ARGS__); } } while (0)
+#define ESP_LOGE(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+#define ESP_LOG_LEVEL_LOCAL(level, tag, fmt, ...) ESP_LOG_HOST(tag, fmt, ##__VA_ARGS__)
+
+static inline uint32_t esp_log_timestamp(void) { return 0; }
+static inline void esp_log_level_set(const char *tag, esp_log_level_t level) { (void)tag; (void)level; }
+
+#endif
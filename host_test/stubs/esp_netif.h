@@ -0,0 +1,6 @@
+#ifndef ESP_NETIF_H
+#define ESP_NETIF_H
+
+#include "esp_err.h"
+
+#endif
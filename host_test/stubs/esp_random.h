@@ -0,0 +1,9 @@
+#ifndef ESP_RANDOM_H
+#define ESP_RANDOM_H
+
+#include <stdint.h>
+
+// Tests supply it, usually from check_rand() so runs repeat
+uint32_t esp_random(void);
+
+#endif
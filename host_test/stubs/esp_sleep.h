@@ -0,0 +1,9 @@
+#ifndef ESP_SLEEP_H
+#define ESP_SLEEP_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Named by headers only; nothing here sleeps
+
+#endif
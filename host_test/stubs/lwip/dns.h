@@ -0,0 +1,6 @@
+#ifndef LWIP_DNS_H
+#define LWIP_DNS_H
+
+#include "lwip/netdb.h"
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef MINIZ_H
+#define MINIZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+// The ROM's tinfl interface, run on zlib by miniz_shim.c. zlib's state lives inside the
+// decompressor, so freeing it, as the firmware does, releases everything.
+
+#define TINFL_LZ_DICT_SIZE 32768
+
+enum {
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8,
+};
+
+typedef enum {
+    TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS = -4,
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+typedef struct {
+    z_stream z;
+    int started;
+    int done;
+    size_t arena_used;
+    unsigned char arena[64 * 1024] __attribute__((aligned(16)));
+} tinfl_decompressor;
+
+void tinfl_init(tinfl_decompressor *r);
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in_buf_next, size_t *in_buf_size,
+                              uint8_t *out_buf_start, uint8_t *out_buf_next, size_t *out_buf_size,
+                              uint32_t decomp_flags);
+
+#endif
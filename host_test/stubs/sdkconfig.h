@@ -0,0 +1,17 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// Only what the modules under test read; values as in the committed sdkconfig
+#define CONFIG_NODE_DLOG_LEVEL 3
+#define CONFIG_NODE_DATA_URL "https://h2overwatch.ca/DesktopModules/ShiftUP_VolsenseMap/waterFile.ashx"
+#define CONFIG_NODE_REGISTER_URL "https://h2overwatch.ca/DesktopModules/ShiftUP_VolsenseMap/registerDevice.ashx"
+#define CONFIG_NODE_UPLOAD_RETRY_DELAY_MS 2000
+#define CONFIG_NODE_INTERVAL_HIGH_MIN 2
+#define CONFIG_NODE_INTERVAL_MID_MIN 5
+#define CONFIG_NODE_INTERVAL_LOW_MIN 10
+#define CONFIG_NODE_VOLT_HIGH_MV 12300
+#define CONFIG_NODE_VOLT_LOW_MV 11800
+#define CONFIG_NODE_UPLOAD_EVERY 1
+#define CONFIG_NODE_AGG_WINDOW_MIN 30
+
+#endif
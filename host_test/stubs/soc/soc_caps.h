@@ -0,0 +1,4 @@
+#ifndef SOC_CAPS_H
+#define SOC_CAPS_H
+
+#endif
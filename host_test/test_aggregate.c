@@ -0,0 +1,282 @@
+// Window statistics against long double references over long runs: millions of samples with
+// a large offset and a small spread, the case where a naive sum of squares loses every
+// digit, plus drifting and stepping series. Windows accumulated separately and merged the
+// way sensors.c folds pending windows must agree with one accumulator over the whole span.
+// Also window rollover, anomaly flagging and the upload row.
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "aggregate.c"
+
+#define LONG_RUN   10000000     // 2-minute samples for 38 years
+#define MEAN_TOL   1e-12        // Relative
+// Welford's error grows with the offset over the spread; at 1e9 of it over the long run the
+// variance keeps about eight digits. The row carries the stddev to two decimals.
+#define VAR_TOL    1e-6
+
+typedef double (*series_fn)(uint32_t i);
+
+// Standard normal from the check generator
+static double gauss(void) {
+    double u = (check_rand() + 1.0) / 4294967297.0;
+    double v = check_rand() / 4294967296.0;
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+// Water pressure in Pa: flat with sensor noise
+static double flat_pressure(uint32_t i) {
+    return 101325.0 + 0.5 * gauss();
+}
+
+// Far from zero, spread in the thousandths
+static double offset_tiny(uint32_t i) {
+    return 1.0e6 + 1.0e-3 * gauss();
+}
+
+// Daily temperature swing with noise
+static double diurnal_temp(uint32_t i) {
+    return 15.0 + 10.0 * sin(2.0 * M_PI * (i % 720) / 720.0) + 0.05 * gauss();
+}
+
+// Battery voltage stepping between charge states
+static double stepping_volts(uint32_t i) {
+    return (i / 50000 % 3 == 0 ? 12.8 : i / 50000 % 3 == 1 ? 12.1 : 11.6) + 0.01 * gauss();
+}
+
+typedef struct {
+    uint32_t count;
+    double min, max, first, last;
+    long double mean, m2;
+} reference_t;
+
+// Two passes in long double over the same generated series
+static reference_t reference(series_fn fn, uint32_t n, uint32_t seed) {
+    reference_t r = {.count = n, .min = INFINITY, .max = -INFINITY};
+    long double sum = 0;
+    check_rng = seed;
+    for (uint32_t i = 0; i < n; i++) {
+        double x = fn(i);
+        sum += x;
+        if ((float)x < r.min) r.min = (float)x;
+        if ((float)x > r.max) r.max = (float)x;
+        if (i == 0) r.first = (float)x;
+        r.last = (float)x;
+    }
+    r.mean = sum / n;
+    check_rng = seed;
+    for (uint32_t i = 0; i < n; i++) {
+        long double d = fn(i) - r.mean;
+        r.m2 += d * d;
+    }
+    return r;
+}
+
+static void check_stat(const agg_stat_t *s, const reference_t *r, const char *what) {
+    CHECK_MSG(s->count == r->count, "%s: count %u", what, s->count);
+    double mean_err = fabsl((s->mean - r->mean) / r->mean);
+    double var_ref = (double)(r->m2 / (r->count - 1));
+    double var_err = fabs(agg_stat_variance(s) - var_ref) / var_ref;
+    CHECK_MSG(mean_err < MEAN_TOL, "%s: mean off by %.3g", what, mean_err);
+    CHECK_MSG(var_err < VAR_TOL, "%s: variance %.17g, reference %.17g, off by %.3g", what, agg_stat_variance(s), var_ref, var_err);
+    CHECK_MSG(s->min == (float)r->min && s->max == (float)r->max, "%s: min/max", what);
+    CHECK_MSG(s->first == (float)r->first && s->last == (float)r->last, "%s: first/last", what);
+}
+
+static void test_long_runs(void) {
+    struct {
+        const char *name;
+        series_fn fn;
+    } series[] = {
+        {"flat pressure", flat_pressure},
+        {"offset", offset_tiny},
+        {"diurnal", diurnal_temp},
+        {"stepping", stepping_volts},
+    };
+
+    for (size_t k = 0; k < sizeof(series) / sizeof(series[0]); k++) {
+        uint32_t seed = 12345 + k;
+        reference_t ref = reference(series[k].fn, LONG_RUN, seed);
+
+        agg_stat_t whole = {0};
+        // Windows of random length, folded in order as pending windows are
+        agg_stat_t merged = {0}, part = {0};
+        uint32_t part_left = 0;
+        uint32_t windows_rng = 777;
+
+        check_rng = seed;
+        for (uint32_t i = 0; i < LONG_RUN; i++) {
+            double x = series[k].fn(i);
+            agg_stat_add(&whole, x);
+
+            if (part_left == 0) {
+                agg_stat_merge(&merged, &part);
+                memset(&part, 0, sizeof(part));
+                uint32_t saved = check_rng;
+                check_rng = windows_rng;
+                part_left = 1 + check_rand_below(check_rand_below(8) ? 30 : 100000);
+                windows_rng = check_rng;
+                check_rng = saved;
+            }
+            agg_stat_add(&part, x);
+            part_left--;
+        }
+        agg_stat_merge(&merged, &part);
+
+        check_stat(&whole, &ref, series[k].name);
+        check_stat(&merged, &ref, series[k].name);
+    }
+}
+
+// Merging many small windows pairwise, as a long outage does, against one accumulator
+static void test_merge_tree(void) {
+    enum { WINDOWS = 4096, PER = 15 };
+    static agg_stat_t windows[WINDOWS];
+    agg_stat_t whole = {0};
+    check_rng = 99;
+    memset(windows, 0, sizeof(windows));
+    for (int w = 0; w < WINDOWS; w++) {
+        for (int i = 0; i < PER; i++) {
+            double x = offset_tiny(0);
+            agg_stat_add(&windows[w], x);
+            agg_stat_add(&whole, x);
+        }
+    }
+    for (int width = 1; width < WINDOWS; width *= 2) {
+        for (int w = 0; w + width < WINDOWS; w += 2 * width) agg_stat_merge(&windows[w], &windows[w + width]);
+    }
+    CHECK(windows[0].count == whole.count);
+    CHECK(fabs(windows[0].mean - whole.mean) / whole.mean < MEAN_TOL);
+    CHECK(fabs(agg_stat_variance(&windows[0]) - agg_stat_variance(&whole)) / agg_stat_variance(&whole) < VAR_TOL);
+    CHECK(windows[0].first == whole.first && windows[0].last == whole.last);
+
+    // Empty on either side
+    agg_stat_t empty = {0}, copy = whole;
+    agg_stat_merge(&copy, &empty);
+    CHECK(memcmp(&copy, &whole, sizeof(copy)) == 0);
+    agg_stat_merge(&empty, &whole);
+    CHECK(memcmp(&empty, &whole, sizeof(copy)) == 0);
+
+    // Variance needs two samples
+    agg_stat_t one = {0};
+    agg_stat_add(&one, 5.0);
+    CHECK(agg_stat_variance(&one) == 0.0 && one.min == 5.0f && one.max == 5.0f);
+}
+
+static void test_windows(void) {
+    const uint32_t window_s = 30 * 60;
+    agg_window_t w = {0}, closed;
+    uint32_t when = 1767225600 + 17;        // Not on a window boundary
+    uint32_t samples = 0, closed_samples = 0, closed_windows = 0;
+    uint32_t last_end = 0;
+
+    for (int i = 0; i < 200000; i++) {
+        when += check_rand_below(8) ? 120 : check_rand_below(4 * 3600);
+        double x[AGG_CHANNELS] = {101325 + gauss(), 20 + gauss(), 12.4};
+        uint32_t start = w.start;
+        bool open = w.ch[0].count > 0;
+        if (agg_window_add(&w, window_s, when, x, &closed)) {
+            CHECK(open && when >= start + window_s);
+            CHECK(closed.start == start && closed.start % window_s == 0);
+            CHECK(closed.end < closed.start + window_s && closed.end >= last_end);
+            CHECK(closed.ch[0].count == closed.ch[1].count && closed.ch[1].count == closed.ch[2].count);
+            closed_samples += closed.ch[0].count;
+            closed_windows++;
+            last_end = closed.end;
+        }
+        samples++;
+        CHECK(w.start % window_s == 0 && w.start <= when && when < w.start + window_s && w.end == when);
+    }
+    CHECK(closed_samples + w.ch[0].count == samples);
+    CHECK(closed_windows > 1000);
+
+    // The clock stepping back closes the window rather than folding older samples into it
+    double x[AGG_CHANNELS] = {1, 2, 3};
+    uint32_t start = w.start;
+    CHECK(agg_window_add(&w, window_s, start - 1, x, &closed));
+    CHECK(closed.start == start && w.start == start - window_s && w.ch[0].count == 1);
+
+    // No window length: every sample starts its own
+    memset(&w, 0, sizeof(w));
+    CHECK(!agg_window_add(&w, 0, 1000, x, &closed) && w.start == 1000);
+    CHECK(agg_window_add(&w, 0, 1001, x, &closed) && closed.ch[0].count == 1 && w.start == 1001);
+}
+
+static void test_anomaly(void) {
+    agg_window_t w = {0}, closed;
+    double x[AGG_CHANNELS] = {101325, 20, 12.4};
+
+    // Too few samples to judge
+    for (int i = 0; i < AGG_ANOMALY_MIN - 1; i++) {
+        x[AGG_PRESSURE] = 101325 + 50 * gauss();
+        agg_window_add(&w, 0x7FFFFFFF, 1000, x, &closed);
+    }
+    x[AGG_PRESSURE] = 200000;
+    CHECK(!agg_window_is_anomaly(&w, x));
+
+    // Noise alone is rarely flagged; a burst is
+    int flagged = 0, trials = 100000;
+    for (int i = 0; i < trials; i++) {
+        x[AGG_PRESSURE] = 101325 + 500 * gauss();
+        if (agg_window_is_anomaly(&w, x)) flagged++;
+        agg_window_add(&w, 0x7FFFFFFF, 1000, x, &closed);
+    }
+    CHECK_MSG(flagged < trials / 1000, "%d of %d noise samples flagged", flagged, trials);
+    x[AGG_PRESSURE] = 101325 + 500 * 6;
+    CHECK(agg_window_is_anomaly(&w, x));
+    x[AGG_PRESSURE] = 101325;
+    x[AGG_VOLTAGE] = 9.0;
+    CHECK(agg_window_is_anomaly(&w, x));
+
+    // A dead flat channel: any change is many sigma out, but under the floor it doesn't count
+    memset(&w, 0, sizeof(w));
+    double flat[AGG_CHANNELS] = {101325, 20, 12.4};
+    for (int i = 0; i < 100; i++) agg_window_add(&w, 0x7FFFFFFF, 1000, flat, &closed);
+    flat[AGG_PRESSURE] += 101325 * AGG_ANOMALY_FLOOR * 0.9;
+    CHECK(!agg_window_is_anomaly(&w, flat));
+    flat[AGG_PRESSURE] = 101325 * (1 + AGG_ANOMALY_FLOOR * 1.1);
+    CHECK(agg_window_is_anomaly(&w, flat));
+}
+
+static void test_row(void) {
+    setenv("TZ", "UTC", 1);
+    tzset();
+    agg_window_t w = {0}, closed;
+    double x[AGG_CHANNELS] = {101325.25, -12.5, 12.4};
+    agg_window_add(&w, 1800, 1767225600 + 60, x, &closed);
+    x[AGG_PRESSURE] = 101327.75;
+    x[AGG_TEMP] = -11.5;
+    agg_window_add(&w, 1800, 1767225600 + 180, x, &closed);
+
+    char row[AGG_ROW_MAX];
+    int len = agg_format_row(&w, row, sizeof(row));
+    CHECK(len > 0 && len < AGG_ROW_MAX && row[len - 1] == '\n' && (size_t)len == strlen(row));
+    const char *expect = "agg:'01-01-2026 00:00:00:000','01-01-2026 00:03:00:000','2',"
+                         "'101325.25','101327.75','101326.50','1.77','101325.25','101327.75',"
+                         "'-12.50','-11.50','-12.00','0.71','-12.50','-11.50',"
+                         "'12.40','12.40','12.40','0.00','12.40','12.40'\n";
+    CHECK_MSG(strcmp(row, expect) == 0, "row %s", row);
+
+    // The widest values a sensor can report still fit
+    memset(&w, 0, sizeof(w));
+    double wide[AGG_CHANNELS] = {4294967295.0, -273.15, 99999.0};
+    agg_window_add(&w, 1800, 4294967295u, wide, &closed);
+    wide[AGG_PRESSURE] = 0;
+    agg_window_add(&w, 1800, 4294967295u, wide, &closed);
+    len = agg_format_row(&w, row, sizeof(row));
+    CHECK(len > 0 && len < AGG_ROW_MAX);
+
+    // Too small a buffer: cut short, the full length returned as snprintf does
+    char small[40];
+    CHECK(agg_format_row(&w, small, sizeof(small)) == len && strlen(small) == sizeof(small) - 1);
+    CHECK(strncmp(small, row, sizeof(small) - 1) == 0);
+}
+
+int main(void) {
+    test_long_runs();
+    test_merge_tree();
+    test_windows();
+    test_anomaly();
+    test_row();
+    return check_result();
+}
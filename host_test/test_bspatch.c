@@ -0,0 +1,249 @@
+// Streaming bspatch against a plain reference applier. Patches come from a generator that
+// builds the new image and its controls together: random ones with seeks anywhere and diff
+// runs hanging off either end of the old image, and ones shaped like a firmware update,
+// mostly copied with sparse byte changes. Each is fed in random splits. Corrupted and
+// truncated patches must be refused without reading outside the old image or writing past
+// the new size they declare.
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "bspatch.c"
+
+#define OLD_MAX   (64 * 1024)
+#define NEW_MAX   (96 * 1024)
+#define PATCH_MAX (4 * NEW_MAX)
+#define RUNS      400
+
+static uint8_t old_img[OLD_MAX];
+static uint8_t new_img[NEW_MAX];
+static uint8_t patch_buf[PATCH_MAX];
+
+// Output side of one apply
+static struct {
+    uint8_t out[PATCH_MAX];     // Output never outruns the input feeding it
+    int64_t written;
+    int64_t limit;          // New size the patch declares
+    int64_t old_size;
+    int bad_reads;
+    int overruns;
+    int64_t fail_at;        // Write callback fails once this much is written, negative for never
+} sink;
+
+static void put_off(uint8_t *buf, int64_t x) {
+    uint64_t y = x < 0 ? (uint64_t)-x : (uint64_t)x;
+    for (int i = 0; i < 8; i++) {
+        buf[i] = y & 0xFF;
+        y >>= 8;
+    }
+    if (x < 0) buf[7] |= 0x80;
+}
+
+static esp_err_t read_old(void *ctx, size_t offset, uint8_t *buf, size_t len) {
+    if ((int64_t)(offset + len) > sink.old_size || len > BSPATCH_BUF_SIZE) {
+        sink.bad_reads++;
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(buf, old_img + offset, len);
+    return ESP_OK;
+}
+
+static esp_err_t write_new(void *ctx, const uint8_t *data, size_t len) {
+    if (sink.fail_at >= 0 && sink.written + (int64_t)len > sink.fail_at) return ESP_ERR_NO_MEM;
+    if (sink.written + (int64_t)len > sink.limit) {
+        sink.overruns++;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(sink.out + sink.written, data, len);
+    sink.written += len;
+    return ESP_OK;
+}
+
+// Builds a new image from old_img and the patch that makes it. `realistic` keeps the seeks
+// short and the diffs mostly zero, as bsdiff produces for a rebuilt firmware.
+static size_t make_patch(size_t old_size, bool realistic, size_t *new_size) {
+    size_t target = realistic ? old_size + check_rand_below(old_size / 8) : check_rand_below(NEW_MAX);
+    size_t len = 24;
+    memcpy(patch_buf, BSPATCH_MAGIC, BSPATCH_MAGIC_LEN);
+
+    // Random seeks land up to `slack` bytes either side of the old image
+    int64_t slack = target / 2 < 2048 ? target / 2 : 2048;
+    int64_t old_pos = 0;
+    size_t n = 0;
+    while (n < target) {
+        size_t diff = check_rand_below(realistic ? 4096 : 2048);
+        size_t extra = check_rand_below(realistic ? 64 : 1024);
+        if (diff > target - n) diff = target - n;
+        if (extra > target - n - diff) extra = target - n - diff;
+        int64_t seek = realistic ? (int64_t)check_rand_below(64) - 32 : (int64_t)check_rand_below(old_size + 2 * slack) - slack - old_pos - (int64_t)diff;
+
+        uint8_t *ctrl = patch_buf + len;
+        put_off(ctrl, diff);
+        put_off(ctrl + 8, extra);
+        put_off(ctrl + 16, seek);
+        len += 24;
+
+        for (size_t i = 0; i < diff; i++, n++, old_pos++) {
+            uint8_t old = old_pos >= 0 && old_pos < (int64_t)old_size ? old_img[old_pos] : 0;
+            uint8_t d = realistic && check_rand_below(16) ? 0 : (uint8_t)check_rand();
+            patch_buf[len++] = d;
+            new_img[n] = old + d;
+        }
+        for (size_t i = 0; i < extra; i++, n++) {
+            patch_buf[len++] = new_img[n] = (uint8_t)check_rand();
+        }
+        old_pos += seek;
+    }
+    // An empty control after the end is allowed
+    if (check_rand_below(4) == 0) {
+        memset(patch_buf + len, 0, 24);
+        len += 24;
+    }
+    put_off(patch_buf + BSPATCH_MAGIC_LEN, target);
+    *new_size = target;
+    return len;
+}
+
+static int64_t declared_size(const uint8_t *patch) {
+    return offtin(patch + BSPATCH_MAGIC_LEN);
+}
+
+// Feeds the patch in random pieces; returns the first error, then bspatch_finish()
+static esp_err_t apply(const uint8_t *patch, size_t len, size_t old_size) {
+    memset(&sink, 0, sizeof(sink));
+    sink.limit = len >= 24 ? declared_size(patch) : 0;
+    sink.old_size = old_size;
+    sink.fail_at = -1;
+
+    bspatch_t p;
+    bspatch_init(&p, read_old, write_new, NULL, old_size);
+    size_t off = 0;
+    while (off < len) {
+        size_t n = check_rand_below(4) == 0 ? 1 : 1 + check_rand_below(3000);
+        if (n > len - off) n = len - off;
+        esp_err_t err = bspatch_feed(&p, patch + off, n);
+        if (err != ESP_OK) return err;
+        off += n;
+    }
+    return bspatch_finish(&p);
+}
+
+static void fill_old(size_t old_size) {
+    for (size_t i = 0; i < old_size; i++) old_img[i] = (uint8_t)check_rand();
+}
+
+static void test_round_trip(void) {
+    for (int run = 0; run < RUNS; run++) {
+        size_t old_size = 1 + check_rand_below(OLD_MAX);
+        bool realistic = run % 2;
+        fill_old(old_size);
+        size_t new_size;
+        size_t len = make_patch(old_size, realistic, &new_size);
+
+        esp_err_t err = apply(patch_buf, len, old_size);
+        CHECK_MSG(err == ESP_OK, "run %d: %s", run, esp_err_to_name(err));
+        CHECK(sink.written == (int64_t)new_size);
+        CHECK_MSG(memcmp(sink.out, new_img, new_size) == 0, "run %d: output differs", run);
+        CHECK(sink.bad_reads == 0 && sink.overruns == 0);
+    }
+}
+
+static void test_empty_and_truncated(void) {
+    // Zero new size: done straight after the header
+    uint8_t hdr[24];
+    memcpy(hdr, BSPATCH_MAGIC, BSPATCH_MAGIC_LEN);
+    put_off(hdr + BSPATCH_MAGIC_LEN, 0);
+    CHECK(apply(hdr, sizeof(hdr), 16) == ESP_OK && sink.written == 0);
+
+    fill_old(4096);
+    size_t new_size;
+    size_t len = make_patch(4096, true, &new_size);
+    for (int i = 0; i < 200; i++) {
+        size_t cut = check_rand_below(len);
+        // Trailing empty controls aside, any cut leaves the image short
+        CHECK(apply(patch_buf, cut, 4096) != ESP_OK || sink.written == (int64_t)new_size);
+    }
+}
+
+static void test_malformed(void) {
+    uint8_t bad[48];
+    memcpy(bad, "ENDSLEY/BSDIFF40", BSPATCH_MAGIC_LEN);
+    put_off(bad + BSPATCH_MAGIC_LEN, 10);
+    CHECK(apply(bad, 24, 16) == ESP_ERR_INVALID_ARG);
+
+    memcpy(bad, BSPATCH_MAGIC, BSPATCH_MAGIC_LEN);
+    put_off(bad + BSPATCH_MAGIC_LEN, -1);
+    CHECK(apply(bad, 24, 16) == ESP_ERR_INVALID_ARG);
+
+    // Negative lengths, and runs longer than the image
+    int64_t controls[][2] = {{-1, 0}, {0, -1}, {11, 0}, {0, 11}, {6, 5}};
+    for (size_t i = 0; i < sizeof(controls) / sizeof(controls[0]); i++) {
+        put_off(bad + BSPATCH_MAGIC_LEN, 10);
+        put_off(bad + 24, controls[i][0]);
+        put_off(bad + 32, controls[i][1]);
+        put_off(bad + 40, 0);
+        CHECK_MSG(apply(bad, 48, 16) == ESP_ERR_INVALID_ARG, "control %zu", i);
+        CHECK(sink.written == 0);
+    }
+
+    // Nothing but controls may follow a complete image
+    put_off(bad + 24, 0);
+    put_off(bad + 32, 0);
+    uint8_t tail[48 + 24 + 1];
+    memcpy(tail, bad, 24);
+    put_off(tail + 24, 0);
+    put_off(tail + 32, 10);
+    put_off(tail + 40, 0);
+    memset(tail + 48, 'x', 10);
+    CHECK(apply(tail, 58, 16) == ESP_OK && sink.written == 10);
+    tail[58] = 1;
+    CHECK(apply(tail, 59, 16) != ESP_OK);
+}
+
+static void test_mutated(void) {
+    for (int run = 0; run < RUNS * 4; run++) {
+        size_t old_size = 1 + check_rand_below(8192);
+        fill_old(old_size);
+        size_t new_size;
+        size_t len = make_patch(old_size, run % 2, &new_size);
+
+        int flips = 1 + check_rand_below(8);
+        for (int i = 0; i < flips; i++) {
+            // Mostly in the header and controls, where it matters
+            size_t at = check_rand_below(2) ? check_rand_below(len < 96 ? len : 96) : check_rand_below(len);
+            patch_buf[at] ^= 1 << check_rand_below(8);
+        }
+
+        esp_err_t err = apply(patch_buf, len, old_size);
+        CHECK_MSG(sink.bad_reads == 0, "run %d: read outside the old image", run);
+        CHECK_MSG(sink.overruns == 0, "run %d: wrote past the declared size", run);
+        if (err == ESP_OK) CHECK(sink.written == declared_size(patch_buf));
+    }
+}
+
+static void test_write_error(void) {
+    fill_old(8192);
+    size_t new_size;
+    size_t len = make_patch(8192, true, &new_size);
+
+    memset(&sink, 0, sizeof(sink));
+    sink.limit = new_size;
+    sink.old_size = 8192;
+    sink.fail_at = new_size / 2;
+    bspatch_t p;
+    bspatch_init(&p, read_old, write_new, NULL, 8192);
+    CHECK(bspatch_feed(&p, patch_buf, len) == ESP_ERR_NO_MEM);
+    // The applier stays failed rather than carrying on with a gap
+    sink.fail_at = -1;
+    CHECK(bspatch_feed(&p, patch_buf, 1) == ESP_ERR_INVALID_STATE);
+    CHECK(bspatch_finish(&p) != ESP_OK);
+}
+
+int main(void) {
+    test_round_trip();
+    test_empty_and_truncated();
+    test_malformed();
+    test_mutated();
+    test_write_error();
+    return check_result();
+}
@@ -0,0 +1,568 @@
+// The CoAP uplink against a stand-in server over a lossy simulated link: Block1 transfer of
+// sealed blocks, retransmission, replies up to PROVISION_RESPONSE_MAX and bound to the upload
+// they answer, and the cached server address being dropped once the server stops answering.
+// On the lossy link the same payloads also go through the HTTPS uplink (upload.c's multipart
+// POST) with TCP and TLS modelled on the same loss and round trip, to compare the two.
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "rtos_sim.h"
+#include "http_client_sim.h"
+#include "udp_sim_redirect.h"
+#include "coap_uplink.c"
+#include "upload.c"
+
+#define SERVER_HOST "ingest.example.com"
+#define SERVER_IP   0x0A000001u
+#define SENSOR_ID   "S42"
+#define SENSOR_KEY  "k3y-for-S42"
+
+static struct {
+    mbedtls_ccm_context ccm;
+    uint32_t counter;
+    uint8_t rows[16384];
+    size_t rows_len;
+    size_t wire_offset;         // Next Block1 byte expected
+    bool complete;
+    // Last answer, resent when the request is retransmitted
+    uint16_t last_mid;
+    bool have_last;
+    uint8_t last_reply[2][COAP_MAX_REPLY];
+    size_t last_reply_len[2];
+    // Tokens of every request, each must be new
+    uint8_t tokens[512][COAP_TOKEN_LEN];
+    int token_count;
+    int reused_tokens;
+    // Behaviour
+    const char *reply_text;
+    size_t reply_len;
+    bool separate;              // Empty ACK first, then the response as its own CON
+    bool stale_replay;          // The first copy of each later block is lost while the previous
+                                // block's CON response is sent again, as if its ACK was lost
+    bool replay_reply;          // Answers the last block with the sealed reply of an earlier upload
+    uint8_t old_reply[COAP_MAX_REPLY];
+    size_t old_reply_len;
+    uint16_t dropped_mid;
+    uint8_t prev_response[COAP_MAX_MSG];
+    size_t prev_response_len;
+    uint16_t next_mid;
+} server;
+
+static int attempts_recorded;
+static link_plan_t plan = {.upload_now = true, .timeout_ms = 30000, .attempts = 1, .chunk_bytes = 4096};
+
+uint32_t esp_random(void) {
+    return check_rand();
+}
+
+const link_plan_t *link_current_plan(void) {
+    return &plan;
+}
+
+void link_record_attempt(size_t bytes, uint32_t handshake_ms, uint32_t transfer_ms, bool ok) {
+    attempts_recorded++;
+}
+
+// What upload.c needs besides upload_buffer_to_server; try_upload_now isn't run here
+const char *const dlog_module_names[DLOG_MODULE_COUNT] = {"MAIN", "SENSORS", "SD", "UPLOAD", "WIFI"};
+const char *payloadpath = "/sdcard/payload.txt";
+const char DigiCertGlobalRootG2_crt_pem_start[] = "-----BEGIN CERTIFICATE-----\n";
+
+void power_lock_cpu(void) {}
+void power_unlock_cpu(void) {}
+
+size_t sd_atomic_header_skip(const char *data, size_t len) {
+    return 0;
+}
+
+bool wifi_is_connected(void) {
+    return false;
+}
+
+esp_err_t load_registration_metadata(char *key, size_t key_size, char *sensorID, size_t id_size, char *geoutm, size_t geo_size) {
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t sd_load_rows(const char *path, char **rows, size_t *rows_len) {
+    return ESP_ERR_NOT_FOUND;
+}
+
+void sensor_flush_held(const char *path) {}
+
+size_t sensor_aggregates(const agg_window_t **windows) {
+    return 0;
+}
+
+void sensor_aggregates_sent(size_t count) {}
+
+int agg_format_row(const agg_window_t *w, char *buf, size_t size) {
+    return -1;
+}
+
+bool sdlog_backfill_pending(uint32_t *from, uint32_t *to) {
+    return false;
+}
+
+esp_err_t sdlog_query(time_t from, time_t to, sdlog_row_cb_t cb, void *ctx) {
+    return ESP_ERR_NOT_FOUND;
+}
+
+void sdlog_backfill_sent(uint32_t through) {}
+
+uint32_t provision_ack_version(void) {
+    return 0;
+}
+
+void provision_mark_acked(uint32_t version) {}
+
+esp_err_t provision_handle_reply(const char *body, size_t len) {
+    return ESP_OK;
+}
+
+bool ota_on_trial(void) {
+    return false;
+}
+
+const link_plan_t *link_plan_upload(size_t bytes, bool may_defer) {
+    return &plan;
+}
+
+void link_finish_upload(bool ok) {}
+
+esp_err_t uplink_send(const uplink_payload_t *payload, char *response_buf, size_t buf_size) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static void server_reset(void) {
+    mbedtls_ccm_free(&server.ccm);
+    memset(&server, 0, sizeof(server));
+    uint8_t key[16];
+    derive_key(SENSOR_KEY, key);
+    mbedtls_ccm_init(&server.ccm);
+    mbedtls_ccm_setkey(&server.ccm, MBEDTLS_CIPHER_ID_AES, key, 128);
+    server.next_mid = 0x8000;
+}
+
+static size_t build_response(uint8_t *buf, uint8_t type, uint8_t code, uint16_t mid, const coap_msg_t *req,
+                             bool has_block1, uint32_t block1, const uint8_t *payload, size_t payload_len) {
+    size_t pos = 0;
+    buf[pos++] = (COAP_VERSION << 6) | (type << 4) | req->tkl;
+    buf[pos++] = code;
+    buf[pos++] = mid >> 8;
+    buf[pos++] = mid & 0xFF;
+    memcpy(&buf[pos], req->token, req->tkl);
+    pos += req->tkl;
+    uint16_t last = 0;
+    if (has_block1) pos = put_uint_option(buf, pos, &last, COAP_OPT_BLOCK1, block1);
+    if (payload_len) {
+        buf[pos++] = 0xFF;
+        memcpy(&buf[pos], payload, payload_len);
+        pos += payload_len;
+    }
+    return pos;
+}
+
+// Sealed like the node's blocks, under a nonce prefix of the server's own, and bound to the
+// block it answers by that block's nonce
+static size_t seal_reply(const uint8_t *block_nonce, uint8_t *out) {
+    uint8_t aad[sizeof(SENSOR_ID) - 1 + COAP_NONCE_LEN];
+    memcpy(aad, SENSOR_ID, strlen(SENSOR_ID));
+    memcpy(aad + strlen(SENSOR_ID), block_nonce, COAP_NONCE_LEN);
+
+    uint8_t *nonce = out;
+    memset(nonce, 0, COAP_NONCE_LEN);
+    memcpy(nonce, "SRV!", 4);
+    memcpy(nonce + 4, &server.counter, 4);
+    server.counter++;
+    mbedtls_ccm_encrypt_and_tag(&server.ccm, server.reply_len, nonce, COAP_NONCE_LEN, aad, sizeof(aad),
+                                (const uint8_t *)server.reply_text, out + COAP_NONCE_LEN,
+                                out + COAP_NONCE_LEN + server.reply_len, COAP_TAG_LEN);
+    return COAP_NONCE_LEN + server.reply_len + COAP_TAG_LEN;
+}
+
+static void send_answer(int count) {
+    for (int i = 0; i < count; i++) udp_sim_reply(server.last_reply[i], server.last_reply_len[i], i * 20);
+}
+
+static void server_receive(const uint8_t *data, size_t len) {
+    coap_msg_t req;
+    if (!parse_msg(data, len, &req) || req.type != COAP_TYPE_CON || req.code != COAP_CODE_POST) return;
+
+    if (server.have_last && req.message_id == server.last_mid) {
+        send_answer(server.separate ? 2 : 1);
+        return;
+    }
+    if (server.stale_replay && server.prev_response_len && req.message_id != server.dropped_mid) {
+        server.dropped_mid = req.message_id;
+        udp_sim_reply(server.prev_response, server.prev_response_len, 0);
+        return;
+    }
+
+    for (int i = 0; i < server.token_count; i++) {
+        if (memcmp(server.tokens[i], req.token, COAP_TOKEN_LEN) == 0) server.reused_tokens++;
+    }
+    if (server.token_count < 512) memcpy(server.tokens[server.token_count++], req.token, COAP_TOKEN_LEN);
+
+    uint32_t num = req.block1 >> 4;
+    bool more = req.block1 & 0x8;
+    uint32_t szx = req.block1 & 0x7;
+    size_t offset = (size_t)num << (szx + 4);
+    if (num == 0) {
+        server.rows_len = 0;
+        server.wire_offset = 0;
+        server.complete = false;
+    }
+
+    uint8_t code;
+    uint8_t plain[COAP_MAX_MSG];
+    size_t plain_len = 0;
+    uint8_t sealed_reply[COAP_MAX_REPLY];
+    size_t sealed_len = 0;
+    if (!req.has_block1 || offset != server.wire_offset || server.complete) {
+        code = 0x88;    // 4.08 Request Entity Incomplete
+    } else if (unseal(&server.ccm, (const uint8_t *)SENSOR_ID, strlen(SENSOR_ID), req.payload, req.payload_len, plain,
+                      &plain_len) != 0) {
+        code = 0x80;    // 4.00 Bad Request
+    } else {
+        memcpy(server.rows + server.rows_len, plain, plain_len);
+        server.rows_len += plain_len;
+        server.wire_offset += (size_t)1 << (szx + 4);
+        server.complete = !more;
+        code = more ? COAP_CODE_CONTINUE : 0x44;   // 2.31 or 2.04
+        if (!more && server.replay_reply) {
+            memcpy(sealed_reply, server.old_reply, server.old_reply_len);
+            sealed_len = server.old_reply_len;
+        } else if (!more && server.reply_len) {
+            sealed_len = seal_reply(req.payload, sealed_reply);
+            memcpy(server.old_reply, sealed_reply, sealed_len);
+            server.old_reply_len = sealed_len;
+        }
+    }
+
+    server.last_mid = req.message_id;
+    server.have_last = true;
+    if (server.separate) {
+        server.last_reply_len[0] = build_response(server.last_reply[0], COAP_TYPE_ACK, 0, req.message_id,
+                                                  &(coap_msg_t){0}, false, 0, NULL, 0);
+        server.last_reply_len[1] = build_response(server.last_reply[1], COAP_TYPE_CON, code, server.next_mid++, &req,
+                                                  req.has_block1, req.block1, sealed_reply, sealed_len);
+        memcpy(server.prev_response, server.last_reply[1], server.last_reply_len[1]);
+        server.prev_response_len = server.last_reply_len[1];
+        send_answer(2);
+    } else {
+        server.last_reply_len[0] = build_response(server.last_reply[0], COAP_TYPE_ACK, code, req.message_id, &req,
+                                                  req.has_block1, req.block1, sealed_reply, sealed_len);
+        send_answer(1);
+    }
+}
+
+static char rows[12000];
+
+static size_t make_rows(size_t bytes) {
+    size_t len = 0;
+    unsigned i = 0;
+    while (len + 64 < bytes) {
+        len += snprintf(rows + len, sizeof(rows) - len, "'01-02-2026 10:%02u:00:000','%u','21.50','12.40','0.00'\n",
+                        i % 60, 101000 + i);
+        i++;
+    }
+    return len;
+}
+
+static uplink_config_t config(void) {
+    uplink_config_t cfg = {.transport = UPLINK_TRANSPORT_COAP};
+    strlcpy(cfg.coap_uri, "coap://" SERVER_HOST ":5683", sizeof(cfg.coap_uri));
+    return cfg;
+}
+
+static esp_err_t upload(size_t bytes, char *reply, size_t reply_size) {
+    uplink_config_t cfg = config();
+    size_t len = make_rows(bytes);
+    uplink_payload_t payload = {.key = SENSOR_KEY, .sensor_id = SENSOR_ID, .geoutm = "12N", .rows = rows, .rows_len = len};
+    return coap_uplink_send(&cfg, &payload, reply, reply_size);
+}
+
+static bool server_has(size_t bytes) {
+    size_t len = make_rows(bytes);
+    return server.complete && server.rows_len == len && memcmp(server.rows, rows, len) == 0;
+}
+
+// A new node: nothing in RTC memory
+static void power_on(void) {
+    memset(&session, 0, sizeof(session));
+    udp_sim_reset(SERVER_HOST, SERVER_IP, server_receive);
+    rtos_sim_reset();
+    server_reset();
+    attempts_recorded = 0;
+}
+
+static void test_clean_link(void) {
+    power_on();
+    char reply[PROVISION_RESPONSE_MAX];
+    CHECK(upload(3000, reply, sizeof(reply)) == ESP_OK);
+    CHECK(server_has(3000));
+    CHECK(server.token_count >= 6 && server.reused_tokens == 0);
+    CHECK(reply[0] == '\0');
+    CHECK(udp_sim_lookups() == 1);
+    CHECK(attempts_recorded == 1);
+
+    // The next wake reuses the address, and tokens stay fresh across wakes
+    CHECK(upload(1500, reply, sizeof(reply)) == ESP_OK);
+    CHECK(server_has(1500));
+    CHECK(udp_sim_lookups() == 1);
+    CHECK(server.reused_tokens == 0);
+
+    // Separate responses are matched by token
+    server.separate = true;
+    CHECK(upload(2500, reply, sizeof(reply)) == ESP_OK);
+    CHECK(server_has(2500));
+}
+
+static void test_reply_size(void) {
+    static char text[PROVISION_RESPONSE_MAX + 200];
+    for (size_t i = 0; i < sizeof(text) - 1; i++) text[i] = "key:'v'\n"[i % 8];
+    char reply[PROVISION_RESPONSE_MAX];
+
+    // Well past one block: the whole provisioning reply comes through
+    power_on();
+    server.reply_text = text;
+    server.reply_len = 1800;
+    CHECK(upload(1200, reply, sizeof(reply)) == ESP_OK);
+    CHECK(strlen(reply) == 1800 && memcmp(reply, text, 1800) == 0);
+
+    // The largest reply the caller can take
+    server.reply_len = PROVISION_RESPONSE_MAX - 1;
+    CHECK(upload(1200, reply, sizeof(reply)) == ESP_OK);
+    CHECK(strlen(reply) == PROVISION_RESPONSE_MAX - 1);
+
+    // Too large: the rows are still delivered, the reply is dropped rather than cut
+    server.reply_len = PROVISION_RESPONSE_MAX + 100;
+    CHECK(upload(1200, reply, sizeof(reply)) == ESP_OK);
+    CHECK(server_has(1200));
+    CHECK(reply[0] == '\0');
+}
+
+static void test_server_moves(void) {
+    power_on();
+    char reply[64];
+    CHECK(upload(1000, reply, sizeof(reply)) == ESP_OK);
+    CHECK(udp_sim_lookups() == 1);
+
+    // Silent server: the address is kept for COAP_SESSION_MAX_FAILURES uploads, then looked up again
+    udp_sim_move_server(SERVER_IP + 1);
+    for (int i = 0; i < COAP_SESSION_MAX_FAILURES; i++) {
+        CHECK(upload(1000, reply, sizeof(reply)) == ESP_ERR_TIMEOUT);
+        CHECK(udp_sim_lookups() == 1);
+    }
+    CHECK(upload(1000, reply, sizeof(reply)) == ESP_OK);
+    CHECK(udp_sim_lookups() == 2);
+    CHECK(server_has(1000));
+
+    // A send error drops it at once
+    udp_sim_fail_send(true);
+    CHECK(upload(1000, reply, sizeof(reply)) == ESP_FAIL);
+    udp_sim_fail_send(false);
+    CHECK(upload(1000, reply, sizeof(reply)) == ESP_OK);
+    CHECK(udp_sim_lookups() == 3);
+
+    // One lost upload in between doesn't add up with later ones
+    udp_sim_move_server(SERVER_IP + 2);
+    CHECK(upload(1000, reply, sizeof(reply)) == ESP_ERR_TIMEOUT);
+    udp_sim_move_server(SERVER_IP + 1);
+    CHECK(upload(1000, reply, sizeof(reply)) == ESP_OK);
+    udp_sim_move_server(SERVER_IP + 2);
+    CHECK(upload(1000, reply, sizeof(reply)) == ESP_ERR_TIMEOUT);
+    CHECK(udp_sim_lookups() == 3);
+}
+
+// A retransmitted response to the previous block must not answer the current one
+static void test_stale_response(void) {
+    power_on();
+    char reply[64];
+    server.separate = true;
+    server.stale_replay = true;
+    CHECK(upload(3000, reply, sizeof(reply)) == ESP_OK);
+    CHECK(server_has(3000));
+}
+
+// A reply recorded from an earlier upload is valid under the same key, but answers another
+// block: the node must not hand it on, or the same config would be applied twice
+static void test_replayed_reply(void) {
+    power_on();
+    char reply[PROVISION_RESPONSE_MAX];
+    server.reply_text = "interval_high:'3'\ncfg_version:'7'\n";
+    server.reply_len = strlen(server.reply_text);
+    CHECK(upload(1200, reply, sizeof(reply)) == ESP_OK);
+    CHECK(strcmp(reply, server.reply_text) == 0);
+
+    server.replay_reply = true;
+    CHECK(upload(1200, reply, sizeof(reply)) == ESP_OK);
+    CHECK(server_has(1200));
+    CHECK(reply[0] == '\0');
+
+    // Also across a reset, which starts a new session
+    memset(&session, 0, sizeof(session));
+    CHECK(upload(300, reply, sizeof(reply)) == ESP_OK);
+    CHECK(reply[0] == '\0');
+
+    server.replay_reply = false;
+    CHECK(upload(300, reply, sizeof(reply)) == ESP_OK);
+    CHECK(strcmp(reply, server.reply_text) == 0);
+}
+
+// HTTPS on the lossy link, behind the esp_http_client API: each request is costed as TCP and
+// TLS 1.2 would carry it, in flights of MSS-sized segments. A lost segment is sent again after
+// the retransmission timeout, doubling each time. There is no congestion window, a flight goes
+// out at once, which flatters HTTPS on the larger bodies. Bytes are TCP payload, like the CoAP
+// counts are UDP payload; neither counts IP headers or bare TCP acks.
+#define HTTPS_MSS            1436
+#define HTTPS_RECORD_EXTRA   29      // AES-GCM record: header, explicit nonce, tag
+#define HTTPS_CLIENT_HELLO   220
+#define HTTPS_SERVER_HELLO   3400    // ServerHello, the certificate chain, key exchange, done
+#define HTTPS_CLIENT_FINISH  130     // Client key exchange, ChangeCipherSpec, Finished
+#define HTTPS_SERVER_FINISH  51
+#define HTTPS_REPLY_HEAD     120     // Status line and headers
+
+static struct {
+    unsigned loss;
+    uint32_t rtt_ms;
+    size_t tx;
+    size_t rx;
+    int64_t elapsed_ms;     // Of this attempt so far, against the plan's timeout
+    bool timed_out;
+} https;
+
+// One flight of bytes in one direction; false once the plan's timeout has passed
+static bool https_flight(size_t bytes, size_t *count) {
+    size_t segments = bytes ? (bytes + HTTPS_MSS - 1) / HTTPS_MSS : 1;
+    uint32_t rto = 3 * https.rtt_ms > 1000 ? 3 * https.rtt_ms : 1000;
+    uint32_t longest = 0;
+    for (size_t i = 0; i < segments; i++) {
+        size_t len = bytes ? (i + 1 < segments ? HTTPS_MSS : bytes - i * HTTPS_MSS) : 0;
+        uint32_t wait = 0;
+        for (uint32_t backoff = rto; ; backoff *= 2) {
+            *count += len;
+            if (check_rand_below(100) >= https.loss) break;
+            wait += backoff;
+            if (wait > plan.timeout_ms) break;
+        }
+        if (wait > longest) longest = wait;
+    }
+    https.elapsed_ms += https.rtt_ms / 2 + longest;
+    https.timed_out = https.elapsed_ms > plan.timeout_ms;
+    return !https.timed_out;
+}
+
+// Request head as esp_http_client writes it: request line, its own headers, upload.c's
+static size_t https_request_head(const http_client_sim_request_t *req) {
+    const char *host = strstr(req->url, "://") + 3;
+    const char *path = strchr(host, '/');
+    size_t len = strlen("POST  HTTP/1.1\r\nUser-Agent: ESP32 HTTP Client/1.0\r\nHost: \r\n") + strlen(path) +
+                 (size_t)(path - host);
+    for (const char *c = req->headers; *c; c++) len += *c == '\n' ? 2 : 1;
+    return len + (size_t)snprintf(NULL, 0, "Content-Length: %zu\r\n\r\n", req->body_len);
+}
+
+static void https_server(http_client_sim_request_t *req, void *ctx) {
+    https.elapsed_ms = 0;
+    https.timed_out = false;
+    size_t records = 1 + (req->body_len + plan.chunk_bytes - 1) / plan.chunk_bytes;
+    bool ok = https_flight(0, &https.tx) && https_flight(0, &https.rx) &&
+              https_flight(HTTPS_CLIENT_HELLO, &https.tx) && https_flight(HTTPS_SERVER_HELLO, &https.rx) &&
+              https_flight(HTTPS_CLIENT_FINISH, &https.tx) && https_flight(HTTPS_SERVER_FINISH, &https.rx) &&
+              https_flight(https_request_head(req) + req->body_len + records * HTTPS_RECORD_EXTRA, &https.tx) &&
+              https_flight(HTTPS_REPLY_HEAD + server.reply_len + HTTPS_RECORD_EXTRA, &https.rx);
+    if (ok) {
+        // close_notify both ways, nobody waits for it
+        https.tx += 2 + HTTPS_RECORD_EXTRA;
+        https.rx += 2 + HTTPS_RECORD_EXTRA;
+    }
+    rtos_sim_advance_ms(https.timed_out ? plan.timeout_ms : (uint32_t)https.elapsed_ms);
+    req->status = ok ? 200 : -1;
+    req->reply = ok ? server.reply_text : "";
+    req->reply_len = ok ? server.reply_len : 0;
+}
+
+// Per transport, over every upload of the lossy link
+typedef struct {
+    int delivered;
+    int64_t ms;             // Delivered uploads only
+    size_t tx;
+    size_t rx;
+    int64_t worst_ms;
+} link_cost_t;
+
+static void cost_add(link_cost_t *cost, bool ok, int64_t ms, size_t tx, size_t rx) {
+    cost->tx += tx;
+    cost->rx += rx;
+    if (!ok) return;
+    cost->delivered++;
+    cost->ms += ms;
+    if (ms > cost->worst_ms) cost->worst_ms = ms;
+}
+
+static void cost_print(const char *name, const link_cost_t *cost, int uploads) {
+    printf("%-6s %9d %10.0f %10" PRId64 " %11.0f %11.0f\n", name, cost->delivered,
+           cost->delivered ? (double)cost->ms / cost->delivered : 0.0, cost->worst_ms, (double)cost->tx / uploads,
+           (double)cost->rx / uploads);
+}
+
+static void test_lossy_link(void) {
+    link_cost_t coap = {0}, http = {0};
+    for (int run = 0; run < 300; run++) {
+        uint32_t seed = check_rng;
+        power_on();
+        https.loss = 5 + check_rand_below(30);
+        https.rtt_ms = 20 + check_rand_below(400);
+        udp_sim_set_loss(https.loss);
+        udp_sim_set_rtt(https.rtt_ms);
+        server.separate = check_rand_below(3) == 0;
+        server.reply_text = "cfg_version:'7'\n";
+        server.reply_len = check_rand_below(2) ? strlen(server.reply_text) : 0;
+
+        for (int wake = 0; wake < 3; wake++) {
+            size_t bytes = 100 + check_rand_below(6000);
+            char reply[PROVISION_RESPONSE_MAX];
+            server.rows_len = 0;    // Only what this wake delivers
+            int64_t start = esp_timer_get_time();
+            esp_err_t ret = upload(bytes, reply, sizeof(reply));
+            cost_add(&coap, ret == ESP_OK, (esp_timer_get_time() - start) / 1000, tx_bytes, rx_bytes);
+            if (ret == ESP_OK) {
+                CHECK_MSG(server_has(bytes), "run %d seed %u wake %d: rows lost or mangled", run, seed, wake);
+                CHECK_MSG(reply[0] == '\0' || strcmp(reply, server.reply_text) == 0,
+                          "run %d seed %u: reply corrupted", run, seed);
+            } else {
+                size_t len = make_rows(bytes);
+                CHECK_MSG(server.rows_len <= len && memcmp(server.rows, rows, server.rows_len) == 0,
+                          "run %d seed %u wake %d: partial upload isn't a prefix", run, seed, wake);
+            }
+            CHECK_MSG(server.reused_tokens == 0, "run %d seed %u: token reused", run, seed);
+
+            // The same rows over HTTPS
+            https.tx = 0;
+            https.rx = 0;
+            http_client_sim_reset(https_server, NULL);
+            start = esp_timer_get_time();
+            ret = upload_buffer_to_server(rows, make_rows(bytes), "https://" SERVER_HOST "/d", reply, sizeof(reply));
+            cost_add(&http, ret == ESP_OK, (esp_timer_get_time() - start) / 1000, https.tx, https.rx);
+            CHECK(http_client_sim_live() == 0);
+        }
+    }
+    printf("lossy link, 900 uploads of 100-6100 bytes at 5-34%% loss and 20-419 ms RTT:\n");
+    printf("%-6s %9s %10s %10s %11s %11s\n", "", "delivered", "mean ms", "worst ms", "sent/upload", "recv/upload");
+    cost_print("CoAP", &coap, 900);
+    cost_print("HTTPS", &http, 900);
+    CHECK(coap.delivered > 450);
+    // Without a handshake CoAP has to come out ahead on bytes, or the comparison is off
+    CHECK(coap.tx < http.tx && coap.rx < http.rx);
+}
+
+int main(void) {
+    test_clean_link();
+    test_reply_size();
+    test_server_moves();
+    test_stale_response();
+    test_replayed_reply();
+    test_lossy_link();
+    return check_result();
+}
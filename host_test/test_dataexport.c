@@ -0,0 +1,270 @@
+// Portal data export through the loopback server, on a history written by sdlog.c to host
+// files: /data and /data.csv whole, gzipped and in byte ranges, checked against the file and
+// against a CSV built here; /history by day; a client leaving part way; no card. The card
+// must be held for the whole of every response and released after it, whatever the outcome.
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "check.h"
+#include "httpd_sim.h"
+#include "sd_host.h"
+#include "sd_host_redirect.h"
+#include "sdlog.c"
+#include "gzstream.c"
+#include "dataexport.c"
+
+#define ROWS     20000
+#define BODY_MAX (4 * 1024 * 1024)
+#define START    1767225600         // 2026-01-01 UTC
+
+static char file[BODY_MAX];
+static size_t file_len;
+static char csv[BODY_MAX];
+static size_t csv_len;
+static char body[BODY_MAX];
+static uint8_t inflated[BODY_MAX];
+
+static bool card = true;
+static int holds;
+static bool released_early;     // Something was sent with the card not held
+
+void power_lock_bus(void) {}
+void power_unlock_bus(void) {}
+
+int64_t esp_timer_get_time(void) {
+    return 0;
+}
+
+bool sd_hold(void) {
+    if (!card) return false;
+    holds++;
+    return true;
+}
+
+void sd_release(void) {
+    holds--;
+}
+
+int sd_format_row(const struct tm *when, int ms, uint32_t pressure, float temp, float voltage, char *buf, size_t size) {
+    return snprintf(buf, size, "'%02d-%02d-%04d %02d:%02d:%02d:%03d','%" PRIu32 "','%.2f','%.2f','%.2f'\n",
+                    when->tm_mday, when->tm_mon + 1, when->tm_year + 1900, when->tm_hour, when->tm_min, when->tm_sec,
+                    ms, pressure, temp, voltage, 0.0);
+}
+
+static void note_chunk(const char *data, size_t len, void *ctx) {
+    if (holds != 1 && card) released_early = true;
+}
+
+typedef struct {
+    httpd_req_t req;
+    httpd_sim_exchange_t ex;
+    char headers[256];
+    esp_err_t ret;
+} request_t;
+
+static void get(request_t *r, esp_err_t (*handler)(httpd_req_t *), const char *uri, const char *headers) {
+    httpd_sim_begin(&r->req, &r->ex, HTTP_GET, uri, body, sizeof(body));
+    snprintf(r->headers, sizeof(r->headers), "%s", headers ? headers : "");
+    r->ex.headers = r->headers;
+    r->ex.on_chunk = note_chunk;
+    released_early = false;
+    r->ret = handler(&r->req);
+    CHECK_MSG(holds == 0, "%s: card still held", uri);
+    CHECK_MSG(!released_early, "%s: sent without holding the card", uri);
+    CHECK_MSG(r->ex.sends_after_end == 0, "%s: sent after the end", uri);
+}
+
+static void write_history(void) {
+    sd_host_reset();
+    uint32_t t = START;
+    for (int i = 0; i < ROWS; i++) {
+        t += check_rand_below(50) ? 120 : check_rand_below(86400);
+        CHECK(sdlog_append(t, 95000 + check_rand_below(10000), 15 + check_rand_below(1000) / 100.0f,
+                           11.5f + check_rand_below(200) / 100.0f) == ESP_OK);
+    }
+    FILE *f = fopen(SDLOG_DATA_PATH, "rb");
+    file_len = fread(file, 1, sizeof(file), f);
+    fclose(f);
+
+    // The CSV as a client should see it
+    csv_len = (size_t)sprintf(csv, "time,pressure,temp,voltage\n");
+    for (char *row = file; row < file + file_len; row = strchr(row, '\n') + 1) {
+        int day, month, year, hour, minute, second;
+        char pressure[16], temp[16], voltage[16];
+        sscanf(row, "'%d-%d-%d %d:%d:%d:%*d','%15[^']','%15[^']','%15[^']'", &day, &month, &year, &hour, &minute,
+               &second, pressure, temp, voltage);
+        csv_len += (size_t)sprintf(csv + csv_len, "%04d-%02d-%02d %02d:%02d:%02d,%s,%s,%s\n", year, month, day, hour,
+                                   minute, second, pressure, temp, voltage);
+    }
+}
+
+static bool body_is(const request_t *r, const char *want, size_t len) {
+    return r->ex.ended && r->ex.out_len == len && memcmp(body, want, len) == 0;
+}
+
+static void test_whole(void) {
+    request_t r;
+    char value[96];
+    get(&r, data_handler, "/data", NULL);
+    CHECK(r.ret == ESP_OK && r.ex.status == 200 && strcmp(r.ex.type, "text/plain") == 0);
+    CHECK_MSG(body_is(&r, file, file_len), "/data: %llu of %zu bytes", r.ex.out_len, file_len);
+    CHECK(r.ex.max_chunk <= sizeof(export.out));
+    CHECK(httpd_sim_header(&r.ex, "Accept-Ranges", value, sizeof(value)) && strcmp(value, "bytes") == 0);
+    CHECK(!httpd_sim_header(&r.ex, "Content-Encoding", value, sizeof(value)));
+
+    get(&r, data_csv_handler, "/data.csv", NULL);
+    CHECK(r.ret == ESP_OK && r.ex.status == 200 && strcmp(r.ex.type, "text/csv") == 0);
+    CHECK_MSG(body_is(&r, csv, csv_len), "/data.csv: %llu of %zu bytes", r.ex.out_len, csv_len);
+}
+
+static void test_gzip(void) {
+    const char *want[] = {file, csv};
+    size_t want_len[] = {file_len, csv_len};
+    for (int k = 0; k < 2; k++) {
+        request_t r;
+        char value[32];
+        get(&r, k ? data_csv_handler : data_handler, k ? "/data.csv" : "/data", "Accept-Encoding: gzip, deflate\n");
+        CHECK(r.ret == ESP_OK && r.ex.ended);
+        CHECK(httpd_sim_header(&r.ex, "Content-Encoding", value, sizeof(value)) && strcmp(value, "gzip") == 0);
+
+        z_stream z = {0};
+        inflateInit2(&z, 16 + 15);
+        z.next_in = (uint8_t *)body;
+        z.avail_in = (uInt)r.ex.out_len;
+        z.next_out = inflated;
+        z.avail_out = sizeof(inflated);
+        int ret = inflate(&z, Z_FINISH);
+        size_t out = z.total_out;
+        inflateEnd(&z);
+        CHECK_MSG(ret == Z_STREAM_END && out == want_len[k] && memcmp(inflated, want[k], out) == 0,
+                  "gzip %d: %zu of %zu bytes back", k, out, want_len[k]);
+        printf("gzip %s: %zu -> %llu bytes\n", k ? "csv" : "data", want_len[k], r.ex.out_len);
+    }
+}
+
+static void check_range(bool is_csv, const char *range, uint64_t first, uint64_t last) {
+    const char *want = is_csv ? csv : file;
+    size_t size = is_csv ? csv_len : file_len;
+    char headers[128], value[96], expect[96];
+    snprintf(headers, sizeof(headers), "Range: %s\nAccept-Encoding: gzip\n", range);
+
+    request_t r;
+    get(&r, is_csv ? data_csv_handler : data_handler, is_csv ? "/data.csv" : "/data", headers);
+    snprintf(expect, sizeof(expect), "bytes %llu-%llu/%zu", (unsigned long long)first, (unsigned long long)last, size);
+    CHECK_MSG(r.ret == ESP_OK && r.ex.status == 206, "%s: status %d", range, r.ex.status);
+    CHECK_MSG(httpd_sim_header(&r.ex, "Content-Range", value, sizeof(value)) && strcmp(value, expect) == 0,
+              "%s: Content-Range %s, want %s", range, value, expect);
+    // Ranges refer to the identity body
+    CHECK(!httpd_sim_header(&r.ex, "Content-Encoding", value, sizeof(value)));
+    CHECK_MSG(body_is(&r, want + first, last - first + 1), "%s: %llu bytes", range, r.ex.out_len);
+}
+
+static void test_ranges(void) {
+    for (int run = 0; run < 200; run++) {
+        bool is_csv = run % 2;
+        size_t size = is_csv ? csv_len : file_len;
+        uint64_t first = check_rand_below(size), last = first + check_rand_below(run % 5 ? 5000 : size);
+        char range[64];
+        switch (run % 4) {
+        case 0:
+            snprintf(range, sizeof(range), "bytes=%llu-", (unsigned long long)first);
+            check_range(is_csv, range, first, size - 1);
+            break;
+        case 1: {
+            uint64_t n = 1 + check_rand_below(size + 100);
+            snprintf(range, sizeof(range), "bytes=-%llu", (unsigned long long)n);
+            check_range(is_csv, range, n < size ? size - n : 0, size - 1);
+            break;
+        }
+        default:
+            snprintf(range, sizeof(range), "bytes=%llu-%llu", (unsigned long long)first, (unsigned long long)last);
+            check_range(is_csv, range, first, last < size ? last : size - 1);
+            break;
+        }
+    }
+    check_range(false, "bytes=0-0", 0, 0);
+    check_range(false, "bytes=-99999999", 0, file_len - 1);
+    check_range(true, "bytes=0-0", 0, 0);
+
+    // Past the end
+    request_t r;
+    char value[64], expect[64];
+    get(&r, data_handler, "/data", "Range: bytes=99999999-\n");
+    snprintf(expect, sizeof(expect), "bytes */%zu", file_len);
+    CHECK(r.ex.status == 416 && r.ex.out_len == 0 && r.ex.ended);
+    CHECK(httpd_sim_header(&r.ex, "Content-Range", value, sizeof(value)) && strcmp(value, expect) == 0);
+
+    // Ranges not served get the whole body
+    const char *whole[] = {"bytes=0-10,20-30", "items=0-10", "bytes=abc", "bytes=10-5"};
+    for (size_t i = 0; i < sizeof(whole) / sizeof(whole[0]); i++) {
+        char headers[64];
+        snprintf(headers, sizeof(headers), "Range: %s\n", whole[i]);
+        get(&r, data_handler, "/data", headers);
+        CHECK_MSG(r.ex.status == 200 && body_is(&r, file, file_len), "%s: status %d", whole[i], r.ex.status);
+    }
+}
+
+static void test_client_gone(void) {
+    for (int run = 0; run < 40; run++) {
+        request_t r;
+        bool is_csv = run % 2;
+        httpd_sim_begin(&r.req, &r.ex, HTTP_GET, "/data", body, sizeof(body));
+        r.ex.headers = run % 3 ? "" : "Accept-Encoding: gzip\n";
+        r.ex.fail_after = check_rand_below(300000);     // Less than either body gzipped
+        r.ret = is_csv ? data_csv_handler(&r.req) : data_handler(&r.req);
+        CHECK(r.ret == ESP_FAIL && r.ex.client_gone && !r.ex.ended);
+        CHECK_MSG(holds == 0, "run %d: card still held", run);
+    }
+}
+
+static void test_history(void) {
+    // Rows from 10 to 12 January inclusive, from the file itself
+    const char *first = strstr(file, "'10-01-2026");
+    const char *end = strstr(file, "'13-01-2026");
+    CHECK(first && end);
+
+    request_t r;
+    get(&r, history_handler, "/history?from=2026-01-10&to=2026-01-12", NULL);
+    CHECK(r.ret == ESP_OK && r.ex.status == 200);
+    CHECK_MSG(first && end && body_is(&r, first, end - first), "/history: %llu bytes", r.ex.out_len);
+
+    get(&r, history_handler, "/history", NULL);
+    CHECK(body_is(&r, file, file_len));
+    get(&r, history_handler, "/history?from=2030-01-01", NULL);
+    CHECK(r.ex.status == 200 && r.ex.out_len == 0 && r.ex.ended);
+
+    httpd_sim_begin(&r.req, &r.ex, HTTP_GET, "/history", body, sizeof(body));
+    r.ex.fail_after = 5000;
+    CHECK(history_handler(&r.req) == ESP_FAIL && holds == 0);
+}
+
+static void test_no_card(void) {
+    request_t r;
+    card = false;
+    get(&r, data_handler, "/data", NULL);
+    CHECK(r.ret == ESP_OK && r.ex.status == 503 && r.ex.ended);
+    get(&r, history_handler, "/history", NULL);
+    CHECK(r.ret == ESP_OK && r.ex.status == 503 && r.ex.ended);
+    card = true;
+
+    // A card without a log
+    sd_host_reset();
+    state.magic = 0;
+    get(&r, data_csv_handler, "/data.csv", NULL);
+    CHECK(r.ret == ESP_OK && r.ex.status == 404 && r.ex.ended);
+    get(&r, history_handler, "/history", NULL);
+    CHECK(r.ret == ESP_OK && r.ex.status == 404 && r.ex.ended);
+}
+
+int main(void) {
+    setenv("TZ", "UTC0", 1);
+    tzset();
+    write_history();
+    test_whole();
+    test_gzip();
+    test_ranges();
+    test_client_gone();
+    test_history();
+    test_no_card();
+    return check_result();
+}
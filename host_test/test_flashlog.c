@@ -0,0 +1,177 @@
+// Flash log on a simulated NOR partition, with power cuts injected at every stage of
+// appends, sector recycling and acks. A cut clears RTC memory, so recovery goes through
+// the partition scan.
+#include <stdlib.h>
+#include "check.h"
+#include "flash_sim.h"
+#include "flashlog.c"
+
+#define SECTORS   4
+#define WORKLOAD  600    // Appends per run, enough to recycle every sector
+#define RUNS      3000
+
+struct tm get_time_now(int *milliseconds) {
+    time_t t = 1700000000;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    *milliseconds = 0;
+    return tm;
+}
+
+static uint32_t pressure_for(uint32_t seq) {
+    return seq * 2654435761u;
+}
+
+// What a power cut leaves: the partition, nothing in RTC memory
+static void power_cycle(void) {
+    memset(&state, 0, sizeof(state));
+    memset(pending, 0, sizeof(pending));
+    pending_count = 0;
+    log_part = NULL;
+}
+
+static size_t read_all(flashlog_record_t *out, size_t max) {
+    size_t count = 0;
+    CHECK(flashlog_read_since(0, out, max, &count) == ESP_OK);
+    return count;
+}
+
+static void test_append_read_ack(void) {
+    flash_sim_init(FLASHLOG_PARTITION_LABEL, SECTORS * FLASH_SIM_SECTOR);
+    power_cycle();
+    CHECK(flashlog_init() == ESP_OK);
+
+    for (uint32_t i = 0; i < 10; i++) {
+        CHECK(flashlog_append_at(1700000000 + i, (uint16_t)i, pressure_for(i + 1), 20.5f, 12.25f) == ESP_OK);
+    }
+    // Two are still batched in RTC memory
+    static flashlog_record_t recs[SECTORS * FLASHLOG_RECORDS_PER_SECTOR];
+    CHECK(read_all(recs, 64) == 8);
+    CHECK(flashlog_flush() == ESP_OK);
+    CHECK(read_all(recs, 64) == 10);
+    for (uint32_t i = 0; i < 10; i++) {
+        CHECK(recs[i].seq == i + 1);
+        CHECK(recs[i].timestamp == 1700000000 + i);
+        CHECK(recs[i].pressure == pressure_for(i + 1));
+        CHECK(recs[i].temp == 20.5f && recs[i].voltage == 12.25f);
+    }
+
+    CHECK(flashlog_ack(6) == ESP_OK);
+    size_t count;
+    CHECK(flashlog_read_since(flashlog_acked_seq(), recs, 64, &count) == ESP_OK);
+    CHECK(count == 4 && recs[0].seq == 7);
+
+    // Deep sleep keeps RTC memory, so the batch and position survive without a scan
+    CHECK(flashlog_append_at(1700000100, 0, 1, 0, 0) == ESP_OK);
+    log_part = NULL;
+    CHECK(flashlog_init() == ESP_OK);
+    CHECK(pending_count == 1);
+
+    // A power cut loses the batch but not the ack or the sequence
+    power_cycle();
+    CHECK(flashlog_init() == ESP_OK);
+    CHECK(flashlog_acked_seq() == 6);
+    CHECK(state.next_seq == 12);
+    CHECK(read_all(recs, 64) == 10);
+}
+
+static void test_wrap(void) {
+    flash_sim_init(FLASHLOG_PARTITION_LABEL, SECTORS * FLASH_SIM_SECTOR);
+    power_cycle();
+    CHECK(flashlog_init() == ESP_OK);
+
+    uint32_t total = 5 * SECTORS * FLASHLOG_RECORDS_PER_SECTOR + 17;
+    for (uint32_t i = 0; i < total; i++) {
+        CHECK(flashlog_append_at(i, 0, pressure_for(i + 1), 0, 0) == ESP_OK);
+    }
+    CHECK(flashlog_flush() == ESP_OK);
+
+    static flashlog_record_t recs[SECTORS * FLASHLOG_RECORDS_PER_SECTOR];
+    size_t count = read_all(recs, SECTORS * FLASHLOG_RECORDS_PER_SECTOR);
+    // Everything but the sector being recycled next is kept
+    CHECK(count >= (SECTORS - 1) * FLASHLOG_RECORDS_PER_SECTOR);
+    CHECK(count > 0 && recs[count - 1].seq == total);
+    for (size_t i = 1; i < count; i++) CHECK(recs[i].seq == recs[i - 1].seq + 1);
+    // Each sector erased once per lap, never more
+    CHECK(flash_sim_erases() <= total / FLASHLOG_RECORDS_PER_SECTOR + 2);
+}
+
+static void test_power_cuts(void) {
+    static flashlog_record_t recs[SECTORS * FLASHLOG_RECORDS_PER_SECTOR];
+    // Bytes written and erased by one run, so cuts land anywhere in it
+    const long span = (WORKLOAD / FLASHLOG_RECORDS_PER_SECTOR + 2) * FLASH_SIM_SECTOR + WORKLOAD * 40L;
+
+    for (int run = 0; run < RUNS; run++) {
+        check_rng = 0x9E3779B9u + run;
+        flash_sim_init(FLASHLOG_PARTITION_LABEL, SECTORS * FLASH_SIM_SECTOR);
+        power_cycle();
+        CHECK(flashlog_init() == ESP_OK);
+
+        // Model: the newest seq known to be in flash and the newest ack that completed
+        volatile uint32_t durable = 0;
+        volatile uint32_t acked = 0;
+        volatile uint32_t assigned = 0;
+        // Acks take sequence numbers too; only data seqs are read back
+        static bool is_data[2 * WORKLOAD + 8];
+        static bool seen[2 * WORKLOAD + 8];
+        memset(is_data, 0, sizeof(is_data));
+        memset(seen, 0, sizeof(seen));
+
+        flash_sim_arm_cut((long)check_rand_below((uint32_t)span));
+        if (setjmp(flash_sim_cut) == 0) {
+            for (uint32_t i = 0; i < WORKLOAD; i++) {
+                uint32_t seq = state.next_seq;
+                assigned = seq;
+                is_data[seq] = true;
+                CHECK(flashlog_append_at(seq, 0, pressure_for(seq), 0, 0) == ESP_OK);
+                if (pending_count == 0) durable = seq;
+                if (check_rand_below(50) == 0 && durable > acked) {
+                    uint32_t ack = durable - check_rand_below(durable - acked);
+                    CHECK(flashlog_ack(ack) == ESP_OK);
+                    acked = ack;
+                    durable = state.next_seq - 1;
+                    assigned = durable;
+                }
+            }
+            flash_sim_arm_cut(-1);
+        }
+
+        power_cycle();
+        CHECK_MSG(flashlog_init() == ESP_OK, "run %d: recovery failed", run);
+
+        size_t count = read_all(recs, SECTORS * FLASHLOG_RECORDS_PER_SECTOR);
+        uint32_t oldest_kept = durable > (SECTORS - 2) * FLASHLOG_RECORDS_PER_SECTOR
+                                   ? durable - (SECTORS - 2) * FLASHLOG_RECORDS_PER_SECTOR : 1;
+        for (size_t i = 0; i < count; i++) {
+            // Never a torn or reordered record, never one the node didn't write
+            CHECK_MSG(recs[i].pressure == pressure_for(recs[i].seq), "run %d: bad record seq %u", run,
+                      (unsigned)recs[i].seq);
+            CHECK_MSG(recs[i].seq <= assigned, "run %d: unknown seq %u", run, (unsigned)recs[i].seq);
+            if (i) CHECK_MSG(recs[i].seq > recs[i - 1].seq, "run %d: out of order at %u", run, (unsigned)i);
+            if (recs[i].seq <= assigned) seen[recs[i].seq] = true;
+        }
+        // Every record flushed before the cut and not yet recycled is still there
+        for (uint32_t seq = oldest_kept; seq <= durable; seq++) {
+            CHECK_MSG(!is_data[seq] || seen[seq], "run %d: lost seq %u (durable %u)", run, (unsigned)seq,
+                      (unsigned)durable);
+        }
+        CHECK_MSG(flashlog_acked_seq() >= acked && flashlog_acked_seq() <= assigned, "run %d: ack %u, expected %u",
+                  run, (unsigned)flashlog_acked_seq(), (unsigned)acked);
+        CHECK_MSG(count == 0 || state.next_seq > recs[count - 1].seq, "run %d: seq reused", run);
+
+        // And the log keeps working after recovery
+        uint32_t seq = state.next_seq;
+        CHECK(flashlog_append_at(seq, 0, pressure_for(seq), 0, 0) == ESP_OK);
+        CHECK(flashlog_flush() == ESP_OK);
+        size_t after;
+        CHECK(flashlog_read_since(seq - 1, recs, 4, &after) == ESP_OK);
+        CHECK_MSG(after == 1 && recs[0].seq == seq, "run %d: append after recovery lost", run);
+    }
+}
+
+int main(void) {
+    test_append_read_ack();
+    test_wrap();
+    test_power_cuts();
+    return check_result();
+}
@@ -0,0 +1,205 @@
+// Streaming form parser against a whole-body reference decoder. The same random bodies are
+// fed in random chunk sizes, down to one byte, and through form_read_request over the httpd
+// loopback; every split must give the reference result.
+#include <string.h>
+#include "check.h"
+#include "httpd_sim.h"
+#include "formparse.c"
+
+#define RUNS 20000
+#define BODY_MAX 600
+
+enum { F_SSID, F_PASSWORD, F_KEY, F_COUNT };
+static const char *const names[F_COUNT] = {"ssid", "password", "key"};
+static const size_t sizes[F_COUNT] = {33, 65, 8};
+
+typedef struct {
+    bool found;
+    char value[BODY_MAX + 1];
+    size_t len;
+} expect_t;
+
+static int ref_hex(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// Decodes in[0..len) the way the portal reads forms: '+' is a space, a malformed escape
+// stays literal
+static size_t ref_decode(const char *in, size_t len, char *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < len;) {
+        if (in[i] == '%' && i + 2 < len && ref_hex(in[i + 1]) >= 0 && ref_hex(in[i + 2]) >= 0) {
+            out[n++] = (char)(ref_hex(in[i + 1]) << 4 | ref_hex(in[i + 2]));
+            i += 3;
+        } else {
+            out[n++] = in[i] == '+' ? ' ' : in[i];
+            i++;
+        }
+    }
+    return n;
+}
+
+// Splits on '&', then on the first '='; the last occurrence of a name wins
+static bool ref_parse(const char *body, size_t len, expect_t *exp) {
+    bool truncated = false;
+    memset(exp, 0, sizeof(expect_t) * F_COUNT);
+    size_t start = 0;
+    while (start <= len) {
+        size_t end = start;
+        while (end < len && body[end] != '&') end++;
+        if (end > start) {
+            size_t eq = start;
+            while (eq < end && body[eq] != '=') eq++;
+            char name[BODY_MAX + 1];
+            size_t name_len = ref_decode(body + start, eq - start, name);
+            for (int f = 0; f < F_COUNT; f++) {
+                if (name_len != strlen(names[f]) || memcmp(name, names[f], name_len) != 0) continue;
+                char value[BODY_MAX + 1];
+                size_t value_len = eq < end ? ref_decode(body + eq + 1, end - eq - 1, value) : 0;
+                if (value_len > sizes[f] - 1) {
+                    truncated = true;
+                    value_len = sizes[f] - 1;
+                }
+                exp[f].found = true;
+                memcpy(exp[f].value, value, value_len);
+                exp[f].len = value_len;
+            }
+        }
+        start = end + 1;
+    }
+    return truncated;
+}
+
+static char values[F_COUNT][65];
+
+static void setup_fields(form_field_t *fields) {
+    for (int f = 0; f < F_COUNT; f++) {
+        memset(values[f], 0x5A, sizeof(values[f]));
+        fields[f] = (form_field_t){.name = names[f], .value = values[f], .size = sizes[f]};
+    }
+}
+
+static void compare(int run, const char *how, const form_field_t *fields, esp_err_t err, const expect_t *exp,
+                    bool truncated) {
+    CHECK_MSG(err == (truncated ? ESP_ERR_INVALID_SIZE : ESP_OK), "run %d %s: err %d", run, how, err);
+    for (int f = 0; f < F_COUNT; f++) {
+        CHECK_MSG(fields[f].found == exp[f].found, "run %d %s: %s found %d", run, how, names[f], fields[f].found);
+        CHECK_MSG(memcmp(fields[f].value, exp[f].value, exp[f].len) == 0 && fields[f].value[exp[f].len] == '\0',
+                  "run %d %s: %s value differs", run, how, names[f]);
+        // Nothing is written past the field's buffer
+        for (size_t i = sizes[f]; i < sizeof(values[f]); i++)
+            CHECK_MSG(values[f][i] == 0x5A, "run %d %s: %s overrun at %zu", run, how, names[f], i);
+    }
+}
+
+// Bodies built from pieces that exercise separators, escapes and names that nearly match
+static size_t random_body(char *body) {
+    static const char *const pieces[] = {
+        "ssid", "password", "key", "pass", "ssidx", "=", "=", "&", "&", "%", "%4", "%41", "%2", "%3D",
+        "%26", "%zz", "%%", "+", "a", "b", "Z", "9", "longnamelongnamelongname", "%73sid", "%00",
+    };
+    size_t len = 0, target = check_rand_below(BODY_MAX);
+    while (len < target) {
+        if (check_rand_below(8) == 0) {
+            body[len++] = (char)check_rand();    // Any byte, NUL included
+            continue;
+        }
+        const char *p = pieces[check_rand_below(sizeof(pieces) / sizeof(pieces[0]))];
+        size_t n = strlen(p);
+        if (len + n > BODY_MAX) break;
+        memcpy(body + len, p, n);
+        len += n;
+    }
+    return len;
+}
+
+static void test_fuzz(void) {
+    static char body[BODY_MAX + 1];
+    expect_t exp[F_COUNT];
+    form_field_t fields[F_COUNT];
+
+    for (int run = 0; run < RUNS; run++) {
+        size_t len = random_body(body);
+        bool truncated = ref_parse(body, len, exp);
+
+        // Whole body, one byte at a time, and random chunks
+        for (int how = 0; how < 3; how++) {
+            form_parser_t p;
+            setup_fields(fields);
+            form_parser_init(&p, fields, F_COUNT);
+            for (size_t pos = 0; pos < len;) {
+                size_t n = how == 0 ? len : how == 1 ? 1 : 1 + check_rand_below(40);
+                if (n > len - pos) n = len - pos;
+                form_parser_feed(&p, body + pos, n);
+                pos += n;
+            }
+            compare(run, how == 0 ? "whole" : how == 1 ? "bytes" : "chunks", fields, form_parser_finish(&p), exp,
+                    truncated);
+        }
+    }
+}
+
+// The same through the request reader, with short reads and timeouts
+static void test_read_request(void) {
+    static char body[BODY_MAX + 1];
+    expect_t exp[F_COUNT];
+    form_field_t fields[F_COUNT];
+    httpd_req_t req;
+    httpd_sim_exchange_t ex;
+
+    for (int run = 0; run < RUNS / 10; run++) {
+        size_t len = random_body(body);
+        body[len] = '\0';
+        len = strlen(body);      // The loopback body is a C string
+        bool truncated = ref_parse(body, len, exp);
+
+        httpd_sim_begin(&req, &ex, HTTP_POST, "/connect", NULL, 0);
+        httpd_sim_body(&req, body);
+        ex.recv_max = 1 + check_rand_below(FORM_CHUNK_SIZE + 10);
+        ex.recv_timeouts = check_rand_below(FORM_RECV_TIMEOUTS);
+        setup_fields(fields);
+        compare(run, "request", fields, form_read_request(&req, fields, F_COUNT), exp, truncated);
+    }
+
+    // Too many timeouts, a closed connection, an oversized body
+    httpd_sim_begin(&req, &ex, HTTP_POST, "/connect", NULL, 0);
+    httpd_sim_body(&req, "ssid=a");
+    ex.recv_timeouts = FORM_RECV_TIMEOUTS;
+    setup_fields(fields);
+    CHECK(form_read_request(&req, fields, F_COUNT) == ESP_FAIL);
+
+    httpd_sim_begin(&req, &ex, HTTP_POST, "/connect", NULL, 0);
+    httpd_sim_body(&req, "ssid=a");
+    req.content_len = 20;       // Client promised more than it sent
+    CHECK(form_read_request(&req, fields, F_COUNT) == ESP_FAIL);
+
+    static char big[FORM_MAX_BODY + 2];
+    memset(big, 'a', FORM_MAX_BODY + 1);
+    httpd_sim_begin(&req, &ex, HTTP_POST, "/connect", NULL, 0);
+    httpd_sim_body(&req, big);
+    CHECK(form_read_request(&req, fields, F_COUNT) == ESP_ERR_INVALID_SIZE);
+    CHECK(ex.body_pos == 0);
+}
+
+// The cases the old strtok code got wrong
+static void test_known(void) {
+    form_field_t fields[F_COUNT];
+    form_parser_t p;
+    const char *body = "ssid=My+Net%26Co&password=p%40ss%3Dword%";
+    setup_fields(fields);
+    form_parser_init(&p, fields, F_COUNT);
+    for (size_t i = 0; body[i]; i++) form_parser_feed(&p, body + i, 1);
+    CHECK(form_parser_finish(&p) == ESP_OK);
+    CHECK(strcmp(values[F_SSID], "My Net&Co") == 0);
+    CHECK(strcmp(values[F_PASSWORD], "p@ss=word%") == 0);
+    CHECK(!fields[F_KEY].found);
+}
+
+int main(void) {
+    test_known();
+    test_fuzz();
+    test_read_request();
+    return check_result();
+}
@@ -0,0 +1,166 @@
+// Streaming gzip encoder, decoded back with zlib: payload-like rows, random bytes, long runs
+// and matches that straddle the window slide, written in random pieces. Also checks the
+// output comes in pieces of at most GZ_OUT_BYTES, that a failed emit stops the stream, and
+// that payload rows compress about as well as gzstream.h claims.
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "check.h"
+#include "gzstream.c"
+
+#define INPUT_MAX (1024 * 1024)
+
+static uint8_t input[INPUT_MAX];
+static uint8_t decoded[INPUT_MAX + 1];
+
+// Compressed output as the export handler would send it
+static struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    size_t max_piece;
+    int pieces;
+    int fail_at;            // Emit fails on this piece, negative for never
+} sink;
+
+static bool emit(const uint8_t *data, size_t len, void *ctx) {
+    if (sink.fail_at >= 0 && sink.pieces == sink.fail_at) return false;
+    sink.pieces++;
+    if (len > sink.max_piece) sink.max_piece = len;
+    if (sink.len + len > sink.cap) {
+        sink.cap = (sink.len + len) * 2;
+        sink.data = realloc(sink.data, sink.cap);
+    }
+    memcpy(sink.data + sink.len, data, len);
+    sink.len += len;
+    return true;
+}
+
+static void sink_reset(void) {
+    sink.len = 0;
+    sink.max_piece = 0;
+    sink.pieces = 0;
+    sink.fail_at = -1;
+}
+
+// Compresses input in random pieces; false if the stream failed
+static bool compress_input(gz_stream_t *gz, size_t len) {
+    sink_reset();
+    gz_begin(gz, emit, NULL);
+    size_t off = 0;
+    while (off < len) {
+        size_t n = check_rand_below(4) == 0 ? check_rand_below(8) : check_rand_below(20000);
+        if (n > len - off) n = len - off;
+        if (!gz_write(gz, input + off, n)) return false;
+        off += n;
+    }
+    return gz_finish(gz);
+}
+
+// Inflates the sink as a gzip stream; returns the decoded length, or -1
+static long inflate_sink(void) {
+    z_stream z = {0};
+    if (inflateInit2(&z, 16 + 15) != Z_OK) return -1;
+    z.next_in = sink.data;
+    z.avail_in = sink.len;
+    z.next_out = decoded;
+    z.avail_out = sizeof(decoded);
+    int ret = inflate(&z, Z_FINISH);
+    long out = (long)z.total_out;
+    bool whole = z.avail_in == 0;
+    inflateEnd(&z);
+    return ret == Z_STREAM_END && whole ? out : -1;
+}
+
+static void check_round_trip(gz_stream_t *gz, size_t len, const char *what) {
+    CHECK_MSG(compress_input(gz, len), "%s: stream failed", what);
+    CHECK_MSG(sink.max_piece <= GZ_OUT_BYTES, "%s: %zu byte piece", what, sink.max_piece);
+    long out = inflate_sink();
+    CHECK_MSG(out == (long)len, "%s: %ld of %zu bytes back", what, out, len);
+    CHECK_MSG(out < 0 || memcmp(decoded, input, len) == 0, "%s: content differs", what);
+}
+
+// Rows as payload.txt holds them: a timestamp every few seconds and slowly moving readings
+static size_t payload_rows(size_t max) {
+    size_t len = 0;
+    long seconds = 36000;
+    double pressure = 101325, temp = 21.5, volts = 12.4;
+    while (len + 80 < max) {
+        seconds += 60;
+        pressure += (int)check_rand_below(41) - 20;
+        temp += ((int)check_rand_below(5) - 2) * 0.01;
+        volts += ((int)check_rand_below(3) - 1) * 0.01;
+        len += snprintf((char *)input + len, max - len, "'%02ld-02-2026 %02ld:%02ld:%02ld:000','%.0f','%.2f','%.2f','0.00'\n",
+                        1 + seconds / 86400 % 28, seconds / 3600 % 24, seconds / 60 % 60, seconds % 60, pressure, temp, volts);
+    }
+    return len;
+}
+
+static void test_round_trips(void) {
+    static gz_stream_t gz;
+
+    check_round_trip(&gz, 0, "empty");
+    input[0] = 'x';
+    check_round_trip(&gz, 1, "one byte");
+
+    for (int run = 0; run < 30; run++) {
+        size_t len = check_rand_below(INPUT_MAX);
+        for (size_t i = 0; i < len; i++) input[i] = (uint8_t)check_rand();
+        check_round_trip(&gz, len, "random");
+    }
+
+    for (int run = 0; run < 30; run++) {
+        size_t len = payload_rows(1 + check_rand_below(INPUT_MAX));
+        check_round_trip(&gz, len, "rows");
+    }
+
+    // Long runs: maximum length matches at distance 1, across every slide
+    memset(input, 'a', INPUT_MAX);
+    check_round_trip(&gz, INPUT_MAX, "run");
+
+    // Blocks repeated at the edge of the window, small alphabets, and mixtures
+    for (int run = 0; run < 60; run++) {
+        size_t len = check_rand_below(INPUT_MAX);
+        size_t period = GZ_WINDOW - 8 + check_rand_below(16);
+        unsigned alphabet = 1 + check_rand_below(run % 3 ? 4 : 256);
+        for (size_t i = 0; i < len; i++) {
+            input[i] = i >= period && check_rand_below(8) ? input[i - period] : (uint8_t)check_rand_below(alphabet);
+        }
+        check_round_trip(&gz, len, "periodic");
+    }
+}
+
+static void test_ratio(void) {
+    static gz_stream_t gz;
+    size_t len = payload_rows(256 * 1024);
+    CHECK(compress_input(&gz, len));
+    double ratio = (double)len / sink.len;
+    printf("Payload rows: %zu -> %zu bytes, %.1f:1\n", len, sink.len, ratio);
+    CHECK_MSG(ratio >= 4.0, "rows only shrink %.1f:1", ratio);
+}
+
+static void test_emit_failure(void) {
+    static gz_stream_t gz;
+    size_t len = payload_rows(INPUT_MAX);
+    for (int fail_at = 0; fail_at < 6; fail_at++) {
+        sink_reset();
+        sink.fail_at = fail_at;
+        gz_begin(&gz, emit, NULL);
+        bool ok = true;
+        for (size_t off = 0; off < len && ok; off += 1000) {
+            ok = gz_write(&gz, input + off, len - off < 1000 ? len - off : 1000);
+        }
+        CHECK(!ok);
+        CHECK(!gz_finish(&gz));
+        // Nothing more went out once a piece was refused
+        CHECK(sink.pieces == fail_at);
+    }
+}
+
+int main(void) {
+    test_round_trips();
+    test_ratio();
+    test_emit_failure();
+    free(sink.data);
+    return check_result();
+}
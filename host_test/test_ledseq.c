@@ -0,0 +1,138 @@
+// Status LED sequencer: the frames each pattern plays, played out the way the LED task
+// does it against a simulated clock. Finite patterns must end dark after exactly their
+// cycles, endless ones must never stall on a zero hold, and a pattern posted part way
+// through replaces the one playing from its first frame.
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "ledseq.c"
+
+#define LED_FULL 8191
+
+// What the LEDC channels do over time: the task's loop, with the queue wait turned into
+// clock time and a post arriving at a chosen moment
+typedef struct {
+    uint32_t now_ms;
+    uint32_t frames;
+    uint32_t lit_frames;
+    uint32_t fades;
+    uint16_t rgb[3];            // Duty the channels end on
+    bool settled;               // Stopped on a frame held for good, rather than cut short
+} player_t;
+
+// Plays pattern until it settles or stop_ms is reached
+static void play(const led_pattern_t *pattern, uint32_t stop_ms, player_t *pl) {
+    memset(pl, 0, sizeof(*pl));
+    led_frame_t frame;
+    for (uint32_t step = 0; led_seq_frame(pattern, step, &frame); step++) {
+        pl->frames++;
+        if (frame.rgb[0] || frame.rgb[1] || frame.rgb[2]) pl->lit_frames++;
+        if (frame.fade_ms) pl->fades++;
+        memcpy(pl->rgb, frame.rgb, sizeof(pl->rgb));
+        if (!frame.hold_ms) {
+            pl->settled = true;
+            return;
+        }
+        if (pl->now_ms + frame.hold_ms > stop_ms) {
+            pl->now_ms = stop_ms;
+            return;
+        }
+        pl->now_ms += frame.hold_ms;
+    }
+}
+
+static led_pattern_t pattern(led_mode_t mode, uint16_t on_ms, uint16_t off_ms, uint16_t count) {
+    led_pattern_t p = {.mode = mode, .rgb = {LED_FULL, 100, 0}, .on_ms = on_ms, .off_ms = off_ms, .count = count};
+    return p;
+}
+
+static void test_solid(void) {
+    led_pattern_t p = pattern(LED_SOLID, 500, 500, 3);
+    led_frame_t frame;
+    CHECK(led_seq_frame(&p, 0, &frame));
+    CHECK(frame.rgb[0] == LED_FULL && frame.rgb[1] == 100 && frame.rgb[2] == 0);
+    // Held until the next pattern, set at once
+    CHECK(frame.hold_ms == 0 && frame.fade_ms == 0);
+    CHECK(!led_seq_frame(&p, 1, &frame));
+    CHECK(!led_seq_frame(&p, UINT32_MAX, &frame));
+
+    // led_off() is a dark solid
+    led_pattern_t off = {.mode = LED_SOLID};
+    CHECK(led_seq_frame(&off, 0, &frame) && !frame.rgb[0] && !frame.rgb[1] && !frame.rgb[2]);
+}
+
+static void test_finite(void) {
+    for (int run = 0; run < 5000; run++) {
+        led_mode_t mode = run % 2 ? LED_BREATHE : LED_BLINK;
+        uint16_t on = check_rand_below(4) ? check_rand_below(2000) : 0;
+        uint16_t off = check_rand_below(4) ? check_rand_below(2000) : 0;
+        uint16_t count = 1 + check_rand_below(run % 50 ? 20 : UINT16_MAX);
+        led_pattern_t p = pattern(mode, on, off, count);
+
+        // Lit then dark, count times
+        led_frame_t frame;
+        for (uint32_t step = 0; step < 2u * count && step < 64; step++) {
+            CHECK(led_seq_frame(&p, step, &frame));
+            bool lit = frame.rgb[0] || frame.rgb[1] || frame.rgb[2];
+            CHECK_MSG(lit == (step % 2 == 0), "run %d step %u", run, step);
+            CHECK(frame.fade_ms == (mode == LED_BREATHE ? (lit ? on : off) : 0));
+        }
+        CHECK(led_seq_frame(&p, 2u * count - 1, &frame) && frame.hold_ms == 0);
+        CHECK(!led_seq_frame(&p, 2u * count, &frame));
+
+        player_t pl;
+        play(&p, UINT32_MAX, &pl);
+        CHECK(pl.settled && pl.frames == 2u * count && pl.lit_frames == count);
+        CHECK_MSG(!pl.rgb[0] && !pl.rgb[1] && !pl.rgb[2], "run %d: left lit", run);
+        // Nothing waits after the last dark frame; zero times still take a tick each
+        uint32_t on_hold = on ? on : 1, off_hold = off ? off : 1;
+        CHECK_MSG(pl.now_ms == count * on_hold + (count - 1) * off_hold, "run %d: played %u ms", run, pl.now_ms);
+    }
+}
+
+static void test_endless(void) {
+    uint16_t times[][2] = {{250, 250}, {0, 0}, {0, 1000}, {1000, 0}, {UINT16_MAX, UINT16_MAX}};
+    for (size_t t = 0; t < sizeof(times) / sizeof(times[0]); t++) {
+        for (int mode = LED_BLINK; mode <= LED_BREATHE; mode++) {
+            led_pattern_t p = pattern(mode, times[t][0], times[t][1], 0);
+            led_frame_t frame;
+            // Never ends, never holds for good: the task must keep waking to play it
+            for (uint32_t step = 0; step < 10000; step++) {
+                CHECK(led_seq_frame(&p, step, &frame) && frame.hold_ms > 0);
+            }
+            CHECK(led_seq_frame(&p, UINT32_MAX - 1, &frame) && frame.hold_ms > 0);
+
+            player_t pl;
+            play(&p, 60000, &pl);
+            CHECK(!pl.settled && pl.now_ms == 60000);
+            // Breathing fades over each half that has a length; a zero half is a step
+            uint32_t fades = (times[t][0] ? (pl.frames + 1) / 2 : 0) + (times[t][1] ? pl.frames / 2 : 0);
+            CHECK(pl.fades == (mode == LED_BREATHE ? fades : 0));
+        }
+    }
+}
+
+// A new pattern cuts the old one short and starts from its own first frame
+static void test_replace(void) {
+    led_pattern_t slow = pattern(LED_BREATHE, 2000, 2000, 0);
+    led_pattern_t done = pattern(LED_BLINK, 100, 100, 3);
+    done.rgb[0] = 0;
+    done.rgb[2] = LED_FULL;
+
+    player_t pl;
+    play(&slow, 4500, &pl);
+    CHECK(pl.frames == 3 && pl.now_ms == 4500);
+
+    play(&done, UINT32_MAX, &pl);
+    CHECK(pl.settled && pl.frames == 6 && pl.now_ms == 500);
+    CHECK(!pl.rgb[0] && !pl.rgb[1] && !pl.rgb[2]);
+    CHECK(pl.fades == 0);
+}
+
+int main(void) {
+    test_solid();
+    test_finite();
+    test_endless();
+    test_replace();
+    return check_result();
+}
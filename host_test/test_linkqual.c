@@ -0,0 +1,131 @@
+// Upload planning from link history: deferral on weak links, the 1, 2, 4 wake backoff after
+// repeated failures, and one history update per wake however many tries the transport made.
+#include <string.h>
+#include "check.h"
+#include "linkqual.c"
+
+static int8_t ap_rssi;
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info) {
+    memset(ap_info, 0, sizeof(*ap_info));
+    ap_info->rssi = ap_rssi;
+    return ESP_OK;
+}
+
+static void reset(void) {
+    memset(&history, 0, sizeof(history));
+    memset(&attempt, 0, sizeof(attempt));
+}
+
+// One wake: plan, and if the plan says so, try and report how it went
+static bool wake(bool ok) {
+    const link_plan_t *plan = link_plan_upload(2000, true);
+    if (!plan->upload_now) return false;
+    link_record_attempt(2000, 300, 500, ok);
+    link_finish_upload(ok);
+    return true;
+}
+
+static void test_backoff(void) {
+    reset();
+    ap_rssi = -70;
+    CHECK(wake(false));
+    CHECK(wake(false));     // One failure alone doesn't back off
+
+    // After the streak reaches 2, 3, 4 and more: 1, 2, 4, 4 wakes skipped before the next try
+    const int expect[] = {1, 2, 4, 4};
+    for (int i = 0; i < 4; i++) {
+        int skipped = 0;
+        while (!wake(false) && skipped < 20) skipped++;
+        CHECK_MSG(skipped == expect[i], "streak %d: skipped %d, expected %d", 2 + i, skipped, expect[i]);
+    }
+
+    // A clearly better link is tried at once
+    ap_rssi = -70 + LINK_RSSI_HYSTERESIS + 1;
+    CHECK(wake(true));
+    CHECK(history.fail_streak == 0);
+    ap_rssi = -70;
+    CHECK(wake(true));
+}
+
+static void test_floor(void) {
+    reset();
+    ap_rssi = LINK_RSSI_FLOOR - 1;
+    int skipped = 0;
+    while (!wake(true) && skipped < 20) skipped++;
+    CHECK(skipped == LINK_MAX_DEFERRALS);
+    CHECK(history.deferred == 0);
+
+    // Samples that won't survive the wake are sent whatever the link
+    const link_plan_t *plan = link_plan_upload(2000, false);
+    CHECK(plan->upload_now);
+    CHECK(history.deferred == 0);
+    CHECK(plan->attempts == 1 && plan->chunk_bytes == 512);
+}
+
+static void test_one_outcome_per_wake(void) {
+    reset();
+    ap_rssi = -60;
+
+    // Two failed tries, then one through: a single success, measured on the try that worked
+    link_plan_upload(4000, true);
+    link_record_attempt(4000, 9000, 0, false);
+    link_record_attempt(4000, 8000, 0, false);
+    link_record_attempt(4000, 400, 1000, true);
+    link_finish_upload(true);
+    CHECK(history.fail_streak == 0 && history.samples == 1);
+    CHECK(history.handshake_ms == 400 && history.throughput_bps == 4000);
+
+    // Every try fails: one failure, not three
+    link_plan_upload(4000, true);
+    for (int i = 0; i < 3; i++) link_record_attempt(4000, 500, 0, false);
+    link_finish_upload(false);
+    CHECK(history.fail_streak == 1 && history.last_fail_rssi == -60);
+    CHECK(history.samples == 1);
+
+    // A later wake's measurement is blended in, a quarter weight
+    link_plan_upload(4000, true);
+    link_record_attempt(4000, 800, 500, true);
+    link_finish_upload(true);
+    CHECK(history.samples == 2 && history.handshake_ms == 500 && history.throughput_bps == 5000);
+}
+
+static void test_plan_sizes(void) {
+    link_history_t h = {.samples = 1, .handshake_ms = 1000, .throughput_bps = 1000};
+    link_plan_t plan;
+    link_decide(&h, -60, 2000, &plan);
+    CHECK(plan.upload_now && plan.attempts == 3 && plan.chunk_bytes == 4096);
+    CHECK(plan.timeout_ms == 2 * 1000 + 3 * 2000 + 2000);
+    link_decide(&h, -70, 100000, &plan);
+    CHECK(plan.attempts == 2 && plan.chunk_bytes == 1024 && plan.timeout_ms == LINK_MAX_TIMEOUT_MS);
+    h.samples = 0;
+    link_decide(&h, -80, 0, &plan);
+    CHECK(plan.attempts == 1 && plan.timeout_ms == 2 * LINK_DEFAULT_HANDSHAKE_MS + 2000);
+}
+
+// The budget is the body link_decide gives the longest timeout, to within rounding
+static void test_budget(void) {
+    link_history_t h = {.samples = 1, .handshake_ms = 1000, .throughput_bps = 3000};
+    link_plan_t plan;
+    CHECK(link_budget(&h) == (LINK_MAX_TIMEOUT_MS - 2 * 1000 - 2000) / 3 * 3000 / 1000);
+    link_decide(&h, -60, link_budget(&h), &plan);
+    CHECK_MSG(plan.timeout_ms + 3 >= LINK_MAX_TIMEOUT_MS, "timeout %lu ms", (unsigned long)plan.timeout_ms);
+
+    // A link that is all handshake leaves nothing past the first batch
+    h.handshake_ms = LINK_MAX_TIMEOUT_MS / 2;
+    CHECK(link_budget(&h) == 0);
+
+    // Without a measurement, or with RTC memory lost, the defaults apply
+    reset();
+    h.samples = 0;
+    CHECK(link_upload_budget() == link_budget(&h) && link_budget(&h) > 0);
+}
+
+int main(void) {
+    test_backoff();
+    test_floor();
+    test_one_outcome_per_wake();
+    test_plan_sizes();
+    test_budget();
+    return check_result();
+}
@@ -0,0 +1,468 @@
+// Firmware updates end to end: ota.c fetching a zlib-compressed bsdiff patch in Range
+// requests from a stand-in server, staging it on a simulated flash partition, and patching
+// the running image into the other slot of a two-slot OTA layout with the bootloader's
+// rollback. Every wake ends in deep sleep, which the bootloader sees as a reset. Checks
+// that the download resumes across refused and dropped connections, failed NVS writes and
+// power cuts at any flash byte, that a bad patch is dropped rather than retried forever, and
+// that an image on trial is kept or rolled back as ota_confirm() promises.
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "check.h"
+#include "nvs_sim.h"
+#include "flash_sim.h"
+#include "ota_sim.h"
+#include "http_client_sim.h"
+#include "ota.c"
+#include "bspatch.c"
+
+#define SLOT_SIZE   (256 * 1024)
+#define STAGE_SIZE  (128 * 1024)
+#define OLD_LEN     150000
+#define INSERT_AT   60000
+#define INSERT_LEN  80000          // Random bytes, so the patch stays big after compression
+#define NEW_LEN     (OLD_LEN + INSERT_LEN)
+#define RAW_MAX     (NEW_LEN + 1024)
+#define FAULT_RUNS  60
+
+static const char URL[] = "https://updates.example.com/node/1.1.0.patch";
+
+static uint8_t old_image[OLD_LEN];
+static uint8_t new_image[NEW_LEN];
+static uint8_t raw_patch[RAW_MAX];
+static const esp_partition_t *slot0, *slot1;
+
+// The update server: one patch, served in ranges
+static struct {
+    uint8_t data[STAGE_SIZE];
+    size_t len;
+    char sha256[65];
+    int status;             // Replies with this instead of the range, 0 normally
+    int corrupt;            // Replies with a flipped byte still to send
+    int requests;
+    unsigned long last_from;
+    uint8_t reply[OTA_CHUNK_BYTES];
+} srv;
+
+const char DigiCertGlobalRootG2_crt_pem_start[] = "-----BEGIN CERTIFICATE-----\n";
+
+const link_plan_t *link_current_plan(void) {
+    static const link_plan_t plan = {.upload_now = true, .timeout_ms = 10000, .attempts = 1};
+    return &plan;
+}
+
+void power_lock_cpu(void) {}
+void power_unlock_cpu(void) {}
+
+static void server(http_client_sim_request_t *req, void *ctx) {
+    srv.requests++;
+    req->reply = "";
+    req->reply_len = 0;
+    if (srv.status) {
+        req->status = srv.status;
+        return;
+    }
+
+    char range[64];
+    unsigned long from, to;
+    if (!http_client_sim_header(req, "Range", range, sizeof(range)) ||
+        sscanf(range, "bytes=%lu-%lu", &from, &to) != 2 || from > to || to >= srv.len ||
+        to - from + 1 > sizeof(srv.reply)) {
+        req->status = 416;
+        return;
+    }
+
+    size_t n = to - from + 1;
+    memcpy(srv.reply, srv.data + from, n);
+    if (srv.corrupt > 0) {
+        srv.corrupt--;
+        srv.reply[n / 2] ^= 0x5A;
+    }
+    srv.last_from = from;
+    req->status = 206;
+    req->reply = (const char *)srv.reply;
+    req->reply_len = n;
+}
+
+static void put_off(uint8_t *buf, int64_t x) {
+    uint64_t y = x < 0 ? (uint64_t)-x : (uint64_t)x;
+    for (int i = 0; i < 8; i++) {
+        buf[i] = y & 0xFF;
+        y >>= 8;
+    }
+    if (x < 0) buf[7] |= 0x80;
+}
+
+// Serves a compressed copy of the raw patch
+static void serve_patch(const uint8_t *raw, size_t raw_len) {
+    uLongf len = sizeof(srv.data);
+    int ret = compress2(srv.data, &len, raw, raw_len, 9);
+    CHECK(ret == Z_OK);
+    srv.len = len;
+
+    unsigned char digest[32];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, srv.data, srv.len);
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    for (int i = 0; i < 32; i++) {
+        sprintf(srv.sha256 + i * 2, "%02x", digest[i]);
+    }
+}
+
+// Version 1.0.0, and a 1.1.0 built from it with a block inserted and bytes changed here and
+// there. The patch is what bsdiff would make of that: copy with differences, the inserted
+// block as extra bytes, copy with differences.
+static size_t make_images(uint8_t *raw) {
+    for (size_t i = sizeof(ota_sim_header_t); i < OLD_LEN; i++) {
+        old_image[i] = (uint8_t)(check_rand_below(4) ? i >> 3 : check_rand());
+    }
+    ota_sim_make_image(old_image, OLD_LEN, "1.0.0");
+
+    memcpy(new_image, old_image, INSERT_AT);
+    for (size_t i = 0; i < INSERT_LEN; i++) new_image[INSERT_AT + i] = (uint8_t)check_rand();
+    memcpy(new_image + INSERT_AT + INSERT_LEN, old_image + INSERT_AT, OLD_LEN - INSERT_AT);
+    for (int i = 0; i < 400; i++) {
+        size_t at = sizeof(ota_sim_header_t) + check_rand_below(NEW_LEN - sizeof(ota_sim_header_t));
+        new_image[at] ^= check_rand() | 1;
+    }
+    ota_sim_make_image(new_image, NEW_LEN, "1.1.0");
+
+    size_t len = 0;
+    memcpy(raw, BSPATCH_MAGIC, BSPATCH_MAGIC_LEN);
+    put_off(raw + BSPATCH_MAGIC_LEN, NEW_LEN);
+    len += 24;
+
+    size_t runs[2][3] = {{0, INSERT_AT, INSERT_LEN}, {INSERT_AT, NEW_LEN - INSERT_AT - INSERT_LEN, 0}};
+    size_t out = 0;
+    for (int r = 0; r < 2; r++) {
+        size_t old_at = runs[r][0], diff = runs[r][1], extra = runs[r][2];
+        put_off(raw + len, diff);
+        put_off(raw + len + 8, extra);
+        put_off(raw + len + 16, 0);
+        len += 24;
+        for (size_t i = 0; i < diff; i++) raw[len++] = new_image[out++] - old_image[old_at + i];
+        memcpy(raw + len, new_image + out, extra);
+        len += extra;
+        out += extra;
+    }
+    return len;
+}
+
+static ota_offer_t make_offer(void) {
+    ota_offer_t offer = {.size = srv.len};
+    strlcpy(offer.version, "1.1.0", sizeof(offer.version));
+    strlcpy(offer.url, URL, sizeof(offer.url));
+    strlcpy(offer.sha256, srv.sha256, sizeof(offer.sha256));
+    strlcpy(offer.base, "1.0.0", sizeof(offer.base));
+    return offer;
+}
+
+static int chunks(void) {
+    return (srv.len + OTA_CHUNK_BYTES - 1) / OTA_CHUNK_BYTES;
+}
+
+// A node fresh off the serial flasher, running 1.0.0 from slot 0
+static void fresh_node(size_t raw_len) {
+    nvs_sim_reset();
+    flash_sim_init(OTA_PATCH_PARTITION_LABEL, STAGE_SIZE);
+    slot0 = flash_sim_add(ESP_PARTITION_TYPE_APP, "ota_0", SLOT_SIZE);
+    slot1 = flash_sim_add(ESP_PARTITION_TYPE_APP, "ota_1", SLOT_SIZE);
+    memcpy(flash_sim_part_data(slot0), old_image, OLD_LEN);
+    ota_sim_init(slot0, slot1);
+
+    serve_patch(raw_patch, raw_len);
+    srv.status = 0;
+    srv.corrupt = 0;
+    srv.requests = 0;
+    http_client_sim_reset(server, NULL);
+}
+
+// Deep sleep or a reset: RAM is gone, the bootloader picks the slot
+static void power_cycle(void) {
+    nvs_sim_power_cut();
+    http_client_sim_reset(server, NULL);
+    ota_sim_reboot();
+}
+
+static bool running_new_image(void) {
+    return ota_sim_running() == 1 && strcmp(esp_app_get_description()->version, "1.1.0") == 0 &&
+           memcmp(flash_sim_part_data(slot1), new_image, NEW_LEN) == 0;
+}
+
+// Steps until the update is written; returns the number of wakes, or -1
+static int run_update(void) {
+    for (int wake = 1; wake <= 50; wake++) {
+        esp_err_t err = ota_step();
+        if (err == ESP_OK) return wake;
+        if (err != ESP_ERR_NOT_FINISHED) return -1;
+    }
+    return -1;
+}
+
+// Fresh node updated to 1.1.0 and rebooted into it, on trial
+static void updated_node(size_t raw_len) {
+    fresh_node(raw_len);
+    ota_offer_t offer = make_offer();
+    CHECK(ota_offer(&offer) == ESP_OK);
+    CHECK(run_update() == chunks());
+    power_cycle();
+    CHECK(running_new_image());
+    CHECK(ota_sim_state(1) == ESP_OTA_IMG_PENDING_VERIFY);
+}
+
+static void test_offer_checks(size_t raw_len) {
+    fresh_node(raw_len);
+    ota_offer_t offer = make_offer();
+
+    ota_offer_t bad = offer;
+    strlcpy(bad.url, "http://updates.example.com/node/1.1.0.patch", sizeof(bad.url));
+    CHECK(ota_offer(&bad) == ESP_ERR_INVALID_ARG);
+    bad = offer;
+    strlcpy(bad.base, "0.9.0", sizeof(bad.base));
+    CHECK(ota_offer(&bad) == ESP_ERR_INVALID_VERSION);
+    bad = offer;
+    bad.size = STAGE_SIZE + 1;
+    CHECK(ota_offer(&bad) == ESP_ERR_INVALID_SIZE);
+    bad.size = 0;
+    CHECK(ota_offer(&bad) == ESP_ERR_INVALID_SIZE);
+    bad = offer;
+    bad.sha256[10] = '\0';
+    CHECK(ota_offer(&bad) == ESP_ERR_INVALID_ARG);
+    // The running version is no update
+    bad = offer;
+    strlcpy(bad.version, "1.0.0", sizeof(bad.version));
+    CHECK(ota_offer(&bad) == ESP_OK);
+    CHECK(ota_step() == ESP_ERR_NOT_FOUND);
+    CHECK(srv.requests == 0);
+
+    CHECK(ota_offer(&offer) == ESP_OK);
+    CHECK(ota_step() == ESP_ERR_NOT_FINISHED);
+    CHECK(srv.last_from == 0);
+
+    // Repeated in the next reply, from another mirror: the staged chunk is kept
+    power_cycle();
+    strlcpy(offer.url, "https://mirror.example.com/node/1.1.0.patch", sizeof(offer.url));
+    CHECK(ota_offer(&offer) == ESP_OK);
+    CHECK(ota_step() == ESP_ERR_NOT_FINISHED);
+    CHECK(srv.last_from == OTA_CHUNK_BYTES);
+
+    // A different patch for the same version starts over
+    power_cycle();
+    offer.sha256[0] = offer.sha256[0] == 'a' ? 'b' : 'a';
+    CHECK(ota_offer(&offer) == ESP_OK);
+    CHECK(ota_step() == ESP_ERR_NOT_FINISHED);
+    CHECK(srv.last_from == 0);
+}
+
+static void test_update(size_t raw_len) {
+    fresh_node(raw_len);
+    CHECK(chunks() > 2);
+    ota_offer_t offer = make_offer();
+    CHECK(ota_offer(&offer) == ESP_OK);
+    CHECK(run_update() == chunks());
+    CHECK(srv.requests == chunks());
+    // Nothing left to do, and the old image runs until the restart
+    CHECK(ota_step() == ESP_ERR_NOT_FOUND);
+    CHECK(ota_sim_running() == 0);
+
+    power_cycle();
+    CHECK(running_new_image());
+    CHECK(ota_on_trial());
+    ota_confirm(ESP_OK, true);
+    CHECK(ota_sim_state(1) == ESP_OTA_IMG_VALID);
+    CHECK(!ota_on_trial());
+    power_cycle();
+    CHECK(running_new_image());
+}
+
+// Every wake something may go wrong: the connection is refused or drops, the server errors,
+// an NVS write fails or power is cut at some flash byte, be it in a chunk or in the apply.
+// The update must still land, and only whole.
+static void test_faults(size_t raw_len) {
+    for (int run = 0; run < FAULT_RUNS; run++) {
+        fresh_node(raw_len);
+        ota_offer_t offer = make_offer();
+        volatile bool done = false;
+        volatile int wakes = 0, cuts = 0;
+
+        while (!done && wakes < 500) {
+            wakes++;
+            switch (check_rand_below(8)) {
+                case 0: http_client_sim_refuse(1); break;
+                case 1: http_client_sim_drop_after(check_rand_below(OTA_CHUNK_BYTES)); break;
+                case 2: srv.status = check_rand_below(2) ? 500 : 200; break;
+                case 3: nvs_sim_fail_write(check_rand_below(3)); break;
+                case 4:
+                case 5: flash_sim_arm_cut(check_rand_below(SLOT_SIZE + NEW_LEN)); break;
+                default: break;
+            }
+
+            if (setjmp(flash_sim_cut) == 0) {
+                // Each upload reply repeats the offer
+                ota_offer(&offer);
+                done = ota_step() == ESP_OK;
+            } else {
+                cuts++;
+            }
+            flash_sim_arm_cut(-1);
+            nvs_sim_fail_write(-1);
+            srv.status = 0;
+            power_cycle();
+        }
+
+        CHECK_MSG(done, "run %d: not updated after %d wakes", run, wakes);
+        CHECK_MSG(running_new_image(), "run %d: wrong image after %d cuts", run, cuts);
+        ota_confirm(ESP_OK, true);
+        CHECK(ota_sim_state(1) == ESP_OTA_IMG_VALID);
+    }
+}
+
+static void test_digest_mismatch(size_t raw_len) {
+    fresh_node(raw_len);
+    ota_offer_t offer = make_offer();
+    CHECK(ota_offer(&offer) == ESP_OK);
+    srv.corrupt = 1;
+
+    int wake;
+    for (wake = 1; wake < chunks(); wake++) CHECK(ota_step() == ESP_ERR_NOT_FINISHED);
+    CHECK(ota_step() == ESP_ERR_INVALID_CRC);
+    // Fetched again from the start
+    CHECK(run_update() == chunks());
+    CHECK(srv.requests == 2 * chunks());
+    power_cycle();
+    CHECK(running_new_image());
+}
+
+// A patch that can never apply is dropped, and the old image keeps running
+static void check_dropped(size_t raw_len) {
+    ota_offer_t offer = make_offer();
+    CHECK(ota_offer(&offer) == ESP_OK);
+    esp_err_t err;
+    do {
+        err = ota_step();
+    } while (err == ESP_ERR_NOT_FINISHED);
+    CHECK(err != ESP_OK);
+    CHECK(ota_step() == ESP_ERR_NOT_FOUND);
+    power_cycle();
+    CHECK(ota_sim_running() == 0 && strcmp(esp_app_get_description()->version, "1.0.0") == 0);
+}
+
+static void test_bad_patch(size_t raw_len) {
+    // Not a bsdiff patch
+    fresh_node(raw_len);
+    raw_patch[0] ^= 1;
+    serve_patch(raw_patch, raw_len);
+    raw_patch[0] ^= 1;
+    check_dropped(raw_len);
+
+    // Compressed stream cut short
+    fresh_node(raw_len);
+    srv.len -= 100;
+    mbedtls_sha256_context sha;
+    unsigned char digest[32];
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, srv.data, srv.len);
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    for (int i = 0; i < 32; i++) sprintf(srv.sha256 + i * 2, "%02x", digest[i]);
+    check_dropped(raw_len);
+
+    // Applies, but the image doesn't validate
+    fresh_node(raw_len);
+    raw_patch[24 + 24 + 1000] ^= 0x10;
+    serve_patch(raw_patch, raw_len);
+    raw_patch[24 + 24 + 1000] ^= 0x10;
+    check_dropped(raw_len);
+}
+
+static void test_trial(size_t raw_len) {
+    // A reset before the first confirm is the bootloader's to roll back
+    updated_node(raw_len);
+    power_cycle();
+    CHECK(ota_sim_running() == 0 && ota_sim_state(1) == ESP_OTA_IMG_ABORTED);
+    CHECK(!ota_on_trial());
+    ota_offer_t offer = make_offer();
+    CHECK(ota_offer(&offer) == ESP_ERR_INVALID_VERSION);
+
+    // No Wi-Fi, or uploads deferred: kept through deep sleep, for OTA_TRIAL_WAKES wakes
+    updated_node(raw_len);
+    for (int wake = 1; wake < OTA_TRIAL_WAKES; wake++) {
+        CHECK(ota_on_trial());
+        ota_confirm(wake % 2 ? ESP_ERR_WIFI_NOT_CONNECT : ESP_ERR_NOT_FINISHED, true);
+        CHECK_MSG(ota_sim_state(1) == ESP_OTA_IMG_VALID, "wake %d: would sleep pending", wake);
+        CHECK(!ota_sim_restart_requested());
+        power_cycle();
+        CHECK_MSG(running_new_image(), "wake %d: rolled back early", wake);
+    }
+    CHECK(ota_on_trial());
+    ota_confirm(ESP_ERR_WIFI_NOT_CONNECT, true);
+    CHECK(ota_sim_restart_requested());
+    power_cycle();
+    CHECK(ota_sim_running() == 0 && ota_sim_state(1) == ESP_OTA_IMG_INVALID);
+    CHECK(!ota_on_trial());
+    CHECK(ota_offer(&offer) == ESP_ERR_INVALID_VERSION);
+
+    // Some wakes without the server, then an accepted upload: kept for good
+    updated_node(raw_len);
+    for (int wake = 0; wake < 5; wake++) {
+        ota_confirm(ESP_ERR_NOT_FOUND, true);
+        power_cycle();
+    }
+    ota_confirm(ESP_OK, true);
+    CHECK(!ota_on_trial());
+    ota_confirm(ESP_FAIL, false);
+    CHECK(!ota_sim_restart_requested());
+    for (int wake = 0; wake < OTA_TRIAL_WAKES; wake++) {
+        power_cycle();
+        ota_confirm(ESP_ERR_WIFI_NOT_CONNECT, true);
+    }
+    CHECK(running_new_image() && !ota_sim_restart_requested());
+
+    // An upload that went out and was refused rolls back, on the first wake or a later one
+    for (int later = 0; later < 2; later++) {
+        updated_node(raw_len);
+        if (later) {
+            ota_confirm(ESP_ERR_WIFI_NOT_CONNECT, true);
+            power_cycle();
+        }
+        ota_confirm(ESP_FAIL, true);
+        CHECK(ota_sim_restart_requested());
+        power_cycle();
+        CHECK(ota_sim_running() == 0);
+    }
+
+    // Samples the image can't take roll it back even with nothing uploaded
+    updated_node(raw_len);
+    ota_confirm(ESP_ERR_WIFI_NOT_CONNECT, false);
+    CHECK(ota_sim_restart_requested());
+    power_cycle();
+    CHECK(ota_sim_running() == 0);
+
+    // The trial count can't be stored: not kept blind
+    updated_node(raw_len);
+    nvs_sim_fail_write(0);
+    ota_confirm(ESP_ERR_WIFI_NOT_CONNECT, true);
+    nvs_sim_fail_write(-1);
+    CHECK(ota_sim_restart_requested());
+
+    // A node that never updated has nothing to confirm
+    fresh_node(raw_len);
+    CHECK(!ota_on_trial());
+    ota_confirm(ESP_FAIL, false);
+    CHECK(!ota_sim_restart_requested());
+}
+
+int main(void) {
+    size_t raw_len = make_images(raw_patch);
+    test_offer_checks(raw_len);
+    test_update(raw_len);
+    test_faults(raw_len);
+    test_digest_mismatch(raw_len);
+    test_bad_patch(raw_len);
+    test_trial(raw_len);
+    return check_result();
+}
@@ -0,0 +1,348 @@
+// Config portal: folding scan records into the network list, and page rendering with 20
+// networks whose SSIDs need escaping, checked for correct output and for memory. The page
+// must stream without touching the heap and with nothing large on the stack, since it runs
+// on the httpd task.
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "httpd_sim.h"
+#include "portal.c"
+#include "html.c"
+
+#define PAGE_MAX 32768
+#define STACK_SIZE (64 * 1024)
+#define STACK_BUDGET 4096       // Half the 8 KB httpd task stack
+
+// Heap use while tracking is on; the test links with --wrap for these
+static bool heap_tracking;
+static size_t heap_calls;
+static size_t heap_bytes;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t n);
+
+void *__wrap_malloc(size_t n) {
+    if (heap_tracking) heap_calls++, heap_bytes += n;
+    return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    if (heap_tracking) heap_calls++, heap_bytes += n * size;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t n) {
+    if (heap_tracking) heap_calls++, heap_bytes += n;
+    return __real_realloc(p, n);
+}
+
+static ap_entry_t aps[PORTAL_MAX_APS];
+static char page[PAGE_MAX];
+static size_t generated_max;    // Largest chunk that wasn't one of the static segments
+
+static void note_chunk(const char *data, size_t len, void *ctx) {
+    if (data == HTML_PAGE_HEAD || data == HTML_PAGE_MIDDLE || data == HTML_PAGE_TAIL) return;
+    if (len > generated_max) generated_max = len;
+}
+
+// 32-byte SSIDs made mostly of characters that expand when escaped, unique by their tail
+static void make_aps(void) {
+    static const char nasty[] = "&<>\"'";
+    for (int i = 0; i < PORTAL_MAX_APS; i++) {
+        for (int j = 0; j < 30; j++) aps[i].ssid[j] = nasty[(i + j) % 5];
+        snprintf(aps[i].ssid + 30, 3, "%02d", i);
+        aps[i].rssi = -30 - i * 3;
+        aps[i].authmode = i % 5;
+    }
+}
+
+// Reverses the HTML escaping so the page can be compared with the input
+static size_t unescape(const char *in, size_t len, char *out) {
+    static const struct { const char *ent; char ch; } ents[] = {
+        {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&#39;", '\''},
+    };
+    size_t n = 0;
+    for (size_t i = 0; i < len;) {
+        size_t k = 0;
+        while (k < 5 && strncmp(in + i, ents[k].ent, strlen(ents[k].ent)) != 0) k++;
+        if (k < 5) {
+            out[n++] = ents[k].ch;
+            i += strlen(ents[k].ent);
+        } else {
+            out[n++] = in[i++];
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// Text up to the next occurrence of `end`, which must not contain raw markup characters
+static const char *take_until(const char *p, const char *end, char *out) {
+    const char *e = strstr(p, end);
+    if (!e) return NULL;
+    for (const char *c = p; c < e; c++)
+        if (*c == '<' || *c == '>' || *c == '"' || *c == '\'') return NULL;
+    unescape(p, e - p, out);
+    return e + strlen(end);
+}
+
+struct render {
+    httpd_req_t req;
+    httpd_sim_exchange_t ex;
+    uint16_t count;
+    bool scanning;
+    const char *status;
+    esp_err_t result;
+};
+
+static void *render_thread(void *arg) {
+    struct render *r = arg;
+    r->result = portal_send_page(&r->req, aps, r->count, r->scanning, "red", r->status);
+    return NULL;
+}
+
+// Renders on a thread with a painted stack and reports how deep it went
+static size_t render(struct render *r) {
+    static unsigned char stack[STACK_SIZE] __attribute__((aligned(64)));
+    memset(stack, 0xA5, sizeof(stack));
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, sizeof(stack));
+    heap_tracking = true;
+    pthread_create(&thread, &attr, render_thread, r);
+    pthread_join(thread, NULL);
+    heap_tracking = false;
+    pthread_attr_destroy(&attr);
+
+    size_t untouched = 0;
+    while (untouched < sizeof(stack) && stack[untouched] == 0xA5) untouched++;
+    return sizeof(stack) - untouched;
+}
+
+// The same thread start with nothing rendered, to take out what pthread itself uses
+static void *idle_thread(void *arg) {
+    return arg;
+}
+
+static size_t baseline_stack(void) {
+    static unsigned char stack[STACK_SIZE] __attribute__((aligned(64)));
+    memset(stack, 0xA5, sizeof(stack));
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, sizeof(stack));
+    pthread_create(&thread, &attr, idle_thread, NULL);
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    size_t untouched = 0;
+    while (untouched < sizeof(stack) && stack[untouched] == 0xA5) untouched++;
+    return sizeof(stack) - untouched;
+}
+
+static void test_twenty_networks(void) {
+    make_aps();
+    struct render r = {.count = PORTAL_MAX_APS, .status = "<b>Failed</b> & \"retried\""};
+    httpd_sim_begin(&r.req, &r.ex, HTTP_GET, "/", page, sizeof(page));
+    r.ex.on_chunk = note_chunk;
+    generated_max = 0;
+    heap_calls = heap_bytes = 0;
+
+    size_t stack_used = render(&r);
+    size_t base = baseline_stack();
+    size_t render_stack = stack_used > base ? stack_used - base : 0;
+    printf("20 networks: %llu bytes in %zu chunks, largest generated chunk %zu, stack %zu bytes, "
+           "heap %zu calls / %zu bytes\n", r.ex.out_len, r.ex.chunks, generated_max, render_stack, heap_calls,
+           heap_bytes);
+
+    CHECK(r.result == ESP_OK);
+    CHECK(r.ex.ended);
+    CHECK(r.ex.sends_after_end == 0);
+    CHECK(strcmp(r.ex.type, "text/html") == 0);
+    CHECK(r.ex.out_len < sizeof(page));
+    CHECK_MSG(heap_calls == 0, "page render allocated %zu times (%zu bytes)", heap_calls, heap_bytes);
+    CHECK_MSG(generated_max <= 64, "generated chunk of %zu bytes", generated_max);
+    CHECK_MSG(render_stack <= STACK_BUDGET, "render used %zu bytes of stack", render_stack);
+
+    // Static segments whole and in order, each network once, escaped both times it appears
+    CHECK(strncmp(page, HTML_PAGE_HEAD, strlen(HTML_PAGE_HEAD)) == 0);
+    const char *p = page + strlen(HTML_PAGE_HEAD);
+    for (int i = 0; i < PORTAL_MAX_APS && p; i++) {
+        char value[64], label[64], tail[32];
+        CHECK_MSG(strncmp(p, "<option value=\"", 15) == 0, "option %d missing", i);
+        p = take_until(p + 15, "\">", value);
+        if (p) p = take_until(p, " (", label);
+        CHECK_MSG(p != NULL, "option %d has raw markup", i);
+        if (!p) break;
+        CHECK_MSG(strcmp(value, aps[i].ssid) == 0, "option %d value '%s'", i, value);
+        CHECK_MSG(strcmp(label, aps[i].ssid) == 0, "option %d label '%s'", i, label);
+        snprintf(tail, sizeof(tail), "%ddBm)</option>", aps[i].rssi);
+        CHECK_MSG(strncmp(p, tail, strlen(tail)) == 0, "option %d rssi", i);
+        p += strlen(tail);
+    }
+    if (p) {
+        CHECK(strncmp(p, HTML_PAGE_MIDDLE, strlen(HTML_PAGE_MIDDLE)) == 0);
+        p += strlen(HTML_PAGE_MIDDLE);
+        CHECK(strncmp(p, "red;\">&lt;b&gt;Failed&lt;/b&gt; &amp; &quot;retried&quot;", 56) == 0);
+        size_t tail_len = strlen(HTML_PAGE_TAIL);
+        CHECK(r.ex.out_len >= tail_len && strcmp(page + r.ex.out_len - tail_len, HTML_PAGE_TAIL) == 0);
+    }
+}
+
+static void test_no_networks(void) {
+    struct render r = {.count = 0, .scanning = true, .status = ""};
+    httpd_sim_begin(&r.req, &r.ex, HTTP_GET, "/", page, sizeof(page));
+    render(&r);
+    CHECK(r.result == ESP_OK && r.ex.ended);
+    CHECK(strstr(page, "<option disabled>Scanning...</option>") != NULL);
+
+    r.scanning = false;
+    httpd_sim_begin(&r.req, &r.ex, HTTP_GET, "/", page, sizeof(page));
+    render(&r);
+    CHECK(strstr(page, "No networks found") != NULL);
+}
+
+// A client that leaves part way stops the render at once
+static void test_client_gone(void) {
+    make_aps();
+    struct render r = {.count = PORTAL_MAX_APS, .status = "ok"};
+    httpd_sim_begin(&r.req, &r.ex, HTTP_GET, "/", page, sizeof(page));
+    r.ex.fail_after = strlen(HTML_PAGE_HEAD) + 300;
+    render(&r);
+    CHECK(r.result == ESP_FAIL);
+    CHECK(!r.ex.ended);
+    CHECK(r.ex.out_len <= (unsigned long long)r.ex.fail_after);
+}
+
+// /scan.json for the same networks: valid escaping, no heap
+static void test_scan_json(void) {
+    make_aps();
+    aps[3].ssid[0] = '\\';
+    aps[4].ssid[0] = '\n';
+    httpd_req_t req;
+    httpd_sim_exchange_t ex;
+    httpd_sim_begin(&req, &ex, HTTP_GET, "/scan.json", page, sizeof(page));
+    heap_calls = 0;
+    heap_tracking = true;
+    esp_err_t err = portal_send_scan_json(&req, aps, PORTAL_MAX_APS, false, 1234);
+    heap_tracking = false;
+    CHECK(err == ESP_OK && ex.ended);
+    CHECK(heap_calls == 0);
+    CHECK(ex.max_chunk <= 64);
+    const char *head = "{\"scanning\":false,\"age_ms\":1234,\"networks\":[{\"ssid\":\"";
+    CHECK(strncmp(page, head, strlen(head)) == 0);
+    CHECK(strstr(page, "{\"ssid\":\"\\\\") != NULL);
+    CHECK(strstr(page, "{\"ssid\":\"\\u000a") != NULL);
+    CHECK(strstr(page, "\\\"") != NULL);
+
+    // Unescaped quotes only delimit strings: count them per entry
+    int quotes = 0;
+    for (const char *c = page; *c; c++)
+        if (*c == '"' && c[-1] != '\\') quotes++;
+    CHECK_MSG(quotes == 6 + PORTAL_MAX_APS * 8, "%d unescaped quotes", quotes);
+    CHECK(ex.out_len > 2 && strcmp(page + ex.out_len - 2, "]}") == 0);
+}
+
+static void record(wifi_ap_record_t *r, const char *ssid, int8_t rssi, uint8_t auth) {
+    memset(r, 0, sizeof(*r));
+    strncpy((char *)r->ssid, ssid, 32);
+    r->rssi = rssi;
+    r->authmode = auth;
+}
+
+static void test_merge_basic(void) {
+    wifi_ap_record_t recs[6];
+    ap_entry_t out[PORTAL_MAX_APS];
+    record(&recs[0], "home", -70, 3);
+    record(&recs[1], "", -20, 0);          // Hidden
+    record(&recs[2], "cafe", -60, 0);
+    record(&recs[3], "home", -50, 4);      // Same SSID, stronger BSSID
+    record(&recs[4], "home", -80, 1);
+    record(&recs[5], "office", -55, 3);
+
+    uint16_t n = ap_merge_records(recs, 6, out, PORTAL_MAX_APS);
+    CHECK(n == 3);
+    CHECK(strcmp(out[0].ssid, "home") == 0 && out[0].rssi == -50 && out[0].authmode == 4);
+    CHECK(strcmp(out[1].ssid, "office") == 0 && out[1].rssi == -55);
+    CHECK(strcmp(out[2].ssid, "cafe") == 0 && out[2].rssi == -60);
+
+    CHECK(ap_merge_records(recs, 0, out, PORTAL_MAX_APS) == 0);
+    CHECK(ap_merge_records(recs, 6, out, 0) == 0);
+
+    // A full 32-byte SSID keeps all 32 bytes
+    record(&recs[0], "0123456789abcdef0123456789ABCDEF", -40, 3);
+    CHECK(ap_merge_records(recs, 1, out, PORTAL_MAX_APS) == 1);
+    CHECK(strcmp(out[0].ssid, "0123456789abcdef0123456789ABCDEF") == 0);
+}
+
+// Random scans against a straightforward model: the strongest record per SSID, then the
+// strongest `max` of those. Signal levels are distinct so the expected order is unique.
+static void test_merge_random(void) {
+    enum { RUNS = 3000, RECORDS = 32, NAMES = 30 };
+    wifi_ap_record_t recs[RECORDS];
+    ap_entry_t out[PORTAL_MAX_APS];
+
+    for (int run = 0; run < RUNS; run++) {
+        uint16_t count = check_rand_below(RECORDS + 1);
+        uint16_t max = run % 4 ? PORTAL_MAX_APS : 1 + check_rand_below(PORTAL_MAX_APS);
+        int8_t levels[RECORDS];
+        for (int i = 0; i < RECORDS; i++) levels[i] = -20 - i * 2;
+        for (int i = RECORDS - 1; i > 0; i--) {
+            int j = check_rand_below(i + 1);
+            int8_t t = levels[i];
+            levels[i] = levels[j];
+            levels[j] = t;
+        }
+
+        int8_t best[NAMES];
+        uint8_t best_auth[NAMES];
+        bool seen[NAMES] = {false};
+        for (int i = 0; i < count; i++) {
+            char ssid[33] = "";
+            int name = check_rand_below(NAMES + 1);     // NAMES stands for a hidden network
+            if (name < NAMES) snprintf(ssid, sizeof(ssid), "net-%02d", name);
+            record(&recs[i], ssid, levels[i], check_rand_below(6));
+            if (name < NAMES && (!seen[name] || levels[i] > best[name])) {
+                seen[name] = true;
+                best[name] = levels[i];
+                best_auth[name] = recs[i].authmode;
+            }
+        }
+
+        // Expected list: seen names by descending level, cut at max
+        int order[NAMES], expected = 0;
+        for (int k = 0; k < NAMES; k++)
+            if (seen[k]) order[expected++] = k;
+        for (int a = 1; a < expected; a++)
+            for (int b = a; b > 0 && best[order[b - 1]] < best[order[b]]; b--) {
+                int t = order[b];
+                order[b] = order[b - 1];
+                order[b - 1] = t;
+            }
+        if (expected > max) expected = max;
+
+        uint16_t n = ap_merge_records(recs, count, out, max);
+        CHECK_MSG(n == expected, "run %d: %u networks, expected %d", run, n, expected);
+        for (int k = 0; k < n && k < expected; k++) {
+            char ssid[33];
+            snprintf(ssid, sizeof(ssid), "net-%02d", order[k]);
+            CHECK_MSG(strcmp(out[k].ssid, ssid) == 0 && out[k].rssi == best[order[k]] &&
+                      out[k].authmode == best_auth[order[k]],
+                      "run %d entry %d: %s %d, expected %s %d", run, k, out[k].ssid, out[k].rssi, ssid,
+                      best[order[k]]);
+        }
+    }
+}
+
+int main(void) {
+    test_merge_basic();
+    test_merge_random();
+    test_twenty_networks();
+    test_no_networks();
+    test_client_gone();
+    test_scan_json();
+    return check_result();
+}
@@ -0,0 +1,293 @@
+// Server reply parsing, in both the key:'value' line format and JSON. Known replies are
+// checked field by field; random replies are rendered in both formats from a typed model and
+// must parse back to it; mutated replies must never overrun a field or pass a bad value.
+// Built with AddressSanitizer and UBSan.
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "provision.c"
+
+#define RUNS 20000
+
+// Node-side storage the parser's callers write to; provision_apply is covered by
+// test_remote_config
+static uplink_config_t uplink_cfg;
+
+const uplink_config_t *uplink_config(void) {
+    return &uplink_cfg;
+}
+
+esp_err_t save_registration_metadata(const char *key, const char *sensorID, const char *geoutm) {
+    return ESP_OK;
+}
+
+const nodecfg_t *nodecfg(void) {
+    static nodecfg_t cfg;
+    return &cfg;
+}
+
+esp_err_t nodecfg_save(const nodecfg_t *cfg) {
+    return ESP_OK;
+}
+
+esp_err_t nodecfg_reload(void) {
+    return ESP_OK;
+}
+
+esp_err_t ota_offer(const ota_offer_t *offer) {
+    return ESP_OK;
+}
+
+void sdlog_backfill_request(uint32_t from, uint32_t to) {}
+
+static provision_t prov;
+
+static esp_err_t parse(const char *body) {
+    return provision_parse(body, strlen(body), &prov);
+}
+
+static void test_lines(void) {
+    // The registration endpoint's reply, with CRLF line ends and surrounding noise
+    CHECK(parse("status:'ok'\r\nkey:'abc123'\r\nsensorID:'42'\r\ngeoutm:'17T 630084 4833438'\r\n") == ESP_OK);
+    CHECK(prov.present == PROV_HAS_REGISTRATION);
+    CHECK(strcmp(prov.key, "abc123") == 0 && strcmp(prov.sensor_id, "42") == 0);
+    CHECK(strcmp(prov.geoutm, "17T 630084 4833438") == 0);
+
+    CHECK(parse("interval_high:'2'\ninterval_mid:'15'\ninterval_low:'1440'\nvolt_high:'12.3'\nvolt_low:'11.85'\n"
+                "upload_every:'4'\nagg_window:'0'\ntransport:'2'\ncoap_uri:'coap://x:5683'\ncfg_version:'7'\n") ==
+          ESP_OK);
+    CHECK(prov.policy.interval_high_min == 2 && prov.policy.interval_mid_min == 15);
+    CHECK(prov.policy.interval_low_min == 1440);
+    CHECK(prov.policy.volt_high_mv == 12300 && prov.policy.volt_low_mv == 11850);
+    CHECK(prov.policy.upload_every == 4 && prov.policy.agg_window_min == 0);
+    CHECK(prov.uplink.transport == UPLINK_TRANSPORT_COAP && strcmp(prov.uplink.coap_uri, "coap://x:5683") == 0);
+    CHECK(prov.cfg_version == 7);
+    CHECK(prov.present == (PROV_HAS_POLICY | PROV_HAS_TRANSPORT | PROV_HAS_COAP_URI | PROV_HAS_CFG_VERSION));
+
+    // Unknown names, junk lines and empty replies are ignored
+    CHECK(parse("hello\nfoo:'bar'\n:'x'\nkey 'y'\n") == ESP_OK && prov.present == 0);
+    CHECK(parse("") == ESP_OK && prov.present == 0);
+
+    // A cut-off value keeps what came before
+    CHECK(parse("key:'abc'\nsensorID:'12") == ESP_OK && prov.present == PROV_HAS_KEY);
+
+    // Size limits: 63 bytes fit key[64], 64 don't
+    char body[200];
+    snprintf(body, sizeof(body), "key:'%063d'\n", 0);
+    CHECK(parse(body) == ESP_OK && strlen(prov.key) == 63);
+    snprintf(body, sizeof(body), "key:'%064d'\n", 0);
+    CHECK(parse(body) == ESP_ERR_INVALID_SIZE);
+
+    // Range and format checks
+    CHECK(parse("interval_high:'0'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("interval_high:'1441'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("interval_high:'1.5'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("interval_high:'5x'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("interval_high:''\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("volt_high:'4.9'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("volt_high:'20.001'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("volt_high:'20.0'\nvolt_low:'5'\n") == ESP_OK);       // The limits themselves
+    CHECK(prov.policy.volt_high_mv == 20000 && prov.policy.volt_low_mv == 5000);
+    CHECK(parse("volt_low:'nan'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("upload_every:'97'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("agg_window:'-1'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("transport:'3'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("cfg_version:'0'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("cfg_version:'4294967296'\n") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("cfg_version:'4294967295'\n") == ESP_OK && prov.cfg_version == UINT32_MAX);
+}
+
+static void test_json(void) {
+    CHECK(parse(" \n{\"key\":\"abc\",\"sensorID\":\"42\",\"geoutm\":\"17T\",\"extra\":[1,{\"a\":null}]}") == ESP_OK);
+    CHECK(prov.present == PROV_HAS_REGISTRATION && strcmp(prov.key, "abc") == 0);
+
+    // Numbers may come as numbers or strings
+    CHECK(parse("{\"interval_mid\":30,\"volt_high\":12.5,\"volt_low\":\"11.9\",\"fw_size\":123456}") == ESP_OK);
+    CHECK(prov.policy.interval_mid_min == 30 && prov.policy.volt_high_mv == 12500);
+    CHECK(prov.policy.volt_low_mv == 11900 && prov.firmware.size == 123456);
+
+    // Escapes are decoded before the size check
+    CHECK(parse("{\"sensorID\":\"a\\u00e9\\n\\\"\"}") == ESP_OK && strcmp(prov.sensor_id, "a\xc3\xa9\n\"") == 0);
+
+    CHECK(parse("{\"key\":12}") == ESP_ERR_INVALID_ARG);            // Strings must be strings
+    CHECK(parse("{\"interval_mid\":true}") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("{\"interval_mid\":{}}") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("{\"interval_mid\":1e400}") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("{\"key\":\"abc\"") == ESP_ERR_INVALID_ARG);         // Cut off
+    CHECK(parse("{key:1}") == ESP_ERR_INVALID_ARG);
+    CHECK(parse("{}") == ESP_OK && prov.present == 0);
+}
+
+// A random reply: the model it should parse to, and the same reply in both formats
+typedef struct {
+    provision_t expect;
+    char lines[2048];
+    char json[2048];
+} sample_t;
+
+static void random_text(char *out, size_t max, bool json_safe) {
+    static const char chars[] = "abcXYZ019 -_./:?=&%+#";
+    size_t len = check_rand_below(max);
+    for (size_t i = 0; i < len; i++) out[i] = chars[check_rand_below(sizeof(chars) - 1)];
+    out[len] = '\0';
+}
+
+static void add(sample_t *s, const prov_field_t *f, const char *text, bool json_number) {
+    size_t n = strlen(s->lines);
+    snprintf(s->lines + n, sizeof(s->lines) - n, "%s:'%s'\r\n", f->name, text);
+    n = strlen(s->json);
+    snprintf(s->json + n, sizeof(s->json) - n, "%s\"%s\":%s%s%s", n > 1 ? "," : "", f->name,
+             json_number ? "" : "\"", text, json_number ? "" : "\"");
+}
+
+static void random_sample(sample_t *s) {
+    memset(s, 0, sizeof(*s));
+    strcpy(s->json, "{");
+    for (size_t i = 0; i < sizeof(prov_fields) / sizeof(prov_fields[0]); i++) {
+        const prov_field_t *f = &prov_fields[i];
+        if (check_rand_below(3) == 0) continue;
+        uint8_t *dst = (uint8_t *)&s->expect + f->offset;
+        char text[160];
+        bool number = f->type != FIELD_STR && check_rand_below(2);
+        uint32_t v;
+        switch (f->type) {
+            case FIELD_STR:
+                random_text(text, f->size, true);
+                strcpy((char *)dst, text);
+                break;
+            case FIELD_MINUTES:
+                v = 1 + check_rand_below(POLICY_MAX_INTERVAL_MIN);
+                *(uint16_t *)dst = v;
+                snprintf(text, sizeof(text), "%u", v);
+                break;
+            case FIELD_WINDOW:
+                v = check_rand_below(POLICY_MAX_INTERVAL_MIN + 1);
+                *(uint16_t *)dst = v;
+                snprintf(text, sizeof(text), "%u", v);
+                break;
+            case FIELD_VOLTS:
+                v = POLICY_MIN_VOLT_MV + check_rand_below(POLICY_MAX_VOLT_MV - POLICY_MIN_VOLT_MV + 1);
+                *(uint16_t *)dst = v;
+                snprintf(text, sizeof(text), "%u.%03u", v / 1000, v % 1000);
+                break;
+            case FIELD_WAKES:
+                v = 1 + check_rand_below(POLICY_MAX_UPLOAD_EVERY);
+                *(uint16_t *)dst = v;
+                snprintf(text, sizeof(text), "%u", v);
+                break;
+            case FIELD_TRANSPORT:
+                v = check_rand_below(3);
+                *dst = v;
+                snprintf(text, sizeof(text), "%u", v);
+                break;
+            default:
+                v = 1 + check_rand();
+                if (v == 0) v = 1;
+                *(uint32_t *)dst = v;
+                snprintf(text, sizeof(text), "%u", v);
+                break;
+        }
+        s->expect.present |= f->flag;
+        add(s, f, text, number);
+    }
+    strcat(s->json, "}");
+}
+
+static void test_round_trip(void) {
+    static sample_t s;
+    for (int run = 0; run < RUNS; run++) {
+        random_sample(&s);
+        CHECK_MSG(parse(s.lines) == ESP_OK && memcmp(&prov, &s.expect, sizeof(prov)) == 0,
+                  "run %d: line reply differs:\n%s", run, s.lines);
+        CHECK_MSG(parse(s.json) == ESP_OK && memcmp(&prov, &s.expect, sizeof(prov)) == 0,
+                  "run %d: JSON reply differs:\n%s", run, s.json);
+    }
+}
+
+// Whatever the input, an accepted reply holds only terminated strings and in-range values
+static void check_invariants(int run) {
+    const uint32_t all = (PROV_HAS_BACKFILL_TO << 1) - 1;
+    CHECK_MSG((prov.present & ~all) == 0, "run %d: stray flags", run);
+    for (size_t i = 0; i < sizeof(prov_fields) / sizeof(prov_fields[0]); i++) {
+        const prov_field_t *f = &prov_fields[i];
+        const uint8_t *src = (const uint8_t *)&prov + f->offset;
+        if (!(prov.present & f->flag)) continue;
+        uint32_t v = 0;
+        if (f->type != FIELD_STR) memcpy(&v, src, f->size);     // Little-endian host
+        switch (f->type) {
+            case FIELD_STR:
+                CHECK_MSG(memchr(src, '\0', f->size) != NULL, "run %d: %s unterminated", run, f->name);
+                break;
+            case FIELD_MINUTES:
+                CHECK_MSG(v >= 1 && v <= POLICY_MAX_INTERVAL_MIN, "run %d: %s = %u", run, f->name, v);
+                break;
+            case FIELD_WINDOW:
+                CHECK_MSG(v <= POLICY_MAX_INTERVAL_MIN, "run %d: %s = %u", run, f->name, v);
+                break;
+            case FIELD_VOLTS:
+                CHECK_MSG(v >= POLICY_MIN_VOLT_MV && v <= POLICY_MAX_VOLT_MV, "run %d: %s = %u", run, f->name, v);
+                break;
+            case FIELD_WAKES:
+                CHECK_MSG(v >= 1 && v <= POLICY_MAX_UPLOAD_EVERY, "run %d: %s = %u", run, f->name, v);
+                break;
+            case FIELD_TRANSPORT:
+                CHECK_MSG(v <= UPLINK_TRANSPORT_COAP, "run %d: %s = %u", run, f->name, v);
+                break;
+            default:
+                CHECK_MSG(v >= 1, "run %d: %s = %u", run, f->name, v);
+                break;
+        }
+    }
+}
+
+static void test_mutations(void) {
+    static sample_t s;
+    static char body[2100];
+    for (int run = 0; run < RUNS; run++) {
+        random_sample(&s);
+        const char *src = run % 2 ? s.json : s.lines;
+        size_t len = strlen(src);
+        memcpy(body, src, len);
+
+        // Flip, insert, delete or cut; the buffer is not terminated, the length is all there is
+        int edits = 1 + check_rand_below(6);
+        for (int e = 0; e < edits && len > 0; e++) {
+            size_t at = check_rand_below(len);
+            switch (check_rand_below(4)) {
+                case 0:
+                    body[at] = (char)check_rand();
+                    break;
+                case 1:
+                    if (len < sizeof(body) - 1) {
+                        memmove(body + at + 1, body + at, len - at);
+                        body[at] = "'{}\":,\\\n0"[check_rand_below(10)];
+                        len++;
+                    }
+                    break;
+                case 2:
+                    memmove(body + at, body + at + 1, len - at - 1);
+                    len--;
+                    break;
+                default:
+                    len = at;
+                    break;
+            }
+        }
+
+        char *exact = malloc(len ? len : 1);     // So ASan sees any read past len
+        memcpy(exact, body, len);
+        esp_err_t err = provision_parse(exact, len, &prov);
+        free(exact);
+        CHECK_MSG(err == ESP_OK || err == ESP_ERR_INVALID_SIZE || err == ESP_ERR_INVALID_ARG, "run %d: err %d",
+                  run, err);
+        if (err == ESP_OK) check_invariants(run);
+    }
+}
+
+int main(void) {
+    test_lines();
+    test_json();
+    test_round_trip();
+    test_mutations();
+    return check_result();
+}
@@ -0,0 +1,571 @@
+// Remote configuration end to end, against a stand-in for the data server. The node runs the
+// real upload path (try_upload_now, the HTTP uplink, the multipart upload over the
+// esp_http_client API) and the real NVS-backed config; the server reads the ack out of each
+// upload and keeps answering with its latest versioned delta until the node reports it.
+// Checks that a delta lands whole or not at all, also across a power cut at every NVS write,
+// and that its ack goes out with the next upload and only counts once that upload got through.
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "nvs_sim.h"
+#include "rtos_sim.h"
+#include "http_client_sim.h"
+#include "upload.c"
+#include "uplink.c"
+#include "provision.c"
+#include "nodecfg.c"
+#include "linkqual.c"
+
+#define ROW "'01-02-2026 10:00:00:000','101000','21.50','12.40','0.00'\n"
+
+// The data server: its latest config, what the node last acknowledged and what it last got
+static struct {
+    uint32_t version;       // 0 while the server has no config for the node
+    char delta[512];        // key:'value' lines of that version, without cfg_version
+    uint32_t acked;
+    bool ignore_acks;       // Keeps resending as if no ack came in
+    int status;             // Reply status for uploads, 200 normally
+    int uploads;
+    int malformed;
+    char url[256];
+    bool had_ack;           // The last upload carried a cfg_version line
+    uint32_t ack;
+    char rows[512];         // Rows of the last upload
+    char reply[1024];
+} cloud;
+
+// What the node's other modules would hand to the upload
+static struct {
+    bool wifi;
+    int8_t rssi;
+    bool no_rows;
+    bool on_trial;          // Running a new image the server hasn't confirmed
+    int registrations_saved;
+    int offers;
+    bool held_flushed;      // The deadband's held row was stored before the batch was read
+} node;
+
+const char *const dlog_module_names[DLOG_MODULE_COUNT] = {"MAIN", "SENSORS", "SD", "UPLOAD", "WIFI"};
+const char *payloadpath = "/sdcard/payload.txt";
+const char DigiCertGlobalRootG2_crt_pem_start[] = "-----BEGIN CERTIFICATE-----\n";
+
+bool wifi_is_connected(void) {
+    return node.wifi;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info) {
+    memset(ap_info, 0, sizeof(*ap_info));
+    ap_info->rssi = node.rssi;
+    return ESP_OK;
+}
+
+esp_err_t load_registration_metadata(char *key, size_t key_size, char *sensorID, size_t id_size, char *geoutm, size_t geo_size) {
+    strlcpy(key, "k1", key_size);
+    strlcpy(sensorID, "42", id_size);
+    strlcpy(geoutm, "17T 630084 4833438", geo_size);
+    return ESP_OK;
+}
+
+esp_err_t save_registration_metadata(const char *key, const char *sensorID, const char *geoutm) {
+    node.registrations_saved++;
+    return ESP_OK;
+}
+
+esp_err_t sd_load_rows(const char *path, char **rows, size_t *rows_len) {
+    CHECK_MSG(node.held_flushed, "batch read before the held row was stored");
+    node.held_flushed = false;
+    const char *text = node.no_rows ? "" : ROW;
+    *rows = strdup(text);
+    *rows_len = strlen(text);
+    return *rows ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+size_t sd_atomic_header_skip(const char *data, size_t len) {
+    return 0;
+}
+
+size_t sensor_aggregates(const agg_window_t **windows) {
+    *windows = NULL;
+    return 0;
+}
+
+void sensor_aggregates_sent(size_t count) {}
+
+void sensor_flush_held(const char *path) {
+    node.held_flushed = true;
+}
+
+int agg_format_row(const agg_window_t *w, char *buf, size_t size) {
+    return -1;
+}
+
+bool sdlog_backfill_pending(uint32_t *from, uint32_t *to) {
+    return false;
+}
+
+esp_err_t sdlog_query(time_t from, time_t to, sdlog_row_cb_t cb, void *ctx) {
+    return ESP_ERR_NOT_FOUND;
+}
+
+void sdlog_backfill_sent(uint32_t through) {}
+void sdlog_backfill_request(uint32_t from, uint32_t to) {}
+
+bool ota_on_trial(void) {
+    return node.on_trial;
+}
+
+esp_err_t ota_offer(const ota_offer_t *offer) {
+    node.offers++;
+    return ESP_OK;
+}
+
+void power_lock_cpu(void) {}
+void power_unlock_cpu(void) {}
+
+esp_err_t esp_crt_bundle_attach(void *conf) {
+    return ESP_OK;
+}
+
+esp_err_t coap_uplink_send(const uplink_config_t *cfg, const uplink_payload_t *payload, char *response_buf, size_t buf_size) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+// Deltas here never switch to MQTT, so the broker is never reached
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+    return NULL;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t handler, void *handler_args) {
+    return ESP_FAIL;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    return ESP_FAIL;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain) {
+    return -1;
+}
+
+// Unwraps the multipart file part and splits it into the metadata, the ack and the rows
+static bool read_upload(const http_client_sim_request_t *req) {
+    char type[128];
+    const char *prefix = "multipart/form-data; boundary=";
+    if (req->method != HTTP_METHOD_POST || !http_client_sim_header(req, "Content-Type", type, sizeof(type)) ||
+        strncmp(type, prefix, strlen(prefix)) != 0) {
+        return false;
+    }
+
+    char head[160], tail[160];
+    const char *boundary = type + strlen(prefix);
+    snprintf(head, sizeof(head), "--%s\r\n", boundary);
+    snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", boundary);
+    char body[1024];
+    if (req->body_len >= sizeof(body)) return false;
+    memcpy(body, req->body, req->body_len);
+    body[req->body_len] = '\0';
+
+    size_t tail_len = strlen(tail);
+    char *text = strstr(body, "\r\n\r\n");
+    if (strncmp(body, head, strlen(head)) != 0 || !text || req->body_len < tail_len ||
+        strcmp(body + req->body_len - tail_len, tail) != 0) {
+        return false;
+    }
+    text += 4;
+    body[req->body_len - tail_len] = '\0';
+
+    const char *meta = "key:'k1'\nsensorID:'42'\ngeoutm:'17T 630084 4833438'\n";
+    if (strncmp(text, meta, strlen(meta)) != 0) return false;
+    text += strlen(meta);
+
+    // The ack, if any, comes straight after the metadata
+    cloud.had_ack = false;
+    unsigned long ack;
+    int used = 0;
+    if (sscanf(text, "cfg_version:'%lu'\n%n", &ack, &used) == 1 && used > 0) {
+        cloud.had_ack = true;
+        cloud.ack = ack;
+        text += used;
+    }
+    strlcpy(cloud.rows, text, sizeof(cloud.rows));
+    return true;
+}
+
+static void data_server(http_client_sim_request_t *req, void *ctx) {
+    cloud.uploads++;
+    strlcpy(cloud.url, req->url, sizeof(cloud.url));
+    if (!read_upload(req)) {
+        cloud.malformed++;
+        req->status = 400;
+        return;
+    }
+
+    req->status = cloud.status;
+    if (cloud.status != 200) return;
+
+    if (cloud.had_ack && !cloud.ignore_acks) cloud.acked = cloud.ack;
+    int n = snprintf(cloud.reply, sizeof(cloud.reply), "status:'ok'\n");
+    if (cloud.version > cloud.acked) {
+        snprintf(cloud.reply + n, sizeof(cloud.reply) - n, "%scfg_version:'%lu'\n", cloud.delta,
+                 (unsigned long)cloud.version);
+    }
+    req->reply = cloud.reply;
+    req->reply_len = strlen(cloud.reply);
+}
+
+static void publish(uint32_t version, const char *delta) {
+    cloud.version = version;
+    strlcpy(cloud.delta, delta, sizeof(cloud.delta));
+}
+
+// RAM goes on every boot, RTC memory only on a reset
+static void deep_sleep_wake(void) {
+    policy_loaded = false;
+    nodecfg_load();
+}
+
+static void power_cut(void) {
+    nvs_sim_power_cut();
+    memset(&cache, 0, sizeof(cache));
+    memset(&history, 0, sizeof(history));
+    policy_loaded = false;
+    nodecfg_load();
+    CHECK(provision_recover() == ESP_OK);
+}
+
+static void fresh_node(void) {
+    memset(&cloud, 0, sizeof(cloud));
+    cloud.status = 200;
+    memset(&node, 0, sizeof(node));
+    node.wifi = true;
+    node.rssi = -60;
+    nvs_sim_reset();
+    rtos_sim_reset();
+    http_client_sim_reset(data_server, NULL);
+    power_cut();
+}
+
+static uint32_t applied(void) {
+    return nodecfg()->cfg_version;
+}
+
+// One wake's upload; every client the upload opened must be closed again
+static esp_err_t wake(void) {
+    deep_sleep_wake();
+    esp_err_t err = try_upload_now();
+    CHECK(http_client_sim_live() == 0);
+    CHECK(cloud.malformed == 0);
+    return err;
+}
+
+#define DELTA_5 "interval_high:'3'\nvolt_low:'11.5'\nupload_every:'2'\ndata_url:'https://example.org/v5'\n"
+
+static bool has_v5(void) {
+    const node_policy_t *p = node_policy();
+    return p->interval_high_min == 3 && p->volt_low_mv == 11500 && p->upload_every == 2 &&
+           strcmp(uplink_config()->data_url, "https://example.org/v5") == 0;
+}
+
+static bool has_defaults(void) {
+    node_policy_t d;
+    node_policy_defaults(&d);
+    return memcmp(node_policy(), &d, sizeof(d)) == 0 &&
+           strcmp(uplink_config()->data_url, UPLINK_DEFAULT_DATA_URL) == 0;
+}
+
+static void test_delta_and_ack(void) {
+    fresh_node();
+
+    // Nothing configured yet: plain uploads, no ack line
+    CHECK(wake() == ESP_OK);
+    CHECK(!cloud.had_ack && strcmp(cloud.rows, ROW) == 0);
+    CHECK(strcmp(cloud.url, UPLINK_DEFAULT_DATA_URL) == 0);
+    CHECK(provision_ack_version() == 0 && has_defaults());
+
+    // The reply to this upload carries version 5; it is in force as soon as the reply is read
+    publish(5, DELTA_5);
+    CHECK(wake() == ESP_OK);
+    CHECK(!cloud.had_ack);
+    CHECK(has_v5());
+    CHECK(applied() == 5 && provision_ack_version() == 5);
+
+    // The next upload reports it, ahead of the rows, and goes to the new URL
+    CHECK(wake() == ESP_OK);
+    CHECK(cloud.had_ack && cloud.ack == 5 && strcmp(cloud.rows, ROW) == 0);
+    CHECK(strcmp(cloud.url, "https://example.org/v5") == 0);
+    CHECK(cloud.acked == 5 && provision_ack_version() == 0);
+
+    // Once the server has it, uploads are plain again and the reply carries no delta
+    CHECK(wake() == ESP_OK);
+    CHECK(!cloud.had_ack && strcmp(cloud.reply, "status:'ok'\n") == 0);
+
+    // Survives a reset: everything came from NVS
+    power_cut();
+    CHECK(has_v5() && provision_ack_version() == 0);
+    CHECK(node.registrations_saved == 0 && node.offers == 0);
+}
+
+static void test_ack_needs_delivery(void) {
+    fresh_node();
+    publish(5, DELTA_5);
+    CHECK(wake() == ESP_OK && provision_ack_version() == 5);
+
+    // No Wi-Fi, a refused connection, a server error: the ack stays pending each time
+    node.wifi = false;
+    CHECK(wake() == ESP_ERR_WIFI_NOT_CONNECT);
+    CHECK(provision_ack_version() == 5);
+    node.wifi = true;
+
+    http_client_sim_refuse(100);
+    int before = cloud.uploads;
+    CHECK(wake() != ESP_OK);
+    CHECK(cloud.uploads == before && provision_ack_version() == 5);
+    http_client_sim_refuse(0);
+
+    cloud.status = 500;
+    CHECK(wake() != ESP_OK);
+    CHECK(cloud.had_ack && cloud.ack == 5);
+    CHECK(cloud.acked == 0 && provision_ack_version() == 5);
+    cloud.status = 200;
+
+    // An upload with no rows still goes out to carry the ack
+    node.no_rows = true;
+    CHECK(wake() == ESP_OK);
+    CHECK(cloud.had_ack && cloud.ack == 5 && cloud.rows[0] == '\0');
+    CHECK(cloud.acked == 5 && provision_ack_version() == 0);
+
+    // With nothing to report and nothing to send the wake stays off the air
+    before = cloud.uploads;
+    CHECK(wake() == ESP_ERR_NOT_FINISHED);
+    CHECK(cloud.uploads == before);
+}
+
+static void test_repeats_and_supersedes(void) {
+    fresh_node();
+    publish(5, DELTA_5);
+    CHECK(wake() == ESP_OK);
+
+    // A server that lost the ack repeats the delta. The node doesn't apply it again, it
+    // reports the version again with every upload until the server stops repeating.
+    cloud.ignore_acks = true;
+    for (int i = 0; i < 3; i++) {
+        int commits = nvs_sim_commits();
+        CHECK(wake() == ESP_OK);
+        CHECK(cloud.had_ack && cloud.ack == 5);
+        CHECK(strstr(cloud.reply, "cfg_version:'5'") != NULL);
+        CHECK(nvs_sim_commits() == commits + 2);     // Marked acked, then due again
+        CHECK(has_v5() && provision_ack_version() == 5);
+    }
+    cloud.ignore_acks = false;
+    CHECK(wake() == ESP_OK && cloud.acked == 5);
+    CHECK(provision_ack_version() == 0);
+
+    // A later version lays its fields over the current config
+    publish(6, "volt_high:'12.6'\n");
+    CHECK(wake() == ESP_OK);
+    CHECK(node_policy()->volt_high_mv == 12600 && has_v5());
+    CHECK(provision_ack_version() == 6);
+
+    CHECK(wake() == ESP_OK && cloud.acked == 6);
+
+    // A server that fell back to an older version changes nothing and is told the current one
+    cloud.acked = 0;
+    publish(4, "interval_high:'9'\n");
+    CHECK(wake() == ESP_OK);
+    CHECK(node_policy()->interval_high_min == 3 && applied() == 6);
+    CHECK(wake() == ESP_OK && cloud.had_ack && cloud.ack == 6);
+}
+
+static void test_rejected_whole(void) {
+    fresh_node();
+    publish(5, DELTA_5);
+    CHECK(wake() == ESP_OK);
+    CHECK(wake() == ESP_OK && cloud.acked == 5);
+
+    // volt_low above the current volt_high: the interval that came with it isn't kept either
+    publish(7, "interval_mid:'20'\nvolt_low:'13.0'\n");
+    CHECK(wake() == ESP_OK);
+    CHECK(has_v5() && node_policy()->interval_mid_min == POLICY_DEFAULT_INTERVAL_MID);
+    CHECK(applied() == 5 && provision_ack_version() == 0);
+
+    // Likewise for a field out of range
+    publish(8, "interval_mid:'20'\ninterval_low:'0'\n");
+    CHECK(wake() == ESP_OK);
+    CHECK(node_policy()->interval_mid_min == POLICY_DEFAULT_INTERVAL_MID && applied() == 5);
+
+    // Registration fields in a delta are dropped, the rest applies
+    publish(9, "key:'other'\nsensorID:'7'\ngeoutm:'x'\ninterval_mid:'20'\n");
+    CHECK(wake() == ESP_OK);
+    CHECK(node_policy()->interval_mid_min == 20 && node.registrations_saved == 0);
+    CHECK(wake() == ESP_OK && cloud.ack == 9 && cloud.acked == 9);
+}
+
+// A reset at every NVS write of the apply: after the reboot the node runs either the old or
+// the new config, never a mix, and a couple of wakes later the server has its ack
+static void test_power_cut_at_every_write(void) {
+    bool finished = false;
+    for (long n = 0; n < 100 && !finished; n++) {
+        fresh_node();
+        CHECK(wake() == ESP_OK);
+        publish(5, DELTA_5);
+
+        nvs_sim_fail_write(n);
+        wake();
+        finished = applied() == 5;
+        uint32_t due = provision_ack_version();
+        nvs_sim_fail_write(-1);
+        power_cut();
+
+        // An ack due before the reset is for a config the reset didn't lose
+        CHECK_MSG(has_v5() || has_defaults(), "write %ld", n);
+        CHECK_MSG(due == applied(), "write %ld: ack %lu due, %lu applied", n, (unsigned long)due, (unsigned long)applied());
+        if (has_v5()) {
+            CHECK(applied() == 5 && provision_ack_version() == 5);
+        } else {
+            CHECK(applied() == 0 && provision_ack_version() == 0);
+        }
+
+        for (int i = 0; i < 3 && cloud.acked != 5; i++) {
+            CHECK(wake() == ESP_OK);
+        }
+        CHECK_MSG(cloud.acked == 5 && has_v5() && provision_ack_version() == 0, "write %ld", n);
+    }
+    CHECK(finished);
+}
+
+// Below the RSSI floor a wake with nothing but aggregates would wait for a better link; an
+// ack, or a new image waiting for the server to confirm it, goes out anyway
+static void test_must_upload_on_weak_link(void) {
+    fresh_node();
+    node.no_rows = true;
+    node.rssi = -90;
+    node.on_trial = true;
+    int before = cloud.uploads;
+    CHECK(wake() == ESP_OK && cloud.uploads == before + 1);
+    node.on_trial = false;
+
+    publish(5, DELTA_5);
+    CHECK(wake() == ESP_ERR_NOT_FINISHED);      // Nothing to send, nothing to report
+    node.no_rows = false;
+    node.rssi = -60;
+    CHECK(wake() == ESP_OK && provision_ack_version() == 5);
+    node.no_rows = true;
+    node.rssi = -90;
+    CHECK(wake() == ESP_OK && cloud.ack == 5 && cloud.acked == 5);
+}
+
+// Reset between applying a delta and the upload that reports it
+static void test_ack_survives_reset(void) {
+    fresh_node();
+    publish(5, DELTA_5);
+    CHECK(wake() == ESP_OK);
+    power_cut();
+    CHECK(provision_ack_version() == 5);
+    CHECK(wake() == ESP_OK && cloud.had_ack && cloud.ack == 5);
+    CHECK(cloud.acked == 5 && provision_ack_version() == 0);
+}
+
+// Firmware before the config blob's version 3: endpoints and versions under their own keys,
+// the blob ending before the endpoints, and maybe a delta journalled and not yet applied
+static void write_legacy(const char *blob_from, size_t blob_len, bool journal) {
+    nvs_handle_t handle;
+    CHECK(nvs_open("uplink", NVS_READWRITE, &handle) == ESP_OK);
+    CHECK(nvs_set_u8(handle, "transport", UPLINK_TRANSPORT_HTTP) == ESP_OK);
+    CHECK(nvs_set_str(handle, "data_url", "https://example.org/old") == ESP_OK);
+    CHECK(nvs_set_str(handle, "reg_url", UPLINK_DEFAULT_REGISTER_URL) == ESP_OK);
+    CHECK(nvs_set_str(handle, "mqtt_uri", "") == ESP_OK);
+    CHECK(nvs_set_str(handle, "mqtt_topic", UPLINK_DEFAULT_MQTT_TOPIC) == ESP_OK);
+    CHECK(nvs_set_str(handle, "coap_uri", "") == ESP_OK);
+    CHECK(nvs_commit(handle) == ESP_OK);
+    nvs_close(handle);
+
+    CHECK(nvs_open("cfg", NVS_READWRITE, &handle) == ESP_OK);
+    CHECK(nvs_set_u32(handle, "version", 4) == ESP_OK);
+    CHECK(nvs_set_u32(handle, "acked", 3) == ESP_OK);
+    if (journal) {
+        provision_t delta;
+        CHECK(provision_parse(DELTA_5 "cfg_version:'5'\n", strlen(DELTA_5) + 17, &delta) == ESP_OK);
+        CHECK(nvs_set_blob(handle, "pending", &delta, sizeof(delta)) == ESP_OK);
+    }
+    CHECK(nvs_commit(handle) == ESP_OK);
+    nvs_close(handle);
+
+    if (blob_from) {
+        CHECK(nvs_open("node", NVS_READWRITE, &handle) == ESP_OK);
+        CHECK(nvs_set_blob(handle, "cfg", blob_from, blob_len) == ESP_OK);
+        CHECK(nvs_commit(handle) == ESP_OK);
+        nvs_close(handle);
+    }
+}
+
+static size_t blob_size(void) {
+    size_t size = 0;
+    nvs_handle_t handle;
+    if (nvs_open("node", NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_blob(handle, "cfg", NULL, &size);
+        nvs_close(handle);
+    }
+    return size;
+}
+
+static void test_legacy_keys(void) {
+    // Policy keys only, no blob yet
+    fresh_node();
+    nvs_handle_t handle;
+    CHECK(nvs_open("policy", NVS_READWRITE, &handle) == ESP_OK);
+    CHECK(nvs_set_u16(handle, "int_high", 7) == ESP_OK);
+    CHECK(nvs_commit(handle) == ESP_OK);
+    nvs_close(handle);
+    write_legacy(NULL, 0, false);
+    power_cut();
+    CHECK(strcmp(uplink_config()->data_url, "https://example.org/old") == 0);
+    CHECK(node_policy()->interval_high_min == 7 && applied() == 4 && provision_ack_version() == 4);
+    CHECK(blob_size() == sizeof(nodecfg_t));
+
+    // A version 2 blob is converted and written back whole
+    fresh_node();
+    nodecfg_t old;
+    memset(&old, 0, sizeof(old));
+    old.version = 2;
+    old.present = NODECFG_HAS_POLICY;
+    node_policy_defaults(&old.policy);
+    old.policy.interval_high_min = 7;
+    write_legacy((const char *)&old, offsetof(nodecfg_t, uplink), false);
+    power_cut();
+    CHECK(strcmp(uplink_config()->data_url, "https://example.org/old") == 0);
+    CHECK(node_policy()->interval_high_min == 7 && applied() == 4 && provision_ack_version() == 4);
+    CHECK(blob_size() == sizeof(nodecfg_t));
+
+    // The old firmware's journal is finished on the first boot, then the ack goes out
+    fresh_node();
+    write_legacy((const char *)&old, offsetof(nodecfg_t, uplink), true);
+    power_cut();
+    CHECK(has_v5() && applied() == 5 && !nvs_sim_has("cfg", "pending"));
+    CHECK(wake() == ESP_OK && cloud.had_ack && cloud.ack == 5);
+    CHECK(provision_ack_version() == 0);
+
+    // Warm wakes after that find everything in the RTC copy
+    int commits = nvs_sim_commits();
+    CHECK(wake() == ESP_OK && !cloud.had_ack && nvs_sim_commits() == commits);
+}
+
+int main(void) {
+    test_delta_and_ack();
+    test_ack_needs_delivery();
+    test_repeats_and_supersedes();
+    test_rejected_whole();
+    test_power_cut_at_every_write();
+    test_ack_survives_reset();
+    test_must_upload_on_weak_link();
+    test_legacy_keys();
+    return check_result();
+}
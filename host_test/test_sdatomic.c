@@ -0,0 +1,129 @@
+// Power-cut fuzzing of the SD metadata files: sd_write_atomic and sd_recover_file run on
+// fs_sim with a cut armed at a random file operation, and the next boot must find either
+// the old body or the new one, never a mix and never nothing once a body was committed.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "fs_sim.h"
+#include "sdatomic.h"
+
+#define PATH "/sdcard/register.txt"
+#define TMP  "/sdcard/register.tmp"
+#define RUNS 5000
+
+static int bus_locks;
+
+void power_lock_bus(void) {
+    bus_locks++;
+}
+
+void power_unlock_bus(void) {
+    bus_locks--;
+}
+
+static void make_body(char *buf, size_t size, unsigned version) {
+    size_t len = (size_t)snprintf(buf, size, "v%u:", version);
+    size_t end = len + check_rand_below((uint32_t)(size - len));
+    while (len < end) buf[len++] = (char)('a' + check_rand_below(26));
+    buf[len] = '\0';
+}
+
+static void test_round_trip(void) {
+    char out[128];
+    size_t len = 0;
+    fs_sim_reset();
+
+    CHECK(sd_read_atomic(PATH, out, sizeof(out), &len) == ESP_ERR_NOT_FOUND);
+    CHECK(sd_write_atomic(PATH, "ssid=lab\n", 9) == ESP_OK);
+    CHECK(sd_read_atomic(PATH, out, sizeof(out), &len) == ESP_OK);
+    CHECK(len == 9 && strcmp(out, "ssid=lab\n") == 0);
+    CHECK(!fs_sim_exists(TMP));
+    CHECK(bus_locks == 0);
+
+    // Sensor rows appended after the body keep the header valid and load on their own
+    char raw[256];
+    size_t raw_len = fs_sim_get(PATH, raw, sizeof(raw));
+    CHECK(sd_atomic_header_skip(raw, raw_len) == SD_ATOMIC_HEADER_LEN);
+    memcpy(raw + raw_len, "1,2,3\n4,5,6\n", 12);
+    fs_sim_put(PATH, raw, raw_len + 12);
+    CHECK(sd_read_atomic(PATH, out, sizeof(out), &len) == ESP_OK && len == 9);
+    char *rows = NULL;
+    size_t rows_len = 0;
+    CHECK(sd_load_rows(PATH, &rows, &rows_len) == ESP_OK);
+    CHECK(rows && rows_len == 12 && strcmp(rows, "1,2,3\n4,5,6\n") == 0);
+    free(rows);
+
+    // A damaged body is reported, not returned
+    raw[SD_ATOMIC_HEADER_LEN] ^= 1;
+    fs_sim_put(PATH, raw, raw_len);
+    CHECK(sd_read_atomic(PATH, out, sizeof(out), &len) == ESP_ERR_INVALID_CRC);
+
+    // Empty body, as sd_init writes for a fresh payload.txt
+    CHECK(sd_write_atomic(PATH, "", 0) == ESP_OK);
+    CHECK(sd_read_atomic(PATH, out, sizeof(out), &len) == ESP_OK && len == 0);
+}
+
+// Recovery with its own cut, rerun on the following boot until it completes
+static void boot_recover(void) {
+    volatile int boots = 0;
+    if (setjmp(fs_sim_cut)) boots++;
+    fs_sim_arm_cut(boots < 3 && check_rand_below(2) ? (long)check_rand_below(6) : -1);
+    CHECK(sd_recover_file(PATH) == ESP_OK);
+    fs_sim_arm_cut(-1);
+}
+
+static void test_power_cuts(void) {
+    int kept_old = 0, got_new = 0, empty = 0;
+    for (int run = 0; run < RUNS; run++) {
+        uint32_t seed = check_rng;
+        char old_body[96], new_body[96], out[128];
+        bool have_old = check_rand_below(4) != 0;
+
+        fs_sim_reset();
+        make_body(old_body, sizeof(old_body), 2 * run);
+        make_body(new_body, sizeof(new_body), 2 * run + 1);
+        if (have_old) {
+            CHECK(sd_write_atomic(PATH, old_body, strlen(old_body)) == ESP_OK);
+            // Half the time an earlier write was itself cut and its temp is still there
+            if (check_rand_below(2)) fs_sim_put(TMP, "#MNF1 0000", 10);
+        }
+
+        volatile bool completed = false;
+        if (!setjmp(fs_sim_cut)) {
+            fs_sim_arm_cut((long)check_rand_below(10));
+            completed = sd_write_atomic(PATH, new_body, strlen(new_body)) == ESP_OK;
+            fs_sim_arm_cut(-1);
+        }
+
+        boot_recover();
+        CHECK_MSG(!fs_sim_exists(TMP), "run %d seed %u: temp file left behind", run, seed);
+
+        size_t len = 0;
+        esp_err_t ret = sd_read_atomic(PATH, out, sizeof(out), &len);
+        if (ret == ESP_OK && strcmp(out, new_body) == 0) {
+            got_new++;
+        } else if (completed) {
+            CHECK_MSG(false, "run %d seed %u: committed write lost (%s)", run, seed, esp_err_to_name(ret));
+        } else if (have_old) {
+            CHECK_MSG(ret == ESP_OK && strcmp(out, old_body) == 0,
+                      "run %d seed %u: old body lost (%s)", run, seed, esp_err_to_name(ret));
+            kept_old++;
+        } else {
+            CHECK_MSG(ret == ESP_ERR_NOT_FOUND, "run %d seed %u: first write left %s", run, seed, esp_err_to_name(ret));
+            empty++;
+        }
+
+        // The file stays writable after whatever happened
+        CHECK(sd_write_atomic(PATH, "next", 4) == ESP_OK);
+        CHECK(sd_read_atomic(PATH, out, sizeof(out), &len) == ESP_OK && strcmp(out, "next") == 0);
+    }
+    printf("power cuts: %d new, %d old kept, %d never written\n", got_new, kept_old, empty);
+    CHECK(got_new > 0 && kept_old > 0 && empty > 0);
+}
+
+int main(void) {
+    test_round_trip();
+    test_power_cuts();
+    return check_result();
+}
@@ -0,0 +1,195 @@
+// SD history on host files: four months of rows with outages, repeated seconds and resets
+// along the way, some of which also cut the index short or lose it. After every reset the
+// index must again hold one entry per block, and range queries must return exactly the rows
+// in range, oldest first, after a binary search of the index and a scan of at most one block.
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "sd_host.h"
+#include "sd_host_redirect.h"
+#include "sdlog.c"
+
+#define DAYS     120
+#define ROWS_MAX (DAYS * 24 * 30 + 1000)
+#define START    1767225600         // 2026-01-01 UTC
+
+static uint32_t times[ROWS_MAX];
+static long offsets[ROWS_MAX];
+static size_t n_rows;
+static int resets, rebuilds;
+
+void power_lock_bus(void) {}
+void power_unlock_bus(void) {}
+
+// As sdcard.c writes it
+int sd_format_row(const struct tm *when, int ms, uint32_t pressure, float temp, float voltage, char *buf, size_t size) {
+    return snprintf(buf, size, "'%02d-%02d-%04d %02d:%02d:%02d:%03d','%" PRIu32 "','%.2f','%.2f','%.2f'\n",
+                    when->tm_mday, when->tm_mon + 1, when->tm_year + 1900, when->tm_hour, when->tm_min, when->tm_sec,
+                    ms, pressure, temp, voltage, 0.0);
+}
+
+static size_t index_entries(void) {
+    return (size_t)(sd_host_size(SDLOG_INDEX_PATH) / (long)sizeof(sdlog_index_t));
+}
+
+// One entry per block, at the offset and time of the block's first row
+static bool index_matches(void) {
+    size_t blocks = (n_rows + SDLOG_BLOCK_ROWS - 1) / SDLOG_BLOCK_ROWS;
+    if (index_entries() != blocks) return false;
+    FILE *index = fopen(SDLOG_INDEX_PATH, "rb");
+    bool ok = index != NULL;
+    for (size_t k = 0; ok && k < blocks; k++) {
+        sdlog_index_t entry;
+        ok = fread(&entry, sizeof(entry), 1, index) == 1 && entry.offset == offsets[k * SDLOG_BLOCK_ROWS] &&
+             entry.first_time == times[k * SDLOG_BLOCK_ROWS];
+    }
+    if (index) fclose(index);
+    return ok;
+}
+
+// A power-on reset: RTC memory is lost, and the index may have lost entries the data kept
+static void reset(void) {
+    state.magic = 0;
+    resets++;
+    size_t entries = index_entries();
+    switch (check_rand_below(4)) {
+    case 0:
+        sd_host_truncate(SDLOG_INDEX_PATH, (long)(entries - check_rand_below(3 < entries ? 3 : entries)) *
+                                               (long)sizeof(sdlog_index_t));
+        break;
+    case 1:
+        if (check_rand_below(10) == 0) {
+            remove(SDLOG_INDEX_PATH);
+            rebuilds++;
+        }
+        break;
+    }
+}
+
+static void build_log(void) {
+    uint32_t t = START;
+    n_rows = 0;
+    while (t < START + DAYS * 86400u && n_rows < ROWS_MAX) {
+        uint32_t r = check_rand_below(1000);
+        if (r < 1) {
+            t += 3600 + check_rand_below(86400);        // Outage
+        } else if (r >= 20) {
+            t += 120;
+        }                                               // Otherwise the same second again
+
+        times[n_rows] = t;
+        offsets[n_rows] = sd_host_size(SDLOG_DATA_PATH);
+        if (offsets[n_rows] < 0) offsets[n_rows] = 0;
+        esp_err_t err = sdlog_append(t, 100000 + check_rand_below(5000), 21.5f, 12.4f);
+        CHECK_MSG(err == ESP_OK, "append %zu failed", n_rows);
+        n_rows++;
+
+        if (check_rand_below(2000) == 0) {
+            reset();
+            // The next append recovers
+        }
+    }
+    CHECK_MSG(index_matches(), "index wrong after %zu rows", n_rows);
+}
+
+typedef struct {
+    size_t next;            // Index in times[] of the row expected next
+    size_t got;
+    size_t stop_after;
+    unsigned long lines_to_first;
+    bool wrong;
+} query_t;
+
+static bool collect(const char *row, size_t len, time_t when, void *ctx) {
+    query_t *q = ctx;
+    if (q->got == 0) q->lines_to_first = sd_host_stats.lines;
+    if (q->next >= n_rows || (uint32_t)when != times[q->next] || row[len - 1] != '\n') q->wrong = true;
+    q->next++;
+    q->got++;
+    return q->got < q->stop_after;
+}
+
+// First row at or after t
+static size_t lower_bound(uint32_t t) {
+    size_t lo = 0, hi = n_rows;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (times[mid] < t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void check_query(time_t from, time_t to, size_t stop_after) {
+    size_t first = lower_bound(from < 0 ? 0 : (uint32_t)from);
+    size_t end = to < from ? first : lower_bound((uint32_t)to + 1);
+    size_t want = end - first < stop_after ? end - first : stop_after;
+
+    query_t q = {.next = first, .stop_after = stop_after};
+    memset(&sd_host_stats, 0, sizeof(sd_host_stats));
+    CHECK(sdlog_query(from, to, collect, &q) == ESP_OK);
+    CHECK_MSG(q.got == want && !q.wrong, "%ld..%ld: %zu rows, want %zu", (long)from, (long)to, q.got, want);
+
+    // A binary search of the index, then at most one block read before the first match
+    size_t entries = index_entries(), probes = 1;
+    while ((1ul << probes) <= entries) probes++;
+    CHECK_MSG(sd_host_stats.freads <= probes, "%lu index reads for %zu entries", sd_host_stats.freads, entries);
+    if (q.got) CHECK_MSG(q.lines_to_first <= SDLOG_BLOCK_ROWS + 1, "%lu rows read to the first match", q.lines_to_first);
+}
+
+static void test_queries(void) {
+    uint32_t end = times[n_rows - 1];
+    for (int i = 0; i < 1000; i++) {
+        // Ranges starting on a stored time, between rows, and before or after the log
+        time_t from = i % 3 == 0 ? times[check_rand_below(n_rows)] : START - 86400 + check_rand_below(end - START + 2 * 86400);
+        time_t to = from + (check_rand_below(50) ? check_rand_below(86400) : check_rand_below(end - START));
+        check_query(from, to, SIZE_MAX);
+    }
+
+    // Each block's first second alone, which a repeated second can carry over from the block before
+    for (size_t i = 0; i < n_rows; i += SDLOG_BLOCK_ROWS) check_query(times[i], times[i], SIZE_MAX);
+    check_query(0, INT32_MAX, SIZE_MAX);
+    check_query(end + 1, INT32_MAX, SIZE_MAX);
+    check_query(START + 100000, START, SIZE_MAX);
+
+    // The callback ends the query
+    check_query(START, INT32_MAX, 1);
+    check_query(START, INT32_MAX, 1000);
+}
+
+static void test_empty(void) {
+    sd_host_reset();
+    state.magic = 0;
+    query_t q = {.stop_after = SIZE_MAX};
+    CHECK(sdlog_query(0, INT32_MAX, collect, &q) == ESP_ERR_NOT_FOUND && q.got == 0);
+}
+
+static void test_row_time(void) {
+    time_t when;
+    CHECK(sdlog_row_time("'01-02-2026 10:00:00:000','101000','21.50','12.40','0.00'\n", &when) && when == 1769940000);
+    CHECK(!sdlog_row_time("garbage\n", &when));
+    CHECK(!sdlog_row_time("", &when));
+}
+
+int main(void) {
+    setenv("TZ", "UTC0", 1);
+    tzset();
+    test_empty();
+    test_row_time();
+
+    sd_host_reset();
+    build_log();
+    printf("%zu rows, %zu blocks, %d resets, %d index rebuilds\n", n_rows, index_entries(), resets, rebuilds);
+    test_queries();
+
+    // Rebuilt from nothing at full size
+    reset();
+    remove(SDLOG_INDEX_PATH);
+    times[n_rows] = times[n_rows - 1] + 120;
+    offsets[n_rows] = sd_host_size(SDLOG_DATA_PATH);
+    CHECK(sdlog_append(times[n_rows], 100000, 21.5f, 12.4f) == ESP_OK);
+    n_rows++;
+    CHECK(index_matches());
+    test_queries();
+    return check_result();
+}
@@ -0,0 +1,196 @@
+// Swinging-door filter: rebuilding each series from the kept points by straight lines must
+// land within the deadband of every sample, on noise, ramps, steps and spikes, with the
+// heartbeat and forced points honoured. Kept points are stored the way sensors.c stores
+// rows, with a flush before each upload, and must come out once each and in time order.
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "sdt.c"
+
+#define SAMPLES   200000
+#define HEARTBEAT (60 * 60)
+
+typedef struct {
+    uint32_t t;
+    double v;
+} point_t;
+
+static point_t samples[SAMPLES];
+static point_t kept[SAMPLES];
+static size_t n_kept;
+
+// Standard normal from the check generator
+static double gauss(void) {
+    double u = (check_rand() + 1.0) / 4294967297.0;
+    double v = check_rand() / 4294967296.0;
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+// Pressure in counts: noise, slow tides, pump steps and the odd spike, sampled every two
+// minutes with gaps
+static void make_series(size_t n, double noise, double step_every) {
+    uint32_t t = 1767225600;
+    double level = 101325;
+    for (size_t i = 0; i < n; i++) {
+        t += check_rand_below(16) ? 120 : 1 + check_rand_below(6 * 3600);
+        if (check_rand_below(1000) < step_every) level += (int)check_rand_below(2001) - 1000;
+        double v = level + 300 * sin(2 * M_PI * t / 44712.0) + noise * gauss();
+        if (check_rand_below(2000) == 0) v += 5000;
+        samples[i].t = t;
+        samples[i].v = round(v);
+    }
+}
+
+// The caller's side, as log_payload_sample() and sensor_flush_held() run it
+static struct {
+    sdt_t sdt;
+    point_t held;
+} node;
+
+static void store(point_t p) {
+    kept[n_kept++] = p;
+}
+
+static void node_add(double deadband, point_t p, bool force) {
+    unsigned emit = sdt_add(&node.sdt, deadband, HEARTBEAT, p.t, p.v, force);
+    if (emit & SDT_EMIT_HELD) store(node.held);
+    if (emit & SDT_EMIT_NEW) {
+        store(p);
+    } else {
+        node.held = p;
+    }
+}
+
+static void node_flush(void) {
+    if (sdt_flush(&node.sdt)) store(node.held);
+}
+
+// Feeds the series, flushing as uploads would, and ends with a flush so the tail is kept
+static void run(size_t n, double deadband, unsigned flush_one_in, bool forced) {
+    memset(&node, 0, sizeof(node));
+    n_kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        node_add(deadband, samples[i], forced && check_rand_below(500) == 0);
+        if (flush_one_in && check_rand_below(flush_one_in) == 0) node_flush();
+    }
+    node_flush();
+}
+
+// Every sample against the line between the kept points around it
+static double worst_error(size_t n) {
+    double worst = 0;
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        while (k + 1 < n_kept && kept[k + 1].t <= samples[i].t) k++;
+        double rebuilt = kept[k].v;
+        if (kept[k].t != samples[i].t && k + 1 < n_kept) {
+            double f = (double)(samples[i].t - kept[k].t) / (kept[k + 1].t - kept[k].t);
+            rebuilt = kept[k].v + f * (kept[k + 1].v - kept[k].v);
+        }
+        double err = fabs(rebuilt - samples[i].v);
+        if (err > worst) worst = err;
+    }
+    return worst;
+}
+
+// Kept points are samples, once each, in order, starting with the first and ending with the last
+static bool kept_in_order(size_t n) {
+    if (n_kept == 0 || kept[0].t != samples[0].t || kept[n_kept - 1].t != samples[n - 1].t) return false;
+    size_t i = 0;
+    for (size_t k = 0; k < n_kept; k++) {
+        while (i < n && samples[i].t < kept[k].t) i++;
+        if (i == n || samples[i].t != kept[k].t || samples[i].v != kept[k].v) return false;
+        if (k > 0 && kept[k].t <= kept[k - 1].t) return false;
+    }
+    return true;
+}
+
+static uint32_t longest_gap(void) {
+    uint32_t gap = 0;
+    for (size_t k = 1; k < n_kept; k++) {
+        if (kept[k].t - kept[k - 1].t > gap) gap = kept[k].t - kept[k - 1].t;
+    }
+    return gap;
+}
+
+static void test_error_bound(void) {
+    double deadbands[] = {1, 10, 50, 200, 1000};
+    for (int run_no = 0; run_no < 40; run_no++) {
+        size_t n = 1 + check_rand_below(run_no % 4 ? 20000 : SAMPLES);
+        make_series(n, run_no % 3 ? 5 : 80, run_no % 2 ? 2 : 0);
+        double deadband = deadbands[run_no % 5];
+        unsigned flush_one_in = run_no % 3 == 0 ? 0 : run_no % 3 == 1 ? 2 : 30;
+        run(n, deadband, flush_one_in, run_no % 2);
+
+        double worst = worst_error(n);
+        CHECK_MSG(worst <= deadband * (1 + 1e-9), "run %d: off by %.3f with deadband %.0f", run_no, worst, deadband);
+        CHECK_MSG(kept_in_order(n), "run %d: kept points out of order", run_no);
+
+        // No gap longer than the heartbeat, unless the samples themselves had one
+        uint32_t sample_gap = 0;
+        for (size_t i = 1; i < n; i++) {
+            if (samples[i].t - samples[i - 1].t > sample_gap) sample_gap = samples[i].t - samples[i - 1].t;
+        }
+        CHECK_MSG(longest_gap() < HEARTBEAT + sample_gap, "run %d: %u s between kept points", run_no, longest_gap());
+    }
+}
+
+static void test_compresses(void) {
+    // Quiet water with a deadband above the noise keeps few points
+    make_series(SAMPLES, 5, 0);
+    run(SAMPLES, 50, 30, false);
+    double ratio = (double)SAMPLES / n_kept;
+    printf("Default deadband: %zu of %d samples kept, %.1f:1\n", n_kept, SAMPLES, ratio);
+    CHECK_MSG(ratio > 5, "only %.1f:1", ratio);
+
+    // Flushing every sample keeps every sample and still holds the bound
+    run(2000, 50, 1, false);
+    CHECK(n_kept == 2000 && worst_error(2000) == 0);
+}
+
+static void test_flush(void) {
+    sdt_t s = {0};
+    CHECK(!sdt_flush(&s));
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 1000, 0, false) == SDT_EMIT_NEW);
+    // Nothing held right after a kept point
+    CHECK(!sdt_flush(&s));
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 1120, 5, false) == 0);
+    CHECK(sdt_flush(&s));
+    // The flushed point is the anchor now: a later point on its line isn't reported again
+    CHECK(!sdt_flush(&s) && s.anchor_t == 1120 && s.anchor_v == 5);
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 1240, 10, false) == 0);
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 1360, 500, false) == SDT_EMIT_HELD);
+    CHECK(s.anchor_t == 1240 && s.held_t == 1360);
+}
+
+static void test_edges(void) {
+    sdt_t s = {0};
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 5000, 0, false) == SDT_EMIT_NEW);
+    // The same second or the clock stepping back starts over from the new point
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 5000, 3, false) == SDT_EMIT_NEW);
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 5120, 3, false) == 0);
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 100, 3, false) == SDT_EMIT_NEW && !s.has_held);
+
+    // Forced points are kept, along with the held one the line to them would lose
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 220, 3, false) == 0);
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 340, 3, true) == SDT_EMIT_NEW);
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 460, 50, false) == 0);
+    CHECK(sdt_add(&s, 10, HEARTBEAT, 580, 3, true) == (SDT_EMIT_HELD | SDT_EMIT_NEW));
+
+    // A flat series is kept once per heartbeat
+    memset(&s, 0, sizeof(s));
+    int stored = 0;
+    for (uint32_t t = 0; t <= 10 * HEARTBEAT; t += 120) {
+        if (sdt_add(&s, 10, HEARTBEAT, 1000 + t, 42, false) & SDT_EMIT_NEW) stored++;
+    }
+    CHECK_MSG(stored == 11, "%d kept", stored);
+}
+
+int main(void) {
+    test_error_bound();
+    test_compresses();
+    test_flush();
+    test_edges();
+    return check_result();
+}
@@ -0,0 +1,263 @@
+// The uplink transports against stand-ins: an MQTT broker behind the ESP-MQTT client API and
+// an HTTP server behind upload_buffer_to_server. Checks what reaches the server, how rows are
+// batched, and that a config save that fails in NVS says so and leaves flash as it was.
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "nvs_sim.h"
+#include "rtos_sim.h"
+#include "uplink.c"
+#include "nodecfg.c"
+
+// Broker behaviour for the next connection
+static struct {
+    bool refuse;            // CONNECT fails
+    int ack_limit;          // PUBACKs sent before the broker goes quiet, negative for all
+    esp_mqtt_client_config_t config;
+    char uri[128];
+    int messages;
+    char topic[128];
+    char data[8192];
+    size_t data_len;
+    size_t largest;
+    bool bad_prefix;
+} broker;
+
+struct esp_mqtt_client {
+    esp_event_handler_t handler;
+    void *handler_args;
+    bool started;
+};
+
+static struct {
+    int calls;
+    char url[256];
+    char body[8192];
+    size_t len;
+    esp_err_t result;
+} server;
+
+static int attempts_recorded;
+static bool attempt_ok;
+static link_plan_t plan = {.upload_now = true, .timeout_ms = 5000, .attempts = 3, .chunk_bytes = 1024};
+
+const char DigiCertGlobalRootG2_crt_pem_start[] = "-----BEGIN CERTIFICATE-----\n";
+
+esp_err_t esp_crt_bundle_attach(void *conf) {
+    return ESP_OK;
+}
+
+void power_lock_cpu(void) {}
+void power_unlock_cpu(void) {}
+
+// The policy part of the config blob isn't used here
+void node_policy_defaults(node_policy_t *p) {
+    memset(p, 0, sizeof(*p));
+}
+
+const link_plan_t *link_current_plan(void) {
+    return &plan;
+}
+
+void link_record_attempt(size_t bytes, uint32_t handshake_ms, uint32_t transfer_ms, bool ok) {
+    attempts_recorded++;
+    attempt_ok = ok;
+}
+
+esp_err_t coap_uplink_send(const uplink_config_t *cfg, const uplink_payload_t *payload, char *response_buf, size_t buf_size) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t upload_buffer_to_server(const char *data, size_t data_len, const char *url, char *response_buf, size_t buf_size) {
+    server.calls++;
+    strlcpy(server.url, url, sizeof(server.url));
+    server.len = data_len < sizeof(server.body) ? data_len : sizeof(server.body) - 1;
+    memcpy(server.body, data, server.len);
+    server.body[server.len] = '\0';
+    if (response_buf && buf_size) strlcpy(response_buf, "status:'ok'\n", buf_size);
+    return server.result;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+    broker.config = *config;
+    strlcpy(broker.uri, config->broker.address.uri, sizeof(broker.uri));
+    return calloc(1, sizeof(struct esp_mqtt_client));
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t handler, void *handler_args) {
+    client->handler = handler;
+    client->handler_args = handler_args;
+    return ESP_OK;
+}
+
+static void deliver(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event) {
+    client->handler(client->handler_args, "MQTT_EVENTS", event, NULL);
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    client->started = true;
+    rtos_sim_advance_ms(400);   // TLS handshake
+    deliver(client, broker.refuse ? MQTT_EVENT_ERROR : MQTT_EVENT_CONNECTED);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+    client->started = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+    free(client);
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain) {
+    CHECK(client->started && qos == 1 && retain == 0);
+    strlcpy(broker.topic, topic, sizeof(broker.topic));
+
+    // Every message leads with the geoutm line, the rows follow
+    const char *prefix = "geoutm:'";
+    const char *line_end = memchr(data, '\n', len);
+    if (strncmp(data, prefix, strlen(prefix)) != 0 || !line_end) {
+        broker.bad_prefix = true;
+    } else {
+        size_t header = line_end + 1 - data;
+        memcpy(broker.data + broker.data_len, data + header, len - header);
+        broker.data_len += len - header;
+    }
+    if ((size_t)len > broker.largest) broker.largest = len;
+
+    broker.messages++;
+    if (broker.ack_limit < 0 || broker.messages <= broker.ack_limit) deliver(client, MQTT_EVENT_PUBLISHED);
+    return broker.messages;
+}
+
+static char rows[6000];
+
+static size_t make_rows(size_t count) {
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        len += snprintf(rows + len, sizeof(rows) - len, "'01-02-2026 10:%02u:00:000','%u','21.50','12.40','0.00'\n",
+                        (unsigned)(i % 60), 101000 + (unsigned)i);
+    }
+    return len;
+}
+
+static void reset(void) {
+    memset(&broker, 0, sizeof(broker));
+    broker.ack_limit = -1;
+    memset(&server, 0, sizeof(server));
+    attempts_recorded = 0;
+    attempt_ok = false;
+    plan.chunk_bytes = 1024;
+    nvs_sim_reset();
+    rtos_sim_reset();
+    memset(&cache, 0, sizeof(cache));
+}
+
+static uplink_config_t mqtt_config(void) {
+    uplink_config_t cfg;
+    uplink_load_config(&cfg);
+    cfg.transport = UPLINK_TRANSPORT_MQTT;
+    strlcpy(cfg.mqtt_uri, "mqtts://broker.example.com:8883", sizeof(cfg.mqtt_uri));
+    return cfg;
+}
+
+static void test_http(void) {
+    reset();
+    size_t len = make_rows(5);
+    uplink_payload_t payload = {.key = "k3y", .sensor_id = "S42", .geoutm = "12N 500000 5600000", .rows = rows, .rows_len = len};
+    char reply[64];
+
+    CHECK(uplink_send(&payload, reply, sizeof(reply)) == ESP_OK);
+    CHECK(server.calls == 1);
+    CHECK(strcmp(server.url, UPLINK_DEFAULT_DATA_URL) == 0);
+    CHECK(strncmp(server.body, "key:'k3y'\nsensorID:'S42'\ngeoutm:'12N 500000 5600000'\n", 53) == 0);
+    CHECK(server.len == 53 + len && memcmp(server.body + 53, rows, len) == 0);
+    CHECK(strcmp(reply, "status:'ok'\n") == 0);
+
+    // An MQTT transport without a broker falls back to HTTP
+    uplink_config_t cfg = mqtt_config();
+    cfg.mqtt_uri[0] = '\0';
+    CHECK(uplink_save_config(&cfg) == ESP_OK);
+    CHECK(uplink_send(&payload, reply, sizeof(reply)) == ESP_OK);
+    CHECK(server.calls == 2 && broker.messages == 0);
+}
+
+static void test_mqtt(void) {
+    reset();
+    uplink_config_t cfg = mqtt_config();
+    CHECK(uplink_save_config(&cfg) == ESP_OK);
+
+    size_t len = make_rows(60);
+    uplink_payload_t payload = {.key = "k3y", .sensor_id = "S42", .geoutm = "12N 500000 5600000", .rows = rows, .rows_len = len};
+    char reply[64] = "stale";
+    CHECK(uplink_send(&payload, reply, sizeof(reply)) == ESP_OK);
+    CHECK(reply[0] == '\0');
+    CHECK(server.calls == 0);
+
+    // Connection: the broker's certificate is checked against the bundle, the node logs in as itself
+    CHECK(strcmp(broker.uri, cfg.mqtt_uri) == 0);
+    CHECK(broker.config.broker.verification.crt_bundle_attach == esp_crt_bundle_attach);
+    CHECK(broker.config.broker.verification.certificate == NULL);
+    CHECK(strcmp(broker.config.credentials.client_id, "S42") == 0);
+    CHECK(strcmp(broker.config.credentials.authentication.password, "k3y") == 0);
+    CHECK(broker.config.session.disable_clean_session);
+
+    // Batches: whole rows under the size limit, all of them, in order, each tagged with geoutm
+    CHECK(strcmp(broker.topic, "volsense/S42/data") == 0);
+    CHECK(!broker.bad_prefix);
+    CHECK(broker.messages > 1 && broker.largest <= UPLINK_MQTT_BATCH_BYTES);
+    CHECK(broker.data_len == len && memcmp(broker.data, rows, len) == 0);
+    CHECK(attempts_recorded == 1 && attempt_ok);
+
+    // A weak link plans smaller chunks
+    reset();
+    CHECK(uplink_save_config(&cfg) == ESP_OK);
+    plan.chunk_bytes = 512;
+    CHECK(uplink_send(&payload, reply, sizeof(reply)) == ESP_OK);
+    CHECK(broker.largest <= 512 && broker.data_len == len);
+
+    // Without every PUBACK the rows aren't delivered
+    reset();
+    CHECK(uplink_save_config(&cfg) == ESP_OK);
+    broker.ack_limit = 2;
+    CHECK(uplink_send(&payload, reply, sizeof(reply)) == ESP_ERR_TIMEOUT);
+    CHECK(attempts_recorded == 1 && !attempt_ok);
+
+    reset();
+    CHECK(uplink_save_config(&cfg) == ESP_OK);
+    broker.refuse = true;
+    CHECK(uplink_send(&payload, reply, sizeof(reply)) == ESP_FAIL);
+    CHECK(broker.messages == 0 && attempts_recorded == 1 && !attempt_ok);
+
+    // Nothing to send, no connection
+    reset();
+    CHECK(uplink_save_config(&cfg) == ESP_OK);
+    payload.rows_len = 0;
+    CHECK(uplink_send(&payload, reply, sizeof(reply)) == ESP_OK);
+    CHECK(broker.uri[0] == '\0');
+}
+
+static void test_save_config(void) {
+    uplink_config_t cfg = mqtt_config();
+    reset();
+    nvs_sim_fail_write(0);
+    CHECK(uplink_save_config(&cfg) == ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    CHECK(nvs_sim_commits() == 0);
+    CHECK(nodecfg_reload() == ESP_ERR_NOT_FOUND && uplink_config()->transport == UPLINK_TRANSPORT_HTTP);
+
+    reset();
+    CHECK(uplink_save_config(&cfg) == ESP_OK);
+    uplink_config_t loaded;
+    CHECK(uplink_load_config(&loaded) == ESP_OK);
+    CHECK(memcmp(&loaded, &cfg, sizeof(cfg)) == 0);
+}
+
+int main(void) {
+    test_http();
+    test_mqtt();
+    test_save_config();
+    return check_result();
+}
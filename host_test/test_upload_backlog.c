@@ -0,0 +1,252 @@
+// Flash log uploads with more rows per upload interval than one read batch: the wake stub
+// takes all but one sample of the interval, so every app boot logs a full interval and
+// uploads it. Each upload has to read batch after batch until the log is caught up, or the
+// unacknowledged rows pile up until the circular log overwrites them. Checks that every row
+// reaches the server once and in order, also after outages, and that no upload is larger
+// than the link budget allows.
+#define CONFIG_NODE_FLASHLOG 1
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "flash_sim.h"
+#include "nvs_sim.h"
+#include "rtos_sim.h"
+#include "http_client_sim.h"
+#include "upload.c"
+#include "uplink.c"
+#include "provision.c"
+#include "nodecfg.c"
+#include "linkqual.c"
+#include "flashlog.c"
+
+#define SECTORS      16
+#define UPLOAD_EVERY 96
+#define OUTAGE       12             // Upload intervals without Wi-Fi, well within the log
+#define START        1767225600     // 2026-01-01 UTC
+
+static struct {
+    uint32_t next;          // Pressure of the row expected next; rows count up from 1
+    int uploads;
+    int bad;                // Rows missing, repeated or out of order
+    size_t rows;            // In the last upload
+    size_t largest;         // Body bytes of the largest upload
+} cloud;
+
+static struct {
+    bool wifi;
+    uint32_t logged;        // Rows handed to the flash log so far
+    size_t stub_taken;
+} node;
+
+const char *const dlog_module_names[DLOG_MODULE_COUNT] = {"MAIN", "SENSORS", "SD", "UPLOAD", "WIFI"};
+const char *payloadpath = "/sdcard/payload.txt";
+const char DigiCertGlobalRootG2_crt_pem_start[] = "-----BEGIN CERTIFICATE-----\n";
+
+struct tm get_time_now(int *milliseconds) {
+    time_t t = START;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    *milliseconds = 0;
+    return tm;
+}
+
+bool wifi_is_connected(void) {
+    return node.wifi;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info) {
+    memset(ap_info, 0, sizeof(*ap_info));
+    ap_info->rssi = -60;
+    return ESP_OK;
+}
+
+esp_err_t load_registration_metadata(char *key, size_t key_size, char *sensorID, size_t id_size, char *geoutm, size_t geo_size) {
+    strlcpy(key, "k1", key_size);
+    strlcpy(sensorID, "42", id_size);
+    strlcpy(geoutm, "17T 630084 4833438", geo_size);
+    return ESP_OK;
+}
+
+esp_err_t save_registration_metadata(const char *key, const char *sensorID, const char *geoutm) {
+    return ESP_OK;
+}
+
+size_t sd_atomic_header_skip(const char *data, size_t len) {
+    return 0;
+}
+
+size_t sensor_aggregates(const agg_window_t **windows) {
+    *windows = NULL;
+    return 0;
+}
+
+void sensor_aggregates_sent(size_t count) {}
+void sensor_flush_held(const char *path) {}
+
+int agg_format_row(const agg_window_t *w, char *buf, size_t size) {
+    return -1;
+}
+
+void sdlog_backfill_request(uint32_t from, uint32_t to) {}
+
+size_t wakestub_taken(void) {
+    return node.stub_taken;
+}
+
+bool ota_on_trial(void) {
+    return false;
+}
+
+esp_err_t ota_offer(const ota_offer_t *offer) {
+    return ESP_OK;
+}
+
+void power_lock_cpu(void) {}
+void power_unlock_cpu(void) {}
+
+esp_err_t esp_crt_bundle_attach(void *conf) {
+    return ESP_OK;
+}
+
+esp_err_t coap_uplink_send(const uplink_config_t *cfg, const uplink_payload_t *payload, char *response_buf, size_t buf_size) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+    return NULL;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t handler, void *handler_args) {
+    return ESP_FAIL;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    return ESP_FAIL;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain) {
+    return -1;
+}
+
+// Checks the rows of the file part against the sequence logged; the pressure counts them
+static void data_server(http_client_sim_request_t *req, void *ctx) {
+    cloud.uploads++;
+    if (req->body_len > cloud.largest) cloud.largest = req->body_len;
+    cloud.rows = 0;
+
+    char *body = malloc(req->body_len + 1);
+    CHECK(body != NULL);
+    memcpy(body, req->body, req->body_len);
+    body[req->body_len] = '\0';
+    for (char *line = strstr(body, "\n'"); line; line = strstr(line, "\n'")) {
+        line++;
+        unsigned long pressure;
+        if (sscanf(line, "'%*[^']','%lu'", &pressure) != 1) continue;
+        if (pressure != cloud.next) cloud.bad++;
+        cloud.next = pressure + 1;
+        cloud.rows++;
+    }
+    free(body);
+
+    req->status = 200;
+    req->reply = "status:'ok'\n";
+    req->reply_len = strlen(req->reply);
+}
+
+// One app boot: the stub's samples and this wake's go to the flash log, then the upload
+static esp_err_t boot(void) {
+    policy_loaded = false;
+    nodecfg_load();
+
+    node.stub_taken = UPLOAD_EVERY - 1;
+    for (size_t i = 0; i <= node.stub_taken; i++) {
+        node.logged++;
+        CHECK(flashlog_append_at(START + node.logged * 120, 0, node.logged, 21.5f, 12.4f) == ESP_OK);
+    }
+    esp_err_t err = try_upload_now();
+    CHECK(http_client_sim_live() == 0);
+    return err;
+}
+
+// Rows logged and not yet acknowledged; ack records take sequence numbers too
+static size_t backlog(void) {
+    static flashlog_record_t rest[SECTORS * FLASHLOG_RECORDS_PER_SECTOR];
+    size_t count = 0;
+    flashlog_flush();
+    CHECK(flashlog_read_since(flashlog_acked_seq(), rest, sizeof(rest) / sizeof(rest[0]), &count) == ESP_OK);
+    return count;
+}
+
+static void fresh_node(void) {
+    memset(&cloud, 0, sizeof(cloud));
+    cloud.next = 1;
+    memset(&node, 0, sizeof(node));
+    node.wifi = true;
+    nvs_sim_reset();
+    rtos_sim_reset();
+    http_client_sim_reset(data_server, NULL);
+    memset(&history, 0, sizeof(history));
+    wakes_since_upload = 0;
+
+    flash_sim_init(FLASHLOG_PARTITION_LABEL, SECTORS * FLASH_SIM_SECTOR);
+    memset(&state, 0, sizeof(state));
+    pending_count = 0;
+    log_part = NULL;
+    CHECK(flashlog_init() == ESP_OK);
+
+    nodecfg_load();
+    node_policy_t p;
+    node_policy_defaults(&p);
+    p.upload_every = UPLOAD_EVERY;
+    CHECK(node_policy_save(&p) == ESP_OK);
+}
+
+// Every upload interval logs more rows than one batch; each upload has to take them all
+static void test_keeps_up(void) {
+    fresh_node();
+    for (int i = 0; i < 200; i++) {
+        CHECK(boot() == ESP_OK);
+        CHECK_MSG(cloud.rows == UPLOAD_EVERY, "upload %d: %zu rows", i, cloud.rows);
+        CHECK_MSG(backlog() == 0, "upload %d: %zu rows left", i, backlog());
+    }
+    CHECK(cloud.uploads == 200 && cloud.bad == 0 && cloud.next == node.logged + 1);
+}
+
+// After a few intervals without Wi-Fi the backlog goes out over the next uploads, each within
+// the budget the link allows, and nothing is lost to the circular log
+static void test_outage(void) {
+    fresh_node();
+    CHECK(boot() == ESP_OK);
+    node.wifi = false;
+    for (int i = 0; i < OUTAGE; i++) CHECK(boot() == ESP_ERR_WIFI_NOT_CONNECT);
+    node.wifi = true;
+
+    int uploads = 0;
+    while (backlog() > 0 && uploads < 10) {
+        CHECK(boot() == ESP_OK);
+        uploads++;
+    }
+    printf("%lu rows after the outage in %d uploads, the largest %zu bytes\n", (unsigned long)(OUTAGE * UPLOAD_EVERY), uploads,
+           cloud.largest);
+    CHECK_MSG(uploads > 1 && uploads <= 3, "caught up after %d uploads", uploads);
+    CHECK(cloud.bad == 0 && cloud.next == node.logged + 1);
+    CHECK_MSG(cloud.largest <= link_upload_budget() + UPLOAD_FLASHLOG_MAX_ROWS * UPLOAD_FLASHLOG_ROW_MAX + 512,
+              "%zu byte upload", cloud.largest);
+}
+
+int main(void) {
+    setenv("TZ", "UTC0", 1);
+    tzset();
+    test_keeps_up();
+    test_outage();
+    return check_result();
+}
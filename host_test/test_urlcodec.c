@@ -0,0 +1,103 @@
+// Differential fuzz of the table-driven URL codecs against the isxdigit/strtol versions they
+// replaced (url_ref.h). For every input and buffer size the output must match byte for byte,
+// the lengths must be exact, and truncation must be reported exactly when it happens.
+#include <string.h>
+#include "check.h"
+#include "url_ref.h"
+#include "urlcodec.c"
+
+#define RUNS 50000
+#define INPUT_MAX 300
+#define GUARD 0x5A
+
+// Inputs weighted towards escapes, near-escapes and runs of unreserved bytes
+static size_t random_input(char *in) {
+    static const char *const pieces[] = {
+        "%41", "%e9", "%Zz", "%4", "%", "%%", "+", " ", "abc", "Hello-World_1.0~", "&", "=", "/", "%00",
+    };
+    size_t len = 0, target = check_rand_below(INPUT_MAX);
+    while (len < target) {
+        if (check_rand_below(4) == 0) {
+            char c = (char)check_rand();
+            if (c) in[len++] = c;
+            continue;
+        }
+        const char *p = pieces[check_rand_below(sizeof(pieces) / sizeof(pieces[0]))];
+        size_t n = strlen(p);
+        if (len + n > INPUT_MAX) break;
+        memcpy(in + len, p, n);
+        len += n;
+    }
+    in[len] = '\0';
+    return len;
+}
+
+typedef esp_err_t (*codec_fn)(const char *, char *, size_t);
+typedef size_t (*ref_fn)(const char *, char *, size_t);
+typedef size_t (*len_fn)(const char *);
+
+static void compare(int run, const char *name, const char *in, codec_fn codec, ref_fn ref, len_fn length) {
+    static char full[INPUT_MAX * 3 + 1];
+    size_t full_len = ref(in, full, sizeof(full));
+    CHECK_MSG(length(in) == full_len, "run %d %s: length %zu, expected %zu", run, name, length(in), full_len);
+
+    // Every buffer size around the exact fit, plus a few random ones
+    size_t sizes[8] = {1, 2, full_len, full_len + 1, full_len + 2, 1 + check_rand_below(full_len + 1),
+                       1 + check_rand_below(full_len + 1), 3};
+    for (int s = 0; s < 8; s++) {
+        size_t size = sizes[s] ? sizes[s] : 1;
+        char out[INPUT_MAX * 3 + 8], expect[INPUT_MAX * 3 + 8];
+        memset(out, GUARD, sizeof(out));
+        size_t expect_len = ref(in, expect, size);
+        esp_err_t err = codec(in, out, size);
+
+        CHECK_MSG(memcmp(out, expect, expect_len + 1) == 0, "run %d %s size %zu: output differs", run, name, size);
+        CHECK_MSG(err == (size > full_len ? ESP_OK : ESP_ERR_INVALID_SIZE), "run %d %s size %zu: err %d", run, name,
+                  size, err);
+        CHECK_MSG(out[size] == (char)GUARD, "run %d %s size %zu: wrote past the buffer", run, name, size);
+    }
+}
+
+static void test_differential(void) {
+    static char in[INPUT_MAX + 1];
+    for (int run = 0; run < RUNS; run++) {
+        random_input(in);
+        compare(run, "decode", in, url_decode, ref_url_decode, url_decoded_len);
+        compare(run, "encode", in, url_encode, ref_url_encode, url_encoded_len);
+    }
+}
+
+// Decoding what was encoded gives the input back
+static void test_round_trip(void) {
+    static char in[INPUT_MAX + 1], enc[INPUT_MAX * 3 + 1], dec[INPUT_MAX + 1];
+    for (int run = 0; run < RUNS / 10; run++) {
+        random_input(in);
+        char *nul = strstr(in, "%00");
+        if (nul) *nul = '\0';      // A decoded NUL would end the comparison early
+        CHECK(url_encode(in, enc, sizeof(enc)) == ESP_OK);
+        CHECK(url_decode(enc, dec, sizeof(dec)) == ESP_OK);
+        CHECK_MSG(strcmp(in, dec) == 0, "run %d: round trip differs", run);
+    }
+}
+
+static void test_edges(void) {
+    char out[8];
+    CHECK(url_decode("abc", out, 0) == ESP_ERR_INVALID_ARG);
+    CHECK(url_encode("abc", out, 0) == ESP_ERR_INVALID_ARG);
+    CHECK(url_decode("", out, 1) == ESP_OK && out[0] == '\0');
+    CHECK(url_encode("", out, 1) == ESP_OK && out[0] == '\0');
+
+    // An escape is never split, a '%' at the end stays literal
+    CHECK(url_encode("a b", out, 4) == ESP_ERR_INVALID_SIZE && strcmp(out, "a") == 0);
+    CHECK(url_encode("a b", out, 6) == ESP_OK && strcmp(out, "a%20b") == 0);
+    CHECK(url_decode("50%", out, sizeof(out)) == ESP_OK && strcmp(out, "50%") == 0);
+    CHECK(url_decode("%4", out, sizeof(out)) == ESP_OK && strcmp(out, "%4") == 0);
+    CHECK(url_decode("%c3%A9", out, sizeof(out)) == ESP_OK && strcmp(out, "\xc3\xa9") == 0);
+}
+
+int main(void) {
+    test_edges();
+    test_differential();
+    test_round_trip();
+    return check_result();
+}
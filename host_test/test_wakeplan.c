@@ -0,0 +1,206 @@
+// Wake stub decisions: when it keeps a sample and sleeps again and when it lets the app
+// boot, and that it never writes outside the ring whatever RTC memory holds. Ends with a
+// long run of wakes against an app that takes the ring on every boot and re-arms, checking
+// that each sample is logged exactly once, in order.
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "wakeplan.c"
+
+#define PERIOD_US (2 * 60 * 1000000ULL)
+#define GUARD     0xA5
+
+// RTC memory around the ring, to catch writes past its end
+static struct {
+    wake_ring_t ring;
+    uint8_t guard[64];
+} rtc;
+
+static bool guard_intact(void) {
+    for (size_t i = 0; i < sizeof(rtc.guard); i++) {
+        if (rtc.guard[i] != GUARD) return false;
+    }
+    return true;
+}
+
+static void rtc_power_on(void) {
+    // RTC memory holds whatever it holds after a power-on
+    uint8_t *raw = (uint8_t *)&rtc.ring;
+    for (size_t i = 0; i < sizeof(rtc.ring); i++) raw[i] = (uint8_t)check_rand();
+    memset(rtc.guard, GUARD, sizeof(rtc.guard));
+}
+
+static wake_sample_t sample(uint32_t pressure, uint16_t volt_raw, bool failed) {
+    wake_sample_t s = {.pressure = pressure, .volt_raw = volt_raw};
+    if (failed) s.flags = WAKE_SAMPLE_PRESSURE_FAILED;
+    return s;
+}
+
+// One wake as esp_wake_deep_sleep() runs it: the sample is only taken if the plan allows
+static wake_action_t stub_wake(const wake_sample_t *s) {
+    if (wakeplan_before_sample(&rtc.ring) == WAKE_BOOT) return WAKE_BOOT;
+    return wakeplan_after_sample(&rtc.ring, s);
+}
+
+static void test_unarmed(void) {
+    memset(&rtc, 0, sizeof(rtc));
+    memset(rtc.guard, GUARD, sizeof(rtc.guard));
+    CHECK(!wakeplan_armed(&rtc.ring));
+    CHECK(wakeplan_before_sample(&rtc.ring) == WAKE_BOOT);
+    CHECK(rtc.ring.reason == WAKE_REASON_UNARMED);
+
+    // Garbage, with a valid magic half the time
+    for (int run = 0; run < 20000; run++) {
+        rtc_power_on();
+        if (run % 2) rtc.ring.magic = WAKE_RING_MAGIC;
+        uint16_t count = rtc.ring.count;
+        wake_sample_t s = sample(1, 0, false);
+        s.volt_raw = rtc.ring.volt_raw_min;
+        for (int wake = 0; wake < WAKE_RING_SIZE + 2; wake++) {
+            if (stub_wake(&s) == WAKE_BOOT) break;
+        }
+        CHECK_MSG(guard_intact(), "run %d: wrote past the ring from count %u", run, count);
+        CHECK(rtc.ring.count <= WAKE_RING_SIZE || !wakeplan_armed(&rtc.ring));
+    }
+}
+
+static void test_arm(void) {
+    rtc_power_on();
+    rtc.ring.reason = WAKE_REASON_SENSOR;
+    wakeplan_arm(&rtc.ring, PERIOD_US, 10, 1000, 2000);
+    CHECK(wakeplan_armed(&rtc.ring));
+    CHECK(rtc.ring.count == 0 && rtc.ring.reason == WAKE_REASON_NONE);
+
+    // More than the ring holds: flushed when full
+    wakeplan_arm(&rtc.ring, PERIOD_US, WAKE_RING_SIZE + 50, 1000, 2000);
+    CHECK(rtc.ring.flush_at == WAKE_RING_SIZE);
+
+    // Plans that can't work let the app boot
+    wakeplan_arm(&rtc.ring, PERIOD_US, 0, 1000, 2000);
+    CHECK(wakeplan_before_sample(&rtc.ring) == WAKE_BOOT && rtc.ring.reason == WAKE_REASON_UNARMED);
+    wakeplan_arm(&rtc.ring, 0, 10, 1000, 2000);
+    CHECK(wakeplan_before_sample(&rtc.ring) == WAKE_BOOT && rtc.ring.reason == WAKE_REASON_UNARMED);
+
+    wakeplan_arm(&rtc.ring, PERIOD_US, 10, 1000, 2000);
+    wake_sample_t s = sample(1, 1500, false);
+    CHECK(stub_wake(&s) == WAKE_SLEEP);
+    wakeplan_disarm(&rtc.ring);
+    CHECK(!wakeplan_armed(&rtc.ring) && rtc.ring.count == 0);
+    CHECK(stub_wake(&s) == WAKE_BOOT && rtc.ring.reason == WAKE_REASON_UNARMED);
+}
+
+static void test_flush(void) {
+    for (uint16_t flush_at = 1; flush_at <= WAKE_RING_SIZE; flush_at++) {
+        rtc_power_on();
+        wakeplan_arm(&rtc.ring, PERIOD_US, flush_at, 1000, 2000);
+        for (uint16_t i = 0; i < flush_at; i++) {
+            wake_sample_t s = sample(100000 + i, 1000 + i, false);
+            CHECK(stub_wake(&s) == WAKE_SLEEP);
+        }
+        CHECK(rtc.ring.count == flush_at);
+        for (uint16_t i = 0; i < flush_at; i++) {
+            CHECK(rtc.ring.samples[i].pressure == 100000u + i && rtc.ring.samples[i].volt_raw == 1000 + i);
+        }
+
+        // The next wake boots before touching a sensor
+        wake_sample_t s = sample(1, 1500, false);
+        CHECK(stub_wake(&s) == WAKE_BOOT);
+        CHECK(rtc.ring.reason == WAKE_REASON_FLUSH && rtc.ring.count == flush_at);
+        CHECK(guard_intact());
+    }
+
+    // Called on a full ring anyway, it boots rather than write past the end
+    rtc_power_on();
+    wakeplan_arm(&rtc.ring, PERIOD_US, WAKE_RING_SIZE, 1000, 2000);
+    rtc.ring.count = WAKE_RING_SIZE;
+    wake_sample_t s = sample(1, 1500, false);
+    CHECK(wakeplan_after_sample(&rtc.ring, &s) == WAKE_BOOT);
+    CHECK(rtc.ring.reason == WAKE_REASON_FLUSH && rtc.ring.count == WAKE_RING_SIZE && guard_intact());
+}
+
+static void test_tier_and_sensor(void) {
+    rtc_power_on();
+    wakeplan_arm(&rtc.ring, PERIOD_US, 50, 1000, 2000);
+
+    // Bounds are inclusive
+    wake_sample_t s = sample(1, 1000, false);
+    CHECK(stub_wake(&s) == WAKE_SLEEP);
+    s.volt_raw = 2000;
+    CHECK(stub_wake(&s) == WAKE_SLEEP);
+
+    uint16_t outside[] = {999, 2001, 0, UINT16_MAX};
+    for (size_t i = 0; i < sizeof(outside) / sizeof(outside[0]); i++) {
+        rtc.ring.reason = WAKE_REASON_NONE;
+        s.volt_raw = outside[i];
+        CHECK(stub_wake(&s) == WAKE_BOOT);
+        CHECK(rtc.ring.reason == WAKE_REASON_TIER && rtc.ring.count == 2);
+    }
+
+    // The app retries a failed read with its own drivers; the sample isn't kept
+    s = sample(0, 1500, true);
+    CHECK(stub_wake(&s) == WAKE_BOOT);
+    CHECK(rtc.ring.reason == WAKE_REASON_SENSOR && rtc.ring.count == 2);
+    // A failed read outside the tier still reads as a sensor failure
+    s.volt_raw = 10;
+    CHECK(stub_wake(&s) == WAKE_BOOT && rtc.ring.reason == WAKE_REASON_SENSOR);
+}
+
+// Months of wakes: the battery drifts across tiers and reads fail now and then. On each
+// boot the app logs what the stub kept plus its own sample, then re-arms for the tier it
+// is in. Every wake's sample must reach the log once, in order.
+static void test_timeline(void) {
+    enum { WAKES = 200000, TIER = 400 };
+    static uint32_t logged[WAKES];
+    size_t n_logged = 0;
+    int boots[WAKE_REASON_SENSOR + 1] = {0};
+    int volt = 2000;
+
+    rtc_power_on();
+    for (uint32_t wake = 0; wake < WAKES; wake++) {
+        volt += (int)check_rand_below(21) - 10;
+        if (volt < 0) volt = 0;
+        if (volt > 4095) volt = 4095;
+        bool failed = check_rand_below(500) == 0;
+        wake_sample_t s = sample(wake + 1, volt, failed);
+
+        if (stub_wake(&s) == WAKE_SLEEP) continue;
+
+        // The app boots
+        CHECK(guard_intact());
+        wake_reason_t reason = rtc.ring.reason;
+        boots[reason]++;
+        if (wakeplan_armed(&rtc.ring)) {
+            for (uint16_t i = 0; i < rtc.ring.count; i++) logged[n_logged++] = rtc.ring.samples[i].pressure;
+        }
+        // Failed reads are retried by the app and succeed here
+        logged[n_logged++] = wake + 1;
+
+        uint16_t base = volt / TIER * TIER;
+        uint16_t flush_at = 1 + check_rand_below(WAKE_RING_SIZE + 10);
+        wakeplan_arm(&rtc.ring, PERIOD_US, flush_at, base, base + TIER - 1);
+    }
+    // Whatever is still in the ring
+    for (uint16_t i = 0; i < rtc.ring.count; i++) logged[n_logged++] = rtc.ring.samples[i].pressure;
+
+    CHECK_MSG(n_logged == WAKES, "%zu of %d samples logged", n_logged, WAKES);
+    for (size_t i = 0; i < n_logged && i < WAKES; i++) {
+        if (logged[i] != i + 1) {
+            CHECK_MSG(0, "log entry %zu is sample %u", i, logged[i]);
+            break;
+        }
+    }
+    CHECK(boots[WAKE_REASON_UNARMED] == 1);
+    CHECK(boots[WAKE_REASON_FLUSH] > 0 && boots[WAKE_REASON_TIER] > 0 && boots[WAKE_REASON_SENSOR] > 0);
+    // Most wakes never reach the app
+    int total = boots[WAKE_REASON_UNARMED] + boots[WAKE_REASON_FLUSH] + boots[WAKE_REASON_TIER] + boots[WAKE_REASON_SENSOR];
+    CHECK_MSG(total < WAKES / 10, "%d boots in %d wakes", total, WAKES);
+}
+
+int main(void) {
+    test_unarmed();
+    test_arm();
+    test_flush();
+    test_tier_and_sensor();
+    test_timeline();
+    return check_result();
+}
@@ -0,0 +1,163 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+#include "check.h"
+#include "esp_timer.h"
+#include "rtos_sim.h"
+#include "udp_sim.h"
+
+#define UDP_SIM_QUEUE 32
+#define UDP_SIM_MTU   4096
+#define UDP_SIM_SOCK  7
+
+typedef struct {
+    int64_t arrive_us;
+    size_t len;
+    uint8_t data[UDP_SIM_MTU];
+} datagram_t;
+
+static datagram_t queue[UDP_SIM_QUEUE];
+static int queued;
+static char server_host[64];
+static uint32_t server_ip;
+static udp_sim_server_fn server_fn;
+static unsigned loss_percent;
+static uint32_t rtt_ms = 80;
+static bool send_fails;
+static bool sock_open;
+static uint32_t rcv_timeout_ms;
+static int lookups;
+static size_t sent;
+
+void udp_sim_reset(const char *host, uint32_t ip, udp_sim_server_fn server) {
+    queued = 0;
+    snprintf(server_host, sizeof(server_host), "%s", host);
+    server_ip = ip;
+    server_fn = server;
+    loss_percent = 0;
+    rtt_ms = 80;
+    send_fails = false;
+    sock_open = false;
+    lookups = 0;
+    sent = 0;
+}
+
+void udp_sim_set_loss(unsigned percent) {
+    loss_percent = percent;
+}
+
+void udp_sim_set_rtt(uint32_t ms) {
+    rtt_ms = ms;
+}
+
+void udp_sim_move_server(uint32_t ip) {
+    server_ip = ip;
+}
+
+void udp_sim_fail_send(bool fail) {
+    send_fails = fail;
+}
+
+int udp_sim_lookups(void) {
+    return lookups;
+}
+
+size_t udp_sim_sent(void) {
+    return sent;
+}
+
+static bool lost(void) {
+    return check_rand_below(100) < loss_percent;
+}
+
+void udp_sim_reply(const uint8_t *data, size_t len, uint32_t delay_ms) {
+    if (lost() || queued == UDP_SIM_QUEUE || len > UDP_SIM_MTU) return;
+    datagram_t *d = &queue[queued++];
+    d->arrive_us = esp_timer_get_time() + (int64_t)(rtt_ms / 2 + delay_ms) * 1000;
+    d->len = len;
+    memcpy(d->data, data, len);
+}
+
+int udp_sim_socket(int domain, int type, int protocol) {
+    if (domain != AF_INET || type != SOCK_DGRAM) return -1;
+    sock_open = true;
+    return UDP_SIM_SOCK;
+}
+
+int udp_sim_setsockopt(int sock, int level, int name, const void *value, socklen_t len) {
+    if (sock != UDP_SIM_SOCK || !sock_open) return -1;
+    if (level == SOL_SOCKET && name == SO_RCVTIMEO && len == sizeof(struct timeval)) {
+        const struct timeval *tv = value;
+        rcv_timeout_ms = tv->tv_sec * 1000 + tv->tv_usec / 1000;
+    }
+    return 0;
+}
+
+ssize_t udp_sim_sendto(int sock, const void *data, size_t len, int flags, const struct sockaddr *to, socklen_t to_len) {
+    if (sock != UDP_SIM_SOCK || !sock_open || send_fails) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    const struct sockaddr_in *addr = (const struct sockaddr_in *)to;
+    sent += len;
+    if (addr->sin_addr.s_addr != htonl(server_ip) || lost()) return len;
+
+    // The server sees it half a round trip later and answers from there
+    rtos_sim_advance_ms(rtt_ms / 2);
+    server_fn(data, len);
+    return len;
+}
+
+// Next datagram due within the receive timeout, else the timeout passes
+ssize_t udp_sim_recv(int sock, void *buf, size_t size, int flags) {
+    if (sock != UDP_SIM_SOCK || !sock_open) return -1;
+    int first = -1;
+    for (int i = 0; i < queued; i++) {
+        if (first < 0 || queue[i].arrive_us < queue[first].arrive_us) first = i;
+    }
+    int64_t now = esp_timer_get_time();
+    int64_t limit = now + (int64_t)rcv_timeout_ms * 1000;
+    if (first < 0 || queue[first].arrive_us > limit) {
+        rtos_sim_advance_ms(rcv_timeout_ms);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    datagram_t *d = &queue[first];
+    if (d->arrive_us > now) rtos_sim_advance_ms((uint32_t)((d->arrive_us - now + 999) / 1000));
+    size_t n = d->len < size ? d->len : size;  // Like UDP, the rest of a long datagram is dropped
+    memcpy(buf, d->data, n);
+    queue[first] = queue[--queued];
+    return n;
+}
+
+int udp_sim_close(int sock) {
+    if (sock != UDP_SIM_SOCK || !sock_open) return -1;
+    sock_open = false;
+    queued = 0;
+    return 0;
+}
+
+int udp_sim_getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res) {
+    lookups++;
+    if (strcmp(node, server_host) != 0) return EAI_NONAME;
+
+    struct addrinfo *ai = calloc(1, sizeof(*ai) + sizeof(struct sockaddr_in));
+    struct sockaddr_in *addr = (struct sockaddr_in *)(ai + 1);
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((uint16_t)atoi(service));
+    addr->sin_addr.s_addr = htonl(server_ip);
+    ai->ai_family = AF_INET;
+    ai->ai_socktype = SOCK_DGRAM;
+    ai->ai_addr = (struct sockaddr *)addr;
+    ai->ai_addrlen = sizeof(*addr);
+    *res = ai;
+    return 0;
+}
+
+void udp_sim_freeaddrinfo(struct addrinfo *res) {
+    free(res);
+}
@@ -0,0 +1,37 @@
+#ifndef UDP_SIM_H
+#define UDP_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+// One node socket talking to one server over a simulated link, timed on the rtos_sim clock.
+// Datagrams are lost at the set rate in each direction and arrive after half the round trip.
+// The server is a callback that answers through udp_sim_reply.
+
+typedef void (*udp_sim_server_fn)(const uint8_t *data, size_t len);
+
+// The server listens on `host` (the name DNS answers for) at the given IPv4 address
+void udp_sim_reset(const char *host, uint32_t ip, udp_sim_server_fn server);
+void udp_sim_set_loss(unsigned percent);
+void udp_sim_set_rtt(uint32_t ms);
+// DNS answers with the new address at once; datagrams to the old one vanish
+void udp_sim_move_server(uint32_t ip);
+// sendto fails outright, as with no route to the host
+void udp_sim_fail_send(bool fail);
+// Queues a datagram for the node, `delay_ms` after half the round trip
+void udp_sim_reply(const uint8_t *data, size_t len, uint32_t delay_ms);
+int udp_sim_lookups(void);
+size_t udp_sim_sent(void);
+
+int udp_sim_socket(int domain, int type, int protocol);
+int udp_sim_setsockopt(int sock, int level, int name, const void *value, socklen_t len);
+ssize_t udp_sim_sendto(int sock, const void *data, size_t len, int flags, const struct sockaddr *to, socklen_t to_len);
+ssize_t udp_sim_recv(int sock, void *buf, size_t size, int flags);
+int udp_sim_close(int sock);
+int udp_sim_getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
+void udp_sim_freeaddrinfo(struct addrinfo *res);
+
+#endif
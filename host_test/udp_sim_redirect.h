@@ -0,0 +1,17 @@
+#ifndef UDP_SIM_REDIRECT_H
+#define UDP_SIM_REDIRECT_H
+
+// Include ahead of a module's source to run its sockets and DNS on udp_sim
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "udp_sim.h"
+
+#define socket      udp_sim_socket
+#define setsockopt  udp_sim_setsockopt
+#define sendto      udp_sim_sendto
+#define recv        udp_sim_recv
+#define close       udp_sim_close
+#define getaddrinfo udp_sim_getaddrinfo
+#define freeaddrinfo udp_sim_freeaddrinfo
+
+#endif
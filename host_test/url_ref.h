@@ -0,0 +1,53 @@
+#ifndef URL_REF_H
+#define URL_REF_H
+
+#include <ctype.h>
+#include <stdlib.h>
+
+// The codecs as they were before the lookup tables, kept as the reference for
+// test_urlcodec and the baseline for bench_urlcodec. Both truncate silently; they return the
+// output length only so the tests can follow a decoded NUL.
+
+static size_t ref_url_decode(const char *input, char *output, size_t buf_size) {
+    size_t i = 0, j = 0;
+    char ch;
+    while ((ch = input[i++]) && j < buf_size - 1) {
+        if (ch == '+') {
+            output[j++] = ' ';
+        } else if (ch == '%') {
+            if (!isxdigit((unsigned char)input[i]) || !isxdigit((unsigned char)input[i + 1])) {
+                output[j++] = '%';
+            } else {
+                char hex[3] = {input[i], input[i + 1], 0};
+                output[j++] = (char)strtol(hex, NULL, 16);
+                i += 2;
+            }
+        } else {
+            output[j++] = ch;
+        }
+    }
+    output[j] = '\0';
+    return j;
+}
+
+static size_t ref_url_encode(const char *input, char *output, size_t buf_size) {
+    const char *hex = "0123456789ABCDEF";
+    size_t i = 0, j = 0;
+
+    while (input[i] && j < buf_size - 1) {
+        if (isalnum((unsigned char)input[i]) || input[i] == '-' || input[i] == '_' || input[i] == '.' ||
+            input[i] == '~') {
+            output[j++] = input[i++];
+        } else {
+            if (j + 3 >= buf_size) break;
+            output[j++] = '%';
+            output[j++] = hex[(input[i] >> 4) & 0xF];
+            output[j++] = hex[input[i] & 0xF];
+            i++;
+        }
+    }
+    output[j] = '\0';
+    return j;
+}
+
+#endif
@@ -1,55 +1,107 @@
-#include <stdio.h>
-#include "driver/ledc.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "driver/gpio.h"
-#include "driver/ledc.h"
-#include "LED.h"  // Include the header for the function declarations
-#include "esp_log.h"
-
-
-#define RED_PIN    21
-#define GREEN_PIN  19
-#define BLUE_PIN   17
-
-#define LEDC_TIMER              LEDC_TIMER_0
-#define LEDC_MODE               LEDC_LOW_SPEED_MODE
-#define LEDC_OUTPUT_RED         LEDC_CHANNEL_0
-#define LEDC_OUTPUT_GREEN       LEDC_CHANNEL_1
-#define LEDC_OUTPUT_BLUE        LEDC_CHANNEL_2
-#define LEDC_FREQUENCY          5000
-#define LEDC_RESOLUTION         LEDC_TIMER_13_BIT
-
-void configure_ledc() {
-    ledc_timer_config_t ledc_timer = {
-        .speed_mode = LEDC_MODE,
-        .duty_resolution = LEDC_RESOLUTION,
-        .timer_num = LEDC_TIMER,
-        .freq_hz = LEDC_FREQUENCY,
-        .clk_cfg = LEDC_APB_CLK
-    };
-    ledc_timer_config(&ledc_timer);
-
-    ledc_channel_config_t ledc_channel[3] = {
-        { .channel = LEDC_OUTPUT_RED, .duty = 0, .gpio_num = RED_PIN, .speed_mode = LEDC_MODE, .hpoint = 0, .timer_sel = LEDC_TIMER },
-        { .channel = LEDC_OUTPUT_GREEN, .duty = 0, .gpio_num = GREEN_PIN, .speed_mode = LEDC_MODE, .hpoint = 0, .timer_sel = LEDC_TIMER },
-        { .channel = LEDC_OUTPUT_BLUE, .duty = 0, .gpio_num = BLUE_PIN, .speed_mode = LEDC_MODE, .hpoint = 0, .timer_sel = LEDC_TIMER }
-    };
-
-    for (int i = 0; i < 3; i++) {
-        ledc_channel_config(&ledc_channel[i]);
-    }
-}
-static const char *LED_TAG = "LED";
-void setColor(int red, int green, int blue) {
-    //ESP_LOGI(LED_TAG, "Setting LED color to R:%d G:%d B:%d", red, green, blue);
-
-    ledc_set_duty(LEDC_MODE, LEDC_OUTPUT_RED, red);
-    ledc_update_duty(LEDC_MODE, LEDC_OUTPUT_RED);
-    
-    ledc_set_duty(LEDC_MODE, LEDC_OUTPUT_GREEN, green);
-    ledc_update_duty(LEDC_MODE, LEDC_OUTPUT_GREEN);
-    
-    ledc_set_duty(LEDC_MODE, LEDC_OUTPUT_BLUE, blue);
-    ledc_update_duty(LEDC_MODE, LEDC_OUTPUT_BLUE);
-}
+#include <stdio.h>
+#include "driver/ledc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "LED.h"  // Include the header for the function declarations
+#include "esp_log.h"
+
+
+#if CONFIG_NODE_LED
+
+#define RED_PIN    CONFIG_NODE_LED_PIN_RED
+#define GREEN_PIN  CONFIG_NODE_LED_PIN_GREEN
+#define BLUE_PIN   CONFIG_NODE_LED_PIN_BLUE
+
+#define LEDC_TIMER              LEDC_TIMER_0
+#define LEDC_MODE               LEDC_LOW_SPEED_MODE
+#define LEDC_OUTPUT_RED         LEDC_CHANNEL_0
+#define LEDC_OUTPUT_GREEN       LEDC_CHANNEL_1
+#define LEDC_OUTPUT_BLUE        LEDC_CHANNEL_2
+#define LEDC_RESOLUTION         LEDC_TIMER_13_BIT
+
+#if CONFIG_NODE_POWER_SAVE
+// APB stops in light sleep; RC_FAST keeps running, slow enough for 13 bits at 1 kHz
+#define LEDC_FREQUENCY          1000
+#define LEDC_CLOCK              LEDC_USE_RC_FAST_CLK
+#else
+#define LEDC_FREQUENCY          5000
+#define LEDC_CLOCK              LEDC_APB_CLK
+#endif
+
+#define LED_TASK_STACK          2048
+#define LED_TASK_PRIORITY       1
+
+static const char *LED_TAG = "LED";
+static const ledc_channel_t channels[3] = {LEDC_OUTPUT_RED, LEDC_OUTPUT_GREEN, LEDC_OUTPUT_BLUE};
+static QueueHandle_t led_queue = NULL;
+
+static bool configure_ledc(void) {
+    ledc_timer_config_t ledc_timer = {
+        .speed_mode = LEDC_MODE,
+        .duty_resolution = LEDC_RESOLUTION,
+        .timer_num = LEDC_TIMER,
+        .freq_hz = LEDC_FREQUENCY,
+        .clk_cfg = LEDC_CLOCK
+    };
+    if (ledc_timer_config(&ledc_timer) != ESP_OK) return false;
+
+    ledc_channel_config_t ledc_channel[3] = {
+        { .channel = LEDC_OUTPUT_RED, .duty = 0, .gpio_num = RED_PIN, .speed_mode = LEDC_MODE, .hpoint = 0, .timer_sel = LEDC_TIMER },
+        { .channel = LEDC_OUTPUT_GREEN, .duty = 0, .gpio_num = GREEN_PIN, .speed_mode = LEDC_MODE, .hpoint = 0, .timer_sel = LEDC_TIMER },
+        { .channel = LEDC_OUTPUT_BLUE, .duty = 0, .gpio_num = BLUE_PIN, .speed_mode = LEDC_MODE, .hpoint = 0, .timer_sel = LEDC_TIMER }
+    };
+
+    for (int i = 0; i < 3; i++) {
+        if (ledc_channel_config(&ledc_channel[i]) != ESP_OK) return false;
+    }
+    return ledc_fade_func_install(0) == ESP_OK;
+}
+
+static void show_frame(const led_frame_t *frame) {
+    for (int i = 0; i < 3; i++) {
+        ledc_fade_stop(LEDC_MODE, channels[i]);
+        if (frame->fade_ms) {
+            ledc_set_fade_with_time(LEDC_MODE, channels[i], frame->rgb[i], frame->fade_ms);
+            ledc_fade_start(LEDC_MODE, channels[i], LEDC_FADE_NO_WAIT);
+        } else {
+            ledc_set_duty_and_update(LEDC_MODE, channels[i], frame->rgb[i], 0);
+        }
+    }
+}
+
+// Plays the latest pattern; a post during a frame's hold cuts it short
+static void led_task(void *pvParameter) {
+    led_pattern_t pattern;
+    xQueueReceive(led_queue, &pattern, portMAX_DELAY);
+    for (;;) {
+        led_frame_t frame;
+        bool replaced = false;
+        for (uint32_t step = 0; !replaced && led_seq_frame(&pattern, step, &frame); step++) {
+            show_frame(&frame);
+            if (!frame.hold_ms) break;
+            replaced = xQueueReceive(led_queue, &pattern, pdMS_TO_TICKS(frame.hold_ms)) == pdTRUE;
+        }
+        if (!replaced) xQueueReceive(led_queue, &pattern, portMAX_DELAY);
+    }
+}
+
+void led_init(bool quiet) {
+    if (led_queue || quiet) return;
+
+    if (!configure_ledc()) {
+        ESP_LOGE(LED_TAG, "LEDC setup failed");
+        return;
+    }
+    led_queue = xQueueCreate(1, sizeof(led_pattern_t));
+    if (!led_queue || xTaskCreate(led_task, "led_task", LED_TASK_STACK, NULL, LED_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(LED_TAG, "LED task setup failed");
+    }
+}
+
+void led_post(const led_pattern_t *pattern) {
+    if (led_queue) xQueueOverwrite(led_queue, pattern);
+}
+
+#endif
@@ -1,7 +1,47 @@
-#ifndef LED_H
-#define LED_H
-
-void configure_ledc(void);
-void setColor(int red, int green, int blue);
-
-#endif
+#ifndef LED_H
+#define LED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "ledseq.h"
+
+// Status LED. Patterns are posted to a low-priority task that plays them with LEDC
+// fades, so callers never wait on the LED. A new pattern replaces the one playing.
+
+#define LED_FULL 8191   // 13-bit duty
+
+#if CONFIG_NODE_LED_TIMER_WAKES
+#define LED_TIMER_WAKES true
+#else
+#define LED_TIMER_WAKES false   // Dark on timer wakes, see led_init()
+#endif
+
+#if CONFIG_NODE_LED
+// quiet leaves the LED dark and turns every post into a no-op
+void led_init(bool quiet);
+void led_post(const led_pattern_t *pattern);
+#else
+// Board without a status LED
+static inline void led_init(bool quiet) { (void)quiet; }
+static inline void led_post(const led_pattern_t *pattern) { (void)pattern; }
+#endif
+
+static inline void led_solid(uint16_t red, uint16_t green, uint16_t blue) {
+    led_pattern_t p = {.mode = LED_SOLID, .rgb = {red, green, blue}};
+    led_post(&p);
+}
+
+static inline void led_blink(uint16_t red, uint16_t green, uint16_t blue, uint16_t on_ms, uint16_t off_ms, uint16_t count) {
+    led_pattern_t p = {.mode = LED_BLINK, .rgb = {red, green, blue}, .on_ms = on_ms, .off_ms = off_ms, .count = count};
+    led_post(&p);
+}
+
+static inline void led_breathe(uint16_t red, uint16_t green, uint16_t blue, uint16_t period_ms, uint16_t count) {
+    led_pattern_t p = {.mode = LED_BREATHE, .rgb = {red, green, blue}, .on_ms = period_ms / 2, .off_ms = period_ms / 2, .count = count};
+    led_post(&p);
+}
+
+static inline void led_off(void) { led_solid(0, 0, 0); }
+
+#endif
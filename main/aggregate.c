@@ -0,0 +1,102 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "aggregate.h"
+
+void agg_stat_add(agg_stat_t *s, double x) {
+    if (s->count == 0) {
+        s->min = s->max = s->first = (float)x;
+        s->mean = 0;
+        s->m2 = 0;
+    }
+    s->count++;
+    if (x < s->min) s->min = (float)x;
+    if (x > s->max) s->max = (float)x;
+    s->last = (float)x;
+
+    double delta = x - s->mean;
+    s->mean += delta / s->count;
+    s->m2 += delta * (x - s->mean);
+}
+
+// Chan et al.'s pairwise combination of two Welford accumulators
+void agg_stat_merge(agg_stat_t *a, const agg_stat_t *b) {
+    if (b->count == 0) return;
+    if (a->count == 0) {
+        *a = *b;
+        return;
+    }
+
+    double n = (double)a->count + b->count;
+    double delta = b->mean - a->mean;
+    a->mean += delta * b->count / n;
+    a->m2 += b->m2 + delta * delta * a->count * b->count / n;
+    a->count += b->count;
+    if (b->min < a->min) a->min = b->min;
+    if (b->max > a->max) a->max = b->max;
+    a->last = b->last;
+}
+
+double agg_stat_variance(const agg_stat_t *s) {
+    return s->count > 1 ? s->m2 / (s->count - 1) : 0.0;
+}
+
+bool agg_window_is_anomaly(const agg_window_t *w, const double x[AGG_CHANNELS]) {
+    for (int i = 0; i < AGG_CHANNELS; i++) {
+        const agg_stat_t *s = &w->ch[i];
+        if (s->count < AGG_ANOMALY_MIN) continue;
+        double dev = fabs(x[i] - s->mean);
+        if (dev > AGG_ANOMALY_SIGMA * sqrt(agg_stat_variance(s)) && dev > AGG_ANOMALY_FLOOR * fabs(s->mean)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool agg_window_add(agg_window_t *w, uint32_t window_s, uint32_t when, const double x[AGG_CHANNELS], agg_window_t *closed) {
+    bool open = w->ch[0].count > 0;
+    bool rolled = open && (when >= w->start + window_s || when < w->start);
+    if (rolled) *closed = *w;
+
+    if (!open || rolled) {
+        memset(w, 0, sizeof(*w));
+        w->start = window_s ? when - when % window_s : when;
+    }
+    w->end = when;
+    for (int i = 0; i < AGG_CHANNELS; i++) {
+        agg_stat_add(&w->ch[i], x[i]);
+    }
+    return rolled;
+}
+
+void agg_window_merge(agg_window_t *a, const agg_window_t *b) {
+    if (b->end > a->end) a->end = b->end;
+    for (int i = 0; i < AGG_CHANNELS; i++) {
+        agg_stat_merge(&a->ch[i], &b->ch[i]);
+    }
+}
+
+static void format_time(uint32_t when, char *buf, size_t size) {
+    time_t t = when;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(buf, size, "%d-%m-%Y %H:%M:%S:000", &tm);   // As the raw rows
+}
+
+int agg_format_row(const agg_window_t *w, char *buf, size_t size) {
+    char start[32], end[32];
+    format_time(w->start, start, sizeof(start));
+    format_time(w->end, end, sizeof(end));
+
+    int len = snprintf(buf, size, "agg:'%s','%s','%u'", start, end, (unsigned)w->ch[0].count);
+    for (int i = 0; i < AGG_CHANNELS; i++) {
+        const agg_stat_t *s = &w->ch[i];
+        size_t used = len > 0 && (size_t)len < size ? (size_t)len : size;
+        len += snprintf(buf + used, size - used, ",'%.2f','%.2f','%.2f','%.2f','%.2f','%.2f'", s->min, s->max,
+                        s->mean, sqrt(agg_stat_variance(s)), s->first, s->last);
+    }
+    size_t used = len > 0 && (size_t)len < size ? (size_t)len : size;
+    len += snprintf(buf + used, size - used, "\n");
+    return len;
+}
@@ -0,0 +1,58 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming statistics over fixed time windows, so uploads can carry one row per window
+// instead of every sample. Constant memory per window. Plain C with no IDF dependencies.
+
+#define AGG_ANOMALY_SIGMA   4.0     // Samples this many standard deviations from the mean
+#define AGG_ANOMALY_MIN     5       // are anomalies once the window has this many samples
+#define AGG_ANOMALY_FLOOR   0.01    // Deviations under this share of the mean never count
+
+typedef enum {
+    AGG_PRESSURE,
+    AGG_TEMP,
+    AGG_VOLTAGE,
+    AGG_CHANNELS,
+} agg_channel_t;
+
+// Welford's running mean and sum of squared deviations
+typedef struct {
+    uint32_t count;
+    float min;
+    float max;
+    float first;
+    float last;
+    double mean;
+    double m2;
+} agg_stat_t;
+
+typedef struct {
+    uint32_t start;         // Unix time, aligned to the window length
+    uint32_t end;           // Last sample
+    agg_stat_t ch[AGG_CHANNELS];
+} agg_window_t;
+
+void agg_stat_add(agg_stat_t *s, double x);
+// Folds b, which must follow a in time, into a
+void agg_stat_merge(agg_stat_t *a, const agg_stat_t *b);
+// Sample variance, 0 below two samples
+double agg_stat_variance(const agg_stat_t *s);
+
+// True if any channel of x is an anomaly against the window so far
+bool agg_window_is_anomaly(const agg_window_t *w, const double x[AGG_CHANNELS]);
+// Adds a sample taken at when. If it falls past the open window, that window is copied to
+// closed and true returned before a new one is started with the sample.
+bool agg_window_add(agg_window_t *w, uint32_t window_s, uint32_t when, const double x[AGG_CHANNELS], agg_window_t *closed);
+void agg_window_merge(agg_window_t *a, const agg_window_t *b);
+
+#define AGG_ROW_MAX 512     // Longest row agg_format_row() writes
+
+// agg:'start','end','count', then min, max, mean, stddev, first and last of pressure,
+// temperature and voltage. Returns the length as snprintf does.
+int agg_format_row(const agg_window_t *w, char *buf, size_t size);
+
+#endif
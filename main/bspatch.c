@@ -0,0 +1,155 @@
+#include <string.h>
+#include "bspatch.h"
+
+enum {
+    BSPATCH_HEADER,
+    BSPATCH_CONTROL,
+    BSPATCH_DIFF,
+    BSPATCH_EXTRA,
+    BSPATCH_DONE,
+    BSPATCH_ERROR,
+};
+
+// bsdiff integers: 8 bytes little endian, sign in the top bit
+static int64_t offtin(const uint8_t *buf) {
+    int64_t y = buf[7] & 0x7F;
+    for (int i = 6; i >= 0; i--) {
+        y = y * 256 + buf[i];
+    }
+    return (buf[7] & 0x80) ? -y : y;
+}
+
+void bspatch_init(bspatch_t *p, bspatch_read_fn read_old, bspatch_write_fn write_new, void *ctx, int64_t old_size) {
+    memset(p, 0, sizeof(*p));
+    p->read_old = read_old;
+    p->write_new = write_new;
+    p->ctx = ctx;
+    p->old_size = old_size;
+    p->state = BSPATCH_HEADER;
+}
+
+// Moves on once the diff and extra runs of a control are both used up
+static void end_control(bspatch_t *p) {
+    if (p->diff_left > 0) {
+        p->state = BSPATCH_DIFF;
+    } else if (p->extra_left > 0) {
+        p->state = BSPATCH_EXTRA;
+    } else {
+        p->old_pos += p->seek;
+        p->state = p->new_pos == p->new_size ? BSPATCH_DONE : BSPATCH_CONTROL;
+    }
+}
+
+static esp_err_t start_control(bspatch_t *p) {
+    p->diff_left = offtin(p->hdr);
+    p->extra_left = offtin(p->hdr + 8);
+    p->seek = offtin(p->hdr + 16);
+    p->hdr_len = 0;
+
+    if (p->diff_left < 0 || p->extra_left < 0 || p->diff_left > p->new_size - p->new_pos ||
+        p->extra_left > p->new_size - p->new_pos - p->diff_left) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // bsdiff only seeks within the old image. Allowing some way past it still rules out a
+    // corrupt seek overflowing the position.
+    int64_t reach = p->old_size + p->new_size;
+    if (p->seek < -2 * reach || p->seek > 2 * reach) return ESP_ERR_INVALID_ARG;
+    int64_t landing = p->old_pos + p->diff_left + p->seek;
+    if (landing < -reach || landing > reach) return ESP_ERR_INVALID_ARG;
+    end_control(p);
+    return ESP_OK;
+}
+
+// Adds old bytes to a run of diff bytes and writes the result
+static esp_err_t apply_diff(bspatch_t *p, const uint8_t *diff, size_t n) {
+    memcpy(p->buf, diff, n);
+
+    // Old bytes outside the old image count as zero, as in bspatch
+    int64_t start = p->old_pos < 0 ? 0 : p->old_pos;
+    int64_t end = p->old_pos + (int64_t)n > p->old_size ? p->old_size : p->old_pos + (int64_t)n;
+    if (start < end) {
+        uint8_t old[BSPATCH_BUF_SIZE];
+        esp_err_t err = p->read_old(p->ctx, (size_t)start, old, (size_t)(end - start));
+        if (err != ESP_OK) return err;
+        for (int64_t i = start; i < end; i++) {
+            p->buf[i - p->old_pos] += old[i - start];
+        }
+    }
+
+    p->old_pos += n;
+    p->new_pos += n;
+    return p->write_new(p->ctx, p->buf, n);
+}
+
+esp_err_t bspatch_feed(bspatch_t *p, const uint8_t *data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        esp_err_t err = ESP_OK;
+
+        switch (p->state) {
+            // Zero length controls may still follow once the new image is complete
+            case BSPATCH_HEADER:
+            case BSPATCH_CONTROL:
+            case BSPATCH_DONE: {
+                size_t need = 24 - p->hdr_len;
+                size_t n = len - i < need ? len - i : need;
+                memcpy(p->hdr + p->hdr_len, data + i, n);
+                p->hdr_len += n;
+                i += n;
+                if (p->hdr_len < 24) break;
+
+                if (p->state == BSPATCH_HEADER) {
+                    if (memcmp(p->hdr, BSPATCH_MAGIC, BSPATCH_MAGIC_LEN) != 0) {
+                        err = ESP_ERR_INVALID_ARG;
+                        break;
+                    }
+                    p->new_size = offtin(p->hdr + BSPATCH_MAGIC_LEN);
+                    p->hdr_len = 0;
+                    p->state = p->new_size > 0 ? BSPATCH_CONTROL : BSPATCH_DONE;
+                    // Far beyond any app partition; also keeps the size sums below from overflowing
+                    if (p->new_size < 0 || p->new_size > INT32_MAX) err = ESP_ERR_INVALID_ARG;
+                } else {
+                    err = start_control(p);
+                }
+                break;
+            }
+
+            case BSPATCH_DIFF: {
+                size_t n = len - i;
+                if ((int64_t)n > p->diff_left) n = (size_t)p->diff_left;
+                if (n > BSPATCH_BUF_SIZE) n = BSPATCH_BUF_SIZE;
+                err = apply_diff(p, data + i, n);
+                i += n;
+                p->diff_left -= n;
+                end_control(p);
+                break;
+            }
+
+            case BSPATCH_EXTRA: {
+                size_t n = len - i;
+                if ((int64_t)n > p->extra_left) n = (size_t)p->extra_left;
+                err = p->write_new(p->ctx, data + i, n);
+                i += n;
+                p->extra_left -= n;
+                p->new_pos += n;
+                end_control(p);
+                break;
+            }
+
+            default:
+                err = ESP_ERR_INVALID_STATE;
+                break;
+        }
+
+        if (err != ESP_OK) {
+            p->state = BSPATCH_ERROR;
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t bspatch_finish(const bspatch_t *p) {
+    return p->state == BSPATCH_DONE && p->hdr_len == 0 ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
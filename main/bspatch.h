@@ -0,0 +1,45 @@
+#ifndef BSPATCH_H
+#define BSPATCH_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming applier for bsdiff patches in the ENDSLEY/BSDIFF43 layout with no compression
+// of its own: a 16 byte magic, the new size, then repeated control triples (diff length,
+// extra length, old seek) each followed by its diff and extra bytes. The patch can be fed
+// in pieces of any size; the old image is read and the new one written through callbacks,
+// so nothing is held in RAM beyond a small copy buffer.
+
+#define BSPATCH_MAGIC     "ENDSLEY/BSDIFF43"
+#define BSPATCH_MAGIC_LEN 16
+#define BSPATCH_BUF_SIZE  512
+
+typedef esp_err_t (*bspatch_read_fn)(void *ctx, size_t offset, uint8_t *buf, size_t len);
+typedef esp_err_t (*bspatch_write_fn)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct {
+    bspatch_read_fn read_old;
+    bspatch_write_fn write_new;
+    void *ctx;
+    int64_t old_size;
+
+    int state;
+    uint8_t hdr[24];          // Magic + new size, or one control triple
+    size_t hdr_len;
+    int64_t new_size;
+    int64_t new_pos;
+    int64_t old_pos;
+    int64_t diff_left;
+    int64_t extra_left;
+    int64_t seek;
+    uint8_t buf[BSPATCH_BUF_SIZE];
+} bspatch_t;
+
+void bspatch_init(bspatch_t *p, bspatch_read_fn read_old, bspatch_write_fn write_new, void *ctx, int64_t old_size);
+// ESP_ERR_INVALID_ARG on a malformed patch, or the first callback error
+esp_err_t bspatch_feed(bspatch_t *p, const uint8_t *data, size_t len);
+// ESP_OK once the whole new image has been written
+esp_err_t bspatch_finish(const bspatch_t *p);
+
+#endif
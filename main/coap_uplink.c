@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "mbedtls/ccm.h"
+#include "mbedtls/sha256.h"
+#include "coap_uplink.h"
+#include "linkqual.h"
+#include "provision.h"
+
+#define COAP_VERSION        1
+#define COAP_TYPE_CON       0
+#define COAP_TYPE_ACK       2
+#define COAP_TYPE_RST       3
+#define COAP_CODE_POST      0x02
+#define COAP_CODE_CONTINUE  0x5F    // 2.31
+#define COAP_OPT_URI_PATH   11
+#define COAP_OPT_CONTENT    12
+#define COAP_OPT_BLOCK1     27
+#define COAP_FORMAT_OCTETS  42
+#define COAP_TOKEN_LEN      4
+#define COAP_MAX_MSG        (32 + (1 << (COAP_BLOCK_SZX + 4)) + 64)
+// The last reply can carry a sealed provisioning reply. One byte over tells a datagram
+// that was cut short from one that just fits.
+#define COAP_MAX_REPLY      (32 + COAP_NONCE_LEN + PROVISION_RESPONSE_MAX + COAP_TAG_LEN + 1)
+
+#define COAP_SESSION_MAGIC  0x434F4150
+
+// Survives deep sleep so a wake can skip DNS and never reuses a nonce
+typedef struct {
+    uint32_t magic;
+    uint32_t session_id;
+    uint32_t counter;
+    uint16_t message_id;
+    char host[64];
+    uint16_t port;
+    uint8_t failures;       // Uploads in a row that got no answer from addr
+    struct sockaddr_in addr;
+} coap_session_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t code;
+    uint16_t message_id;
+    uint8_t token[8];
+    uint8_t tkl;
+    bool has_block1;
+    uint32_t block1;
+    bool truncated;         // Larger than the receive buffer, payload dropped
+    const uint8_t *payload;
+    size_t payload_len;
+} coap_msg_t;
+
+static const char *COAPTAG = "COAP_UPLINK";
+static RTC_DATA_ATTR coap_session_t session;
+
+static size_t tx_bytes;
+static size_t rx_bytes;
+
+static esp_err_t parse_uri(const char *uri, char *host, size_t host_size, uint16_t *port) {
+    if (strncmp(uri, "coap://", 7) != 0) return ESP_ERR_INVALID_ARG;
+    const char *start = uri + 7;
+    const char *end = start + strcspn(start, ":/");
+    if (end == start || (size_t)(end - start) >= host_size) return ESP_ERR_INVALID_ARG;
+
+    memcpy(host, start, end - start);
+    host[end - start] = '\0';
+    *port = (*end == ':') ? (uint16_t)atoi(end + 1) : COAP_DEFAULT_PORT;
+    return ESP_OK;
+}
+
+static esp_err_t resolve_server(const char *uri) {
+    char host[sizeof(session.host)];
+    uint16_t port;
+    if (parse_uri(uri, host, sizeof(host), &port) != ESP_OK) {
+        ESP_LOGE(COAPTAG, "Bad CoAP URI: %s", uri);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (session.magic != COAP_SESSION_MAGIC) {
+        memset(&session, 0, sizeof(session));
+        session.magic = COAP_SESSION_MAGIC;
+        session.session_id = esp_random();
+        session.message_id = (uint16_t)esp_random();
+    }
+
+    // Cached address from an earlier wake saves the DNS round trip
+    if (session.addr.sin_family == AF_INET && session.port == port && strcmp(session.host, host) == 0) {
+        return ESP_OK;
+    }
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+    struct addrinfo *res = NULL;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%u", port);
+    if (getaddrinfo(host, port_str, &hints, &res) != 0 || !res) {
+        ESP_LOGE(COAPTAG, "DNS lookup failed for %s", host);
+        return ESP_FAIL;
+    }
+    memcpy(&session.addr, res->ai_addr, sizeof(session.addr));
+    freeaddrinfo(res);
+
+    strlcpy(session.host, host, sizeof(session.host));
+    session.port = port;
+    return ESP_OK;
+}
+
+// The server may have moved: after a send error, or COAP_SESSION_MAX_FAILURES silent uploads,
+// the next one looks the host up again. Counters and session ID stay, nonces must not repeat.
+static void note_failure(bool send_failed) {
+    if (send_failed || ++session.failures >= COAP_SESSION_MAX_FAILURES) {
+        ESP_LOGW(COAPTAG, "Dropping cached address of %s", session.host);
+        memset(&session.addr, 0, sizeof(session.addr));
+        session.failures = 0;
+    }
+}
+
+static void derive_key(const char *psk, uint8_t key[16]) {
+    uint8_t digest[32];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, (const uint8_t *)"volsense-coap", 13);
+    mbedtls_sha256_update(&sha, (const uint8_t *)psk, strlen(psk));
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    memcpy(key, digest, 16);
+}
+
+// out = nonce | ciphertext | tag, with aad bound in as associated data
+static int seal(mbedtls_ccm_context *ccm, const uint8_t *aad, size_t aad_len, const uint8_t *in, size_t len, uint8_t *out) {
+    uint8_t *nonce = out;
+    memset(nonce, 0, COAP_NONCE_LEN);
+    memcpy(nonce, &session.session_id, 4);
+    memcpy(nonce + 4, &session.counter, 4);
+    session.counter++;
+
+    return mbedtls_ccm_encrypt_and_tag(ccm, len, nonce, COAP_NONCE_LEN, aad, aad_len,
+                                       in, out + COAP_NONCE_LEN, out + COAP_NONCE_LEN + len, COAP_TAG_LEN);
+}
+
+static int unseal(mbedtls_ccm_context *ccm, const uint8_t *aad, size_t aad_len, const uint8_t *in, size_t len, uint8_t *out,
+                  size_t *out_len) {
+    if (len < COAP_NONCE_LEN + COAP_TAG_LEN) return -1;
+    *out_len = len - COAP_NONCE_LEN - COAP_TAG_LEN;
+    return mbedtls_ccm_auth_decrypt(ccm, *out_len, in, COAP_NONCE_LEN, aad, aad_len,
+                                    in + COAP_NONCE_LEN, out, in + COAP_NONCE_LEN + *out_len, COAP_TAG_LEN);
+}
+
+static size_t put_option(uint8_t *buf, size_t pos, uint16_t *last, uint16_t number, const void *value, size_t len) {
+    uint16_t delta = number - *last;
+    *last = number;
+
+    uint8_t *hdr = &buf[pos++];
+    uint8_t d = delta < 13 ? delta : (delta < 269 ? 13 : 14);
+    uint8_t l = len < 13 ? len : 13;
+    *hdr = (d << 4) | l;
+    if (d == 13) buf[pos++] = delta - 13;
+    if (d == 14) {
+        buf[pos++] = (delta - 269) >> 8;
+        buf[pos++] = (delta - 269) & 0xFF;
+    }
+    if (l == 13) buf[pos++] = len - 13;
+    memcpy(&buf[pos], value, len);
+    return pos + len;
+}
+
+static size_t put_uint_option(uint8_t *buf, size_t pos, uint16_t *last, uint16_t number, uint32_t value) {
+    uint8_t bytes[4];
+    size_t len = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (len || (value >> shift) & 0xFF) bytes[len++] = (value >> shift) & 0xFF;
+    }
+    return put_option(buf, pos, last, number, bytes, len);
+}
+
+static size_t build_post(uint8_t *buf, uint16_t message_id, const uint8_t *token, const char *sensor_id,
+                         uint32_t block1, const uint8_t *payload, size_t payload_len) {
+    size_t pos = 0;
+    buf[pos++] = (COAP_VERSION << 6) | (COAP_TYPE_CON << 4) | COAP_TOKEN_LEN;
+    buf[pos++] = COAP_CODE_POST;
+    buf[pos++] = message_id >> 8;
+    buf[pos++] = message_id & 0xFF;
+    memcpy(&buf[pos], token, COAP_TOKEN_LEN);
+    pos += COAP_TOKEN_LEN;
+
+    uint16_t last = 0;
+    pos = put_option(buf, pos, &last, COAP_OPT_URI_PATH, "d", 1);
+    pos = put_option(buf, pos, &last, COAP_OPT_URI_PATH, sensor_id, strnlen(sensor_id, 32));
+    pos = put_uint_option(buf, pos, &last, COAP_OPT_CONTENT, COAP_FORMAT_OCTETS);
+    pos = put_uint_option(buf, pos, &last, COAP_OPT_BLOCK1, block1);
+
+    buf[pos++] = 0xFF;
+    memcpy(&buf[pos], payload, payload_len);
+    return pos + payload_len;
+}
+
+static bool parse_msg(const uint8_t *buf, size_t len, coap_msg_t *msg) {
+    memset(msg, 0, sizeof(*msg));
+    if (len < 4 || (buf[0] >> 6) != COAP_VERSION) return false;
+
+    msg->type = (buf[0] >> 4) & 0x3;
+    msg->tkl = buf[0] & 0xF;
+    msg->code = buf[1];
+    msg->message_id = (buf[2] << 8) | buf[3];
+    if (msg->tkl > 8 || len < 4u + msg->tkl) return false;
+    memcpy(msg->token, &buf[4], msg->tkl);
+
+    size_t pos = 4 + msg->tkl;
+    uint16_t number = 0;
+    while (pos < len && buf[pos] != 0xFF) {
+        uint16_t delta = buf[pos] >> 4;
+        uint16_t optlen = buf[pos] & 0xF;
+        pos++;
+        // Extended delta/length bytes must be inside the datagram too
+        if (pos + (delta == 13) + 2 * (delta == 14) + (optlen == 13) + 2 * (optlen == 14) > len) return false;
+        if (delta == 13) delta = 13 + buf[pos++];
+        else if (delta == 14) { delta = 269 + ((buf[pos] << 8) | buf[pos + 1]); pos += 2; }
+        else if (delta == 15) return false;
+        if (optlen == 13) optlen = 13 + buf[pos++];
+        else if (optlen == 14) { optlen = 269 + ((buf[pos] << 8) | buf[pos + 1]); pos += 2; }
+        else if (optlen == 15) return false;
+        if (pos + optlen > len) return false;
+
+        number += delta;
+        if (number == COAP_OPT_BLOCK1 && optlen <= 3) {
+            msg->has_block1 = true;
+            for (int i = 0; i < optlen; i++) msg->block1 = (msg->block1 << 8) | buf[pos + i];
+        }
+        pos += optlen;
+    }
+    if (pos < len) {
+        msg->payload = &buf[pos + 1];
+        msg->payload_len = len - pos - 1;
+    }
+    return true;
+}
+
+// Sends a confirmable request and waits for its response, retransmitting with
+// RFC 7252 exponential backoff. Handles both piggybacked and separate responses.
+static esp_err_t exchange(int sock, const uint8_t *req, size_t req_len, uint16_t message_id, const uint8_t *token,
+                          uint8_t *resp, size_t resp_size, coap_msg_t *msg) {
+    uint32_t timeout_ms = COAP_ACK_TIMEOUT_MS + esp_random() % (COAP_ACK_TIMEOUT_MS / 2);
+    bool acked = false;
+
+    for (int attempt = 0; attempt <= COAP_MAX_RETRANSMIT; attempt++) {
+        if (!acked) {
+            if (attempt > 0) ESP_LOGW(COAPTAG, "Retransmit %d of MID %u", attempt, message_id);
+            if (sendto(sock, req, req_len, 0, (struct sockaddr *)&session.addr, sizeof(session.addr)) < 0) {
+                ESP_LOGE(COAPTAG, "Send to %s failed", session.host);
+                note_failure(true);
+                return ESP_FAIL;
+            }
+            tx_bytes += req_len;
+        }
+
+        struct timeval tv = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+        while (esp_timer_get_time() < deadline) {
+            int n = recv(sock, resp, resp_size, 0);
+            if (n < 0) break;
+            rx_bytes += n;
+            if (!parse_msg(resp, n, msg)) continue;
+            session.failures = 0;
+            if ((size_t)n >= resp_size) {
+                // Header and options are whole, the payload can't be trusted
+                msg->truncated = true;
+                msg->payload = NULL;
+                msg->payload_len = 0;
+            }
+
+            if (msg->type == COAP_TYPE_RST && msg->message_id == message_id) return ESP_FAIL;
+            if (msg->type == COAP_TYPE_ACK && msg->message_id == message_id) {
+                if (msg->code != 0) return ESP_OK;
+                acked = true;   // Empty ACK, the response follows separately
+                continue;
+            }
+            if (msg->type == COAP_TYPE_CON && msg->tkl == COAP_TOKEN_LEN && memcmp(msg->token, token, COAP_TOKEN_LEN) == 0) {
+                uint8_t ack[4] = {(COAP_VERSION << 6) | (COAP_TYPE_ACK << 4), 0, msg->message_id >> 8, msg->message_id & 0xFF};
+                sendto(sock, ack, sizeof(ack), 0, (struct sockaddr *)&session.addr, sizeof(session.addr));
+                tx_bytes += sizeof(ack);
+                return ESP_OK;
+            }
+        }
+        timeout_ms *= 2;
+    }
+    note_failure(false);
+    return ESP_ERR_TIMEOUT;
+}
+
+esp_err_t coap_uplink_send(const uplink_config_t *cfg, const uplink_payload_t *payload, char *response_buf, size_t buf_size) {
+    if (response_buf && buf_size > 0) response_buf[0] = '\0';
+    if (payload->rows_len == 0) return ESP_OK;
+
+    esp_err_t ret = resolve_server(cfg->coap_uri);
+    if (ret != ESP_OK) return ret;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGE(COAPTAG, "Failed to create socket");
+        return ESP_FAIL;
+    }
+
+    // Blocks carry the sensor ID as associated data. The reply adds the nonce of the last
+    // block, so a reply recorded from an earlier upload doesn't authenticate for this one.
+    uint8_t aad[32 + COAP_NONCE_LEN];
+    size_t id_len = strnlen(payload->sensor_id, 32);
+    memcpy(aad, payload->sensor_id, id_len);
+
+    uint8_t key[16];
+    derive_key(payload->key, key);
+    mbedtls_ccm_context ccm;
+    mbedtls_ccm_init(&ccm);
+    mbedtls_ccm_setkey(&ccm, MBEDTLS_CIPHER_ID_AES, key, 128);
+
+    static uint8_t req[COAP_MAX_MSG];
+    static uint8_t resp[COAP_MAX_REPLY];
+    static uint8_t sealed[1 << (COAP_BLOCK_SZX + 4)];
+
+    tx_bytes = 0;
+    rx_bytes = 0;
+    int64_t start = esp_timer_get_time();
+
+    // Weak links get 256 byte blocks so a lost datagram costs less airtime
+    uint32_t szx = link_current_plan()->chunk_bytes <= 512 ? COAP_BLOCK_SZX - 1 : COAP_BLOCK_SZX;
+    int64_t first_rtt_us = 0;
+    size_t offset = 0;        // Plaintext bytes sent
+    size_t wire_offset = 0;   // Sealed bytes sent, what Block1 numbers count
+    coap_msg_t msg = {0};
+    ret = ESP_OK;
+    while (ret == ESP_OK) {
+        size_t wire_block = 1u << (szx + 4);
+        size_t chunk = wire_block - COAP_NONCE_LEN - COAP_TAG_LEN;
+        size_t len = payload->rows_len - offset;
+        bool more = len > chunk;
+        if (more) len = chunk;
+
+        if (seal(&ccm, aad, id_len, (const uint8_t *)payload->rows + offset, len, sealed) != 0) {
+            ret = ESP_FAIL;
+            break;
+        }
+        memcpy(aad + id_len, sealed, COAP_NONCE_LEN);
+
+        uint32_t num = wire_offset >> (szx + 4);
+        uint32_t block1 = (num << 4) | (more ? 0x8 : 0) | szx;
+        uint16_t message_id = session.message_id++;
+        // Every request gets its own token, so a late response to one block can't answer the next
+        uint8_t token[COAP_TOKEN_LEN];
+        uint32_t token_val = esp_random();
+        memcpy(token, &token_val, sizeof(token));
+        size_t req_len = build_post(req, message_id, token, payload->sensor_id, block1, sealed,
+                                    len + COAP_NONCE_LEN + COAP_TAG_LEN);
+
+        int64_t t_block = esp_timer_get_time();
+        ret = exchange(sock, req, req_len, message_id, token, resp, sizeof(resp), &msg);
+        if (ret != ESP_OK) break;
+        if (first_rtt_us == 0) first_rtt_us = esp_timer_get_time() - t_block;
+
+        if ((msg.code >> 5) != 2) {
+            ESP_LOGE(COAPTAG, "Server rejected block %" PRIu32 ": %d.%02d", num, msg.code >> 5, msg.code & 0x1F);
+            ret = ESP_FAIL;
+            break;
+        }
+        offset += len;
+        wire_offset += wire_block;
+        if (!more) break;
+
+        if (msg.code != COAP_CODE_CONTINUE) {
+            ESP_LOGE(COAPTAG, "Expected 2.31 Continue, got %d.%02d", msg.code >> 5, msg.code & 0x1F);
+            ret = ESP_FAIL;
+            break;
+        }
+        // The server may ask for smaller blocks, each one is still sealed on its own
+        if (msg.has_block1 && (msg.block1 & 0x7) < szx) {
+            szx = msg.block1 & 0x7;
+            if (szx < 2) {
+                ESP_LOGE(COAPTAG, "Server block size too small for sealed blocks");
+                ret = ESP_FAIL;
+                break;
+            }
+        }
+    }
+
+    if (ret == ESP_OK && msg.truncated) {
+        ESP_LOGW(COAPTAG, "Reply over %d bytes, payload dropped", PROVISION_RESPONSE_MAX);
+    }
+    if (ret == ESP_OK && msg.payload_len > 0 && response_buf && buf_size > 1) {
+        size_t out_len = 0;
+        if (msg.payload_len >= COAP_NONCE_LEN + COAP_TAG_LEN &&
+            msg.payload_len - COAP_NONCE_LEN - COAP_TAG_LEN < buf_size &&
+            unseal(&ccm, aad, id_len + COAP_NONCE_LEN, msg.payload, msg.payload_len, (uint8_t *)response_buf, &out_len) == 0) {
+            response_buf[out_len] = '\0';
+        } else {
+            ESP_LOGW(COAPTAG, "Discarding unauthenticated response payload");
+            response_buf[0] = '\0';
+        }
+    }
+
+    mbedtls_ccm_free(&ccm);
+    close(sock);
+
+    int64_t elapsed_ms = (esp_timer_get_time() - start) / 1000;
+    link_record_attempt(payload->rows_len, first_rtt_us / 1000, elapsed_ms, ret == ESP_OK);
+
+    ESP_LOGI(COAPTAG, "CoAP upload %s: %u bytes of rows, %u bytes sent, %u received, %" PRId64 " ms",
+             ret == ESP_OK ? "done" : "failed", (unsigned)payload->rows_len, (unsigned)tx_bytes, (unsigned)rx_bytes,
+             elapsed_ms);
+    return ret;
+}
@@ -0,0 +1,23 @@
+#ifndef COAP_UPLINK_H
+#define COAP_UPLINK_H
+
+#include "esp_err.h"
+#include "uplink.h"
+
+#define COAP_DEFAULT_PORT     5683
+#define COAP_BLOCK_SZX        5        // 512 byte blocks on the wire
+#define COAP_ACK_TIMEOUT_MS   2000
+#define COAP_MAX_RETRANSMIT   4
+#define COAP_NONCE_LEN        12
+#define COAP_TAG_LEN          8
+#define COAP_SESSION_MAX_FAILURES 2   // Silent uploads before the server address is looked up again
+
+// Confirmable CoAP POST of the rows to coap://host[:port]/d/<sensorID> using Block1 transfer.
+// Each block is sealed with AES-CCM under a key derived from the registration key, so there is
+// no handshake; server address and message counters are kept in RTC memory between wakes.
+// The reply to the last block may carry up to PROVISION_RESPONSE_MAX bytes of sealed reply in
+// one datagram, which relies on lwIP IP reassembly beyond one MTU. It is sealed with the nonce
+// of the last block in its associated data, and dropped unless it answers that block.
+esp_err_t coap_uplink_send(const uplink_config_t *cfg, const uplink_payload_t *payload, char *response_buf, size_t buf_size);
+
+#endif
@@ -0,0 +1,398 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "dataexport.h"
+#include "flashlog.h"
+#include "gzstream.h"
+#include "power.h"
+#include "sdcard.h"
+#include "sdlog.h"
+
+static const char *EXPORTTAG = "DataExport";
+
+static esp_err_t send_no_card(httpd_req_t *req)
+{
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    return httpd_resp_sendstr(req, "The SD card is not mounted");
+}
+
+// Rows are batched into one buffer per chunk rather than a chunk per row
+typedef struct
+{
+    httpd_req_t *req;
+    char buf[1024];
+    size_t len;
+    bool failed;
+} history_stream_t;
+
+static bool history_send_row(const char *row, size_t len, time_t when, void *ctx)
+{
+    history_stream_t *out = ctx;
+    if (out->len + len > sizeof(out->buf))
+    {
+        if (httpd_resp_send_chunk(out->req, out->buf, out->len) != ESP_OK)
+        {
+            out->failed = true;
+            return false;
+        }
+        out->len = 0;
+    }
+    memcpy(out->buf + out->len, row, len);
+    out->len += len;
+    return true;
+}
+
+// Local midnight of a YYYY-MM-DD query value
+static bool history_day(const char *query, const char *key, time_t *day)
+{
+    char value[16];
+    struct tm tm = {0};
+    if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK ||
+        sscanf(value, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3)
+    {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    *day = mktime(&tm);
+    return *day != (time_t)-1;
+}
+
+static esp_err_t history_send(httpd_req_t *req)
+{
+    time_t from = 0;
+    time_t to = INT32_MAX;
+    char query[64] = "";
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        time_t day;
+        if (history_day(query, "from", &day))
+            from = day;
+        if (history_day(query, "to", &day))
+            to = day + 24 * 60 * 60 - 1;
+    }
+
+    static history_stream_t out;
+    out.req = req;
+    out.len = 0;
+    out.failed = false;
+
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    esp_err_t err = sdlog_query(from, to, history_send_row, &out);
+    if (err == ESP_ERR_NOT_FOUND)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No history on the SD card");
+        return ESP_OK;
+    }
+    if (err != ESP_OK || out.failed || (out.len && httpd_resp_send_chunk(req, out.buf, out.len) != ESP_OK))
+    {
+        ESP_LOGW(EXPORTTAG, "History stream ended early");
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// GET /history?from=YYYY-MM-DD&to=YYYY-MM-DD streams stored rows for those days, both inclusive.
+// Either bound may be left out.
+esp_err_t history_handler(httpd_req_t *req)
+{
+    if (!sd_hold())
+        return send_no_card(req);
+    esp_err_t err = history_send(req);
+    sd_release();
+    return err;
+}
+
+#if FLASHLOG_ENABLED
+#define DATA_PATH "/sdcard/export.txt"    // Written by flashlog_export() when config mode starts
+#else
+#define DATA_PATH SDLOG_DATA_PATH
+#endif
+#define DATA_CSV_HEADER "time,pressure,temp,voltage\n"
+
+// State of the one export in progress; the server runs its handlers on a single task.
+// Everything is fixed size, a whole card streams through these buffers.
+typedef struct
+{
+    httpd_req_t *req;
+    bool csv;
+    bool gzip;
+    bool counting;          // Only sizing the CSV for a range
+    bool failed;
+    uint64_t total;
+    uint64_t skip;          // Output bytes before the requested range
+    uint64_t remaining;     // Output bytes left in it
+    size_t row_len;
+    size_t out_len;
+    char row[SDLOG_ROW_MAX];
+    char in[2048];
+    char out[1024];
+    char content_range[64];
+    gz_stream_t gz;
+} data_export_t;
+
+static data_export_t export;
+
+static bool data_emit(const uint8_t *data, size_t len, void *ctx)
+{
+    data_export_t *ex = ctx;
+    return httpd_resp_send_chunk(ex->req, (const char *)data, len) == ESP_OK;
+}
+
+static void data_flush(data_export_t *ex)
+{
+    if (ex->out_len && !ex->failed && httpd_resp_send_chunk(ex->req, ex->out, ex->out_len) != ESP_OK)
+        ex->failed = true;
+    ex->out_len = 0;
+}
+
+static void data_out(data_export_t *ex, const char *data, size_t len)
+{
+    if (ex->counting)
+    {
+        ex->total += len;
+        return;
+    }
+
+    size_t skipped = ex->skip < len ? (size_t)ex->skip : len;
+    data += skipped;
+    len -= skipped;
+    ex->skip -= skipped;
+    if (len > ex->remaining)
+        len = (size_t)ex->remaining;
+    ex->remaining -= len;
+
+    if (ex->gzip)
+    {
+        if (len && !gz_write(&ex->gz, data, len))
+            ex->failed = true;
+        return;
+    }
+    while (len && !ex->failed)
+    {
+        size_t n = sizeof(ex->out) - ex->out_len;
+        if (n > len)
+            n = len;
+        memcpy(ex->out + ex->out_len, data, n);
+        ex->out_len += n;
+        data += n;
+        len -= n;
+        if (ex->out_len == sizeof(ex->out))
+            data_flush(ex);
+    }
+}
+
+// 'dd-mm-yyyy hh:mm:ss:ms','pressure','temp','voltage','0.00' becomes one CSV line
+static void data_csv_row(data_export_t *ex)
+{
+    int day, month, year, hour, minute, second;
+    char pressure[16], temp[16], voltage[16];
+    if (sscanf(ex->row, "'%d-%d-%d %d:%d:%d:%*d','%15[^']','%15[^']','%15[^']'", &day, &month, &year, &hour,
+               &minute, &second, pressure, temp, voltage) != 9)
+    {
+        return;
+    }
+
+    char line[96];
+    int n = snprintf(line, sizeof(line), "%04d-%02d-%02d %02d:%02d:%02d,%s,%s,%s\n", year, month, day, hour, minute,
+                     second, pressure, temp, voltage);
+    if (n > 0 && n < (int)sizeof(line))
+        data_out(ex, line, n);
+}
+
+static void data_csv_feed(data_export_t *ex, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (ex->row_len < sizeof(ex->row) - 1)
+            ex->row[ex->row_len++] = data[i];
+        if (data[i] == '\n')
+        {
+            ex->row[ex->row_len] = '\0';
+            data_csv_row(ex);
+            ex->row_len = 0;
+        }
+    }
+}
+
+// Reads from the current file position to the end or the end of the range
+static void data_stream(data_export_t *ex, FILE *file)
+{
+    ex->row_len = 0;
+    if (ex->csv)
+        data_out(ex, DATA_CSV_HEADER, strlen(DATA_CSV_HEADER));
+
+    size_t n;
+    do
+    {
+        power_lock_bus();
+        n = fread(ex->in, 1, sizeof(ex->in), file);
+        power_unlock_bus();
+        if (ex->csv)
+            data_csv_feed(ex, ex->in, n);
+        else
+            data_out(ex, ex->in, n);
+    } while (n == sizeof(ex->in) && !ex->failed && (ex->counting || ex->remaining > 0));
+}
+
+// A single "bytes=" range. ESP_ERR_NOT_FOUND for none or one we don't serve, which gets the
+// whole body; ESP_ERR_INVALID_SIZE if it lies past the end.
+static esp_err_t data_parse_range(const char *value, uint64_t size, uint64_t *first, uint64_t *last)
+{
+    if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ','))
+        return ESP_ERR_NOT_FOUND;
+
+    char *end;
+    const char *spec = value + 6;
+    if (*spec == '-')
+    {
+        // Suffix: the last n bytes
+        uint64_t n = strtoull(spec + 1, &end, 10);
+        if (end == spec + 1 || *end)
+            return ESP_ERR_NOT_FOUND;
+        if (n == 0 || size == 0)
+            return ESP_ERR_INVALID_SIZE;
+        *first = n < size ? size - n : 0;
+        *last = size - 1;
+        return ESP_OK;
+    }
+
+    *first = strtoull(spec, &end, 10);
+    if (end == spec || *end != '-')
+        return ESP_ERR_NOT_FOUND;
+    spec = end + 1;
+    *last = size - 1;
+    if (*spec)
+    {
+        *last = strtoull(spec, &end, 10);
+        if (*end || *last < *first)
+            return ESP_ERR_NOT_FOUND;
+        if (*last >= size)
+            *last = size - 1;
+    }
+    return *first < size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+// Byte ranges refer to the identity body, so a ranged request is never gzipped. The log only
+// grows by appending, which keeps the offsets of an interrupted download valid.
+static esp_err_t data_send_file(httpd_req_t *req, bool csv)
+{
+    data_export_t *ex = &export;
+    memset(ex, 0, offsetof(data_export_t, row));
+    ex->req = req;
+    ex->csv = csv;
+    ex->remaining = UINT64_MAX;
+
+    power_lock_bus();
+    FILE *file = fopen(DATA_PATH, "rb");
+    power_unlock_bus();
+    if (!file)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No sensor log on the SD card");
+        return ESP_OK;
+    }
+
+    char range[64] = "";
+    char encoding[128] = "";
+    httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range));
+    httpd_req_get_hdr_value_str(req, "Accept-Encoding", encoding, sizeof(encoding));
+
+    uint64_t first = 0, last = 0;
+    esp_err_t range_err = ESP_ERR_NOT_FOUND;
+    if (range[0])
+    {
+        uint64_t size;
+        if (csv)
+        {
+            ex->counting = true;
+            data_stream(ex, file);
+            ex->counting = false;
+            size = ex->total;
+        }
+        else
+        {
+            fseek(file, 0, SEEK_END);
+            size = ftell(file);
+        }
+        // A range we don't serve still gets the whole body
+        fseek(file, 0, SEEK_SET);
+
+        range_err = data_parse_range(range, size, &first, &last);
+        if (range_err == ESP_ERR_INVALID_SIZE)
+        {
+            fclose(file);
+            snprintf(ex->content_range, sizeof(ex->content_range), "bytes */%" PRIu64, size);
+            httpd_resp_set_status(req, "416 Range Not Satisfiable");
+            httpd_resp_set_hdr(req, "Content-Range", ex->content_range);
+            return httpd_resp_send(req, NULL, 0);
+        }
+        if (range_err == ESP_OK)
+        {
+            snprintf(ex->content_range, sizeof(ex->content_range), "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64, first,
+                     last, size);
+            httpd_resp_set_status(req, "206 Partial Content");
+            httpd_resp_set_hdr(req, "Content-Range", ex->content_range);
+            ex->remaining = last - first + 1;
+            if (csv)
+                ex->skip = first;
+            else
+                fseek(file, (long)first, SEEK_SET);
+        }
+    }
+    ex->gzip = range_err != ESP_OK && strstr(encoding, "gzip") != NULL;
+
+    httpd_resp_set_type(req, csv ? "text/csv" : "text/plain");
+    httpd_resp_set_hdr(req, "Content-Disposition", csv ? "attachment; filename=\"history.csv\""
+                                                       : "attachment; filename=\"history.txt\"");
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    if (ex->gzip)
+    {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        gz_begin(&ex->gz, data_emit, ex);
+    }
+
+    int64_t started = esp_timer_get_time();
+    data_stream(ex, file);
+    fclose(file);
+    if (ex->gzip && !gz_finish(&ex->gz))
+        ex->failed = true;
+    data_flush(ex);
+    if (ex->failed)
+    {
+        ESP_LOGW(EXPORTTAG, "Client went away during the data export");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(EXPORTTAG, "Data export done in %" PRId64 " ms", (esp_timer_get_time() - started) / 1000);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// The card stays mounted until the export is over, however long the client takes
+static esp_err_t data_send(httpd_req_t *req, bool csv)
+{
+    if (!sd_hold())
+        return send_no_card(req);
+    esp_err_t err = data_send_file(req, csv);
+    sd_release();
+    return err;
+}
+
+// GET /data: the sensor log as stored
+esp_err_t data_handler(httpd_req_t *req)
+{
+    return data_send(req, false);
+}
+
+// GET /data.csv: the same rows as CSV with ISO dates
+esp_err_t data_csv_handler(httpd_req_t *req)
+{
+    return data_send(req, true);
+}
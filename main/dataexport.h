@@ -0,0 +1,16 @@
+#ifndef DATAEXPORT_H
+#define DATAEXPORT_H
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Portal handlers that stream stored data off the SD card through fixed buffers. Each keeps
+// the card mounted while it runs and answers 503 when there is none.
+
+// GET /history?from=YYYY-MM-DD&to=YYYY-MM-DD: rows from the indexed history
+esp_err_t history_handler(httpd_req_t *req);
+// GET /data and /data.csv: the whole sensor log, with Range and gzip
+esp_err_t data_handler(httpd_req_t *req);
+esp_err_t data_csv_handler(httpd_req_t *req);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_app_desc.h"
+#include "freertos/FreeRTOS.h"
+#include "dlog.h"
+
+const char *const dlog_module_names[DLOG_MODULE_COUNT] = {
+    [DLOG_MAIN] = "main",
+    [DLOG_SENSORS] = "sensors",
+    [DLOG_SD] = "sd",
+    [DLOG_UPLOAD] = "upload",
+    [DLOG_WIFI] = "wifi",
+};
+
+#if CONFIG_NODE_DLOG
+
+#define DLOG_MAGIC 0x474F4C44   // "DLOG"
+
+// Survives deep sleep, so wakes without an SD card keep their history until the next flush
+typedef struct {
+    uint32_t magic;
+    uint16_t tail;          // Oldest record
+    uint16_t used;
+    uint16_t dropped;
+    uint16_t boot;
+    uint8_t levels[DLOG_MODULE_COUNT];
+    uint8_t data[DLOG_RING_BYTES];
+} dlog_ring_t;
+
+static RTC_DATA_ATTR dlog_ring_t ring;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void dlog_init(void) {
+    if (ring.magic != DLOG_MAGIC || ring.tail >= DLOG_RING_BYTES || ring.used > DLOG_RING_BYTES) {
+        memset(&ring, 0, sizeof(ring));
+        memset(ring.levels, CONFIG_NODE_DLOG_LEVEL, sizeof(ring.levels));
+        ring.magic = DLOG_MAGIC;
+    }
+    ring.boot++;
+}
+
+void dlog_set_level(dlog_module_t module, esp_log_level_t level) {
+    if (module < DLOG_MODULE_COUNT) ring.levels[module] = level;
+}
+
+bool dlog_enabled(dlog_module_t module, esp_log_level_t level) {
+    return ring.magic == DLOG_MAGIC && module < DLOG_MODULE_COUNT && level <= ring.levels[module];
+}
+
+// Ring accessors, called with ring_lock held
+static void ring_copy_out(size_t offset, void *out, size_t len) {
+    size_t first = DLOG_RING_BYTES - offset < len ? DLOG_RING_BYTES - offset : len;
+    memcpy(out, ring.data + offset, first);
+    memcpy((uint8_t *)out + first, ring.data, len - first);
+}
+
+static void ring_copy_in(size_t offset, const void *in, size_t len) {
+    size_t first = DLOG_RING_BYTES - offset < len ? DLOG_RING_BYTES - offset : len;
+    memcpy(ring.data + offset, in, first);
+    memcpy(ring.data, (const uint8_t *)in + first, len - first);
+}
+
+static void ring_drop_oldest(void) {
+    dlog_record_t rec;
+    ring_copy_out(ring.tail, &rec, sizeof(rec));
+    size_t len = sizeof(rec) + (rec.level_nargs & 0x0F) * sizeof(uint64_t);
+    ring.tail = (ring.tail + len) % DLOG_RING_BYTES;
+    ring.used -= len;
+    if (ring.dropped < UINT16_MAX) ring.dropped++;
+}
+
+void dlog_write(dlog_module_t module, esp_log_level_t level, const char *fmt, const uint64_t *args, size_t nargs) {
+    if (nargs > DLOG_MAX_ARGS) nargs = DLOG_MAX_ARGS;
+    dlog_record_t rec = {
+        .fmt = (uint32_t)(uintptr_t)fmt,
+        .ms = esp_log_timestamp(),
+        .boot = ring.boot,
+        .module = module,
+        .level_nargs = (uint8_t)(level << 4 | nargs),
+    };
+    size_t len = sizeof(rec) + nargs * sizeof(uint64_t);
+
+    taskENTER_CRITICAL(&ring_lock);
+    while (ring.used + len > DLOG_RING_BYTES) ring_drop_oldest();
+    size_t head = (ring.tail + ring.used) % DLOG_RING_BYTES;
+    ring_copy_in(head, &rec, sizeof(rec));
+    ring_copy_in((head + sizeof(rec)) % DLOG_RING_BYTES, args, nargs * sizeof(uint64_t));
+    ring.used += len;
+    taskEXIT_CRITICAL(&ring_lock);
+}
+
+esp_err_t dlog_flush(const char *path) {
+    static uint8_t out[DLOG_RING_BYTES];
+
+    FILE *file = fopen(path, "ab");
+    if (!file) return ESP_ERR_NOT_FOUND;
+    if (ftell(file) > DLOG_FILE_MAX) {
+        fclose(file);
+        remove(DLOG_FILE_OLD);
+        rename(path, DLOG_FILE_OLD);
+        file = fopen(path, "ab");
+        if (!file) return ESP_FAIL;
+    }
+
+    dlog_chunk_t chunk = {.magic = {'D', 'L', 'G', '1'}};
+    char sha[sizeof(chunk.elf_sha256) + 1];
+    esp_app_get_elf_sha256(sha, sizeof(sha));
+    memcpy(chunk.elf_sha256, sha, sizeof(chunk.elf_sha256));
+
+    taskENTER_CRITICAL(&ring_lock);
+    chunk.length = ring.used;
+    chunk.dropped = ring.dropped;
+    ring_copy_out(ring.tail, out, ring.used);
+    ring.tail = 0;
+    ring.used = 0;
+    ring.dropped = 0;
+    taskEXIT_CRITICAL(&ring_lock);
+
+    bool ok = chunk.length == 0 ||
+              (fwrite(&chunk, sizeof(chunk), 1, file) == 1 && fwrite(out, 1, chunk.length, file) == chunk.length);
+    fclose(file);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+#endif
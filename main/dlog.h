@@ -0,0 +1,114 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+// Deferred logging. A record keeps the module, the level, the address of the format string
+// and the raw arguments in a ring in RTC memory; nothing is formatted or sent over the UART.
+// tools/dlog_decode.py rebuilds the text from DLOG_FILE and the firmware ELF.
+//
+// Only addresses are stored, so formats must be string literals and %s arguments string
+// constants. Up to DLOG_MAX_ARGS arguments. Without CONFIG_NODE_DLOG these are ESP_LOGx calls.
+
+typedef enum {
+    DLOG_MAIN,
+    DLOG_SENSORS,
+    DLOG_SD,
+    DLOG_UPLOAD,
+    DLOG_WIFI,
+    DLOG_MODULE_COUNT,
+} dlog_module_t;
+
+#define DLOG_MAX_ARGS   6
+#define DLOG_RING_BYTES 3072
+#define DLOG_FILE       "/sdcard/dlog.bin"
+#define DLOG_FILE_OLD   "/sdcard/dlog.old"
+#define DLOG_FILE_MAX   (1024 * 1024)   // Rotated to DLOG_FILE_OLD past this
+
+// Tags for the ESP_LOG fallback, also read from the ELF by the decoder
+extern const char *const dlog_module_names[DLOG_MODULE_COUNT];
+
+#if CONFIG_NODE_DLOG
+
+// Ring records, packed and little-endian, each followed by nargs 8-byte argument slots
+typedef struct __attribute__((packed)) {
+    uint32_t fmt;           // Format string address
+    uint32_t ms;            // esp_log_timestamp()
+    uint16_t boot;          // Counts boots, deep sleep wakes included
+    uint8_t module;
+    uint8_t level_nargs;    // esp_log_level_t << 4 | nargs
+} dlog_record_t;
+
+// DLOG_FILE is a sequence of flushes, each this header and then `length` bytes of records
+typedef struct __attribute__((packed)) {
+    char magic[4];          // "DLG1"
+    uint16_t dropped;       // Records overwritten in the ring before this flush
+    uint16_t reserved;
+    uint32_t length;
+    char elf_sha256[16];    // Prefix of the firmware's ELF hash, for matching the decoder's ELF
+} dlog_chunk_t;
+
+// Call once per boot, before the first DLOG
+void dlog_init(void);
+void dlog_set_level(dlog_module_t module, esp_log_level_t level);
+bool dlog_enabled(dlog_module_t module, esp_log_level_t level);
+void dlog_write(dlog_module_t module, esp_log_level_t level, const char *fmt, const uint64_t *args, size_t nargs);
+// Appends the ring to path and empties it. The ring is kept if path can't be opened.
+esp_err_t dlog_flush(const char *path);
+
+// Arguments are widened to 8-byte slots; floats keep their double bits
+static inline uint64_t dlog_double(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+static inline uint64_t dlog_ptr(const void *p) { return (uintptr_t)p; }
+static inline uint64_t dlog_int(long long v) { return (uint64_t)v; }
+
+#define DLOG_SLOT(x) _Generic((x), \
+    float: dlog_double, double: dlog_double, \
+    char *: dlog_ptr, const char *: dlog_ptr, void *: dlog_ptr, const void *: dlog_ptr, \
+    default: dlog_int)(x)
+
+#define DLOG_NARGS(...) DLOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b) a##b
+#define DLOG_MAP_0(m)
+#define DLOG_MAP_1(m, a) m(a)
+#define DLOG_MAP_2(m, a, ...) m(a), DLOG_MAP_1(m, __VA_ARGS__)
+#define DLOG_MAP_3(m, a, ...) m(a), DLOG_MAP_2(m, __VA_ARGS__)
+#define DLOG_MAP_4(m, a, ...) m(a), DLOG_MAP_3(m, __VA_ARGS__)
+#define DLOG_MAP_5(m, a, ...) m(a), DLOG_MAP_4(m, __VA_ARGS__)
+#define DLOG_MAP_6(m, a, ...) m(a), DLOG_MAP_5(m, __VA_ARGS__)
+#define DLOG_MAP(m, ...) DLOG_CAT(DLOG_MAP_, DLOG_NARGS(__VA_ARGS__))(m, ##__VA_ARGS__)
+
+#define DLOG(level, module, fmt, ...) do { \
+        if (dlog_enabled(module, level)) { \
+            const uint64_t dlog_args_[DLOG_NARGS(__VA_ARGS__) + 1] = {DLOG_MAP(DLOG_SLOT, ##__VA_ARGS__)}; \
+            dlog_write(module, level, fmt, dlog_args_, DLOG_NARGS(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+#else
+
+static inline void dlog_init(void) {}
+static inline void dlog_set_level(dlog_module_t module, esp_log_level_t level) { esp_log_level_set(dlog_module_names[module], level); }
+static inline esp_err_t dlog_flush(const char *path) { (void)path; return ESP_OK; }
+
+#define DLOG(level, module, fmt, ...) ESP_LOG_LEVEL_LOCAL(level, dlog_module_names[module], fmt, ##__VA_ARGS__)
+
+#endif
+
+#define DLOGE(module, fmt, ...) DLOG(ESP_LOG_ERROR, module, fmt, ##__VA_ARGS__)
+#define DLOGW(module, fmt, ...) DLOG(ESP_LOG_WARN, module, fmt, ##__VA_ARGS__)
+#define DLOGI(module, fmt, ...) DLOG(ESP_LOG_INFO, module, fmt, ##__VA_ARGS__)
+#define DLOGD(module, fmt, ...) DLOG(ESP_LOG_DEBUG, module, fmt, ##__VA_ARGS__)
+
+#endif
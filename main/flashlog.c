@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_attr.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "flashlog.h"
+#include "timex.h"
+
+#define FLASHLOG_MAGIC        0x474C4E4D   // "MNLG"
+#define FLASHLOG_STATE_MAGIC  0x5354474C
+#define FLASHLOG_SCAN_CHUNK   16           // Records read per esp_partition_read during scans
+
+// Written once right after a sector is erased. first_seq lets readers skip whole sectors.
+typedef struct {
+    uint32_t magic;
+    uint32_t sector_seq;
+    uint32_t first_seq;
+    uint32_t reserved[4];
+    uint32_t crc;
+} flashlog_sector_header_t;
+
+#define FLASHLOG_RECORDS_PER_SECTOR ((FLASHLOG_SECTOR_SIZE - sizeof(flashlog_sector_header_t)) / sizeof(flashlog_record_t))
+
+_Static_assert(sizeof(flashlog_record_t) == 32, "flashlog record must stay 32 bytes");
+_Static_assert(sizeof(flashlog_sector_header_t) == 32, "flashlog sector header must stay 32 bytes");
+
+// Write position, kept in RTC memory so timer wakes don't have to rescan the partition.
+typedef struct {
+    uint32_t magic;
+    uint32_t sector_count;
+    uint32_t head;          // Sector currently being filled
+    uint32_t head_seq;      // sector_seq of the head sector
+    uint32_t slot;          // Next free record slot in the head sector
+    uint32_t next_seq;
+    uint32_t acked_seq;
+} flashlog_state_t;
+
+static const char *FLTAG = "FLASH_LOG";
+static const esp_partition_t *log_part = NULL;
+
+static RTC_DATA_ATTR flashlog_state_t state;
+static RTC_DATA_ATTR flashlog_record_t pending[FLASHLOG_BATCH_RECORDS];
+static RTC_DATA_ATTR uint32_t pending_count;
+
+static bool is_erased(const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+static uint32_t record_crc(const flashlog_record_t *rec) {
+    return esp_rom_crc32_le(0, (const uint8_t *)rec, offsetof(flashlog_record_t, crc));
+}
+
+static uint32_t header_crc(const flashlog_sector_header_t *hdr) {
+    return esp_rom_crc32_le(0, (const uint8_t *)hdr, offsetof(flashlog_sector_header_t, crc));
+}
+
+static size_t slot_offset(uint32_t sector, uint32_t slot) {
+    return (size_t)sector * FLASHLOG_SECTOR_SIZE + sizeof(flashlog_sector_header_t) + (size_t)slot * sizeof(flashlog_record_t);
+}
+
+static bool read_header(uint32_t sector, flashlog_sector_header_t *hdr) {
+    if (esp_partition_read(log_part, (size_t)sector * FLASHLOG_SECTOR_SIZE, hdr, sizeof(*hdr)) != ESP_OK) return false;
+    return hdr->magic == FLASHLOG_MAGIC && hdr->crc == header_crc(hdr);
+}
+
+// Erases a sector and stamps it as the new head. The oldest records are recycled here.
+static esp_err_t open_sector(uint32_t sector, uint32_t sector_seq, uint32_t first_seq) {
+    ESP_LOGD(FLTAG, "Opening sector %" PRIu32 " (seq %" PRIu32 ")", sector, sector_seq);
+    esp_err_t ret = esp_partition_erase_range(log_part, (size_t)sector * FLASHLOG_SECTOR_SIZE, FLASHLOG_SECTOR_SIZE);
+    if (ret != ESP_OK) return ret;
+
+    flashlog_sector_header_t hdr = {
+        .magic = FLASHLOG_MAGIC,
+        .sector_seq = sector_seq,
+        .first_seq = first_seq,
+    };
+    memset(hdr.reserved, 0xFF, sizeof(hdr.reserved));
+    hdr.crc = header_crc(&hdr);
+    ret = esp_partition_write(log_part, (size_t)sector * FLASHLOG_SECTOR_SIZE, &hdr, sizeof(hdr));
+    if (ret != ESP_OK) return ret;
+
+    state.head = sector;
+    state.head_seq = sector_seq;
+    state.slot = 0;
+    return ESP_OK;
+}
+
+// Cold boot: find the newest sector, the next free slot and the last server ack.
+// Slots with a bad CRC (power cut mid-write) are skipped but never reused.
+static esp_err_t scan_partition(void) {
+    flashlog_sector_header_t hdr;
+    flashlog_record_t chunk[FLASHLOG_SCAN_CHUNK];
+    bool found = false;
+
+    state.next_seq = 1;
+    state.acked_seq = 0;
+    state.slot = 0;
+
+    for (uint32_t s = 0; s < state.sector_count; s++) {
+        if (!read_header(s, &hdr)) continue;
+        if (!found || hdr.sector_seq > state.head_seq) {
+            state.head = s;
+            state.head_seq = hdr.sector_seq;
+            found = true;
+        }
+        if (hdr.first_seq > state.next_seq) state.next_seq = hdr.first_seq;
+
+        bool end = false;
+        for (uint32_t base = 0; base < FLASHLOG_RECORDS_PER_SECTOR && !end; base += FLASHLOG_SCAN_CHUNK) {
+            uint32_t n = FLASHLOG_RECORDS_PER_SECTOR - base;
+            if (n > FLASHLOG_SCAN_CHUNK) n = FLASHLOG_SCAN_CHUNK;
+            esp_err_t ret = esp_partition_read(log_part, slot_offset(s, base), chunk, n * sizeof(flashlog_record_t));
+            if (ret != ESP_OK) return ret;
+
+            for (uint32_t i = 0; i < n; i++) {
+                if (is_erased(&chunk[i], sizeof(chunk[i]))) {
+                    end = true;
+                    break;
+                }
+                if (chunk[i].crc != record_crc(&chunk[i])) {
+                    ESP_LOGW(FLTAG, "Torn record in sector %" PRIu32 " slot %" PRIu32, s, base + i);
+                    continue;
+                }
+                if (chunk[i].seq >= state.next_seq) state.next_seq = chunk[i].seq + 1;
+                if (chunk[i].type == FLASHLOG_REC_ACK && chunk[i].ack_seq > state.acked_seq) {
+                    state.acked_seq = chunk[i].ack_seq;
+                }
+            }
+        }
+    }
+
+    if (!found) {
+        ESP_LOGI(FLTAG, "Empty log partition, formatting");
+        return open_sector(0, 1, state.next_seq);
+    }
+
+    // Position after the last used slot of the head sector
+    state.slot = FLASHLOG_RECORDS_PER_SECTOR;
+    for (uint32_t slot = 0; slot < FLASHLOG_RECORDS_PER_SECTOR; slot++) {
+        flashlog_record_t rec;
+        esp_err_t ret = esp_partition_read(log_part, slot_offset(state.head, slot), &rec, sizeof(rec));
+        if (ret != ESP_OK) return ret;
+        if (is_erased(&rec, sizeof(rec))) {
+            state.slot = slot;
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t flashlog_init(void) {
+    log_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FLASHLOG_PARTITION_LABEL);
+    if (!log_part) {
+        ESP_LOGE(FLTAG, "Partition '%s' not found", FLASHLOG_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t sector_count = log_part->size / FLASHLOG_SECTOR_SIZE;
+    if (sector_count < 2) {
+        ESP_LOGE(FLTAG, "Partition '%s' too small", FLASHLOG_PARTITION_LABEL);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Trust the RTC copy only if the slot it points at is still blank
+    if (state.magic == FLASHLOG_STATE_MAGIC && state.sector_count == sector_count) {
+        if (state.slot >= FLASHLOG_RECORDS_PER_SECTOR) return ESP_OK;
+        flashlog_record_t rec;
+        if (esp_partition_read(log_part, slot_offset(state.head, state.slot), &rec, sizeof(rec)) == ESP_OK &&
+            is_erased(&rec, sizeof(rec))) {
+            return ESP_OK;
+        }
+        ESP_LOGW(FLTAG, "RTC log state stale, rescanning");
+    }
+
+    state.magic = 0;
+    state.sector_count = sector_count;
+    pending_count = 0;
+    esp_err_t ret = scan_partition();
+    if (ret != ESP_OK) {
+        ESP_LOGE(FLTAG, "Log scan failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    state.magic = FLASHLOG_STATE_MAGIC;
+    ESP_LOGI(FLTAG, "Log ready: sector %" PRIu32 " slot %" PRIu32 ", next seq %" PRIu32 ", acked %" PRIu32,
+             state.head, state.slot, state.next_seq, state.acked_seq);
+    return ESP_OK;
+}
+
+// Writes pending records in runs that never cross a sector boundary.
+esp_err_t flashlog_flush(void) {
+    if (!log_part) return ESP_ERR_INVALID_STATE;
+
+    uint32_t done = 0;
+    esp_err_t ret = ESP_OK;
+    while (done < pending_count) {
+        if (state.slot >= FLASHLOG_RECORDS_PER_SECTOR) {
+            ret = open_sector((state.head + 1) % state.sector_count, state.head_seq + 1, pending[done].seq);
+            if (ret != ESP_OK) break;
+        }
+
+        uint32_t n = pending_count - done;
+        if (n > FLASHLOG_RECORDS_PER_SECTOR - state.slot) n = FLASHLOG_RECORDS_PER_SECTOR - state.slot;
+
+        ret = esp_partition_write(log_part, slot_offset(state.head, state.slot), &pending[done], n * sizeof(flashlog_record_t));
+        // A failed write may have programmed part of the run, so never reuse those slots
+        state.slot += n;
+        if (ret != ESP_OK) break;
+        done += n;
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(FLTAG, "Flash write failed: %s", esp_err_to_name(ret));
+    }
+    memmove(pending, &pending[done], (pending_count - done) * sizeof(flashlog_record_t));
+    pending_count -= done;
+    return ret;
+}
+
+static esp_err_t queue_record(flashlog_record_t *rec) {
+    if (pending_count >= FLASHLOG_BATCH_RECORDS) {
+        ESP_LOGE(FLTAG, "Batch buffer full, dropping record");
+        return ESP_ERR_NO_MEM;
+    }
+    rec->seq = state.next_seq++;
+    rec->crc = record_crc(rec);
+    pending[pending_count++] = *rec;
+
+    if (pending_count == FLASHLOG_BATCH_RECORDS) return flashlog_flush();
+    return ESP_OK;
+}
+
+esp_err_t flashlog_append(uint32_t pressure, float temp, float voltage) {
+    int ms;
+    struct tm now = get_time_now(&ms);
+    return flashlog_append_at((uint32_t)mktime(&now), (uint16_t)ms, pressure, temp, voltage);
+}
+
+esp_err_t flashlog_append_at(uint32_t timestamp, uint16_t ms, uint32_t pressure, float temp, float voltage) {
+    if (!log_part) return ESP_ERR_INVALID_STATE;
+
+    flashlog_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = FLASHLOG_REC_DATA;
+    rec.ms = ms;
+    rec.timestamp = timestamp;
+    rec.pressure = pressure;
+    rec.temp = temp;
+    rec.voltage = voltage;
+    return queue_record(&rec);
+}
+
+esp_err_t flashlog_ack(uint32_t seq) {
+    if (!log_part) return ESP_ERR_INVALID_STATE;
+    if (seq <= state.acked_seq) return ESP_OK;
+
+    flashlog_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = FLASHLOG_REC_ACK;
+    rec.ack_seq = seq;
+
+    esp_err_t ret = queue_record(&rec);
+    if (ret == ESP_OK) ret = flashlog_flush();
+    if (ret == ESP_OK) state.acked_seq = seq;
+    return ret;
+}
+
+uint32_t flashlog_acked_seq(void) {
+    return state.acked_seq;
+}
+
+// Only records already in flash are returned, call flashlog_flush first.
+esp_err_t flashlog_read_since(uint32_t after_seq, flashlog_record_t *out, size_t max, size_t *count) {
+    *count = 0;
+    if (!log_part) return ESP_ERR_INVALID_STATE;
+
+    // Sectors are in write order starting just after the head. Find the last one that
+    // starts at or before the wanted seq so older sectors don't have to be read.
+    flashlog_sector_header_t hdr;
+    uint32_t oldest = (state.head + 1) % state.sector_count;
+    uint32_t start = state.head;
+    bool have_start = false;
+    for (uint32_t k = 0; k < state.sector_count; k++) {
+        uint32_t s = (oldest + k) % state.sector_count;
+        if (!read_header(s, &hdr)) continue;
+        if (!have_start || hdr.first_seq <= after_seq + 1) {
+            start = s;
+            have_start = true;
+        }
+    }
+    if (!have_start) return ESP_OK;
+
+    flashlog_record_t chunk[FLASHLOG_SCAN_CHUNK];
+    for (uint32_t s = start;; s = (s + 1) % state.sector_count) {
+        if (read_header(s, &hdr)) {
+            uint32_t used = (s == state.head) ? state.slot : FLASHLOG_RECORDS_PER_SECTOR;
+            for (uint32_t base = 0; base < used; base += FLASHLOG_SCAN_CHUNK) {
+                uint32_t n = used - base;
+                if (n > FLASHLOG_SCAN_CHUNK) n = FLASHLOG_SCAN_CHUNK;
+                esp_err_t ret = esp_partition_read(log_part, slot_offset(s, base), chunk, n * sizeof(flashlog_record_t));
+                if (ret != ESP_OK) return ret;
+
+                for (uint32_t i = 0; i < n; i++) {
+                    if (is_erased(&chunk[i], sizeof(chunk[i]))) break;
+                    if (chunk[i].crc != record_crc(&chunk[i])) continue;
+                    if (chunk[i].type != FLASHLOG_REC_DATA || chunk[i].seq <= after_seq) continue;
+                    out[(*count)++] = chunk[i];
+                    if (*count == max) return ESP_OK;
+                }
+            }
+        }
+        if (s == state.head) break;
+    }
+    return ESP_OK;
+}
+
+// Same row layout as sd_write_sensors so the server sees no difference.
+int flashlog_format_row(const flashlog_record_t *rec, char *buf, size_t buf_size) {
+    time_t t = (time_t)rec->timestamp;
+    struct tm tm_rec;
+    localtime_r(&t, &tm_rec);
+
+    return snprintf(buf, buf_size, "'%02d-%02d-%04d %02d:%02d:%02d:%03d','%" PRIu32 "','%.2f','%.2f','%.2f'\n",
+                    tm_rec.tm_mday, tm_rec.tm_mon + 1, tm_rec.tm_year + 1900,
+                    tm_rec.tm_hour, tm_rec.tm_min, tm_rec.tm_sec, rec->ms,
+                    rec->pressure, rec->temp, rec->voltage, 0.0);
+}
+
+esp_err_t flashlog_export(const char *filepath) {
+    esp_err_t ret = flashlog_flush();
+    if (ret != ESP_OK) return ret;
+
+    FILE *file = fopen(filepath, "w");
+    if (!file) {
+        ESP_LOGE(FLTAG, "Failed to open %s for export", filepath);
+        return ESP_FAIL;
+    }
+
+    flashlog_record_t batch[FLASHLOG_SCAN_CHUNK];
+    char row[128];
+    uint32_t after = 0;
+    size_t total = 0;
+    size_t count;
+    do {
+        ret = flashlog_read_since(after, batch, FLASHLOG_SCAN_CHUNK, &count);
+        if (ret != ESP_OK) break;
+        for (size_t i = 0; i < count; i++) {
+            flashlog_format_row(&batch[i], row, sizeof(row));
+            fputs(row, file);
+        }
+        if (count) after = batch[count - 1].seq;
+        total += count;
+    } while (count == FLASHLOG_SCAN_CHUNK);
+
+    fclose(file);
+    ESP_LOGI(FLTAG, "Exported %u records to %s", (unsigned)total, filepath);
+    return ret;
+}
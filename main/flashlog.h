@@ -0,0 +1,54 @@
+#ifndef FLASHLOG_H
+#define FLASHLOG_H
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// CONFIG_NODE_FLASHLOG logs samples to the "sensorlog" flash partition instead of the SD card.
+// The SD card is then only used to export the log.
+#ifdef CONFIG_NODE_FLASHLOG
+#define FLASHLOG_ENABLED 1
+#else
+#define FLASHLOG_ENABLED 0
+#endif
+
+#define FLASHLOG_PARTITION_LABEL "sensorlog"
+#define FLASHLOG_SECTOR_SIZE     4096
+// Samples are batched in RTC memory before a flash write. RTC memory survives deep sleep but
+// not a power cut or brown-out reset, which loses up to FLASHLOG_BATCH_RECORDS - 1 of the
+// newest samples. Uploads and exports flush first, so only flashed records are acknowledged.
+#define FLASHLOG_BATCH_RECORDS   4
+
+#define FLASHLOG_REC_DATA 0x0001
+#define FLASHLOG_REC_ACK  0x0002
+
+// One 32 byte slot in the log. Sectors are filled front to back and never rewritten.
+typedef struct {
+    uint32_t seq;
+    uint16_t type;
+    uint16_t ms;
+    uint32_t timestamp;   // Unix time of the sample
+    uint32_t pressure;
+    float temp;
+    float voltage;
+    uint32_t ack_seq;     // FLASHLOG_REC_ACK only: highest seq accepted by the server
+    uint32_t crc;
+} flashlog_record_t;
+
+esp_err_t flashlog_init(void);
+esp_err_t flashlog_append(uint32_t pressure, float temp, float voltage);
+// For samples taken earlier, e.g. by the wake stub
+esp_err_t flashlog_append_at(uint32_t timestamp, uint16_t ms, uint32_t pressure, float temp, float voltage);
+esp_err_t flashlog_flush(void);
+
+// Reads up to max data records newer than after_seq, oldest first.
+esp_err_t flashlog_read_since(uint32_t after_seq, flashlog_record_t *out, size_t max, size_t *count);
+esp_err_t flashlog_ack(uint32_t seq);
+uint32_t flashlog_acked_seq(void);
+
+int flashlog_format_row(const flashlog_record_t *rec, char *buf, size_t buf_size);
+esp_err_t flashlog_export(const char *filepath);
+
+#endif
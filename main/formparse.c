@@ -0,0 +1,157 @@
+#include <string.h>
+#include "esp_log.h"
+#include "formparse.h"
+
+#define FORM_RECV_TIMEOUTS 3
+
+static const char *FORMTAG = "FORM";
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Appends one decoded byte to the name or the current value
+static void emit(form_parser_t *p, char c) {
+    if (!p->in_value) {
+        if (p->name_len < FORM_MAX_NAME_LEN) {
+            p->name[p->name_len++] = c;
+        } else {
+            p->name_overflow = true;
+        }
+        return;
+    }
+
+    if (!p->current) return;
+    if (p->value_len + 1 < p->current->size) {
+        p->current->value[p->value_len++] = c;
+    } else {
+        p->truncated = true;
+    }
+}
+
+// A malformed escape is kept literally, as url_decode does
+static void flush_pct(form_parser_t *p) {
+    if (p->pct_len == 0) return;
+    emit(p, '%');
+    if (p->pct_len == 2) emit(p, p->pct_hi);
+    p->pct_len = 0;
+}
+
+static void end_name(form_parser_t *p) {
+    flush_pct(p);
+    p->current = NULL;
+    if (!p->name_overflow) {
+        for (size_t i = 0; i < p->field_count; i++) {
+            if (strlen(p->fields[i].name) == p->name_len &&
+                memcmp(p->fields[i].name, p->name, p->name_len) == 0) {
+                // A repeated name overwrites the earlier value
+                p->current = &p->fields[i];
+                p->current->found = true;
+                break;
+            }
+        }
+    }
+    p->in_value = true;
+    p->value_len = 0;
+}
+
+static void end_pair(form_parser_t *p) {
+    flush_pct(p);
+    if (!p->in_value && p->name_len > 0) {
+        end_name(p);   // "name" without '=' counts as an empty value
+    }
+    if (p->current) {
+        p->current->value[p->value_len] = '\0';
+    }
+    p->current = NULL;
+    p->in_value = false;
+    p->name_len = 0;
+    p->name_overflow = false;
+    p->value_len = 0;
+}
+
+void form_parser_init(form_parser_t *p, form_field_t *fields, size_t field_count) {
+    memset(p, 0, sizeof(*p));
+    p->fields = fields;
+    p->field_count = field_count;
+    for (size_t i = 0; i < field_count; i++) {
+        if (fields[i].size > 0) fields[i].value[0] = '\0';
+        fields[i].found = false;
+    }
+}
+
+void form_parser_feed(form_parser_t *p, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (p->pct_len > 0) {
+            if (hex_value(c) >= 0) {
+                if (p->pct_len == 1) {
+                    p->pct_hi = c;
+                    p->pct_len = 2;
+                } else {
+                    p->pct_len = 0;
+                    emit(p, (char)(hex_value(p->pct_hi) << 4 | hex_value(c)));
+                }
+                continue;
+            }
+            flush_pct(p);   // Not an escape after all; c is handled below
+        }
+
+        switch (c) {
+            case '&':
+                end_pair(p);
+                break;
+            case '=':
+                if (!p->in_value) {
+                    end_name(p);
+                } else {
+                    emit(p, c);
+                }
+                break;
+            case '%':
+                p->pct_len = 1;
+                break;
+            case '+':
+                emit(p, ' ');
+                break;
+            default:
+                emit(p, c);
+                break;
+        }
+    }
+}
+
+esp_err_t form_parser_finish(form_parser_t *p) {
+    end_pair(p);
+    return p->truncated ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+esp_err_t form_read_request(httpd_req_t *req, form_field_t *fields, size_t field_count) {
+    if (req->content_len > FORM_MAX_BODY) {
+        ESP_LOGW(FORMTAG, "Form body of %u bytes refused", (unsigned)req->content_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    form_parser_t parser;
+    form_parser_init(&parser, fields, field_count);
+
+    char buf[FORM_CHUNK_SIZE];
+    size_t remaining = req->content_len;
+    int timeouts = 0;
+    while (remaining > 0) {
+        int received = httpd_req_recv(req, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
+        if (received <= 0) {
+            if (received == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < FORM_RECV_TIMEOUTS) continue;
+            ESP_LOGW(FORMTAG, "Failed to read form body (%d)", received);
+            return ESP_FAIL;
+        }
+        form_parser_feed(&parser, buf, received);
+        remaining -= received;
+    }
+
+    return form_parser_finish(&parser);
+}
@@ -0,0 +1,45 @@
+#ifndef FORMPARSE_H
+#define FORMPARSE_H
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FORM_MAX_NAME_LEN  16     // Longer names can't match a field and are skipped
+#define FORM_CHUNK_SIZE    128    // Receive buffer, the only copy of the raw body
+#define FORM_MAX_BODY      2048   // Larger requests are refused before reading
+
+// A field to capture. value is always NUL terminated; found is set if the name appeared.
+typedef struct {
+    const char *name;
+    char *value;
+    size_t size;
+    bool found;
+} form_field_t;
+
+// Incremental application/x-www-form-urlencoded parser. Bytes are URL-decoded straight
+// into the field buffers as they arrive, so fields and escapes may straddle chunks.
+typedef struct {
+    form_field_t *fields;
+    size_t field_count;
+    form_field_t *current;   // Field whose value is being written, NULL while skipping
+    bool in_value;
+    char name[FORM_MAX_NAME_LEN + 1];
+    size_t name_len;
+    bool name_overflow;
+    size_t value_len;
+    char pct_hi;             // First hex digit of an escape not yet complete
+    size_t pct_len;          // 0, or 1 or 2 once '%' has been seen
+    bool truncated;
+} form_parser_t;
+
+void form_parser_init(form_parser_t *p, form_field_t *fields, size_t field_count);
+void form_parser_feed(form_parser_t *p, const char *data, size_t len);
+// ESP_ERR_INVALID_SIZE if any captured value didn't fit its buffer
+esp_err_t form_parser_finish(form_parser_t *p);
+
+// Reads the whole request body through the parser
+esp_err_t form_read_request(httpd_req_t *req, form_field_t *fields, size_t field_count);
+
+#endif
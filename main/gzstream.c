@@ -0,0 +1,191 @@
+#include <string.h>
+#include "gzstream.h"
+
+#define GZ_MIN_MATCH 3
+#define GZ_MAX_MATCH 258
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+// CRC-32 as gzip uses it, a nibble at a time to keep the table small
+static const uint32_t crc_nibble[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crc_nibble[crc & 0x0F];
+        crc = (crc >> 4) ^ crc_nibble[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+static void put_byte(gz_stream_t *gz, uint8_t byte) {
+    gz->out[gz->out_len++] = byte;
+    if (gz->out_len == sizeof(gz->out)) {
+        if (!gz->failed && !gz->emit(gz->out, gz->out_len, gz->ctx)) gz->failed = true;
+        gz->out_len = 0;
+    }
+}
+
+// Deflate packs bits from the least significant end
+static void put_bits(gz_stream_t *gz, uint32_t value, unsigned count) {
+    gz->bits |= value << gz->bit_count;
+    gz->bit_count += count;
+    while (gz->bit_count >= 8) {
+        put_byte(gz, (uint8_t)gz->bits);
+        gz->bits >>= 8;
+        gz->bit_count -= 8;
+    }
+}
+
+// Huffman codes go most significant bit first
+static void put_code(gz_stream_t *gz, uint32_t code, unsigned count) {
+    uint32_t reversed = 0;
+    for (unsigned i = 0; i < count; i++) {
+        reversed = reversed << 1 | (code & 1);
+        code >>= 1;
+    }
+    put_bits(gz, reversed, count);
+}
+
+// Fixed literal/length code, RFC 1951 3.2.6
+static void put_symbol(gz_stream_t *gz, unsigned symbol) {
+    if (symbol < 144) {
+        put_code(gz, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        put_code(gz, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        put_code(gz, symbol - 256, 7);
+    } else {
+        put_code(gz, 0xC0 + symbol - 280, 8);
+    }
+}
+
+static void put_match(gz_stream_t *gz, unsigned length, unsigned distance) {
+    unsigned code = 28;
+    while (length_base[code] > length) code--;
+    put_symbol(gz, 257 + code);
+    put_bits(gz, length - length_base[code], length_extra[code]);
+
+    code = 29;
+    while (dist_base[code] > distance) code--;
+    put_code(gz, code, 5);
+    put_bits(gz, distance - dist_base[code], dist_extra[code]);
+}
+
+static unsigned hash_at(const uint8_t *p) {
+    uint32_t v = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    return (v * 2654435761u) >> (32 - GZ_HASH_BITS);
+}
+
+// Encodes window bytes up to limit. Matches may read past it, up to end.
+static void encode(gz_stream_t *gz, size_t limit) {
+    while (gz->pos < limit) {
+        size_t avail = gz->end - gz->pos;
+        unsigned length = 0;
+        size_t distance = 0;
+
+        if (avail >= GZ_MIN_MATCH) {
+            unsigned h = hash_at(gz->window + gz->pos);
+            size_t candidate = gz->head[h];
+            gz->head[h] = (uint16_t)(gz->pos + 1);
+            if (candidate && gz->pos - (candidate - 1) <= GZ_WINDOW) {
+                candidate--;
+                size_t max = avail < GZ_MAX_MATCH ? avail : GZ_MAX_MATCH;
+                while (length < max && gz->window[candidate + length] == gz->window[gz->pos + length]) length++;
+                distance = gz->pos - candidate;
+            }
+        }
+
+        if (length >= GZ_MIN_MATCH) {
+            put_match(gz, length, distance);
+            // Positions inside the match stay findable for later ones
+            for (size_t i = gz->pos + 1; i < gz->pos + length && i + GZ_MIN_MATCH <= gz->end; i++) {
+                gz->head[hash_at(gz->window + i)] = (uint16_t)(i + 1);
+            }
+            gz->pos += length;
+        } else {
+            put_symbol(gz, gz->window[gz->pos]);
+            gz->pos++;
+        }
+    }
+}
+
+// Keeps the last GZ_WINDOW bytes as history for the next ones
+static void slide(gz_stream_t *gz) {
+    memmove(gz->window, gz->window + GZ_WINDOW, gz->end - GZ_WINDOW);
+    gz->pos -= GZ_WINDOW;
+    gz->end -= GZ_WINDOW;
+    for (size_t i = 0; i < sizeof(gz->head) / sizeof(gz->head[0]); i++) {
+        gz->head[i] = gz->head[i] > GZ_WINDOW ? gz->head[i] - GZ_WINDOW : 0;
+    }
+}
+
+void gz_begin(gz_stream_t *gz, gz_emit_t emit, void *ctx) {
+    memset(gz->head, 0, sizeof(gz->head));
+    gz->emit = emit;
+    gz->ctx = ctx;
+    gz->failed = false;
+    gz->crc = 0;
+    gz->size = 0;
+    gz->pos = 0;
+    gz->end = 0;
+    gz->bits = 0;
+    gz->bit_count = 0;
+    gz->out_len = 0;
+
+    // Deflate, no name or mtime, unknown OS
+    static const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+    for (size_t i = 0; i < sizeof(header); i++) put_byte(gz, header[i]);
+    // The whole stream is one final block with the fixed codes
+    put_bits(gz, 1, 1);
+    put_bits(gz, 1, 2);
+}
+
+bool gz_write(gz_stream_t *gz, const void *data, size_t len) {
+    const uint8_t *in = data;
+    gz->crc = crc_update(gz->crc, in, len);
+    gz->size += (uint32_t)len;
+
+    while (len > 0 && !gz->failed) {
+        size_t n = sizeof(gz->window) - gz->end;
+        if (n > len) n = len;
+        memcpy(gz->window + gz->end, in, n);
+        gz->end += n;
+        in += n;
+        len -= n;
+
+        // Hold back a full match length so matches aren't cut at write boundaries
+        if (gz->end == sizeof(gz->window)) {
+            encode(gz, gz->end - GZ_MAX_MATCH);
+            slide(gz);
+        }
+    }
+    return !gz->failed;
+}
+
+bool gz_finish(gz_stream_t *gz) {
+    encode(gz, gz->end);
+    put_symbol(gz, 256);
+    if (gz->bit_count) put_bits(gz, 0, 8 - gz->bit_count);
+    for (int i = 0; i < 32; i += 8) put_byte(gz, (uint8_t)(gz->crc >> i));
+    for (int i = 0; i < 32; i += 8) put_byte(gz, (uint8_t)(gz->size >> i));
+    if (gz->out_len && !gz->failed && !gz->emit(gz->out, gz->out_len, gz->ctx)) gz->failed = true;
+    gz->out_len = 0;
+    return !gz->failed;
+}
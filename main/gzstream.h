@@ -0,0 +1,42 @@
+#ifndef GZSTREAM_H
+#define GZSTREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming gzip encoder with a fixed memory footprint, for sending logs over a slow link.
+// One fixed-Huffman deflate block, LZ77 over a GZ_WINDOW byte window with a single hash
+// candidate per position. Payload rows, with their repeating dates, shrink to about a fifth.
+// Plain C with no IDF dependencies.
+
+#define GZ_WINDOW    4096
+#define GZ_HASH_BITS 12
+#define GZ_OUT_BYTES 1024
+
+// Receives the compressed stream in pieces of up to GZ_OUT_BYTES. Returning false aborts it.
+typedef bool (*gz_emit_t)(const uint8_t *data, size_t len, void *ctx);
+
+typedef struct {
+    gz_emit_t emit;
+    void *ctx;
+    bool failed;
+    uint32_t crc;
+    uint32_t size;              // Input bytes, modulo 2^32 as gzip stores it
+    size_t pos;                 // Next window byte to encode
+    size_t end;                 // Bytes in the window
+    uint32_t bits;
+    unsigned bit_count;
+    size_t out_len;
+    uint16_t head[1 << GZ_HASH_BITS];   // Window position + 1 of the last 3-byte string per hash
+    uint8_t window[2 * GZ_WINDOW];
+    uint8_t out[GZ_OUT_BYTES];
+} gz_stream_t;
+
+void gz_begin(gz_stream_t *gz, gz_emit_t emit, void *ctx);
+// false once the emit callback has failed
+bool gz_write(gz_stream_t *gz, const void *data, size_t len);
+// Encodes what is left and writes the trailer
+bool gz_finish(gz_stream_t *gz);
+
+#endif
@@ -1,20 +1,12 @@
 #include "html.h"
 
-// HTML Template with status message support
-const char *HTML_PAGE =
+// The page is streamed in segments around the generated parts, so there are no
+// format specifiers and no size limit. Styling is served pre-gzipped from /style.css.
+const char HTML_PAGE_HEAD[] =
 "<html>\n"
 "<head>\n"
 "<title>WiFi Config</title>\n"
-"<style>\n"
-"body { font-family: Arial, sans-serif; text-align: center; background-color: #f4f4f4; padding: 20px; }\n"
-"h1 { color: #333; }\n"
-".container { display: flex; flex-direction: column; align-items: center; gap: 20px; }\n"
-"form { background: #fff; padding: 20px; border-radius: 10px; box-shadow: 0px 0px 10px rgba(0, 0, 0, 0.1); width: 300px; }\n"
-"input, select { padding: 10px; margin-top: 10px; width: 100%; border: 1px solid #ccc; border-radius: 5px; }\n"
-"input[type=submit] { background: #007BFF; color: white; border: none; cursor: pointer; font-size: 18px; padding: 8px; width: 200px; }\n"
-"input[type=submit]:hover { background: #0056b3; }\n"
-"p { font-size: 14px; font-weight: bold; }\n"
-"</style>\n"
+"<link rel=\"stylesheet\" href=\"/style.css\">\n"
 "</head>\n"
 "<body>\n"
 "<h1>WiFi Configuration</h1>\n"
@@ -22,8 +14,11 @@ const char *HTML_PAGE =
 
 "<form action=\"/connect\" method=\"post\">\n"
 "<label for=\"ssid\">Select WiFi:</label>\n"
-"<select name=\"ssid\">\n"
-"%s" // WiFi options placeholder
+"<select name=\"ssid\" id=\"ssid\">\n";
+
+// WiFi option rows go here
+
+const char HTML_PAGE_MIDDLE[] =
 "</select><br><br>\n"
 "<label for=\"password\">Password:</label>\n"
 "<input type=\"password\" name=\"password\"><br><br>\n"
@@ -44,6 +39,32 @@ const char *HTML_PAGE =
 "<input type=\"submit\" value=\"Register Device\">\n"
 "</form>\n"
 
+"<form action=\"/exit\" method=\"post\">\n"
+"<input type=\"submit\" value=\"Done, resume sampling\">\n"
+"</form>\n"
+
 "</div>\n"
-"<p style=\"color: %s;\">%s</p>\n" // Status message
+"<p id=\"status\" style=\"color: ";
+
+// Status colour, then ";\">", then the escaped status message
+
+// Polls /scan.json while a background scan runs and rebuilds the network list when it lands,
+// and /status.json while a connection attempt is in progress
+const char HTML_PAGE_TAIL[] =
+"</p>\n"
+"<script>\n"
+"function poll(){fetch('/scan.json').then(r=>r.json()).then(d=>{\n"
+"var s=document.getElementById('ssid'),v=s.value;\n"
+"if(d.networks.length){s.innerHTML='';d.networks.forEach(n=>{\n"
+"var o=document.createElement('option');o.value=n.ssid;o.textContent=n.ssid+' ('+n.rssi+'dBm)';s.appendChild(o);});\n"
+"if(v)s.value=v;}\n"
+"if(d.scanning)setTimeout(poll,1500);}).catch(()=>setTimeout(poll,3000));}\n"
+"poll();\n"
+"function status(){fetch('/status.json').then(r=>r.json()).then(d=>{\n"
+"var p=document.getElementById('status');\n"
+"if(d.state=='connecting'){p.style.color='black';p.textContent='Connecting to '+d.ssid+'...';setTimeout(status,1000);}\n"
+"else if(location.search.indexOf('connecting')>=0){var ok=d.state=='connected';p.style.color=ok?'green':'red';\n"
+"p.textContent=ok?'Connected to '+d.ssid:'Connection failed (reason '+d.reason+')';}});}\n"
+"status();\n"
+"</script>\n"
 "</body></html>\n";
@@ -1,6 +1,12 @@
 #ifndef HTML_H
 #define HTML_H
 
-extern const char *HTML_PAGE;
+extern const char HTML_PAGE_HEAD[];
+extern const char HTML_PAGE_MIDDLE[];
+extern const char HTML_PAGE_TAIL[];
+
+// style.css, gzipped at build time
+extern const char style_css_gz_start[] asm("_binary_style_css_gz_start");
+extern const char style_css_gz_end[] asm("_binary_style_css_gz_end");
 
 #endif
\ No newline at end of file
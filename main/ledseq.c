@@ -0,0 +1,24 @@
+#include <string.h>
+#include "ledseq.h"
+
+bool led_seq_frame(const led_pattern_t *pattern, uint32_t step, led_frame_t *frame) {
+    memset(frame, 0, sizeof(*frame));
+
+    if (pattern->mode == LED_SOLID) {
+        if (step > 0) return false;
+        memcpy(frame->rgb, pattern->rgb, sizeof(frame->rgb));
+        return true;
+    }
+
+    // Two frames per cycle, lit then dark
+    if (pattern->count && step >= 2u * pattern->count) return false;
+    bool lit = step % 2 == 0;
+    if (lit) memcpy(frame->rgb, pattern->rgb, sizeof(frame->rgb));
+
+    uint16_t ms = lit ? pattern->on_ms : pattern->off_ms;
+    if (pattern->mode == LED_BREATHE) frame->fade_ms = ms;
+    // The final dark frame has nothing after it to wait for
+    bool last = pattern->count && step == 2u * pattern->count - 1;
+    frame->hold_ms = last ? 0 : (ms ? ms : 1);
+    return true;
+}
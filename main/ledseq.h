@@ -0,0 +1,34 @@
+#ifndef LEDSEQ_H
+#define LEDSEQ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Status LED patterns as a sequence of frames. Plain C with no IDF dependencies, the
+// LED task in LED.c plays the frames on the LEDC channels.
+
+typedef enum {
+    LED_SOLID,      // Colour until the next pattern
+    LED_BLINK,      // on_ms colour, off_ms dark
+    LED_BREATHE,    // Fades up over on_ms and down over off_ms
+} led_mode_t;
+
+typedef struct {
+    led_mode_t mode;
+    uint16_t rgb[3];        // Duty per channel, 0 to 8191
+    uint16_t on_ms;
+    uint16_t off_ms;
+    uint16_t count;         // Blink or breathe cycles, 0 repeats until the next pattern
+} led_pattern_t;
+
+typedef struct {
+    uint16_t rgb[3];        // Duty to reach
+    uint16_t fade_ms;       // 0 sets it at once, otherwise a hardware fade
+    uint16_t hold_ms;       // Time from the start of the frame to the next, 0 holds it
+} led_frame_t;
+
+// Fills frame for step 0, 1, ... of the pattern. False once the pattern has ended; the
+// last frame of every finite pattern leaves the LED dark.
+bool led_seq_frame(const led_pattern_t *pattern, uint32_t step, led_frame_t *frame);
+
+#endif
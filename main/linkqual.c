@@ -0,0 +1,148 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_wifi.h"
+#include "linkqual.h"
+
+#define LINK_HISTORY_MAGIC 0x4C4E4B31
+
+static const char *LINKTAG = "LINK";
+
+static RTC_DATA_ATTR link_history_t history;
+
+// Best try of this wake's upload, measured by the transport
+static struct {
+    bool ok;
+    size_t bytes;
+    uint32_t handshake_ms;
+    uint32_t transfer_ms;
+} attempt;
+
+// Used until a plan is made, e.g. for registration from the config portal
+static link_plan_t current_plan = {
+    .upload_now = true,
+    .rssi = 0,
+    .timeout_ms = LINK_MAX_TIMEOUT_MS,
+    .attempts = 3,
+    .chunk_bytes = 4096,
+};
+
+static uint32_t clamp_u32(uint32_t v, uint32_t lo, uint32_t hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+void link_decide(const link_history_t *h, int8_t rssi, size_t bytes, link_plan_t *plan) {
+    plan->rssi = rssi;
+    plan->upload_now = true;
+
+    // Skip doomed uploads, but never let data starve for more than a few wakes
+    if (h->deferred < LINK_MAX_DEFERRALS) {
+        if (rssi < LINK_RSSI_FLOOR) {
+            plan->upload_now = false;
+        } else if (h->fail_streak >= 2 && rssi <= h->last_fail_rssi + LINK_RSSI_HYSTERESIS) {
+            // Same link that just failed: back off 1, 2, 4 wakes before trying again
+            int shift = h->fail_streak - 2 > 2 ? 2 : h->fail_streak - 2;
+            if (h->deferred < (1 << shift)) plan->upload_now = false;
+        }
+    }
+
+    uint32_t handshake = h->samples ? h->handshake_ms : LINK_DEFAULT_HANDSHAKE_MS;
+    uint32_t throughput = h->samples && h->throughput_bps ? h->throughput_bps : LINK_DEFAULT_THROUGHPUT;
+    uint32_t transfer_ms = (uint32_t)((uint64_t)bytes * 1000 / throughput);
+    plan->timeout_ms = clamp_u32(2 * handshake + 3 * transfer_ms + 2000, LINK_MIN_TIMEOUT_MS, LINK_MAX_TIMEOUT_MS);
+
+    // Retries on a weak link mostly repeat the same failure
+    if (rssi >= LINK_RSSI_GOOD) {
+        plan->attempts = 3;
+        plan->chunk_bytes = 4096;
+    } else if (rssi >= LINK_RSSI_FAIR) {
+        plan->attempts = 2;
+        plan->chunk_bytes = 1024;
+    } else {
+        plan->attempts = 1;
+        plan->chunk_bytes = 512;
+    }
+}
+
+void link_update(link_history_t *h, int8_t rssi, size_t bytes, uint32_t handshake_ms, uint32_t transfer_ms, bool ok) {
+    h->deferred = 0;
+    if (!ok) {
+        h->last_fail_rssi = rssi;
+        if (h->fail_streak < UINT8_MAX) h->fail_streak++;
+        return;
+    }
+
+    h->fail_streak = 0;
+    uint32_t throughput = transfer_ms ? (uint32_t)((uint64_t)bytes * 1000 / transfer_ms) : LINK_DEFAULT_THROUGHPUT;
+    if (h->samples == 0) {
+        h->throughput_bps = throughput;
+        h->handshake_ms = handshake_ms;
+    } else {
+        // EWMA with weight 1/4 on the new sample
+        h->throughput_bps = (3 * h->throughput_bps + throughput) / 4;
+        h->handshake_ms = (3 * h->handshake_ms + handshake_ms) / 4;
+    }
+    if (h->samples < UINT8_MAX) h->samples++;
+}
+
+size_t link_budget(const link_history_t *h) {
+    uint32_t handshake = h->samples ? h->handshake_ms : LINK_DEFAULT_HANDSHAKE_MS;
+    uint32_t throughput = h->samples && h->throughput_bps ? h->throughput_bps : LINK_DEFAULT_THROUGHPUT;
+    // link_decide's timeout solved for the transfer time
+    if (2 * (uint64_t)handshake + 2000 >= LINK_MAX_TIMEOUT_MS) return 0;
+    uint32_t transfer_ms = (LINK_MAX_TIMEOUT_MS - 2 * handshake - 2000) / 3;
+    return (size_t)((uint64_t)transfer_ms * throughput / 1000);
+}
+
+const link_plan_t *link_plan_upload(size_t bytes, bool may_defer) {
+    if (history.magic != LINK_HISTORY_MAGIC) {
+        memset(&history, 0, sizeof(history));
+        history.magic = LINK_HISTORY_MAGIC;
+    }
+    memset(&attempt, 0, sizeof(attempt));
+
+    wifi_ap_record_t ap;
+    int8_t rssi = esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : LINK_RSSI_FLOOR;
+
+    link_decide(&history, rssi, bytes, &current_plan);
+    if (!may_defer) {
+        current_plan.upload_now = true;
+    } else if (!current_plan.upload_now && history.deferred < UINT8_MAX) {
+        history.deferred++;
+    }
+
+    ESP_LOGI(LINKTAG, "RSSI %d dBm, ~%" PRIu32 " B/s, handshake ~%" PRIu32 " ms: %s (timeout %" PRIu32 " ms, %d attempts, %u B chunks)",
+             rssi, history.throughput_bps, history.handshake_ms, current_plan.upload_now ? "upload" : "defer",
+             current_plan.timeout_ms, current_plan.attempts, (unsigned)current_plan.chunk_bytes);
+    return &current_plan;
+}
+
+const link_plan_t *link_current_plan(void) {
+    return &current_plan;
+}
+
+size_t link_upload_budget(void) {
+    static const link_history_t none;
+    return link_budget(history.magic == LINK_HISTORY_MAGIC ? &history : &none);
+}
+
+void link_record_attempt(size_t bytes, uint32_t handshake_ms, uint32_t transfer_ms, bool ok) {
+    if (attempt.ok && !ok) return;
+    attempt.ok = ok;
+    attempt.bytes = bytes;
+    attempt.handshake_ms = handshake_ms;
+    attempt.transfer_ms = transfer_ms;
+}
+
+void link_finish_upload(bool ok) {
+    if (history.magic != LINK_HISTORY_MAGIC) return;
+    if (ok && !attempt.ok) {
+        // Delivered without a measurement: the streak ends, the estimates stay
+        history.deferred = 0;
+        history.fail_streak = 0;
+        return;
+    }
+    link_update(&history, current_plan.rssi, attempt.bytes, attempt.handshake_ms, attempt.transfer_ms, ok);
+    memset(&attempt, 0, sizeof(attempt));
+}
@@ -0,0 +1,53 @@
+#ifndef LINKQUAL_H
+#define LINKQUAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LINK_RSSI_FLOOR          -85    // Below this an upload is almost never worth the energy
+#define LINK_RSSI_GOOD           -67
+#define LINK_RSSI_FAIR           -78
+#define LINK_RSSI_HYSTERESIS     3
+#define LINK_MAX_DEFERRALS       6      // Upload anyway after this many skipped wakes
+#define LINK_MIN_TIMEOUT_MS      5000
+#define LINK_MAX_TIMEOUT_MS      35000
+#define LINK_DEFAULT_HANDSHAKE_MS 3000
+#define LINK_DEFAULT_THROUGHPUT  4000   // Bytes/s assumed before the first measurement
+
+// Running link estimate, kept in RTC memory across deep sleep
+typedef struct {
+    uint32_t magic;
+    uint32_t throughput_bps;   // EWMA of body bytes / transfer time
+    uint32_t handshake_ms;     // EWMA of TCP+TLS connect time, roughly a few RTTs
+    int8_t last_fail_rssi;
+    uint8_t fail_streak;
+    uint8_t deferred;          // Wakes skipped in a row
+    uint8_t samples;
+} link_history_t;
+
+typedef struct {
+    bool upload_now;
+    int8_t rssi;
+    uint32_t timeout_ms;
+    int attempts;
+    size_t chunk_bytes;
+} link_plan_t;
+
+// Pure decision logic, no radio or RTOS calls
+void link_decide(const link_history_t *history, int8_t rssi, size_t bytes, link_plan_t *plan);
+void link_update(link_history_t *history, int8_t rssi, size_t bytes, uint32_t handshake_ms, uint32_t transfer_ms, bool ok);
+// Largest body that still fits the longest timeout at the estimated throughput
+size_t link_budget(const link_history_t *history);
+
+// Reads the current RSSI and plans an upload of the given size. Without may_defer the upload
+// goes ahead whatever the link, e.g. when its samples won't survive to the next wake.
+const link_plan_t *link_plan_upload(size_t bytes, bool may_defer);
+const link_plan_t *link_current_plan(void);
+// link_budget() of the running estimate, for sizing an upload before it is planned
+size_t link_upload_budget(void);
+// Transports report every try; the history takes one outcome per wake, from link_finish_upload()
+void link_record_attempt(size_t bytes, uint32_t handshake_ms, uint32_t transfer_ms, bool ok);
+void link_finish_upload(bool ok);
+
+#endif
@@ -12,11 +12,16 @@
 #include "esp_system.h"
 #include "esp_http_server.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
 
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <time.h>
 #include <sys/time.h>
 #include <esp_err.h>
@@ -25,21 +30,32 @@
 #include "lwip/sockets.h"
 #include "lwip/inet.h"
 #include "esp_netif.h"
+#include "driver/gpio.h"
 
-#include "sdcard.c"
+#include "sdcard.h"
+#include "timex.h"
 #include "pt928.h"
 #include "sensors.h"
 #include "upload.h"
 #include "LED.h"
+#include "flashlog.h"
+#include "provision.h"
+#include "ota.h"
+#include "power.h"
+#include "uplink.h"
+#include "dlog.h"
+#include "nodecfg.h"
 
-#define REED_SWITCH_GPIO 45
 #define REED_SWITCH_RESTART_GPIO 46 // not used yet
+#define PORTAL_IDLE_MS (5 * 60 * 1000) // Config mode ends once the portal has been idle this long
+#define PORTAL_MAX_MS (2 * 60 * 60 * 1000) // or after this, so a phone left on the softAP can't drain the battery
 
 static const char *TAG = "Monitoring-Node";
 
 void go_to_sleep_minutes(int minutes)
 {
     ESP_LOGI(TAG, "Sleeping for %d minutes...", minutes);
+    dlog_flush(DLOG_FILE);
     sd_deinit();
     esp_sleep_enable_timer_wakeup((uint64_t)minutes * 60ULL * 1000000ULL);
     esp_deep_sleep_start();
@@ -59,7 +75,9 @@ bool check_registration(void)
     }
 
     ESP_LOGI(TAG, "Loaded registration: key=%s, sensorID=%s, geoutm=%s", key, sensorID, geoutm);
+#if !FLASHLOG_ENABLED
     sd_set_metadata(key, sensorID, geoutm);
+#endif
     return true;
 }
 
@@ -74,74 +92,209 @@ void configure_reed_switch()
     gpio_config(&io_conf);
 }
 
-void monitoring_node_task(void *pvParameter)
+// Wake pipeline: storage and sensors on core 1 while core 0 brings up Wi-Fi, the clock and
+// DNS. The upload starts as soon as both the batch and the link are ready.
+typedef struct
 {
+    int sleep_minutes;
+    bool sampled;           // Sensors read; the local half of a new image's self-test
+} wake_batch_t;
+
+typedef enum
+{
+    STAGE_STORAGE,
+    STAGE_ACQUIRE,
+    STAGE_WIFI,
+    STAGE_TIME,
+    STAGE_DNS,
+    STAGE_UPLOAD,
+    STAGE_COUNT,
+} wake_stage_t;
+
+static const char *const stage_names[STAGE_COUNT] = {
+    [STAGE_STORAGE] = "storage",
+    [STAGE_ACQUIRE] = "acquire",
+    [STAGE_WIFI] = "wifi",
+    [STAGE_TIME] = "time",
+    [STAGE_DNS] = "dns",
+    [STAGE_UPLOAD] = "upload",
+};
+
+#define TIME_READY_BIT BIT0
+
+static QueueHandle_t batch_queue = NULL;
+static EventGroupHandle_t wake_events = NULL;
+static int64_t stage_us[STAGE_COUNT][2];    // Start and end since reset, each written by one task
+
+static void stage_begin(wake_stage_t stage)
+{
+    stage_us[stage][0] = esp_timer_get_time();
+}
+
+static void stage_end(wake_stage_t stage)
+{
+    stage_us[stage][1] = esp_timer_get_time();
+}
+
+static void log_stages(void)
+{
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        if (stage_us[i][1] == 0)
+            continue;
+        ESP_LOGI(TAG, "Stage %-8s %6" PRId64 " -> %6" PRId64 " ms (%" PRId64 " ms)", stage_names[i], stage_us[i][0] / 1000,
+                 stage_us[i][1] / 1000, (stage_us[i][1] - stage_us[i][0]) / 1000);
+    }
+}
+
+static void acquire_task(void *pvParameter)
+{
+    stage_begin(STAGE_STORAGE);
+#if FLASHLOG_ENABLED
+    // Samples go to the internal log partition, the SD card is only needed for export
+    if (flashlog_init() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Flash log init failed. Restarting...");
+        led_solid(LED_FULL, 0, 0);
+        esp_restart();
+    }
+#else
     if (sd_init() != ESP_OK)
     {
         ESP_LOGE(TAG, "SD init failed. Restarting...");
-        setColor(8191, 0, 0);
+        led_solid(LED_FULL, 0, 0);
         esp_restart();
     }
-
-    esp_netif_ip_info_t ip_info;
-    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
-    esp_netif_get_ip_info(netif, &ip_info);
-    ESP_LOGI("NETIF", "My IP: " IPSTR, IP2STR(&ip_info.ip));
-
-    init_time();
+#endif
 
     while (!check_registration())
     {
         ESP_LOGW(TAG, "Registration missing. Awaiting user input.");
         vTaskDelay(pdMS_TO_TICKS(5000));
     }
+    stage_end(STAGE_STORAGE);
+
+    // Rows carry timestamps; the RTC keeps time across deep sleep, a clock never set waits for SNTP
+    if (!time_is_valid())
+    {
+        xEventGroupWaitBits(wake_events, TIME_READY_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+    }
+
+    stage_begin(STAGE_ACQUIRE);
+    sensor_log_wake_samples(payloadpath);
+    wake_batch_t batch = {.sleep_minutes = sensor_single_log(payloadpath)};
+    batch.sampled = sensor_read_ok();
+    stage_end(STAGE_ACQUIRE);
+
+    xQueueSend(batch_queue, &batch, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+static void network_task(void *pvParameter)
+{
+    uint32_t wifi_timeout_ms = (uint32_t)(uintptr_t)pvParameter;
+
+    stage_begin(STAGE_WIFI);
+    bool connected = wifi_wait_connected(wifi_timeout_ms, true);
+    stage_end(STAGE_WIFI);
+
+    power_phase(POWER_PHASE_PREPARE);
+    if (connected)
+    {
+        esp_netif_ip_info_t ip_info;
+        esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+        esp_netif_get_ip_info(netif, &ip_info);
+        ESP_LOGI("NETIF", "My IP: " IPSTR, IP2STR(&ip_info.ip));
+        led_solid(0, LED_FULL, 0);
+
+        stage_begin(STAGE_TIME);
+        init_time();
+        stage_end(STAGE_TIME);
+
+        stage_begin(STAGE_DNS);
+        uplink_resolve();
+        stage_end(STAGE_DNS);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Wi-Fi not connected, sampling without a time sync.");
+        led_solid(LED_FULL, 0, 0);
+    }
+    xEventGroupSetBits(wake_events, TIME_READY_BIT);
+
+    power_phase(POWER_PHASE_SAMPLE);
+    wake_batch_t batch;
+    xQueueReceive(batch_queue, &batch, portMAX_DELAY);
+
+    power_phase(POWER_PHASE_UPLOAD);
+    stage_begin(STAGE_UPLOAD);
+    esp_err_t upload_err = try_upload_now();
+    ota_confirm(upload_err, batch.sampled);
+
+    // Firmware patches are fetched a chunk per wake, only after the samples got through
+    if (upload_err == ESP_OK && ota_step() == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Restarting into new firmware");
+        dlog_flush(DLOG_FILE);
+        sd_deinit();
+        esp_restart();
+    }
+    stage_end(STAGE_UPLOAD);
 
-    int sleep_time = sensor_single_log(payloadpath);
-    try_upload_now();
-    go_to_sleep_minutes(sleep_time);
+    log_stages();
+    power_report();
+    sensor_arm_wake_stub(batch.sleep_minutes);
+    go_to_sleep_minutes(batch.sleep_minutes);
 
     vTaskDelete(NULL);
 }
 
+// Wi-Fi must already be started; wifi_timeout_ms is how much longer to wait for it
+static void start_wake_pipeline(uint32_t wifi_timeout_ms)
+{
+    time_set_zone();
+    batch_queue = xQueueCreate(1, sizeof(wake_batch_t));
+    wake_events = xEventGroupCreate();
+    if (!batch_queue || !wake_events)
+    {
+        ESP_LOGE(TAG, "Pipeline setup failed. Restarting...");
+        esp_restart();
+    }
+
+    // Wi-Fi and lwIP run on core 0, so the network side stays with them
+    xTaskCreatePinnedToCore(network_task, "network_task", 12288, (void *)(uintptr_t)wifi_timeout_ms, 5, NULL, 0);
+    xTaskCreatePinnedToCore(acquire_task, "acquire_task", 6144, NULL, 5, NULL, 1);
+}
+
 void app_main(void)
 {
     esp_reset_reason_t reason = esp_reset_reason();
     ESP_LOGI(TAG, "Reset reason: %d", reason);
 
     
-    ESP_ERROR_CHECK(nvs_flash_init());
-    init_nvs();
+    dlog_init();
+    ESP_ERROR_CHECK(init_nvs());
+    power_init();
+    // Deep sleep wakes read the RTC copy; a cold boot loads it from NVS
+    nodecfg_load();
+    // A delta can only be left half-applied by a reset mid-wake, never by a deep sleep
+    if (reason != ESP_RST_DEEPSLEEP)
+    {
+        provision_recover();
+    }
 
     if (reason == ESP_RST_DEEPSLEEP)
     {
-        configure_ledc();
+        led_init(!LED_TIMER_WAKES);
+        ESP_LOGI(TAG, "Reconnecting to Wi-Fi...");
         wifi_init_sta_only();
-
-        int retry = 0;
-        while (!wifi_connected && retry++ < 20)
-        {
-            ESP_LOGI(TAG, "Reconnecting to Wi-Fi... attempt %d", retry);
-            vTaskDelay(pdMS_TO_TICKS(2000));
-        }
-
-        if (!wifi_connected)
-        {
-            ESP_LOGE(TAG, "Failed to reconnect to Wi-Fi after deep sleep.");
-            setColor(8191, 0, 0);
-        }
-        else
-        {
-            ESP_LOGI(TAG, "Wi-Fi reconnected successfully!");
-            setColor(0, 8191, 0);
-        }
-
-        xTaskCreate(monitoring_node_task, "monitoring_node_task", 12288, NULL, 5, NULL);
+        start_wake_pipeline(40000);
         return;
     }
 
     // ====== Normal Power-On Boot ======
     configure_reed_switch();
-    configure_ledc();
+    led_init(false);
 
     ESP_LOGI(TAG, "Watching for reed switch trigger...");
     bool config_mode = false;
@@ -157,51 +310,64 @@ void app_main(void)
     {
         ESP_LOGI(TAG, "Reed switch ACTIVE: Entering config mode");
 
+        // The portal serves the history and the export from the card
+        bool card = sd_init() == ESP_OK;
+        if (!card)
+        {
+            ESP_LOGW(TAG, "No SD card, the portal can't serve stored data");
+        }
+#if FLASHLOG_ENABLED
+        // Site visit: copy the flash log to the card if one is fitted
+        if (card && flashlog_init() == ESP_OK)
+        {
+            flashlog_export("/sdcard/export.txt");
+            dlog_flush(DLOG_FILE);
+        }
+#endif
+
         wifi_init_softap();
         httpd_handle_t server = start_webserver();
         if (!server)
         {
             ESP_LOGE(TAG, "Webserver failed to start");
-            setColor(8191, 0, 0);
+            led_blink(LED_FULL, 0, 0, 500, 500, 0);
         }
-
-        int retries = 0;
-        setColor(0, 0, 8191);
-        while (!wifi_connected && retries++ < 12)
+        else
         {
-            vTaskDelay(pdMS_TO_TICKS(5000));
-            ESP_LOGI(TAG, "Waiting for Wi-Fi connection in config mode... (%d)", retries);
+            led_breathe(0, 0, LED_FULL, 2000, 0);
         }
+        ESP_LOGI(TAG, "Waiting for Wi-Fi connection in config mode...");
 
-        if (wifi_connected)
+        // Failed attempts don't end the wait; the user can try again from the portal
+        if (wifi_wait_connected(60000, false))
         {
             ESP_LOGI(TAG, "Connected to Wi-Fi!");
-            setColor(0, 8191, 0);
-            vTaskDelay(pdMS_TO_TICKS(3000));
-            setColor(0, 0, 0);
+            led_blink(0, LED_FULL, 0, 500, 500, 3);
         }
         else
         {
             ESP_LOGW(TAG, "Still not connected to Wi-Fi after config wait.");
         }
+
+        // Stay up while the technician is on the portal; sampling and sleep come after, and
+        // sleep waits for any export still streaming from the card
+        if (server)
+        {
+            portal_wait_done(PORTAL_IDLE_MS, PORTAL_MAX_MS);
+            ESP_LOGI(TAG, "Portal done, leaving config mode");
+        }
     }
     else
     {
         ESP_LOGI(TAG, "No config trigger. Attempting stored Wi-Fi connection.");
-        wifi_connect_stored();
-
-        int retries = 0;
-        while (!wifi_connected && retries++ < 10)
-        {
-            ESP_LOGI(TAG, "Waiting for Wi-Fi... attempt %d", retries);
-            vTaskDelay(pdMS_TO_TICKS(1000));
-        }
+        wifi_init_sta_only();
 
-        if (!wifi_connected)
+        if (!wifi_wait_connected(10000, true))
         {
             ESP_LOGW(TAG, "Wi-Fi not connected after all attempts.");
         }
     }
 
-    xTaskCreate(monitoring_node_task, "monitoring_node_task", 12288, NULL, 5, NULL); 
+    // Wi-Fi has had its wait above
+    start_wake_pipeline(0);
 }
@@ -0,0 +1,199 @@
+#include <stddef.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "nodecfg.h"
+
+static const char *CFGTAG = "NODECFG";
+
+typedef struct {
+    nodecfg_t cfg;
+    uint32_t crc;
+} nodecfg_cache_t;
+
+// The bootloader reloads RTC data on every boot except a deep sleep wake
+static RTC_DATA_ATTR nodecfg_cache_t cache;
+
+static uint32_t cache_crc(void) {
+    return esp_rom_crc32_le(0, (const uint8_t *)&cache.cfg, sizeof(cache.cfg));
+}
+
+static bool cache_valid(void) {
+    return cache.cfg.version == NODECFG_VERSION && cache.crc == cache_crc();
+}
+
+static void cache_store(const nodecfg_t *cfg) {
+    cache.cfg = *cfg;
+    cache.crc = cache_crc();
+}
+
+static void terminate_strings(nodecfg_t *cfg) {
+    cfg->ssid[sizeof(cfg->ssid) - 1] = '\0';
+    cfg->password[sizeof(cfg->password) - 1] = '\0';
+    cfg->key[sizeof(cfg->key) - 1] = '\0';
+    cfg->sensor_id[sizeof(cfg->sensor_id) - 1] = '\0';
+    cfg->geoutm[sizeof(cfg->geoutm) - 1] = '\0';
+    cfg->uplink.data_url[sizeof(cfg->uplink.data_url) - 1] = '\0';
+    cfg->uplink.register_url[sizeof(cfg->uplink.register_url) - 1] = '\0';
+    cfg->uplink.mqtt_uri[sizeof(cfg->uplink.mqtt_uri) - 1] = '\0';
+    cfg->uplink.mqtt_topic[sizeof(cfg->uplink.mqtt_topic) - 1] = '\0';
+    cfg->uplink.coap_uri[sizeof(cfg->uplink.coap_uri) - 1] = '\0';
+}
+
+// Before version 3 the endpoints had their own keys in the "uplink" namespace, and the
+// applied and acknowledged config versions theirs in "cfg". Left in place, like the keys
+// load_legacy() reads.
+static void load_legacy_uplink(nodecfg_t *cfg) {
+    nvs_handle_t handle;
+    size_t size;
+
+    if (nvs_open("uplink", NVS_READONLY, &handle) == ESP_OK) {
+        esp_err_t err = nvs_get_u8(handle, "transport", &cfg->uplink.transport);
+        size = sizeof(cfg->uplink.data_url);
+        if (err == ESP_OK) err = nvs_get_str(handle, "data_url", cfg->uplink.data_url, &size);
+        size = sizeof(cfg->uplink.register_url);
+        if (err == ESP_OK) err = nvs_get_str(handle, "reg_url", cfg->uplink.register_url, &size);
+        size = sizeof(cfg->uplink.mqtt_uri);
+        if (err == ESP_OK) err = nvs_get_str(handle, "mqtt_uri", cfg->uplink.mqtt_uri, &size);
+        size = sizeof(cfg->uplink.mqtt_topic);
+        if (err == ESP_OK) err = nvs_get_str(handle, "mqtt_topic", cfg->uplink.mqtt_topic, &size);
+        size = sizeof(cfg->uplink.coap_uri);
+        if (err == ESP_OK) err = nvs_get_str(handle, "coap_uri", cfg->uplink.coap_uri, &size);
+        // Saves always wrote every key; anything less falls back to the defaults
+        if (err == ESP_OK) cfg->present |= NODECFG_HAS_UPLINK;
+        nvs_close(handle);
+    }
+
+    if (nvs_open("cfg", NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u32(handle, "version", &cfg->cfg_version);
+        nvs_get_u32(handle, "acked", &cfg->cfg_acked);
+        nvs_close(handle);
+    }
+}
+
+// stored is the version the blob was written as, before any conversion
+static esp_err_t load_blob(nodecfg_t *cfg, uint16_t *stored) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("node", NVS_READONLY, &handle);
+    if (err != ESP_OK) return err;
+
+    size_t size = sizeof(*cfg);
+    err = nvs_get_blob(handle, "cfg", cfg, &size);
+    nvs_close(handle);
+    if (err != ESP_OK) return err;
+    *stored = cfg->version;
+
+    // Version 1 ended before policy.agg_window_min, version 2 before uplink
+    if (cfg->version == 1 && size == offsetof(nodecfg_t, policy.agg_window_min)) {
+        cfg->policy.agg_window_min = POLICY_DEFAULT_AGG_WINDOW;
+        cfg->version = 2;
+        size = offsetof(nodecfg_t, uplink);
+    }
+    if (cfg->version == 2 && size == offsetof(nodecfg_t, uplink)) {
+        memset(&cfg->uplink, 0, sizeof(*cfg) - offsetof(nodecfg_t, uplink));
+        load_legacy_uplink(cfg);
+        cfg->version = NODECFG_VERSION;
+        size = sizeof(*cfg);
+    }
+    if (size != sizeof(*cfg) || cfg->version != NODECFG_VERSION) return ESP_ERR_INVALID_VERSION;
+    return ESP_OK;
+}
+
+// Firmware before the blob kept each field under its own key in three namespaces. Those keys
+// are left in place so a rollback to that firmware still finds them.
+static void load_legacy(nodecfg_t *cfg) {
+    nvs_handle_t handle;
+    size_t size;
+
+    if (nvs_open("wifi_config", NVS_READONLY, &handle) == ESP_OK) {
+        size = sizeof(cfg->ssid);
+        if (nvs_get_str(handle, "ssid", cfg->ssid, &size) == ESP_OK) {
+            size = sizeof(cfg->password);
+            nvs_get_str(handle, "password", cfg->password, &size);
+            cfg->present |= NODECFG_HAS_WIFI;
+        }
+        nvs_close(handle);
+    }
+
+    if (nvs_open("registration", NVS_READONLY, &handle) == ESP_OK) {
+        size = sizeof(cfg->key);
+        esp_err_t err = nvs_get_str(handle, "key", cfg->key, &size);
+        size = sizeof(cfg->sensor_id);
+        if (err == ESP_OK) err = nvs_get_str(handle, "sensorID", cfg->sensor_id, &size);
+        size = sizeof(cfg->geoutm);
+        if (err == ESP_OK) err = nvs_get_str(handle, "geoutm", cfg->geoutm, &size);
+        if (err == ESP_OK) cfg->present |= NODECFG_HAS_REGISTRATION;
+        nvs_close(handle);
+    }
+
+    // Keys that were never set keep their defaults
+    node_policy_defaults(&cfg->policy);
+    if (nvs_open("policy", NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u16(handle, "int_high", &cfg->policy.interval_high_min);
+        nvs_get_u16(handle, "int_mid", &cfg->policy.interval_mid_min);
+        nvs_get_u16(handle, "int_low", &cfg->policy.interval_low_min);
+        nvs_get_u16(handle, "volt_high", &cfg->policy.volt_high_mv);
+        nvs_get_u16(handle, "volt_low", &cfg->policy.volt_low_mv);
+        nvs_get_u16(handle, "upload_every", &cfg->policy.upload_every);
+        cfg->present |= NODECFG_HAS_POLICY;
+        nvs_close(handle);
+    }
+
+    load_legacy_uplink(cfg);
+}
+
+esp_err_t nodecfg_load(void) {
+    if (cache_valid()) return ESP_OK;
+
+    nodecfg_t cfg;
+    uint16_t stored = 0;
+    esp_err_t err = load_blob(&cfg, &stored);
+    if (err == ESP_OK) {
+        terminate_strings(&cfg);
+        if (stored == NODECFG_VERSION) {
+            cache_store(&cfg);
+            return ESP_OK;
+        }
+        ESP_LOGI(CFGTAG, "Converting config from version %u", stored);
+        return nodecfg_save(&cfg);
+    }
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.version = NODECFG_VERSION;
+    load_legacy(&cfg);
+    terminate_strings(&cfg);
+    if (!cfg.present) {
+        cache_store(&cfg);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ESP_LOGI(CFGTAG, "Moving config to a single blob (0x%x)", cfg.present);
+    return nodecfg_save(&cfg);
+}
+
+const nodecfg_t *nodecfg(void) {
+    if (!cache_valid()) nodecfg_load();
+    return &cache.cfg;
+}
+
+esp_err_t nodecfg_reload(void) {
+    memset(&cache, 0, sizeof(cache));
+    return nodecfg_load();
+}
+
+esp_err_t nodecfg_save(const nodecfg_t *cfg) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("node", NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, "cfg", cfg, sizeof(*cfg));
+        if (err == ESP_OK) err = nvs_commit(handle);
+        nvs_close(handle);
+    }
+
+    // Cached even when the write failed, so this boot and its deep-sleep wakes use it
+    cache_store(cfg);
+    if (err != ESP_OK) ESP_LOGE(CFGTAG, "Saving config failed: %s", esp_err_to_name(err));
+    return err;
+}
@@ -0,0 +1,43 @@
+#ifndef NODECFG_H
+#define NODECFG_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "provision.h"
+
+// Wi-Fi credentials, registration, sleep policy, uplink endpoints and the remote config
+// versions as one versioned blob in the "node" NVS namespace. A copy with a CRC sits in RTC
+// memory, so deep-sleep wakes read it without touching NVS; a cold boot or a bad CRC reloads
+// it from flash.
+
+#define NODECFG_VERSION 3   // Bump on any layout change and convert the old blob in load_blob()
+
+#define NODECFG_HAS_WIFI         (1u << 0)
+#define NODECFG_HAS_REGISTRATION (1u << 1)
+#define NODECFG_HAS_POLICY       (1u << 2)
+#define NODECFG_HAS_UPLINK       (1u << 3)
+
+typedef struct {
+    uint16_t version;
+    uint16_t present;       // NODECFG_HAS_*
+    char ssid[33];
+    char password[65];
+    char key[64];
+    char sensor_id[32];
+    char geoutm[128];
+    node_policy_t policy;
+    uplink_config_t uplink;
+    uint32_t cfg_version;   // Remote config version applied, 0 for none
+    uint32_t cfg_acked;     // Last version whose ack got through to the server
+} nodecfg_t;
+
+// Call once NVS is up, before the tasks that read the config start
+esp_err_t nodecfg_load(void);
+// Cached config; fields not flagged in present are empty
+const nodecfg_t *nodecfg(void);
+// Writes cfg to NVS, then to the cache
+esp_err_t nodecfg_save(const nodecfg_t *cfg);
+// Drops the cache and loads what NVS holds, e.g. after a save that didn't reach flash
+esp_err_t nodecfg_reload(void);
+
+#endif
@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "esp_app_desc.h"
+#include "esp_image_format.h"
+#include "esp_http_client.h"
+#include "esp_wifi.h"
+#include "mbedtls/sha256.h"
+#include "miniz.h"
+#include "ota.h"
+#include "bspatch.h"
+#include "linkqual.h"
+#include "upload.h"
+#include "power.h"
+
+#define OTA_READ_BYTES 1024   // Staging partition reads while hashing and inflating
+
+static const char *OTATAG = "OTA";
+
+// The "ota" namespace holds the offer being fetched and how many bytes of it are staged.
+// The offset only moves after a whole chunk is written, so a dropped connection costs
+// at most one chunk.
+static esp_err_t load_state(ota_offer_t *offer, uint32_t *offset) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("ota", NVS_READONLY, &handle);
+    if (err != ESP_OK) return err;
+
+    size_t size = sizeof(*offer);
+    err = nvs_get_blob(handle, "offer", offer, &size);
+    if (err == ESP_OK && size != sizeof(*offer)) err = ESP_ERR_INVALID_SIZE;
+    if (err == ESP_OK) err = nvs_get_u32(handle, "offset", offset);
+    nvs_close(handle);
+    return err;
+}
+
+static esp_err_t save_state(const ota_offer_t *offer, uint32_t offset) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("ota", NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+
+    if (offer) err = nvs_set_blob(handle, "offer", offer, sizeof(*offer));
+    if (err == ESP_OK) err = nvs_set_u32(handle, "offset", offset);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static void clear_state(void) {
+    nvs_handle_t handle;
+    if (nvs_open("ota", NVS_READWRITE, &handle) != ESP_OK) return;
+    nvs_erase_key(handle, "offer");
+    nvs_erase_key(handle, "offset");
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+// Also in "ota": how many wakes the running image has had on trial without an upload
+// getting through. Keyed by version, so a record left by a rolled back image means nothing.
+typedef struct {
+    char version[32];
+    uint32_t wakes;
+} ota_trial_t;
+
+static bool load_trial(const char *version, uint32_t *wakes) {
+    nvs_handle_t handle;
+    if (nvs_open("ota", NVS_READONLY, &handle) != ESP_OK) return false;
+
+    ota_trial_t trial;
+    size_t size = sizeof(trial);
+    esp_err_t err = nvs_get_blob(handle, "trial", &trial, &size);
+    nvs_close(handle);
+    if (err != ESP_OK || size != sizeof(trial) || strncmp(trial.version, version, sizeof(trial.version)) != 0) {
+        return false;
+    }
+    *wakes = trial.wakes;
+    return true;
+}
+
+static esp_err_t save_trial(const char *version, uint32_t wakes) {
+    ota_trial_t trial = {.wakes = wakes};
+    strlcpy(trial.version, version, sizeof(trial.version));
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("ota", NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(handle, "trial", &trial, sizeof(trial));
+    if (err == ESP_OK) err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+static void clear_trial(void) {
+    nvs_handle_t handle;
+    if (nvs_open("ota", NVS_READWRITE, &handle) != ESP_OK) return;
+    if (nvs_erase_key(handle, "trial") == ESP_OK) nvs_commit(handle);
+    nvs_close(handle);
+}
+
+static const esp_partition_t *patch_partition(void) {
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, OTA_PATCH_PARTITION_LABEL);
+    if (!part) {
+        ESP_LOGE(OTATAG, "Partition '%s' not found", OTA_PATCH_PARTITION_LABEL);
+    }
+    return part;
+}
+
+esp_err_t ota_offer(const ota_offer_t *offer) {
+    const esp_app_desc_t *app = esp_app_get_description();
+    if (strcmp(offer->version, app->version) == 0) return ESP_OK;
+
+    // Patches come over TLS like the uploads; plain http could be redirected or stalled by
+    // anything on the path, costing a wake's energy per chunk
+    if (strncasecmp(offer->url, "https://", 8) != 0) {
+        ESP_LOGE(OTATAG, "Update %s not served over https, ignoring", offer->version);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (strcmp(offer->base, app->version) != 0) {
+        ESP_LOGW(OTATAG, "Update %s is against %s, running %s", offer->version, offer->base, app->version);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    // Don't fetch again an image the bootloader already rolled back from
+    const esp_partition_t *invalid = esp_ota_get_last_invalid_partition();
+    esp_app_desc_t desc;
+    if (invalid && esp_ota_get_partition_description(invalid, &desc) == ESP_OK && strcmp(desc.version, offer->version) == 0) {
+        ESP_LOGW(OTATAG, "Update %s failed its self-test before, ignoring", offer->version);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    const esp_partition_t *part = patch_partition();
+    if (!part) return ESP_ERR_NOT_FOUND;
+    if (offer->size == 0 || offer->size > part->size) {
+        ESP_LOGE(OTATAG, "Patch of %" PRIu32 " bytes doesn't fit '%s'", offer->size, OTA_PATCH_PARTITION_LABEL);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (strlen(offer->sha256) != 64) return ESP_ERR_INVALID_ARG;
+
+    ota_offer_t current;
+    uint32_t offset;
+    if (load_state(&current, &offset) == ESP_OK && strcmp(current.version, offer->version) == 0 &&
+        strcasecmp(current.sha256, offer->sha256) == 0 && current.size == offer->size) {
+        // Same patch; the URL may have moved but the staged bytes are still good
+        return strcmp(current.url, offer->url) == 0 ? ESP_OK : save_state(offer, offset);
+    }
+
+    ESP_LOGI(OTATAG, "Update %s offered, %" PRIu32 " byte patch", offer->version, offer->size);
+    return save_state(offer, 0);
+}
+
+// Range request for one chunk, written straight into the staging partition
+static esp_err_t fetch_chunk(const esp_partition_t *part, const ota_offer_t *offer, uint32_t offset, uint32_t len) {
+    uint32_t erase_len = (len + OTA_SECTOR_SIZE - 1) / OTA_SECTOR_SIZE * OTA_SECTOR_SIZE;
+    esp_err_t err = esp_partition_erase_range(part, offset, erase_len);
+    if (err != ESP_OK) return err;
+
+    esp_http_client_config_t config = {
+        .url = offer->url,
+        .cert_pem = DigiCertGlobalRootG2_crt_pem_start,
+        .timeout_ms = link_current_plan()->timeout_ms,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (!client) return ESP_ERR_NO_MEM;
+
+    char range[48];
+    snprintf(range, sizeof(range), "bytes=%" PRIu32 "-%" PRIu32, offset, offset + len - 1);
+    esp_http_client_set_header(client, "Range", range);
+
+    char *buf = malloc(OTA_READ_BYTES);
+    power_lock_cpu();
+    err = buf ? esp_http_client_open(client, 0) : ESP_ERR_NO_MEM;
+    power_unlock_cpu();
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(client);
+        int status_code = esp_http_client_get_status_code(client);
+        if (status_code != 206) {
+            ESP_LOGE(OTATAG, "Range request got HTTP %d", status_code);
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+
+        uint32_t got = 0;
+        while (err == ESP_OK && got < len) {
+            int want = len - got < OTA_READ_BYTES ? len - got : OTA_READ_BYTES;
+            int n = esp_http_client_read(client, buf, want);
+            if (n <= 0) {
+                ESP_LOGE(OTATAG, "Patch download stopped at %" PRIu32 " bytes", offset + got);
+                err = ESP_FAIL;
+                break;
+            }
+            err = esp_partition_write(part, offset + got, buf, n);
+            got += n;
+        }
+        esp_http_client_close(client);
+    }
+
+    free(buf);
+    esp_http_client_cleanup(client);
+    return err;
+}
+
+static esp_err_t verify_patch(const esp_partition_t *part, const ota_offer_t *offer) {
+    uint8_t *buf = malloc(OTA_READ_BYTES);
+    if (!buf) return ESP_ERR_NO_MEM;
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+
+    esp_err_t err = ESP_OK;
+    for (uint32_t off = 0; off < offer->size && err == ESP_OK; off += OTA_READ_BYTES) {
+        size_t n = offer->size - off < OTA_READ_BYTES ? offer->size - off : OTA_READ_BYTES;
+        err = esp_partition_read(part, off, buf, n);
+        if (err == ESP_OK) mbedtls_sha256_update(&sha, buf, n);
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    free(buf);
+    if (err != ESP_OK) return err;
+
+    char hex[65];
+    for (int i = 0; i < 32; i++) {
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+    return strcasecmp(hex, offer->sha256) == 0 ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+typedef struct {
+    const esp_partition_t *old_part;
+    esp_ota_handle_t handle;
+} apply_ctx_t;
+
+static esp_err_t read_old(void *ctx, size_t offset, uint8_t *buf, size_t len) {
+    return esp_partition_read(((apply_ctx_t *)ctx)->old_part, offset, buf, len);
+}
+
+static esp_err_t write_new(void *ctx, const uint8_t *data, size_t len) {
+    return esp_ota_write(((apply_ctx_t *)ctx)->handle, data, len);
+}
+
+// Inflates the staged patch through the ROM tinfl and patches the running image into the
+// passive app partition. tinfl's output buffer doubles as its 32K history window.
+static esp_err_t apply_patch(const esp_partition_t *patch_part, uint32_t patch_size) {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+    if (!target) return ESP_ERR_NOT_FOUND;
+
+    // bsdiff was run against the image itself, not the padded partition
+    esp_partition_pos_t pos = {.offset = running->address, .size = running->size};
+    esp_image_metadata_t meta;
+    esp_err_t err = esp_image_get_metadata(&pos, &meta);
+    if (err != ESP_OK) return err;
+
+    tinfl_decompressor *inflator = malloc(sizeof(tinfl_decompressor));
+    uint8_t *dict = malloc(TINFL_LZ_DICT_SIZE);
+    uint8_t *in = malloc(OTA_READ_BYTES);
+    bspatch_t *patch = malloc(sizeof(bspatch_t));
+    apply_ctx_t ctx = {.old_part = running};
+
+    if (!inflator || !dict || !in || !patch) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        err = esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &ctx.handle);
+    }
+
+    if (err == ESP_OK) {
+        tinfl_init(inflator);
+        bspatch_init(patch, read_old, write_new, &ctx, meta.image_len);
+
+        uint32_t in_off = 0;
+        size_t in_len = 0, in_pos = 0, dict_pos = 0;
+        while (err == ESP_OK) {
+            if (in_pos == in_len && in_off < patch_size) {
+                in_len = patch_size - in_off < OTA_READ_BYTES ? patch_size - in_off : OTA_READ_BYTES;
+                err = esp_partition_read(patch_part, in_off, in, in_len);
+                in_off += in_len;
+                in_pos = 0;
+                if (err != ESP_OK) break;
+            }
+
+            size_t in_bytes = in_len - in_pos;
+            size_t out_bytes = TINFL_LZ_DICT_SIZE - dict_pos;
+            int flags = TINFL_FLAG_PARSE_ZLIB_HEADER | (in_off < patch_size ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+            tinfl_status status = tinfl_decompress(inflator, in + in_pos, &in_bytes, dict, dict + dict_pos, &out_bytes, flags);
+            in_pos += in_bytes;
+
+            if (out_bytes > 0) {
+                err = bspatch_feed(patch, dict + dict_pos, out_bytes);
+                dict_pos = (dict_pos + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+            }
+            if (status == TINFL_STATUS_DONE) break;
+            if (status < TINFL_STATUS_DONE) {
+                ESP_LOGE(OTATAG, "Patch inflate failed: %d", status);
+                err = ESP_ERR_INVALID_ARG;
+            }
+        }
+
+        if (err == ESP_OK) err = bspatch_finish(patch);
+        if (err == ESP_OK) {
+            err = esp_ota_end(ctx.handle);
+        } else {
+            esp_ota_abort(ctx.handle);
+        }
+    }
+
+    free(inflator);
+    free(dict);
+    free(in);
+    free(patch);
+
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(target);
+    }
+    return err;
+}
+
+esp_err_t ota_step(void) {
+    ota_offer_t offer;
+    uint32_t offset;
+    if (load_state(&offer, &offset) != ESP_OK) return ESP_ERR_NOT_FOUND;
+
+    // Flashed over serial since the offer came in
+    if (strcmp(offer.base, esp_app_get_description()->version) != 0) {
+        clear_state();
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const esp_partition_t *part = patch_partition();
+    if (!part) return ESP_ERR_NOT_FOUND;
+
+    if (offset < offer.size) {
+        uint32_t len = offer.size - offset < OTA_CHUNK_BYTES ? offer.size - offset : OTA_CHUNK_BYTES;
+        esp_err_t err = fetch_chunk(part, &offer, offset, len);
+        if (err != ESP_OK) {
+            ESP_LOGE(OTATAG, "Chunk at %" PRIu32 " failed: %s", offset, esp_err_to_name(err));
+            return err;
+        }
+
+        offset += len;
+        save_state(NULL, offset);
+        ESP_LOGI(OTATAG, "Update %s: %" PRIu32 "/%" PRIu32 " bytes", offer.version, offset, offer.size);
+        if (offset < offer.size) return ESP_ERR_NOT_FINISHED;
+    }
+
+    // Hashing, inflating and patching are CPU bound, better done at full speed
+    power_lock_cpu();
+    esp_err_t err = verify_patch(part, &offer);
+    power_unlock_cpu();
+    if (err == ESP_ERR_INVALID_CRC) {
+        ESP_LOGE(OTATAG, "Patch digest mismatch, fetching again");
+        save_state(NULL, 0);
+        return err;
+    }
+    if (err != ESP_OK) return err;
+
+    power_lock_cpu();
+    err = apply_patch(part, offer.size);
+    power_unlock_cpu();
+    if (err != ESP_OK) {
+        ESP_LOGE(OTATAG, "Applying update %s failed: %s", offer.version, esp_err_to_name(err));
+        // A patch that doesn't apply never will; anything else is retried next wake
+        if (err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_STATE || err == ESP_ERR_OTA_VALIDATE_FAILED) {
+            clear_state();
+        }
+        return err;
+    }
+
+    clear_state();
+    ESP_LOGI(OTATAG, "Update %s written, boots on restart", offer.version);
+    return ESP_OK;
+}
+
+static bool pending_verify(void) {
+    esp_ota_img_states_t state;
+    return esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+           state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+
+bool ota_on_trial(void) {
+    uint32_t wakes;
+    return pending_verify() || load_trial(esp_app_get_description()->version, &wakes);
+}
+
+static void roll_back(const char *version, const char *why) {
+    ESP_LOGE(OTATAG, "Firmware %s %s, rolling back", version, why);
+    clear_trial();
+    esp_err_t err = esp_ota_mark_app_invalid_rollback_and_reboot();
+    // Only returns if there is no image to go back to
+    ESP_LOGE(OTATAG, "Rollback failed: %s", esp_err_to_name(err));
+}
+
+void ota_confirm(esp_err_t upload_err, bool self_test_ok) {
+    const char *version = esp_app_get_description()->version;
+    bool pending = pending_verify();
+    uint32_t wakes = 0;
+    bool counted = load_trial(version, &wakes);
+    if (!pending && !counted) return;
+
+    if (upload_err == ESP_OK) {
+        ESP_LOGI(OTATAG, "Firmware %s confirmed by the server", version);
+        if (pending) esp_ota_mark_app_valid_cancel_rollback();
+        clear_trial();
+        return;
+    }
+
+    bool attempted = upload_err != ESP_ERR_WIFI_NOT_CONNECT && upload_err != ESP_ERR_NOT_FINISHED &&
+                     upload_err != ESP_ERR_NOT_FOUND;
+    if (attempted) {
+        roll_back(version, "had its upload refused");
+        return;
+    }
+    if (!self_test_ok) {
+        roll_back(version, "failed its self-test");
+        return;
+    }
+    if (wakes + 1 >= OTA_TRIAL_WAKES) {
+        roll_back(version, "never reached the server");
+        return;
+    }
+
+    // Nothing went out this wake. The count goes to NVS before the image is marked valid,
+    // so a reset in between leaves it pending and the bootloader rolls back.
+    if (save_trial(version, wakes + 1) != ESP_OK) {
+        roll_back(version, "can't count its trial wakes");
+        return;
+    }
+    if (pending) esp_ota_mark_app_valid_cancel_rollback();
+    ESP_LOGW(OTATAG, "Firmware %s kept without the server, %" PRIu32 "/%d wakes", version, wakes + 1, OTA_TRIAL_WAKES);
+}
@@ -0,0 +1,47 @@
+#ifndef OTA_H
+#define OTA_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define OTA_PATCH_PARTITION_LABEL "otapatch"
+#define OTA_CHUNK_BYTES           (32 * 1024)   // Patch bytes fetched per wake, multiple of the flash sector
+#define OTA_SECTOR_SIZE           4096
+#define OTA_TRIAL_WAKES           24            // Wakes a new image may go without reaching the server
+
+// Firmware update offered in an upload reply. The patch is a zlib-compressed bsdiff
+// (ENDSLEY/BSDIFF43) from base to version, served from url with HTTP Range support.
+typedef struct {
+    char version[32];
+    char url[128];
+    uint32_t size;          // Bytes of the patch as served
+    char sha256[65];        // Hex digest of the patch as served
+    char base[32];          // Firmware version the patch was made against
+} ota_offer_t;
+
+// Records an offer in the "ota" NVS namespace. Offers for another base, for the running
+// version, for a version that already failed its self-test or with a URL other than https
+// are ignored. Repeating the offer in progress keeps the download position.
+esp_err_t ota_offer(const ota_offer_t *offer);
+
+// Fetches the next chunk of the offered patch into the staging partition. Once the patch
+// is complete it is verified and applied to the passive app partition.
+// ESP_OK: the new image is set to boot, restart to run it
+// ESP_ERR_NOT_FINISHED: more chunks to fetch on later wakes
+// ESP_ERR_NOT_FOUND: no update offered
+esp_err_t ota_step(void);
+
+// A new image is on trial until an upload from it is accepted. Until then every wake
+// uploads, whatever the link.
+bool ota_on_trial(void);
+
+// Call once per wake with the upload's result and the local self-test. No-op off trial.
+// An accepted upload keeps the image. An upload that went out and was refused, or a failed
+// self-test, rolls back and reboots. Wakes where nothing went out (ESP_ERR_WIFI_NOT_CONNECT,
+// ESP_ERR_NOT_FINISHED, ESP_ERR_NOT_FOUND) keep the image through deep sleep, which the
+// bootloader would otherwise take for a crash, but after OTA_TRIAL_WAKES of them in a row
+// the node rolls back anyway.
+void ota_confirm(esp_err_t upload_err, bool self_test_ok);
+
+#endif
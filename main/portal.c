@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "portal.h"
+#include "html.h"
+
+uint16_t ap_merge_records(const wifi_ap_record_t *records, uint16_t count, ap_entry_t *out, uint16_t max)
+{
+    uint16_t n = 0;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        const char *ssid = (const char *)records[i].ssid;
+        if (ssid[0] == '\0')
+            continue;
+
+        uint16_t j = 0;
+        while (j < n && strncmp(out[j].ssid, ssid, sizeof(out[j].ssid) - 1) != 0)
+            j++;
+
+        if (j == n && n == max)
+        {
+            // Full: a new network only gets in by displacing the weakest one
+            uint16_t weakest = 0;
+            for (uint16_t k = 1; k < n; k++)
+            {
+                if (out[k].rssi < out[weakest].rssi)
+                    weakest = k;
+            }
+            if (n == 0 || records[i].rssi <= out[weakest].rssi)
+                continue;
+            j = weakest;
+            strlcpy(out[j].ssid, ssid, sizeof(out[j].ssid));
+            out[j].rssi = records[i].rssi;
+            out[j].authmode = records[i].authmode;
+        }
+        else if (j == n)
+        {
+            strlcpy(out[j].ssid, ssid, sizeof(out[j].ssid));
+            out[j].rssi = records[i].rssi;
+            out[j].authmode = records[i].authmode;
+            n++;
+        }
+        else if (records[i].rssi > out[j].rssi)
+        {
+            out[j].rssi = records[i].rssi;
+            out[j].authmode = records[i].authmode;
+        }
+    }
+
+    // Insertion sort, strongest first; n is at most PORTAL_MAX_APS
+    for (uint16_t i = 1; i < n; i++)
+    {
+        ap_entry_t tmp = out[i];
+        uint16_t j = i;
+        while (j > 0 && out[j - 1].rssi < tmp.rssi)
+        {
+            out[j] = out[j - 1];
+            j--;
+        }
+        out[j] = tmp;
+    }
+    return n;
+}
+
+esp_err_t portal_send_escaped(httpd_req_t *req, const char *text, size_t max_len)
+{
+    char out[64];
+    size_t n = 0;
+    for (size_t i = 0; i < max_len && text[i]; i++)
+    {
+        const char *rep = NULL;
+        switch (text[i])
+        {
+        case '&': rep = "&amp;"; break;
+        case '<': rep = "&lt;"; break;
+        case '>': rep = "&gt;"; break;
+        case '"': rep = "&quot;"; break;
+        case '\'': rep = "&#39;"; break;
+        default: break;
+        }
+
+        size_t len = rep ? strlen(rep) : 1;
+        if (n + len > sizeof(out))
+        {
+            if (httpd_resp_send_chunk(req, out, n) != ESP_OK)
+                return ESP_FAIL;
+            n = 0;
+        }
+        if (rep)
+        {
+            memcpy(out + n, rep, len);
+        }
+        else
+        {
+            out[n] = text[i];
+        }
+        n += len;
+    }
+    return n ? httpd_resp_send_chunk(req, out, n) : ESP_OK;
+}
+
+esp_err_t portal_send_json_escaped(httpd_req_t *req, const char *text, size_t max_len)
+{
+    char out[64];
+    size_t n = 0;
+    for (size_t i = 0; i < max_len && text[i]; i++)
+    {
+        unsigned char ch = (unsigned char)text[i];
+        char rep[8];
+        size_t len;
+        if (ch == '"' || ch == '\\')
+        {
+            rep[0] = '\\';
+            rep[1] = ch;
+            len = 2;
+        }
+        else if (ch < 0x20)
+        {
+            len = snprintf(rep, sizeof(rep), "\\u%04x", ch);
+        }
+        else
+        {
+            rep[0] = ch;
+            len = 1;
+        }
+
+        if (n + len > sizeof(out))
+        {
+            if (httpd_resp_send_chunk(req, out, n) != ESP_OK)
+                return ESP_FAIL;
+            n = 0;
+        }
+        memcpy(out + n, rep, len);
+        n += len;
+    }
+    return n ? httpd_resp_send_chunk(req, out, n) : ESP_OK;
+}
+
+static esp_err_t send_wifi_options(httpd_req_t *req, const ap_entry_t *aps, uint16_t count, bool scanning)
+{
+    if (count == 0)
+    {
+        return httpd_resp_sendstr_chunk(req, scanning ? "<option disabled>Scanning...</option>"
+                                                      : "<option disabled>No networks found. Please scan.</option>");
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        char rssi[24];
+        snprintf(rssi, sizeof(rssi), " (%ddBm)</option>", aps[i].rssi);
+
+        if (httpd_resp_sendstr_chunk(req, "<option value=\"") != ESP_OK ||
+            portal_send_escaped(req, aps[i].ssid, 32) != ESP_OK ||
+            httpd_resp_sendstr_chunk(req, "\">") != ESP_OK ||
+            portal_send_escaped(req, aps[i].ssid, 32) != ESP_OK ||
+            httpd_resp_sendstr_chunk(req, rssi) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t portal_send_page(httpd_req_t *req, const ap_entry_t *aps, uint16_t count, bool scanning,
+                           const char *status_color, const char *status_text)
+{
+    // Static segments with the option rows and status in between
+    httpd_resp_set_type(req, "text/html");
+    if (httpd_resp_sendstr_chunk(req, HTML_PAGE_HEAD) != ESP_OK ||
+        send_wifi_options(req, aps, count, scanning) != ESP_OK ||
+        httpd_resp_sendstr_chunk(req, HTML_PAGE_MIDDLE) != ESP_OK ||
+        httpd_resp_sendstr_chunk(req, status_color) != ESP_OK ||
+        httpd_resp_sendstr_chunk(req, ";\">") != ESP_OK ||
+        portal_send_escaped(req, status_text, SIZE_MAX) != ESP_OK ||
+        httpd_resp_sendstr_chunk(req, HTML_PAGE_TAIL) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+esp_err_t portal_send_scan_json(httpd_req_t *req, const ap_entry_t *aps, uint16_t count, bool scanning,
+                                long long age_ms)
+{
+    char line[64];
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    snprintf(line, sizeof(line), "{\"scanning\":%s,\"age_ms\":%lld,\"networks\":[",
+             scanning ? "true" : "false", age_ms);
+    if (httpd_resp_sendstr_chunk(req, line) != ESP_OK)
+        return ESP_FAIL;
+
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(line, sizeof(line), "\",\"rssi\":%d,\"auth\":%d}", aps[i].rssi, aps[i].authmode);
+        if (httpd_resp_sendstr_chunk(req, i ? ",{\"ssid\":\"" : "{\"ssid\":\"") != ESP_OK ||
+            portal_send_json_escaped(req, aps[i].ssid, 32) != ESP_OK ||
+            httpd_resp_sendstr_chunk(req, line) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+
+    if (httpd_resp_sendstr_chunk(req, "]}") != ESP_OK)
+        return ESP_FAIL;
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
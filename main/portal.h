@@ -0,0 +1,41 @@
+#ifndef PORTAL_H
+#define PORTAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_wifi.h"
+
+#define PORTAL_MAX_APS 20
+
+// One scanned network: the strongest BSSID seen for its SSID
+typedef struct
+{
+    char ssid[33];
+    int8_t rssi;
+    uint8_t authmode;
+} ap_entry_t;
+
+// Folds raw scan records into one entry per SSID, keeping the strongest BSSID, sorted by
+// signal strength. Hidden networks are skipped, and past `max` networks the weakest are dropped.
+// Returns the number of entries written.
+uint16_t ap_merge_records(const wifi_ap_record_t *records, uint16_t count, ap_entry_t *out, uint16_t max);
+
+// Send text HTML-escaped / as the inside of a JSON string, at most max_len bytes of it,
+// through a small stack buffer
+esp_err_t portal_send_escaped(httpd_req_t *req, const char *text, size_t max_len);
+esp_err_t portal_send_json_escaped(httpd_req_t *req, const char *text, size_t max_len);
+
+// Streams the whole config page, ending the response. Nothing is built in memory: the static
+// segments from html.c go out as they are, the generated parts through 64-byte buffers.
+esp_err_t portal_send_page(httpd_req_t *req, const ap_entry_t *aps, uint16_t count, bool scanning,
+                           const char *status_color, const char *status_text);
+
+// {"scanning":false,"age_ms":1234,"networks":[{"ssid":"...","rssi":-60,"auth":3},...]}
+// age_ms is -1 before the first scan.
+esp_err_t portal_send_scan_json(httpd_req_t *req, const ap_entry_t *aps, uint16_t count, bool scanning,
+                                long long age_ms);
+
+#endif
@@ -0,0 +1,150 @@
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "power.h"
+
+static const char *PWRTAG = "POWER";
+
+static const char *const phase_names[POWER_PHASE_COUNT] = {
+    [POWER_PHASE_CONNECT] = "connect",
+    [POWER_PHASE_PREPARE] = "prepare",
+    [POWER_PHASE_SAMPLE] = "sample",
+    [POWER_PHASE_UPLOAD] = "upload",
+};
+
+typedef struct {
+    int64_t wall_us;
+    int64_t busy_us;    // Summed over the cores
+} phase_time_t;
+
+static phase_time_t phases[POWER_PHASE_COUNT];
+static int current = -1;
+static int64_t phase_start_us;
+static uint64_t phase_start_idle_us;
+
+#if CONFIG_NODE_POWER_SAVE
+static esp_pm_lock_handle_t bus_lock = NULL;
+static esp_pm_lock_handle_t cpu_lock = NULL;
+#endif
+
+// Run time of the idle tasks. Light sleep is entered from the idle task, so it counts as idle.
+static uint64_t idle_us(void) {
+    uint64_t total = 0;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    for (int core = 0; core < configNUMBER_OF_CORES; core++) {
+        total += ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(core));
+    }
+#endif
+    return total;
+}
+
+esp_err_t power_init(void) {
+    // Counted from reset, both timers start at zero
+    current = POWER_PHASE_CONNECT;
+    phase_start_us = 0;
+    phase_start_idle_us = 0;
+
+#if CONFIG_NODE_POWER_SAVE
+    esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = POWER_MIN_FREQ_MHZ,
+        .light_sleep_enable = true,
+    };
+    esp_err_t err = esp_pm_configure(&config);
+    if (err == ESP_OK) err = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "node_bus", &bus_lock);
+    if (err == ESP_OK) err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "node_cpu", &cpu_lock);
+    if (err != ESP_OK) {
+        ESP_LOGE(PWRTAG, "Power management setup failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(PWRTAG, "DFS %d-%d MHz, auto light sleep", POWER_MIN_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+#endif
+    return ESP_OK;
+}
+
+void power_lock_bus(void) {
+#if CONFIG_NODE_POWER_SAVE
+    if (bus_lock) esp_pm_lock_acquire(bus_lock);
+#endif
+}
+
+void power_unlock_bus(void) {
+#if CONFIG_NODE_POWER_SAVE
+    if (bus_lock) esp_pm_lock_release(bus_lock);
+#endif
+}
+
+void power_lock_cpu(void) {
+#if CONFIG_NODE_POWER_SAVE
+    if (cpu_lock) esp_pm_lock_acquire(cpu_lock);
+#endif
+}
+
+void power_unlock_cpu(void) {
+#if CONFIG_NODE_POWER_SAVE
+    if (cpu_lock) esp_pm_lock_release(cpu_lock);
+#endif
+}
+
+static void close_phase(void) {
+    if (current < 0) return;
+
+    int64_t wall = esp_timer_get_time() - phase_start_us;
+    int64_t busy = wall * configNUMBER_OF_CORES - (int64_t)(idle_us() - phase_start_idle_us);
+    // The run time counters are 32-bit microseconds and wrap after about 71 minutes
+    if (busy < 0) busy = 0;
+    if (busy > wall * configNUMBER_OF_CORES) busy = wall * configNUMBER_OF_CORES;
+
+    phases[current].wall_us += wall;
+    phases[current].busy_us += busy;
+    current = -1;
+}
+
+void power_phase(power_phase_t phase) {
+    close_phase();
+    current = phase;
+    phase_start_us = esp_timer_get_time();
+    phase_start_idle_us = idle_us();
+}
+
+#if CONFIG_NODE_POWER_SAVE
+// The board has no current sensor: the bench figures from Kconfig, weighted by busy share
+static uint32_t average_ua(const phase_time_t *p) {
+    int64_t span = p->wall_us * configNUMBER_OF_CORES;
+    if (span <= 0) return CONFIG_NODE_POWER_IDLE_MA * 1000;
+    return CONFIG_NODE_POWER_IDLE_MA * 1000 +
+           (uint32_t)((CONFIG_NODE_POWER_BUSY_MA - CONFIG_NODE_POWER_IDLE_MA) * 1000LL * p->busy_us / span);
+}
+#endif
+
+void power_report(void) {
+    close_phase();
+
+    int64_t total_us = 0;
+#if CONFIG_NODE_POWER_SAVE
+    uint64_t total_uas = 0;     // Charge in microampere-seconds
+#endif
+    for (int i = 0; i < POWER_PHASE_COUNT; i++) {
+        const phase_time_t *p = &phases[i];
+        if (p->wall_us == 0) continue;
+        total_us += p->wall_us;
+#if CONFIG_NODE_POWER_SAVE
+        uint32_t ua = average_ua(p);
+        total_uas += (uint64_t)ua * p->wall_us / 1000000;
+        ESP_LOGI(PWRTAG, "%-8s %6" PRId64 " ms, %3d%% busy, ~%" PRIu32 ".%" PRIu32 " mA",
+                 phase_names[i], p->wall_us / 1000, (int)(p->busy_us * 100 / (p->wall_us * configNUMBER_OF_CORES)),
+                 ua / 1000, ua % 1000 / 100);
+#else
+        ESP_LOGI(PWRTAG, "%-8s %6" PRId64 " ms", phase_names[i], p->wall_us / 1000);
+#endif
+    }
+
+#if CONFIG_NODE_POWER_SAVE
+    ESP_LOGI(PWRTAG, "wake     %6" PRId64 " ms, ~%" PRIu64 " uAh", total_us / 1000, total_uas / 3600);
+#else
+    ESP_LOGI(PWRTAG, "wake     %6" PRId64 " ms", total_us / 1000);
+#endif
+}
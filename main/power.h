@@ -0,0 +1,35 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+// With CONFIG_NODE_POWER_SAVE the CPU runs at the XTAL frequency unless something asks
+// for more, and the chip light-sleeps whenever every task is blocked. The locks keep it
+// awake and at speed for the stretches that need it; waits in between are left to sleep.
+
+#define POWER_MIN_FREQ_MHZ 40   // XTAL, lowest DFS step that keeps Wi-Fi working
+
+typedef enum {
+    POWER_PHASE_CONNECT,    // Reset to Wi-Fi up
+    POWER_PHASE_PREPARE,    // Time sync and DNS, storage and sampling run alongside
+    POWER_PHASE_SAMPLE,     // Network ready, waiting for the sample batch
+    POWER_PHASE_UPLOAD,     // Upload and firmware chunk
+    POWER_PHASE_COUNT,
+} power_phase_t;
+
+// Call before Wi-Fi starts. Also opens POWER_PHASE_CONNECT, counted from reset.
+esp_err_t power_init(void);
+
+// Nest like a counter: every lock needs its unlock
+void power_lock_bus(void);      // SPI, I2C and ADC transfers: APB at full speed, no light sleep
+void power_unlock_bus(void);
+void power_lock_cpu(void);      // TLS handshakes and other CPU-bound work: CPU at full speed
+void power_unlock_cpu(void);
+
+// Closes the running phase and opens the next
+void power_phase(power_phase_t phase);
+// Closes the running phase and logs time, busy share and average current of each
+void power_report(void);
+
+#endif
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "cJSON.h"
+#include "provision.h"
+#include "wifi.h"
+#include "nodecfg.h"
+#include "sdlog.h"
+
+#define POLICY_MAX_INTERVAL_MIN 1440
+#define POLICY_MIN_VOLT_MV      5000
+#define POLICY_MAX_VOLT_MV      20000
+#define POLICY_MAX_UPLOAD_EVERY 96
+
+static const char *PROVTAG = "PROVISION";
+
+static node_policy_t policy;
+static bool policy_loaded = false;
+
+typedef enum {
+    FIELD_STR,
+    FIELD_MINUTES,    // Whole minutes, 1..POLICY_MAX_INTERVAL_MIN
+    FIELD_VOLTS,      // Decimal volts, stored as millivolts
+    FIELD_TRANSPORT,
+    FIELD_WAKES,      // 1..POLICY_MAX_UPLOAD_EVERY
+    FIELD_WINDOW,     // Whole minutes, 0..POLICY_MAX_INTERVAL_MIN
+    FIELD_VERSION,    // Positive integer
+    FIELD_BYTES,      // Byte count, positive
+    FIELD_TIME,       // Unix time, positive
+} field_type_t;
+
+typedef struct {
+    const char *name;
+    field_type_t type;
+    size_t offset;
+    size_t size;
+    uint32_t flag;
+} prov_field_t;
+
+#define FIELD(n, t, m, f) {n, t, offsetof(provision_t, m), sizeof(((provision_t *)0)->m), f}
+
+static const prov_field_t prov_fields[] = {
+    FIELD("key", FIELD_STR, key, PROV_HAS_KEY),
+    FIELD("sensorID", FIELD_STR, sensor_id, PROV_HAS_SENSOR_ID),
+    FIELD("geoutm", FIELD_STR, geoutm, PROV_HAS_GEOUTM),
+    FIELD("interval_high", FIELD_MINUTES, policy.interval_high_min, PROV_HAS_INTERVAL_HIGH),
+    FIELD("interval_mid", FIELD_MINUTES, policy.interval_mid_min, PROV_HAS_INTERVAL_MID),
+    FIELD("interval_low", FIELD_MINUTES, policy.interval_low_min, PROV_HAS_INTERVAL_LOW),
+    FIELD("volt_high", FIELD_VOLTS, policy.volt_high_mv, PROV_HAS_VOLT_HIGH),
+    FIELD("volt_low", FIELD_VOLTS, policy.volt_low_mv, PROV_HAS_VOLT_LOW),
+    FIELD("upload_every", FIELD_WAKES, policy.upload_every, PROV_HAS_UPLOAD_EVERY),
+    FIELD("agg_window", FIELD_WINDOW, policy.agg_window_min, PROV_HAS_AGG_WINDOW),
+    FIELD("transport", FIELD_TRANSPORT, uplink.transport, PROV_HAS_TRANSPORT),
+    FIELD("data_url", FIELD_STR, uplink.data_url, PROV_HAS_DATA_URL),
+    FIELD("register_url", FIELD_STR, uplink.register_url, PROV_HAS_REGISTER_URL),
+    FIELD("mqtt_uri", FIELD_STR, uplink.mqtt_uri, PROV_HAS_MQTT_URI),
+    FIELD("mqtt_topic", FIELD_STR, uplink.mqtt_topic, PROV_HAS_MQTT_TOPIC),
+    FIELD("coap_uri", FIELD_STR, uplink.coap_uri, PROV_HAS_COAP_URI),
+    FIELD("cfg_version", FIELD_VERSION, cfg_version, PROV_HAS_CFG_VERSION),
+    FIELD("fw_version", FIELD_STR, firmware.version, PROV_HAS_FW_VERSION),
+    FIELD("fw_url", FIELD_STR, firmware.url, PROV_HAS_FW_URL),
+    FIELD("fw_size", FIELD_BYTES, firmware.size, PROV_HAS_FW_SIZE),
+    FIELD("fw_sha256", FIELD_STR, firmware.sha256, PROV_HAS_FW_SHA256),
+    FIELD("fw_base", FIELD_STR, firmware.base, PROV_HAS_FW_BASE),
+    FIELD("backfill_from", FIELD_TIME, backfill_from, PROV_HAS_BACKFILL_FROM),
+    FIELD("backfill_to", FIELD_TIME, backfill_to, PROV_HAS_BACKFILL_TO),
+};
+
+static const prov_field_t *find_field(const char *name, size_t name_len) {
+    for (size_t i = 0; i < sizeof(prov_fields) / sizeof(prov_fields[0]); i++) {
+        if (strlen(prov_fields[i].name) == name_len && memcmp(prov_fields[i].name, name, name_len) == 0) {
+            return &prov_fields[i];
+        }
+    }
+    return NULL;
+}
+
+// Whole number in [min, max]. Checked in this order so NaN and out-of-range values never
+// reach the cast.
+static bool whole_in_range(double value, double min, double max) {
+    return value >= min && value <= max && value == (double)(uint32_t)value;
+}
+
+static esp_err_t set_number(provision_t *out, const prov_field_t *field, double value) {
+    uint8_t *dst = (uint8_t *)out + field->offset;
+
+    switch (field->type) {
+        case FIELD_MINUTES:
+            if (!whole_in_range(value, 1, POLICY_MAX_INTERVAL_MIN)) return ESP_ERR_INVALID_ARG;
+            *(uint16_t *)dst = (uint16_t)value;
+            break;
+        case FIELD_VOLTS: {
+            // Rounded to the millivolt before the range check, so the limits themselves pass
+            double mv = value * 1000.0 + 0.5;
+            if (!(mv >= POLICY_MIN_VOLT_MV && mv < POLICY_MAX_VOLT_MV + 1)) return ESP_ERR_INVALID_ARG;
+            *(uint16_t *)dst = (uint16_t)mv;
+            break;
+        }
+        case FIELD_WAKES:
+            if (!whole_in_range(value, 1, POLICY_MAX_UPLOAD_EVERY)) return ESP_ERR_INVALID_ARG;
+            *(uint16_t *)dst = (uint16_t)value;
+            break;
+        case FIELD_WINDOW:
+            if (!whole_in_range(value, 0, POLICY_MAX_INTERVAL_MIN)) return ESP_ERR_INVALID_ARG;
+            *(uint16_t *)dst = (uint16_t)value;
+            break;
+        case FIELD_VERSION:
+        case FIELD_BYTES:
+        case FIELD_TIME:
+            if (!whole_in_range(value, 1, UINT32_MAX)) return ESP_ERR_INVALID_ARG;
+            *(uint32_t *)dst = (uint32_t)value;
+            break;
+        case FIELD_TRANSPORT:
+            if (value != UPLINK_TRANSPORT_HTTP && value != UPLINK_TRANSPORT_MQTT && value != UPLINK_TRANSPORT_COAP) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            *dst = (uint8_t)value;
+            break;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+    out->present |= field->flag;
+    return ESP_OK;
+}
+
+// Stores one value given as text; len excludes any terminator
+static esp_err_t set_text(provision_t *out, const prov_field_t *field, const char *text, size_t len) {
+    if (field->type == FIELD_STR) {
+        if (len >= field->size) {
+            ESP_LOGE(PROVTAG, "%s is %u bytes, limit %u", field->name, (unsigned)len, (unsigned)field->size - 1);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        char *dst = (char *)out + field->offset;
+        memcpy(dst, text, len);
+        dst[len] = '\0';
+        out->present |= field->flag;
+        return ESP_OK;
+    }
+
+    char num[16];
+    if (len == 0 || len >= sizeof(num)) return ESP_ERR_INVALID_ARG;
+    memcpy(num, text, len);
+    num[len] = '\0';
+
+    char *end;
+    double value = strtod(num, &end);
+    if (*end != '\0') return ESP_ERR_INVALID_ARG;
+    return set_number(out, field, value);
+}
+
+// One pass over lines of the form  name:'value'  as sent by the registration endpoint.
+// Anything else on a line, and lines that don't match, are ignored.
+static esp_err_t parse_lines(const char *body, size_t len, provision_t *out) {
+    size_t i = 0;
+    while (i < len) {
+        size_t name_start = i;
+        while (i < len && (isalnum((unsigned char)body[i]) || body[i] == '_')) i++;
+        size_t name_len = i - name_start;
+
+        if (name_len > 0 && i + 1 < len && body[i] == ':' && body[i + 1] == '\'') {
+            size_t value_start = i + 2;
+            const char *quote = memchr(body + value_start, '\'', len - value_start);
+            if (!quote) break;   // Cut-off reply, keep what came before
+
+            size_t value_len = quote - (body + value_start);
+            const prov_field_t *field = find_field(body + name_start, name_len);
+            if (field) {
+                esp_err_t err = set_text(out, field, body + value_start, value_len);
+                if (err != ESP_OK) return err;
+            }
+            i = quote - body + 1;
+        }
+
+        while (i < len && body[i] != '\n') i++;
+        i++;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t parse_json(const char *body, size_t len, provision_t *out) {
+    cJSON *root = cJSON_ParseWithLength(body, len);
+    if (!cJSON_IsObject(root)) {
+        cJSON_Delete(root);
+        ESP_LOGE(PROVTAG, "Reply is not a JSON object");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_OK;
+    const cJSON *item;
+    cJSON_ArrayForEach(item, root) {
+        const prov_field_t *field = find_field(item->string, strlen(item->string));
+        if (!field) continue;
+
+        if (cJSON_IsString(item)) {
+            err = set_text(out, field, item->valuestring, strlen(item->valuestring));
+        } else if (cJSON_IsNumber(item) && field->type != FIELD_STR) {
+            err = set_number(out, field, item->valuedouble);
+        } else {
+            err = ESP_ERR_INVALID_ARG;
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(PROVTAG, "Bad value for %s", field->name);
+            break;
+        }
+    }
+
+    cJSON_Delete(root);
+    return err;
+}
+
+esp_err_t provision_parse(const char *body, size_t len, provision_t *out) {
+    memset(out, 0, sizeof(*out));
+
+    size_t i = 0;
+    while (i < len && isspace((unsigned char)body[i])) i++;
+    if (i < len && body[i] == '{') {
+        return parse_json(body + i, len - i, out);
+    }
+    return parse_lines(body, len, out);
+}
+
+void node_policy_defaults(node_policy_t *p) {
+    p->interval_high_min = POLICY_DEFAULT_INTERVAL_HIGH;
+    p->interval_mid_min = POLICY_DEFAULT_INTERVAL_MID;
+    p->interval_low_min = POLICY_DEFAULT_INTERVAL_LOW;
+    p->volt_high_mv = POLICY_DEFAULT_VOLT_HIGH_MV;
+    p->volt_low_mv = POLICY_DEFAULT_VOLT_LOW_MV;
+    p->upload_every = POLICY_DEFAULT_UPLOAD_EVERY;
+    p->agg_window_min = POLICY_DEFAULT_AGG_WINDOW;
+}
+
+esp_err_t node_policy_load(node_policy_t *p) {
+    const nodecfg_t *cfg = nodecfg();
+    if (!(cfg->present & NODECFG_HAS_POLICY)) {
+        node_policy_defaults(p);
+        return ESP_ERR_NOT_FOUND;
+    }
+    *p = cfg->policy;
+    return ESP_OK;
+}
+
+esp_err_t node_policy_save(const node_policy_t *p) {
+    if (p->volt_low_mv > p->volt_high_mv) return ESP_ERR_INVALID_ARG;
+
+    nodecfg_t cfg = *nodecfg();
+    cfg.policy = *p;
+    cfg.present |= NODECFG_HAS_POLICY;
+    esp_err_t err = nodecfg_save(&cfg);
+
+    if (err == ESP_OK) {
+        policy = *p;
+        policy_loaded = true;
+    }
+    return err;
+}
+
+const node_policy_t *node_policy(void) {
+    if (!policy_loaded) {
+        node_policy_load(&policy);
+        policy_loaded = true;
+    }
+    return &policy;
+}
+
+int node_policy_sleep_minutes(float voltage) {
+    const node_policy_t *p = node_policy();
+    uint32_t mv = voltage > 0 ? (uint32_t)(voltage * 1000.0f) : 0;
+
+    if (mv >= p->volt_high_mv) return p->interval_high_min;
+    if (mv >= p->volt_low_mv) return p->interval_mid_min;
+    return p->interval_low_min;
+}
+
+// Current policy with the fields the reply carried laid over it
+static void merge_policy(const provision_t *prov, node_policy_t *p) {
+    *p = *node_policy();
+    if (prov->present & PROV_HAS_INTERVAL_HIGH) p->interval_high_min = prov->policy.interval_high_min;
+    if (prov->present & PROV_HAS_INTERVAL_MID) p->interval_mid_min = prov->policy.interval_mid_min;
+    if (prov->present & PROV_HAS_INTERVAL_LOW) p->interval_low_min = prov->policy.interval_low_min;
+    if (prov->present & PROV_HAS_VOLT_HIGH) p->volt_high_mv = prov->policy.volt_high_mv;
+    if (prov->present & PROV_HAS_VOLT_LOW) p->volt_low_mv = prov->policy.volt_low_mv;
+    if (prov->present & PROV_HAS_UPLOAD_EVERY) p->upload_every = prov->policy.upload_every;
+    if (prov->present & PROV_HAS_AGG_WINDOW) p->agg_window_min = prov->policy.agg_window_min;
+}
+
+// Lays the policy and endpoint fields the reply carried over cfg
+static void merge_config(const provision_t *prov, nodecfg_t *cfg) {
+    if (prov->present & PROV_HAS_POLICY) {
+        merge_policy(prov, &cfg->policy);
+        cfg->present |= NODECFG_HAS_POLICY;
+    }
+
+    if (prov->present & PROV_HAS_UPLINK) {
+        uplink_config_t *u = &cfg->uplink;
+        *u = *uplink_config();
+        if (prov->present & PROV_HAS_TRANSPORT) u->transport = prov->uplink.transport;
+        if (prov->present & PROV_HAS_DATA_URL) strlcpy(u->data_url, prov->uplink.data_url, sizeof(u->data_url));
+        if (prov->present & PROV_HAS_REGISTER_URL) strlcpy(u->register_url, prov->uplink.register_url, sizeof(u->register_url));
+        if (prov->present & PROV_HAS_MQTT_URI) strlcpy(u->mqtt_uri, prov->uplink.mqtt_uri, sizeof(u->mqtt_uri));
+        if (prov->present & PROV_HAS_MQTT_TOPIC) strlcpy(u->mqtt_topic, prov->uplink.mqtt_topic, sizeof(u->mqtt_topic));
+        if (prov->present & PROV_HAS_COAP_URI) strlcpy(u->coap_uri, prov->uplink.coap_uri, sizeof(u->coap_uri));
+        cfg->present |= NODECFG_HAS_UPLINK;
+    }
+}
+
+static void log_config(const provision_t *prov, const nodecfg_t *cfg) {
+    const node_policy_t *p = &cfg->policy;
+    if (prov->present & PROV_HAS_POLICY) {
+        ESP_LOGI(PROVTAG, "Policy: %u/%u/%u min, %u/%u mV, upload every %u, %u min windows", p->interval_high_min,
+                 p->interval_mid_min, p->interval_low_min, p->volt_high_mv, p->volt_low_mv, p->upload_every,
+                 p->agg_window_min);
+    }
+    if (prov->present & PROV_HAS_UPLINK) ESP_LOGI(PROVTAG, "Endpoints updated, transport %d", cfg->uplink.transport);
+}
+
+esp_err_t provision_apply(const provision_t *prov) {
+    esp_err_t err = ESP_OK;
+
+    if ((prov->present & PROV_HAS_REGISTRATION) == PROV_HAS_REGISTRATION) {
+        err = save_registration_metadata(prov->key, prov->sensor_id, prov->geoutm);
+        if (err != ESP_OK) return err;
+    }
+    if (!(prov->present & (PROV_HAS_POLICY | PROV_HAS_UPLINK))) return ESP_OK;
+
+    nodecfg_t cfg = *nodecfg();
+    merge_config(prov, &cfg);
+    if (cfg.policy.volt_low_mv > cfg.policy.volt_high_mv) return ESP_ERR_INVALID_ARG;
+
+    err = nodecfg_save(&cfg);
+    policy_loaded = false;
+    if (err != ESP_OK) return err;
+    log_config(prov, &cfg);
+    return ESP_OK;
+}
+
+// A delta's policy, endpoints and version go to NVS in the one config blob, so the delta
+// lands whole or not at all. A save that didn't reach flash is dropped from the cache too:
+// the version must not be reported to the server before a reset can no longer lose it.
+static esp_err_t apply_delta(const provision_t *delta) {
+    nodecfg_t cfg = *nodecfg();
+    merge_config(delta, &cfg);
+    cfg.cfg_version = delta->cfg_version;
+
+    esp_err_t err = nodecfg_save(&cfg);
+    if (err != ESP_OK) nodecfg_reload();
+    policy_loaded = false;
+    if (err != ESP_OK) return err;
+
+    log_config(delta, &cfg);
+    ESP_LOGI(PROVTAG, "Applied config version %" PRIu32, delta->cfg_version);
+    return ESP_OK;
+}
+
+esp_err_t provision_handle_reply(const char *body, size_t len) {
+    provision_t *delta = malloc(sizeof(provision_t));
+    if (!delta) return ESP_ERR_NO_MEM;
+
+    esp_err_t err = provision_parse(body, len, delta);
+    if (err == ESP_OK && (delta->present & PROV_HAS_FIRMWARE) == PROV_HAS_FIRMWARE) {
+        ota_offer(&delta->firmware);
+    }
+    if (err == ESP_OK && (delta->present & PROV_HAS_BACKFILL) == PROV_HAS_BACKFILL) {
+        sdlog_backfill_request(delta->backfill_from, delta->backfill_to);
+    }
+    if (err != ESP_OK || !(delta->present & PROV_HAS_CFG_VERSION)) {
+        free(delta);
+        return err;
+    }
+
+    if (delta->cfg_version <= nodecfg()->cfg_version) {
+        // Server is repeating a delta we have, so it missed the ack: send it again
+        provision_mark_acked(0);
+        free(delta);
+        return ESP_OK;
+    }
+
+    delta->present &= ~PROV_HAS_REGISTRATION;
+
+    // Reject the whole delta up front rather than leave it half applied
+    node_policy_t merged;
+    merge_policy(delta, &merged);
+    if (merged.volt_low_mv > merged.volt_high_mv) {
+        ESP_LOGE(PROVTAG, "Config version %" PRIu32 " rejected: volt_low above volt_high", delta->cfg_version);
+        free(delta);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    err = apply_delta(delta);
+    if (err != ESP_OK) {
+        ESP_LOGE(PROVTAG, "Failed to apply config version %" PRIu32 ": %s", delta->cfg_version, esp_err_to_name(err));
+    }
+    free(delta);
+    return err;
+}
+
+// Firmware before the config blob version 3 journalled a delta to "pending" in the "cfg"
+// namespace before applying it. One left by a reset is finished here.
+esp_err_t provision_recover(void) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("cfg", NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+
+    size_t size = 0;
+    if (nvs_get_blob(handle, "pending", NULL, &size) != ESP_OK) {
+        nvs_close(handle);
+        return ESP_OK;
+    }
+
+    provision_t *delta = malloc(sizeof(provision_t));
+    if (!delta) {
+        nvs_close(handle);
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = ESP_OK;
+    if (size == sizeof(*delta) && nvs_get_blob(handle, "pending", delta, &size) == ESP_OK) {
+        ESP_LOGW(PROVTAG, "Finishing interrupted config version %" PRIu32, delta->cfg_version);
+        err = apply_delta(delta);
+    } else {
+        // Written by a different firmware layout; the server will resend it
+        ESP_LOGW(PROVTAG, "Discarding unreadable config journal");
+    }
+    if (err == ESP_OK) {
+        nvs_erase_key(handle, "pending");
+        err = nvs_commit(handle);
+    }
+
+    free(delta);
+    nvs_close(handle);
+    return err;
+}
+
+uint32_t provision_ack_version(void) {
+    const nodecfg_t *cfg = nodecfg();
+    return cfg->cfg_version != cfg->cfg_acked ? cfg->cfg_version : 0;
+}
+
+void provision_mark_acked(uint32_t version) {
+    if (nodecfg()->cfg_acked == version) return;
+    nodecfg_t cfg = *nodecfg();
+    cfg.cfg_acked = version;
+    nodecfg_save(&cfg);
+}
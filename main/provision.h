@@ -0,0 +1,118 @@
+#ifndef PROVISION_H
+#define PROVISION_H
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "uplink.h"
+#include "ota.h"
+
+#define PROVISION_RESPONSE_MAX 2048   // Largest server reply read for provisioning
+
+// Sleep interval by battery voltage, stored with the node config (see nodecfg.h).
+// The defaults apply until the server sends a policy.
+#define POLICY_DEFAULT_INTERVAL_HIGH CONFIG_NODE_INTERVAL_HIGH_MIN  // Minutes, battery at or above volt_high
+#define POLICY_DEFAULT_INTERVAL_MID  CONFIG_NODE_INTERVAL_MID_MIN
+#define POLICY_DEFAULT_INTERVAL_LOW  CONFIG_NODE_INTERVAL_LOW_MIN   // Minutes, battery below volt_low
+#define POLICY_DEFAULT_VOLT_HIGH_MV  CONFIG_NODE_VOLT_HIGH_MV
+#define POLICY_DEFAULT_VOLT_LOW_MV   CONFIG_NODE_VOLT_LOW_MV
+#define POLICY_DEFAULT_UPLOAD_EVERY  CONFIG_NODE_UPLOAD_EVERY       // Wakes per upload; flash log or wake stub only
+#define POLICY_DEFAULT_AGG_WINDOW    CONFIG_NODE_AGG_WINDOW_MIN     // Minutes per aggregate row, 0 uploads raw rows
+
+typedef struct {
+    uint16_t interval_high_min;
+    uint16_t interval_mid_min;
+    uint16_t interval_low_min;
+    uint16_t volt_high_mv;
+    uint16_t volt_low_mv;
+    uint16_t upload_every;
+    uint16_t agg_window_min;
+} node_policy_t;
+
+// Which fields a reply carried
+#define PROV_HAS_KEY           (1u << 0)
+#define PROV_HAS_SENSOR_ID     (1u << 1)
+#define PROV_HAS_GEOUTM        (1u << 2)
+#define PROV_HAS_INTERVAL_HIGH (1u << 3)
+#define PROV_HAS_INTERVAL_MID  (1u << 4)
+#define PROV_HAS_INTERVAL_LOW  (1u << 5)
+#define PROV_HAS_VOLT_HIGH     (1u << 6)
+#define PROV_HAS_VOLT_LOW      (1u << 7)
+#define PROV_HAS_TRANSPORT     (1u << 8)
+#define PROV_HAS_DATA_URL      (1u << 9)
+#define PROV_HAS_REGISTER_URL  (1u << 10)
+#define PROV_HAS_MQTT_URI      (1u << 11)
+#define PROV_HAS_MQTT_TOPIC    (1u << 12)
+#define PROV_HAS_COAP_URI      (1u << 13)
+#define PROV_HAS_UPLOAD_EVERY  (1u << 14)
+#define PROV_HAS_CFG_VERSION   (1u << 15)
+#define PROV_HAS_FW_VERSION    (1u << 16)
+#define PROV_HAS_FW_URL        (1u << 17)
+#define PROV_HAS_FW_SIZE       (1u << 18)
+#define PROV_HAS_FW_SHA256     (1u << 19)
+#define PROV_HAS_FW_BASE       (1u << 20)
+#define PROV_HAS_AGG_WINDOW    (1u << 21)
+#define PROV_HAS_BACKFILL_FROM (1u << 22)
+#define PROV_HAS_BACKFILL_TO   (1u << 23)
+
+#define PROV_HAS_REGISTRATION  (PROV_HAS_KEY | PROV_HAS_SENSOR_ID | PROV_HAS_GEOUTM)
+#define PROV_HAS_POLICY        (PROV_HAS_INTERVAL_HIGH | PROV_HAS_INTERVAL_MID | PROV_HAS_INTERVAL_LOW | \
+                                PROV_HAS_VOLT_HIGH | PROV_HAS_VOLT_LOW | PROV_HAS_UPLOAD_EVERY | \
+                                PROV_HAS_AGG_WINDOW)
+#define PROV_HAS_UPLINK        (PROV_HAS_TRANSPORT | PROV_HAS_DATA_URL | PROV_HAS_REGISTER_URL | \
+                                PROV_HAS_MQTT_URI | PROV_HAS_MQTT_TOPIC | PROV_HAS_COAP_URI)
+#define PROV_HAS_FIRMWARE      (PROV_HAS_FW_VERSION | PROV_HAS_FW_URL | PROV_HAS_FW_SIZE | \
+                                PROV_HAS_FW_SHA256 | PROV_HAS_FW_BASE)
+#define PROV_HAS_BACKFILL      (PROV_HAS_BACKFILL_FROM | PROV_HAS_BACKFILL_TO)
+
+// A server reply decoded into typed fields. Only the fields flagged in present are set.
+typedef struct {
+    uint32_t present;
+    char key[64];
+    char sensor_id[32];
+    char geoutm[128];
+    node_policy_t policy;
+    uplink_config_t uplink;
+    uint32_t cfg_version;
+    ota_offer_t firmware;
+    uint32_t backfill_from;
+    uint32_t backfill_to;
+} provision_t;
+
+// Accepts either the key:'value' line format or a JSON object with the same names:
+//   key, sensorID, geoutm, interval_high, interval_mid, interval_low (minutes),
+//   volt_high, volt_low (volts), upload_every (wakes), agg_window (minutes, 0 for raw rows), transport, data_url, register_url,
+//   mqtt_uri, mqtt_topic, coap_uri, cfg_version,
+//   fw_version, fw_url, fw_size (bytes), fw_sha256, fw_base, backfill_from, backfill_to (Unix time)
+// Unknown names are ignored. ESP_ERR_INVALID_SIZE if a value doesn't fit its field,
+// ESP_ERR_INVALID_ARG if a number is malformed or out of range.
+esp_err_t provision_parse(const char *body, size_t len, provision_t *out);
+
+// Stores every field the reply carried: registration, policy and endpoints
+esp_err_t provision_apply(const provision_t *prov);
+
+// Remote configuration. An upload reply carrying cfg_version newer than the applied one is
+// a config delta: it is saved with the node config in one NVS write and reported back with
+// the next upload.
+// A reply repeating the applied version, or an older one, means the server missed that
+// report, so it goes out again.
+// Registration fields in a delta are ignored; re-keying goes through the portal.
+// A reply carrying all the fw_ fields offers a firmware update, see ota_offer().
+// backfill_from and backfill_to ask for stored history, see sdlog_backfill_request().
+esp_err_t provision_handle_reply(const char *body, size_t len);
+// Finishes a delta that older firmware journalled and a reset interrupted. Call once the
+// node config is loaded.
+esp_err_t provision_recover(void);
+// Version to report in the next upload, 0 if the server already has it
+uint32_t provision_ack_version(void);
+void provision_mark_acked(uint32_t version);
+
+void node_policy_defaults(node_policy_t *policy);
+esp_err_t node_policy_load(node_policy_t *policy);
+esp_err_t node_policy_save(const node_policy_t *policy);
+const node_policy_t *node_policy(void);
+int node_policy_sleep_minutes(float voltage);
+
+#endif
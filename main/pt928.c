@@ -4,26 +4,24 @@
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "driver/i2c_master.h"
+#include "power.h"
 #include <inttypes.h>
 #include "pt928.h"
+#include "dlog.h"
 
 static const char *PTAG = "PT928-I2C";
 static i2c_master_bus_handle_t bus_handle = NULL;
 static i2c_master_dev_handle_t dev_handle = NULL;
 
-#define I2C_MASTER_SCL_IO           4
-#define I2C_MASTER_SDA_IO           5
+#define I2C_MASTER_SCL_IO           CONFIG_NODE_I2C_PIN_SCL
+#define I2C_MASTER_SDA_IO           CONFIG_NODE_I2C_PIN_SDA
 #define I2C_MASTER_NUM              I2C_NUM_0
 #define I2C_MASTER_FREQ_HZ          100000
 #define I2C_MASTER_TIMEOUT_MS       1000
 
-#define PT928_SENSOR_ADDR         0x6d
-#define PT928_MEASURE_TYPE_ADDR   0x30   // Measurement mode register
-#define PT928_PRES_OUT_1_REG_ADDR 0x06   // Pressure data register
-
 esp_err_t pt928_init(void){
 
-    ESP_LOGI(PTAG,"Pt928init starting here");
+    DLOGI(DLOG_SENSORS, "Pt928init starting here");
     if(bus_handle != NULL) return ESP_OK;
     i2c_master_bus_config_t bus_config = {
         .i2c_port = I2C_MASTER_NUM,
@@ -47,12 +45,18 @@ esp_err_t pt928_init(void){
 }
 
 static esp_err_t pt928_register_read(i2c_master_dev_handle_t dev_handle, uint8_t reg_addr, uint8_t *data, size_t len) {
-    return i2c_master_transmit_receive(dev_handle, &reg_addr, 1, data, len, I2C_MASTER_TIMEOUT_MS / portTICK_PERIOD_MS);
+    power_lock_bus();
+    esp_err_t ret = i2c_master_transmit_receive(dev_handle, &reg_addr, 1, data, len, I2C_MASTER_TIMEOUT_MS / portTICK_PERIOD_MS);
+    power_unlock_bus();
+    return ret;
 }
 
 static esp_err_t pt928_register_write_byte(i2c_master_dev_handle_t dev_handle, uint8_t reg_addr, uint8_t data) {
     uint8_t write_buf[2] = {reg_addr, data};
-    return i2c_master_transmit(dev_handle, write_buf, sizeof(write_buf), I2C_MASTER_TIMEOUT_MS / portTICK_PERIOD_MS);
+    power_lock_bus();
+    esp_err_t ret = i2c_master_transmit(dev_handle, write_buf, sizeof(write_buf), I2C_MASTER_TIMEOUT_MS / portTICK_PERIOD_MS);
+    power_unlock_bus();
+    return ret;
 }
 
 
@@ -65,7 +69,7 @@ uint32_t pt928_read_pressure() {
         ESP_LOGE(PTAG, "Measurement mode set failed");
         return UINT32_MAX;
     }
-    vTaskDelay(pdMS_TO_TICKS(25));
+    vTaskDelay(pdMS_TO_TICKS(PT928_CONVERSION_MS));   // Light-sleeps with power saving on
 
     // Read pressure data
     uint8_t press_data[3];
@@ -4,6 +4,11 @@
 #include <stdint.h>
 #include "esp_err.h"
 
+#define PT928_SENSOR_ADDR         0x6d
+#define PT928_MEASURE_TYPE_ADDR   0x30   // Measurement mode register
+#define PT928_PRES_OUT_1_REG_ADDR 0x06   // Pressure data register
+#define PT928_CONVERSION_MS       25     // Single measurement, trigger to data ready
+
 esp_err_t pt928_init(void);
 uint32_t pt928_read_pressure(void);
 void pt928_deinit(void);
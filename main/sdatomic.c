@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "power.h"
+#include "sdatomic.h"
+
+static const char *SDTAG = "SD_CARD";
+
+// "/sdcard/payload.txt" -> "/sdcard/payload.tmp" (FAT here has no long file names)
+static void sd_tmp_path(const char *path, char *out, size_t out_size) {
+    strlcpy(out, path, out_size);
+    char *slash = strrchr(out, '/');
+    char *dot = strrchr(out, '.');
+    if (dot && (!slash || dot > slash)) *dot = '\0';
+    strlcat(out, ".tmp", out_size);
+}
+
+static bool sd_parse_header(const char *data, size_t len, uint32_t *body_len, uint32_t *crc) {
+    if (len < SD_ATOMIC_HEADER_LEN || strncmp(data, "#MNF1 ", 6) != 0 || data[SD_ATOMIC_HEADER_LEN - 1] != '\n') return false;
+    return sscanf(data, "#MNF1 %8" SCNx32 " %8" SCNx32, body_len, crc) == 2;
+}
+
+// Length of a valid header at the start of data, so uploads can send just the body
+size_t sd_atomic_header_skip(const char *data, size_t len) {
+    uint32_t body_len, crc;
+    return sd_parse_header(data, len, &body_len, &crc) ? SD_ATOMIC_HEADER_LEN : 0;
+}
+
+// Reads the sensor rows appended after the CRC'd metadata block into a malloc'd buffer
+esp_err_t sd_load_rows(const char *path, char **rows, size_t *rows_len) {
+    power_lock_bus();
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        ESP_LOGE(SDTAG, "Failed to open %s", path);
+        power_unlock_bus();
+        return ESP_FAIL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *content = malloc(file_size + 1);
+    size_t len = content ? fread(content, 1, file_size, file) : 0;
+    fclose(file);
+    power_unlock_bus();
+    if (!content) return ESP_ERR_NO_MEM;
+
+    uint32_t body_len, crc;
+    size_t skip = 0;
+    if (sd_parse_header(content, len, &body_len, &crc) && SD_ATOMIC_HEADER_LEN + body_len <= len) {
+        skip = SD_ATOMIC_HEADER_LEN + body_len;
+    } else {
+        ESP_LOGW(SDTAG, "%s has no metadata header, sending it whole", path);
+    }
+
+    memmove(content, content + skip, len - skip);
+    content[len - skip] = '\0';
+    *rows = content;
+    *rows_len = len - skip;
+    return ESP_OK;
+}
+
+// Checks the header CRC. Bytes appended after the body (sensor rows) are allowed.
+static esp_err_t sd_check_file(const char *path, char *buffer, size_t buffer_size, size_t *out_len) {
+    FILE *file = fopen(path, "r");
+    if (!file) return ESP_ERR_NOT_FOUND;
+
+    char header[SD_ATOMIC_HEADER_LEN];
+    uint32_t body_len, crc;
+    size_t n = fread(header, 1, sizeof(header), file);
+    if (!sd_parse_header(header, n, &body_len, &crc)) {
+        fclose(file);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    uint32_t actual = 0;
+    size_t remaining = body_len;
+    size_t copied = 0;
+    char chunk[128];
+    while (remaining > 0) {
+        size_t want = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+        n = fread(chunk, 1, want, file);
+        if (n == 0) break;
+        actual = esp_rom_crc32_le(actual, (const uint8_t *)chunk, n);
+        if (buffer && copied + n < buffer_size) {
+            memcpy(buffer + copied, chunk, n);
+            copied += n;
+        }
+        remaining -= n;
+    }
+    fclose(file);
+
+    if (remaining > 0 || actual != crc) return ESP_ERR_INVALID_CRC;
+    if (buffer) {
+        if (copied != body_len) return ESP_ERR_INVALID_SIZE;
+        buffer[copied] = '\0';
+    }
+    if (out_len) *out_len = body_len;
+    return ESP_OK;
+}
+
+// Write temp, fsync, then swap in. FAT can't rename over an existing file, so the
+// target is removed first and sd_recover_file finishes the job after a power cut.
+esp_err_t sd_write_atomic(const char *path, const char *data, size_t len) {
+    char tmp[64];
+    sd_tmp_path(path, tmp, sizeof(tmp));
+
+    power_lock_bus();
+    FILE *file = fopen(tmp, "w");
+    if (!file) {
+        ESP_LOGE(SDTAG, "Failed to open %s: %s", tmp, strerror(errno));
+        power_unlock_bus();
+        return ESP_FAIL;
+    }
+
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)data, len);
+    bool ok = fprintf(file, "#MNF1 %08" PRIx32 " %08" PRIx32 "\n", (uint32_t)len, crc) == SD_ATOMIC_HEADER_LEN &&
+              fwrite(data, 1, len, file) == len &&
+              fflush(file) == 0 &&
+              fsync(fileno(file)) == 0;
+    fclose(file);
+    if (!ok) {
+        ESP_LOGE(SDTAG, "Failed to write %s", tmp);
+        remove(tmp);
+        power_unlock_bus();
+        return ESP_FAIL;
+    }
+
+    remove(path);
+    int renamed = rename(tmp, path);
+    power_unlock_bus();
+    if (renamed != 0) {
+        ESP_LOGE(SDTAG, "Failed to rename %s: %s", tmp, strerror(errno));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sd_read_atomic(const char *path, char *buffer, size_t buffer_size, size_t *out_len) {
+    esp_err_t ret = sd_check_file(path, buffer, buffer_size, out_len);
+    if (ret != ESP_OK) {
+        ESP_LOGW(SDTAG, "%s not readable: %s", path, esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+// Boot-time recovery: a complete temp file wins over a missing or damaged target,
+// an incomplete one is thrown away.
+esp_err_t sd_recover_file(const char *path) {
+    char tmp[64];
+    sd_tmp_path(path, tmp, sizeof(tmp));
+
+    esp_err_t tmp_state = sd_check_file(tmp, NULL, 0, NULL);
+    if (tmp_state == ESP_ERR_NOT_FOUND) return ESP_OK;
+
+    if (tmp_state != ESP_OK) {
+        ESP_LOGW(SDTAG, "Discarding incomplete %s", tmp);
+        remove(tmp);
+        return ESP_OK;
+    }
+
+    // The temp file is only complete once its write was committed, so it replaces
+    // whatever is left at the target
+    remove(path);
+    ESP_LOGW(SDTAG, "Completing interrupted write of %s", path);
+    if (rename(tmp, path) != 0) {
+        ESP_LOGE(SDTAG, "Recovery rename failed: %s", strerror(errno));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
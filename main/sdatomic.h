@@ -0,0 +1,16 @@
+#ifndef SDATOMIC_H
+#define SDATOMIC_H
+
+#include <stddef.h>
+#include "esp_err.h"
+
+// Crash-safe metadata files: body is prefixed by a CRC'd header line and replaced via temp file + rename.
+// Plain stdio, so it also builds on a host against a simulated file system.
+#define SD_ATOMIC_HEADER_LEN 24
+esp_err_t sd_write_atomic(const char *path, const char *data, size_t len);
+esp_err_t sd_read_atomic(const char *path, char *buffer, size_t buffer_size, size_t *out_len);
+esp_err_t sd_recover_file(const char *path);
+size_t sd_atomic_header_skip(const char *data, size_t len);
+esp_err_t sd_load_rows(const char *path, char **rows, size_t *rows_len);
+
+#endif
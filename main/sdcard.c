@@ -1,11 +1,13 @@
 #include <stdio.h>
 #include <string.h>
+#include "sdkconfig.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "driver/spi_master.h"
 #include "sdmmc_cmd.h"
 #include "esp_vfs_fat.h"
 #include "sdcard.h"
+#include "dlog.h"
 #include <sys/time.h>
 #include "esp_system.h"
 #include "esp_event.h"
@@ -18,22 +20,37 @@
 #include "esp_attr.h"
 #include "esp_sleep.h"
 #include "esp_netif.h"
-
-#include "time.c"
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "timex.h"
+#include "power.h"
 
 // Define SPI pins
-#define PIN_NUM_MISO 35
-#define PIN_NUM_MOSI 34
-#define PIN_NUM_CLK  36
-#define PIN_NUM_CS   33
+#define PIN_NUM_MISO CONFIG_NODE_SD_PIN_MISO
+#define PIN_NUM_MOSI CONFIG_NODE_SD_PIN_MOSI
+#define PIN_NUM_CLK  CONFIG_NODE_SD_PIN_CLK
+#define PIN_NUM_CS   CONFIG_NODE_SD_PIN_CS
 
 
 static const char *SDTAG = "SD_CARD";
 static sdmmc_card_t *card = NULL;
 static spi_host_device_t spi_host = SPI2_HOST;
 
+// Portal handlers streaming from the card, which sd_deinit waits out
+static portMUX_TYPE hold_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile int holders = 0;
+static bool unmounting = false;
+
+// Files written through sd_write_atomic, checked for an interrupted replace on every mount
+static const char *metadata_files[] = {"/sdcard/payload.txt", "/sdcard/register.txt"};
+
 esp_err_t sd_init(void) {
     static bool initialized = false;
+    // Config mode mounts it before the wake pipeline asks again
+    if (card) return ESP_OK;
     
     spi_bus_config_t bus_cfg = {
         .mosi_io_num = PIN_NUM_MOSI,
@@ -61,33 +78,65 @@ esp_err_t sd_init(void) {
     };
 
     vTaskDelay(pdMS_TO_TICKS(1000));
+
+    // Card traffic runs in one go instead of light-sleeping between SPI transactions
+    power_lock_bus();
     ret = esp_vfs_fat_sdspi_mount("/sdcard", &host, &slot_config, &mount_config, &card);
     
     if(ret == ESP_OK) initialized = true;
 
     if(initialized){
-        FILE *file = fopen("/sdcard/payload.txt", "w");
-        if (!file){
-            initialized = false;
-            return ESP_FAIL;
+        for (size_t i = 0; i < sizeof(metadata_files) / sizeof(metadata_files[0]); i++) {
+            sd_recover_file(metadata_files[i]);
         }
-        fclose(file);
-        return ESP_OK;
+
+        // A fresh payload for this wake, replaced like any metadata file so it always has a header
+        ret = sd_write_atomic("/sdcard/payload.txt", "", 0);
+        if (ret != ESP_OK) initialized = false;
     }
+    power_unlock_bus();
     return ret;
 }
 
 void sd_deinit(void) {
+    taskENTER_CRITICAL(&hold_lock);
+    unmounting = true;
+    taskEXIT_CRITICAL(&hold_lock);
+    while (holders > 0) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+
     if(card) {
+        power_lock_bus();
         esp_vfs_fat_sdcard_unmount("/sdcard", card);
+        power_unlock_bus();
         spi_bus_free(spi_host);
         card = NULL;
     }
+    unmounting = false;
 }
 
-// Modified write function for pressure, temp, and voltage, timestamp is added by default.
-esp_err_t sd_write_sensors(uint32_t pressure, float temp, float voltage, const char *filepath){
-    ESP_LOGI(SDTAG,"SD Write function starting...");
+bool sd_hold(void) {
+    taskENTER_CRITICAL(&hold_lock);
+    bool held = card != NULL && !unmounting;
+    if (held) holders++;
+    taskEXIT_CRITICAL(&hold_lock);
+    return held;
+}
+
+void sd_release(void) {
+    taskENTER_CRITICAL(&hold_lock);
+    holders--;
+    taskEXIT_CRITICAL(&hold_lock);
+}
+
+int sd_format_row(const struct tm *when, int ms, uint32_t pressure, float temp, float voltage, char *buf, size_t size) {
+    return snprintf(buf, size, "'%02d-%02d-%04d %02d:%02d:%02d:%03d','%"PRIu32"','%.2f','%.2f','%.2f'\n",
+                    when->tm_mday, when->tm_mon + 1, when->tm_year + 1900, when->tm_hour, when->tm_min, when->tm_sec,
+                    ms, pressure, temp, voltage, 0.0);
+}
+
+static esp_err_t sd_write_row(const struct tm *current_time, int ms, uint32_t pressure, float temp, float voltage, const char *filepath){
     if (!card) {
         ESP_LOGE(SDTAG, "SD card not initialized!");
         return ESP_ERR_INVALID_STATE;
@@ -95,32 +144,41 @@ esp_err_t sd_write_sensors(uint32_t pressure, float temp, float voltage, const c
 
 
     // Open file in append mode
+    power_lock_bus();
     FILE *file = fopen(filepath, "a");
     if (!file) {
         ESP_LOGE(SDTAG, "Failed to open file: %s", strerror(errno));
+        power_unlock_bus();
         return ESP_FAIL;
     }
-   
-    int ms;
-    struct tm current_time = get_time_now(&ms);
-
-    char timestamp[64];
-    snprintf(timestamp, sizeof(timestamp), "%02d-%02d-%04d %02d:%02d:%02d:%03d",
-             current_time.tm_mday, current_time.tm_mon + 1, current_time.tm_year + 1900,
-             current_time.tm_hour, current_time.tm_min, current_time.tm_sec, ms);
 
     char data[128];
-    snprintf(data, sizeof(data), "'%s','%"PRIu32"','%.2f','%.2f','%.2f'\n", timestamp, pressure, temp, voltage, 0.0);
+    sd_format_row(current_time, ms, pressure, temp, voltage, data, sizeof(data));
 
     // Write data
-    ESP_LOGI(SDTAG,"Writing to SD...");
+    DLOGI(DLOG_SD, "Writing to SD...");
     fprintf(file, "%s", data);
     fflush(file);
     fclose(file);
+    power_unlock_bus();
 
     return ESP_OK;
 }
 
+// Modified write function for pressure, temp, and voltage, timestamp is added by default.
+esp_err_t sd_write_sensors(uint32_t pressure, float temp, float voltage, const char *filepath){
+    DLOGI(DLOG_SD, "SD Write function starting...");
+    int ms;
+    struct tm current_time = get_time_now(&ms);
+    return sd_write_row(&current_time, ms, pressure, temp, voltage, filepath);
+}
+
+esp_err_t sd_write_sensors_at(uint32_t pressure, float temp, float voltage, time_t when, const char *filepath){
+    struct tm sample_time;
+    localtime_r(&when, &sample_time);
+    return sd_write_row(&sample_time, 0, pressure, temp, voltage, filepath);
+}
+
 esp_err_t sd_read(const char *path, char *buffer, size_t buffer_size) {
 
     // Read from file
@@ -140,18 +198,18 @@ esp_err_t sd_read(const char *path, char *buffer, size_t buffer_size) {
 }
 
 esp_err_t sd_set_metadata(const char *key, const char *sensorID, const char *geoutm) {
-    FILE *file = fopen("/sdcard/payload.txt", "w");
-    if (!file) {
-        ESP_LOGE(SDTAG, "Failed to open payload.txt for writing metadata");
-        return ESP_FAIL;
+    char data[256];
+    int len = snprintf(data, sizeof(data), "key:'%s'\nsensorID:'%s'\ngeoutm:'%s'\n", key, sensorID, geoutm);
+    if (len < 0 || (size_t)len >= sizeof(data)) {
+        ESP_LOGE(SDTAG, "Metadata too long for payload.txt");
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    fprintf(file, "key:'%s'\n", key);
-    fprintf(file, "sensorID:'%s'\n", sensorID);
-    fprintf(file, "geoutm:'%s'\n", geoutm);
-    fclose(file);
+    esp_err_t ret = sd_write_atomic("/sdcard/payload.txt", data, len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(SDTAG, "Failed to write metadata to payload.txt");
+        return ret;
+    }
     ESP_LOGI(SDTAG, "Metadata written to payload.txt");
     return ESP_OK;
 }
-
-
@@ -2,17 +2,28 @@
 #define SDCARD_H
 
 #include "esp_err.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <time.h>
 #include <inttypes.h>
+#include "sdatomic.h"
 
 // Initialization
+// Does nothing if the card is already mounted
 esp_err_t sd_init(void);
 void sd_deinit(void);
+// Keeps the card mounted while a portal handler streams from it: sd_deinit waits for every
+// hold to be released. False if no card is mounted.
+bool sd_hold(void);
+void sd_release(void);
 
 // Unified write function with timestamp hopepfully
 esp_err_t sd_read(const char *path, char *buffer, size_t buffer_size);
 esp_err_t sd_set_metadata(const char *key, const char *id, const char *geoutm);
 esp_err_t sd_write_sensors(uint32_t pressure, float temp, float voltage, const char *filepath);
+esp_err_t sd_write_sensors_at(uint32_t pressure, float temp, float voltage, time_t when, const char *filepath);
+// One payload row: 'dd-mm-yyyy hh:mm:ss:ms','pressure','temp','voltage','0.00' and a newline
+int sd_format_row(const struct tm *when, int ms, uint32_t pressure, float temp, float voltage, char *buf, size_t size);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "sdcard.h"
+#include "power.h"
+#include "sdlog.h"
+
+#define SDLOG_MAGIC 0x474F4C48   // "HLOG"
+
+static const char *HLOGTAG = "SDLOG";
+
+// Where the next row falls in its block. Survives deep sleep; checked against the card
+// after any other reset.
+static RTC_DATA_ATTR struct {
+    uint32_t magic;
+    uint32_t block_rows;
+} state;
+
+static RTC_DATA_ATTR struct {
+    uint32_t from;
+    uint32_t to;
+} backfill;
+
+bool sdlog_row_time(const char *row, time_t *when) {
+    struct tm tm = {0};
+    if (sscanf(row, "'%d-%d-%d %d:%d:%d", &tm.tm_mday, &tm.tm_mon, &tm.tm_year, &tm.tm_hour, &tm.tm_min,
+               &tm.tm_sec) != 6) {
+        return false;
+    }
+    tm.tm_mon -= 1;
+    tm.tm_year -= 1900;
+    tm.tm_isdst = -1;
+    *when = mktime(&tm);
+    return *when != (time_t)-1;
+}
+
+static esp_err_t add_index(FILE *index, uint32_t first_time, uint32_t offset) {
+    sdlog_index_t entry = {.first_time = first_time, .offset = offset};
+    return fwrite(&entry, sizeof(entry), 1, index) == 1 ? ESP_OK : ESP_FAIL;
+}
+
+// Rows after the last index entry give the position in the block. Blocks that a reset cut
+// off before their entry was written get it now; a missing index is rebuilt from scratch.
+static esp_err_t recover(FILE *data, FILE *index) {
+    sdlog_index_t last = {0};
+    fseek(index, 0, SEEK_END);
+    long entries = ftell(index) / (long)sizeof(sdlog_index_t);
+    if (entries > 0) {
+        fseek(index, (entries - 1) * (long)sizeof(sdlog_index_t), SEEK_SET);
+        if (fread(&last, sizeof(last), 1, index) != 1) return ESP_FAIL;
+    }
+    fseek(index, entries * (long)sizeof(sdlog_index_t), SEEK_SET);
+
+    char row[SDLOG_ROW_MAX];
+    uint32_t rows = 0;
+    fseek(data, entries > 0 ? (long)last.offset : 0, SEEK_SET);
+    for (long offset = ftell(data); fgets(row, sizeof(row), data); offset = ftell(data)) {
+        if (entries == 0 || rows == SDLOG_BLOCK_ROWS) {
+            time_t when = 0;
+            sdlog_row_time(row, &when);
+            if (add_index(index, (uint32_t)when, (uint32_t)offset) != ESP_OK) return ESP_FAIL;
+            entries++;
+            rows = 0;
+        }
+        rows++;
+    }
+
+    state.block_rows = rows % SDLOG_BLOCK_ROWS;
+    state.magic = SDLOG_MAGIC;
+    ESP_LOGI(HLOGTAG, "History has %ld blocks, %" PRIu32 " rows in the last", entries, rows);
+    return ESP_OK;
+}
+
+esp_err_t sdlog_append(time_t when, uint32_t pressure, float temp, float voltage) {
+    char row[SDLOG_ROW_MAX];
+    struct tm tm;
+    localtime_r(&when, &tm);
+    int len = sd_format_row(&tm, 0, pressure, temp, voltage, row, sizeof(row));
+    if (len < 0 || len >= (int)sizeof(row)) return ESP_ERR_INVALID_SIZE;
+
+    power_lock_bus();
+    FILE *data = fopen(SDLOG_DATA_PATH, "a+");
+    FILE *index = fopen(SDLOG_INDEX_PATH, "a+");
+    esp_err_t err = data && index ? ESP_OK : ESP_FAIL;
+
+    if (err == ESP_OK && state.magic != SDLOG_MAGIC) err = recover(data, index);
+    if (err == ESP_OK) {
+        fseek(data, 0, SEEK_END);
+        long offset = ftell(data);
+        if (state.block_rows == 0) err = add_index(index, (uint32_t)when, (uint32_t)offset);
+        if (err == ESP_OK && fwrite(row, 1, len, data) != (size_t)len) err = ESP_FAIL;
+    }
+
+    if (index) fclose(index);
+    if (data) fclose(data);
+    power_unlock_bus();
+
+    if (err == ESP_OK) {
+        state.block_rows = (state.block_rows + 1) % SDLOG_BLOCK_ROWS;
+    } else {
+        // The card is checked again before the next append
+        state.magic = 0;
+        ESP_LOGE(HLOGTAG, "History append failed");
+    }
+    return err;
+}
+
+// Last entry whose block starts before from, or the first entry. A block starting at from
+// may follow rows with that same second.
+static esp_err_t find_block(FILE *index, time_t from, uint32_t *offset) {
+    fseek(index, 0, SEEK_END);
+    long lo = 0, hi = ftell(index) / (long)sizeof(sdlog_index_t) - 1;
+    *offset = 0;
+
+    while (lo <= hi) {
+        long mid = lo + (hi - lo) / 2;
+        sdlog_index_t entry;
+        fseek(index, mid * (long)sizeof(entry), SEEK_SET);
+        if (fread(&entry, sizeof(entry), 1, index) != 1) return ESP_FAIL;
+        if ((time_t)entry.first_time < from) {
+            *offset = entry.offset;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t sdlog_query(time_t from, time_t to, sdlog_row_cb_t cb, void *ctx) {
+    power_lock_bus();
+    FILE *index = fopen(SDLOG_INDEX_PATH, "rb");
+    FILE *data = fopen(SDLOG_DATA_PATH, "rb");
+    if (!index || !data) {
+        if (index) fclose(index);
+        if (data) fclose(data);
+        power_unlock_bus();
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t offset = 0;
+    esp_err_t err = find_block(index, from, &offset);
+    fclose(index);
+
+    char row[SDLOG_ROW_MAX];
+    if (err == ESP_OK) fseek(data, offset, SEEK_SET);
+    while (err == ESP_OK && fgets(row, sizeof(row), data)) {
+        time_t when;
+        if (!sdlog_row_time(row, &when) || when < from) continue;
+        if (when > to || !cb(row, strlen(row), when, ctx)) break;
+    }
+    fclose(data);
+    power_unlock_bus();
+    return err;
+}
+
+void sdlog_backfill_request(uint32_t from, uint32_t to) {
+    if (from > to) return;
+    backfill.from = from;
+    backfill.to = to;
+    ESP_LOGI(HLOGTAG, "Backfill requested for %" PRIu32 "..%" PRIu32, from, to);
+}
+
+bool sdlog_backfill_pending(uint32_t *from, uint32_t *to) {
+    if (backfill.to == 0 || backfill.from > backfill.to) return false;
+    *from = backfill.from;
+    *to = backfill.to;
+    return true;
+}
+
+void sdlog_backfill_sent(uint32_t through) {
+    if (through >= backfill.to) {
+        backfill.from = backfill.to = 0;
+    } else if (through >= backfill.from) {
+        backfill.from = through + 1;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef SDLOG_H
+#define SDLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+
+// Every payload row stored on the SD card is also appended to a history file that is never
+// rewritten. A sparse index beside it holds the time and file offset of the first row of
+// each block of SDLOG_BLOCK_ROWS rows, so a time range is found with a binary search of the
+// index and a scan of at most one block before the first match. Rows are appended in time
+// order.
+
+#define SDLOG_DATA_PATH  "/sdcard/history.txt"
+#define SDLOG_INDEX_PATH "/sdcard/history.idx"
+#define SDLOG_BLOCK_ROWS 64
+#define SDLOG_ROW_MAX    128
+
+typedef struct {
+    uint32_t first_time;    // Unix time of the block's first row
+    uint32_t offset;        // Its offset in SDLOG_DATA_PATH
+} sdlog_index_t;
+
+// Called for each row in range, newline included. Returning false stops the query.
+typedef bool (*sdlog_row_cb_t)(const char *row, size_t len, time_t when, void *ctx);
+
+esp_err_t sdlog_append(time_t when, uint32_t pressure, float temp, float voltage);
+// Rows with from <= time <= to, oldest first
+esp_err_t sdlog_query(time_t from, time_t to, sdlog_row_cb_t cb, void *ctx);
+// Time of a row as written by sd_format_row(), in local time
+bool sdlog_row_time(const char *row, time_t *when);
+
+// Server backfill: rows in the requested range ride along with the next uploads until
+// all have been sent. Kept in RTC memory, a reset drops the request.
+void sdlog_backfill_request(uint32_t from, uint32_t to);
+bool sdlog_backfill_pending(uint32_t *from, uint32_t *to);
+// Rows up to and including `through` reached the server
+void sdlog_backfill_sent(uint32_t through);
+
+#endif
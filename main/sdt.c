@@ -0,0 +1,53 @@
+#include "sdt.h"
+
+static void anchor_at(sdt_t *s, uint32_t t, double v) {
+    s->started = true;
+    s->has_held = false;
+    s->anchor_t = t;
+    s->anchor_v = v;
+}
+
+// The door keeps the intersection of each point's band, so a new endpoint is only accepted
+// if its own slope lies inside it; that is what bounds the error at every dropped point.
+unsigned sdt_add(sdt_t *s, double deadband, uint32_t heartbeat_s, uint32_t t, double v, bool force) {
+    if (!s->started || t <= s->anchor_t) {
+        anchor_at(s, t, v);
+        return SDT_EMIT_NEW;
+    }
+
+    unsigned emit = 0;
+    double dt = (double)(t - s->anchor_t);
+    double slope = (v - s->anchor_v) / dt;
+    if (s->has_held && (slope < s->slope_lo || slope > s->slope_hi)) {
+        // The held point ends the segment and starts the next
+        emit |= SDT_EMIT_HELD;
+        anchor_at(s, s->held_t, s->held_v);
+        dt = (double)(t - s->anchor_t);
+        slope = (v - s->anchor_v) / dt;
+    }
+
+    if (force || t - s->anchor_t >= heartbeat_s) {
+        anchor_at(s, t, v);
+        return emit | SDT_EMIT_NEW;
+    }
+
+    double lo = slope - deadband / dt;
+    double hi = slope + deadband / dt;
+    if (!s->has_held) {
+        s->slope_lo = lo;
+        s->slope_hi = hi;
+    } else {
+        if (lo > s->slope_lo) s->slope_lo = lo;
+        if (hi < s->slope_hi) s->slope_hi = hi;
+    }
+    s->has_held = true;
+    s->held_t = t;
+    s->held_v = v;
+    return emit;
+}
+
+bool sdt_flush(sdt_t *s) {
+    if (!s->has_held) return false;
+    anchor_at(s, s->held_t, s->held_v);
+    return true;
+}
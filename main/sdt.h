@@ -0,0 +1,34 @@
+#ifndef SDT_H
+#define SDT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Swinging-door compression of one time series. A point is only kept when the series can't
+// be rebuilt without it: linear interpolation between kept points stays within the deadband
+// of every dropped point. Plain C with no IDF dependencies.
+//
+// Each point is held until the next one shows whether it is needed, so a kept point is
+// usually reported one sample late. The caller keeps the held sample's other fields.
+
+#define SDT_EMIT_HELD 0x1   // Store the sample held from the previous call
+#define SDT_EMIT_NEW  0x2   // Store this sample now; otherwise it becomes the held one
+
+typedef struct {
+    bool started;
+    bool has_held;
+    uint32_t anchor_t;      // Last kept point
+    double anchor_v;
+    uint32_t held_t;
+    double held_v;
+    double slope_lo;        // Slopes from the anchor that keep every point since it in the band
+    double slope_hi;
+} sdt_t;
+
+// force keeps this sample, as does heartbeat_s passing since the last kept point
+unsigned sdt_add(sdt_t *s, double deadband, uint32_t heartbeat_s, uint32_t t, double v, bool force);
+// Keeps the held sample now, before a batch goes out, and starts the next segment from it.
+// True if there was one for the caller to store.
+bool sdt_flush(sdt_t *s);
+
+#endif
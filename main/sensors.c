@@ -1,6 +1,14 @@
 #include "sensors.h"
 #include "sdcard.h"
 #include "pt928.h"
+#include "flashlog.h"
+#include "provision.h"
+#include "wakestub.h"
+#include "power.h"
+#include "dlog.h"
+#include "sdt.h"
+#include "sdlog.h"
+#include "esp_attr.h"
 #include "driver/temperature_sensor.h"
 #include <esp_log.h>
 #include <math.h>
@@ -10,12 +18,127 @@
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include <inttypes.h>
+#include <string.h>
+#include <time.h>
 
 static const char *TAG = "SENSORS";
 
+// From the last full reading, for converting and bounding the wake stub's raw ADC values
+static RTC_DATA_ATTR float mv_per_raw = 0.0f;
+static RTC_DATA_ATTR float last_voltage = 0.0f;
+static RTC_DATA_ATTR float last_temp = 0.0f;
+static bool read_ok = false;
+
+// Payload samples are summarised per policy window before storage, see aggregate.h
+static RTC_DATA_ATTR agg_window_t agg_open;
+static RTC_DATA_ATTR agg_window_t agg_pending[SENSOR_AGG_PENDING];
+static RTC_DATA_ATTR uint8_t agg_pending_count = 0;
+
+#if CONFIG_NODE_SDT
+// Raw payload rows pass a swinging door on pressure; the held row waits for the next sample
+static RTC_DATA_ATTR sdt_t sdt;
+static RTC_DATA_ATTR struct {
+    time_t when;
+    uint32_t pressure;
+    float temp;
+    float voltage;
+} sdt_held;
+#endif
+
 const char *payloadpath = "/sdcard/payload.txt";
 const char *registerpath = "/sdcard/register.txt";
 
+static void queue_window(const agg_window_t *w) {
+    if (agg_pending_count == SENSOR_AGG_PENDING) {
+        // Uploads are failing; keep the whole span at a coarser resolution
+        agg_window_merge(&agg_pending[0], &agg_pending[1]);
+        memmove(&agg_pending[1], &agg_pending[2], (SENSOR_AGG_PENDING - 2) * sizeof(agg_window_t));
+        agg_pending_count--;
+    }
+    agg_pending[agg_pending_count++] = *w;
+}
+
+// Feeds a payload sample to the open window. True if its raw row should be stored as well:
+// raw rows were asked for, or the sample is an anomaly.
+static bool aggregate_sample(time_t when, uint32_t pressure, float temp, float voltage) {
+    uint32_t window_s = node_policy()->agg_window_min * 60;
+    if (window_s == 0) {
+        if (agg_open.ch[0].count) {
+            queue_window(&agg_open);
+            memset(&agg_open, 0, sizeof(agg_open));
+        }
+        return true;
+    }
+
+    double x[AGG_CHANNELS] = {[AGG_PRESSURE] = pressure, [AGG_TEMP] = temp, [AGG_VOLTAGE] = voltage};
+    bool anomaly = agg_window_is_anomaly(&agg_open, x);
+    agg_window_t closed;
+    if (agg_window_add(&agg_open, window_s, (uint32_t)when, x, &closed)) {
+        queue_window(&closed);
+    }
+    if (anomaly) {
+        DLOGW(DLOG_SENSORS, "Sample outside its window, keeping the raw row");
+    }
+    return anomaly;
+}
+
+size_t sensor_aggregates(const agg_window_t **windows) {
+    *windows = agg_pending;
+    return agg_pending_count;
+}
+
+void sensor_aggregates_sent(size_t count) {
+    if (count >= agg_pending_count) {
+        agg_pending_count = 0;
+        return;
+    }
+    memmove(&agg_pending[0], &agg_pending[count], (agg_pending_count - count) * sizeof(agg_window_t));
+    agg_pending_count -= count;
+}
+
+static esp_err_t store_row(const char *path, time_t when, uint32_t pressure, float temp, float voltage) {
+#if FLASHLOG_ENABLED
+    if (strcmp(path, payloadpath) == 0) {
+        return flashlog_append_at((uint32_t)when, 0, pressure, temp, voltage);
+    }
+#endif
+    return sd_write_sensors_at(pressure, temp, voltage, when, path);
+}
+
+// Aggregation first, then the deadband for the raw rows that remain. Anomalies are always kept.
+// payload.txt is rewritten every wake, so every sample also goes to the SD history first.
+static void log_payload_sample(const char *path, time_t when, uint32_t pressure, float temp, float voltage) {
+#if !FLASHLOG_ENABLED
+    sdlog_append(when, pressure, temp, voltage);
+#endif
+    if (!aggregate_sample(when, pressure, temp, voltage)) return;
+
+#if CONFIG_NODE_SDT
+    bool anomaly = node_policy()->agg_window_min > 0;
+    unsigned emit = sdt_add(&sdt, CONFIG_NODE_SDT_DEADBAND, CONFIG_NODE_SDT_HEARTBEAT_MIN * 60, (uint32_t)when,
+                            pressure, anomaly);
+    if (emit & SDT_EMIT_HELD) {
+        store_row(path, sdt_held.when, sdt_held.pressure, sdt_held.temp, sdt_held.voltage);
+    }
+    if (!(emit & SDT_EMIT_NEW)) {
+        sdt_held.when = when;
+        sdt_held.pressure = pressure;
+        sdt_held.temp = temp;
+        sdt_held.voltage = voltage;
+        return;
+    }
+#endif
+    store_row(path, when, pressure, temp, voltage);
+}
+
+void sensor_flush_held(const char *path) {
+#if CONFIG_NODE_SDT
+    if (sdt_flush(&sdt)) {
+        store_row(path, sdt_held.when, sdt_held.pressure, sdt_held.temp, sdt_held.voltage);
+    }
+#endif
+}
+
 int sensor_single_log(const char *path) {
     // Init temp sensor
     temperature_sensor_handle_t temp_handle;
@@ -33,21 +156,30 @@ int sensor_single_log(const char *path) {
     // Read voltage
     float voltage = read_voltage_once();
 
+    last_voltage = voltage;
+    if (!isnan(temp)) last_temp = temp;
+    read_ok = pressure && !isnan(temp);
+
     // Log
     if (pressure && !isnan(temp)) {
-        ESP_LOGI("SENSOR", "Logging P= %"PRIu32", T= %.2f, V= %.2f", pressure, temp, voltage);
-        sd_write_sensors(pressure, temp, voltage, path);
+        DLOGI(DLOG_SENSORS, "Logging P= %"PRIu32", T= %.2f, V= %.2f", pressure, temp, voltage);
+        if (strcmp(path, payloadpath) != 0) {
+            sd_write_sensors(pressure, temp, voltage, path);
+        } else {
+            log_payload_sample(path, time(NULL), pressure, temp, voltage);
+        }
     }
 
     // Cleanup temp sensor
     temperature_sensor_disable(temp_handle);
     temperature_sensor_uninstall(temp_handle);
 
-    // Sleep tier logic
-    if (voltage >= 12.3f) return 2;
-    else if (voltage >= 11.8f && voltage <= 12.3f) return 5;
-    else if (voltage < 11.8f) return 10;
-    else return 10; //Default fallback
+    // Sleep tier logic, thresholds and intervals can be provisioned by the server
+    return node_policy_sleep_minutes(voltage);
+}
+
+bool sensor_read_ok(void) {
+    return read_ok;
 }
 
 float read_voltage_once(void) {
@@ -57,6 +189,8 @@ float read_voltage_once(void) {
 
     vTaskDelay(pdMS_TO_TICKS(20));
 
+    // The divider settles in light sleep, the conversion needs the clocks steady
+    power_lock_bus();
     adc_oneshot_unit_handle_t adc_handle;
     adc_oneshot_unit_init_cfg_t unit_cfg = {
         .unit_id = VOLTSENS_UNIT,
@@ -82,17 +216,18 @@ float read_voltage_once(void) {
 
     int raw = 0, mv = 0;
     ESP_ERROR_CHECK(adc_oneshot_read(adc_handle, VOLTSENS_READCHANNEL, &raw));
-    ESP_LOGI(TAG, "Raw ADC: %d", raw);
+    DLOGD(DLOG_SENSORS, "Raw ADC: %d", raw);
 
     if (calibrated) {
         ESP_ERROR_CHECK(adc_cali_raw_to_voltage(cali_handle, raw, &mv));
     } else {
         mv = (raw * 3300)/4095;
     }
+    if (raw > 0) mv_per_raw = (float)mv / raw;
 
     float vin = (mv / 1000.0f) * VOLTSENS_SCALING;  // Scale up to Vin
 
-    ESP_LOGI(TAG, "ADC Voltage: %.2f V, Scaled Input: %.2f V", mv / 1000.0f, vin);
+    DLOGI(DLOG_SENSORS, "ADC Voltage: %.2f V, Scaled Input: %.2f V", mv / 1000.0f, vin);
     
     gpio_set_level(VOLTSENS_ENABLE,0);
     // Cleanup
@@ -100,6 +235,56 @@ float read_voltage_once(void) {
     if (calibrated) {
         adc_cali_delete_scheme_curve_fitting(cali_handle);
     }
+    power_unlock_bus();
 
     return vin;
 }
+
+int sensor_log_wake_samples(const char *path) {
+    static wake_sample_t samples[WAKE_RING_SIZE];
+    uint32_t period_s = 0;
+    size_t count = wakestub_take(samples, WAKE_RING_SIZE, &period_s);
+    if (count == 0) return 0;
+
+    DLOGI(DLOG_SENSORS, "Logging %u wake stub samples, boot reason %d", (unsigned)count, wakestub_boot_reason());
+
+    // The stub wakes every period_s and this boot is the wake after the last sample.
+    // Die temperature isn't read by the stub, rows carry the last full reading.
+    time_t now = time(NULL);
+    for (size_t i = 0; i < count; i++) {
+        float voltage = samples[i].volt_raw * mv_per_raw / 1000.0f * VOLTSENS_SCALING;
+        log_payload_sample(path, now - (time_t)(count - i) * period_s, samples[i].pressure, last_temp, voltage);
+    }
+    return count;
+}
+
+// Voltage in volts at the battery to the raw ADC value the stub would read
+static uint16_t raw_from_volts(float volts) {
+    float raw = volts * 1000.0f / VOLTSENS_SCALING / mv_per_raw;
+    if (raw <= 0) return 0;
+    if (raw >= UINT16_MAX) return UINT16_MAX;
+    return (uint16_t)raw;
+}
+
+void sensor_arm_wake_stub(int sleep_minutes) {
+    const node_policy_t *p = node_policy();
+    uint16_t flush_at = p->upload_every - 1;
+    if (flush_at == 0 || mv_per_raw <= 0.0f) {
+        wakestub_disarm();
+        return;
+    }
+
+    // Stay within the tier that gave sleep_minutes, otherwise the app has to pick a new interval
+    uint32_t mv = (uint32_t)(last_voltage * 1000.0f);
+    uint16_t raw_min = 0, raw_max = UINT16_MAX;
+    if (mv >= p->volt_high_mv) {
+        raw_min = raw_from_volts(p->volt_high_mv / 1000.0f);
+    } else if (mv >= p->volt_low_mv) {
+        raw_min = raw_from_volts(p->volt_low_mv / 1000.0f);
+        raw_max = raw_from_volts(p->volt_high_mv / 1000.0f);
+    } else {
+        raw_max = raw_from_volts(p->volt_low_mv / 1000.0f);
+    }
+
+    wakestub_arm((uint32_t)sleep_minutes * 60, flush_at, raw_min, raw_max);
+}
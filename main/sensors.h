@@ -1,24 +1,41 @@
 #ifndef SENSORS_H
 #define SENSORS_H
 
+#include "sdkconfig.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
 #include "esp_adc/adc_oneshot.h"
 #include "soc/soc_caps.h"
+#include "aggregate.h"
 
 
-#define VOLTSENS_ENABLE GPIO_NUM_2
+#define VOLTSENS_ENABLE CONFIG_NODE_VOLTSENS_ENABLE_GPIO
 #define VOLTSENS_READCHANNEL ADC_CHANNEL_2
 #define VOLTSENS_UNIT ADC_UNIT_1
 #define VOLTSENS_ATTEN ADC_ATTEN_DB_6
 #define VOLTSENS_SCALING 11.0f
 
+#define SENSOR_AGG_PENDING 8    // Closed windows kept for upload; the oldest two merge when full
+
 extern const char *payloadpath;
 extern const char *registerpath;
 
 
 float read_voltage_once(void);
 int sensor_single_log(const char *path);
+// Stores the row the deadband is holding back, so the batch about to go out ends on it
+void sensor_flush_held(const char *path);
+// The last sensor_single_log this boot got a pressure and a temperature
+bool sensor_read_ok(void);
+
+// Wake stub: log the samples it took since the last boot, then plan the next sleep
+int sensor_log_wake_samples(const char *path);
+void sensor_arm_wake_stub(int sleep_minutes);
+
+// Closed aggregation windows waiting for upload, oldest first
+size_t sensor_aggregates(const agg_window_t **windows);
+// Drops the first count once the server has them
+void sensor_aggregates_sent(size_t count);
 
 
 #endif
\ No newline at end of file
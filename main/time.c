@@ -1,34 +1,38 @@
 #include <string.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
 #include <time.h>
 #include <sys/time.h>
 #include "esp_system.h"
-#include "esp_event.h"
+#include "esp_random.h"
 #include "esp_log.h"
-#include "esp_attr.h"
-#include "esp_sleep.h"
-#include "nvs_flash.h"
 #include "esp_netif_sntp.h"
-#include "lwip/ip_addr.h"
 #include "esp_sntp.h"
+#include "freertos/FreeRTOS.h"
 #include <inttypes.h>
-#include <esp_log.h>
-#include "esp_netif.h"
 #include "timex.h"
 
+#if CONFIG_NODE_TIME_HTTP_FALLBACK
 #include "esp_http_client.h"
-#include "esp_sntp.h"
-
+#endif
 
 static const char *TIME_TAG = "time";
 
-#ifndef INET6_ADDRSTRLEN
-#define INET6_ADDRSTRLEN 48
-#endif
 
+void time_set_zone(void) {
+    setenv("TZ", CONFIG_NODE_TIMEZONE, 1);
+    tzset();
+}
+
+bool time_is_valid(void) {
+    time_t now = time(NULL);
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+    return timeinfo.tm_year >= (2024 - 1900);
+}
 
 void init_time(void) {
-    setenv("TZ", "MST7MDT,M3.2.0/2:00:00,M11.1.0/2:00:00", 1);
-    tzset();
+    time_set_zone();
 
     // STEP 1: Try SNTP
     ESP_LOGI(TIME_TAG, "Attempting SNTP time sync...");
@@ -55,11 +59,12 @@ void init_time(void) {
         return;
     }
 
+#if CONFIG_NODE_TIME_HTTP_FALLBACK
     ESP_LOGW(TIME_TAG, "SNTP failed. Trying HTTP time fallback...");
 
     // STEP 2: Use HTTP fallback
     esp_http_client_config_t http_cfg = {
-        .url = "http://worldtimeapi.org/api/timezone/America/Denver",
+        .url = CONFIG_NODE_TIME_HTTP_URL,
         .timeout_ms = 5000,
     };
 
@@ -96,12 +101,9 @@ void init_time(void) {
     }
 
     esp_http_client_cleanup(client);
-}
-
-
-void time_sync_notification_cb(struct timeval *tv)
-{
-    ESP_LOGI(TIME_TAG, "Notification of a time synchronization event");
+#else
+    ESP_LOGW(TIME_TAG, "SNTP failed. Clock left unset.");
+#endif
 }
 
 
@@ -1,9 +1,13 @@
 #ifndef TIME_UTIL_H
 #define TIME_UTIL_H
 
+#include <stdbool.h>
 #include <time.h>
 
 void init_time(void);
+void time_set_zone(void);
+// False until SNTP or the HTTP fallback has set the clock once; it survives deep sleep
+bool time_is_valid(void);
 struct tm get_time_now(int *milliseconds);
 
 
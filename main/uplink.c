@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "mqtt_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "uplink.h"
+#include "nodecfg.h"
+#include "upload.h"
+#include "coap_uplink.h"
+#include "linkqual.h"
+#include "power.h"
+#include "esp_timer.h"
+#include "esp_crt_bundle.h"
+#include "lwip/netdb.h"
+
+#define MQTT_CONNECTED_BIT BIT0
+#define MQTT_ACK_BIT       BIT1
+#define MQTT_FAIL_BIT      BIT2
+
+static const char *UPTAG = "UPLINK";
+
+static EventGroupHandle_t mqtt_events = NULL;
+static volatile int mqtt_acked = 0;
+
+static void uplink_defaults(uplink_config_t *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->transport = UPLINK_TRANSPORT_HTTP;
+    strlcpy(cfg->data_url, UPLINK_DEFAULT_DATA_URL, sizeof(cfg->data_url));
+    strlcpy(cfg->register_url, UPLINK_DEFAULT_REGISTER_URL, sizeof(cfg->register_url));
+    strlcpy(cfg->mqtt_topic, UPLINK_DEFAULT_MQTT_TOPIC, sizeof(cfg->mqtt_topic));
+}
+
+esp_err_t uplink_load_config(uplink_config_t *cfg) {
+    const nodecfg_t *node = nodecfg();
+    if (!(node->present & NODECFG_HAS_UPLINK)) {
+        uplink_defaults(cfg);
+        return ESP_ERR_NOT_FOUND;
+    }
+    *cfg = node->uplink;
+    return ESP_OK;
+}
+
+esp_err_t uplink_save_config(const uplink_config_t *cfg) {
+    nodecfg_t node = *nodecfg();
+    node.uplink = *cfg;
+    node.present |= NODECFG_HAS_UPLINK;
+    return nodecfg_save(&node);
+}
+
+const uplink_config_t *uplink_config(void) {
+    static uplink_config_t defaults;
+    const nodecfg_t *node = nodecfg();
+    if (node->present & NODECFG_HAS_UPLINK) return &node->uplink;
+    uplink_defaults(&defaults);
+    return &defaults;
+}
+
+// Today's format: metadata lines followed by the rows, as a multipart file upload
+static esp_err_t http_send(const uplink_config_t *cfg, const uplink_payload_t *payload, char *response_buf, size_t buf_size) {
+    size_t body_size = 256 + payload->rows_len;
+    char *body = malloc(body_size);
+    if (!body) {
+        ESP_LOGE(UPTAG, "Memory allocation failed");
+        return ESP_ERR_NO_MEM;
+    }
+
+    int len = snprintf(body, body_size, "key:'%s'\nsensorID:'%s'\ngeoutm:'%s'\n",
+                       payload->key, payload->sensor_id, payload->geoutm);
+    if (len < 0 || (size_t)len + payload->rows_len >= body_size) {
+        free(body);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(body + len, payload->rows, payload->rows_len);
+    len += payload->rows_len;
+    body[len] = '\0';
+
+    esp_err_t ret = upload_buffer_to_server(body, len, cfg->data_url, response_buf, buf_size);
+    free(body);
+    return ret;
+}
+
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
+    switch ((esp_mqtt_event_id_t)event_id) {
+        case MQTT_EVENT_CONNECTED:
+            xEventGroupSetBits(mqtt_events, MQTT_CONNECTED_BIT);
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            mqtt_acked++;
+            xEventGroupSetBits(mqtt_events, MQTT_ACK_BIT);
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+        case MQTT_EVENT_ERROR:
+            ESP_LOGW(UPTAG, "MQTT %s", event_id == MQTT_EVENT_ERROR ? "error" : "disconnected");
+            xEventGroupSetBits(mqtt_events, MQTT_FAIL_BIT);
+            break;
+        default:
+            break;
+    }
+}
+
+// Rows are packed into QoS1 publishes of up to UPLINK_MQTT_BATCH_BYTES, split on line ends.
+// The sensor ID and key authenticate the connection, so each message carries the geoutm line
+// of the HTTP format followed by rows, and the broker keeps the session between wakes. The
+// broker can be any host with a publicly trusted certificate, checked against the IDF bundle.
+static esp_err_t mqtt_send(const uplink_config_t *cfg, const uplink_payload_t *payload, char *response_buf, size_t buf_size) {
+    if (response_buf && buf_size > 0) response_buf[0] = '\0';
+    if (payload->rows_len == 0) return ESP_OK;
+
+    const link_plan_t *plan = link_current_plan();
+    size_t batch_bytes = plan->chunk_bytes < UPLINK_MQTT_BATCH_BYTES ? plan->chunk_bytes : UPLINK_MQTT_BATCH_BYTES;
+
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/%s/data", cfg->mqtt_topic, payload->sensor_id);
+
+    char header[160];
+    int header_len = snprintf(header, sizeof(header), "geoutm:'%s'\n", payload->geoutm);
+    if (header_len < 0 || (size_t)header_len >= sizeof(header) || (size_t)header_len >= batch_bytes / 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t rows_bytes = batch_bytes - header_len;
+
+    if (!mqtt_events) {
+        mqtt_events = xEventGroupCreate();
+        if (!mqtt_events) return ESP_ERR_NO_MEM;
+    }
+    xEventGroupClearBits(mqtt_events, MQTT_CONNECTED_BIT | MQTT_ACK_BIT | MQTT_FAIL_BIT);
+    mqtt_acked = 0;
+
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = cfg->mqtt_uri,
+        .broker.verification.crt_bundle_attach = esp_crt_bundle_attach,
+        .credentials.client_id = payload->sensor_id,
+        .credentials.username = payload->sensor_id,
+        .credentials.authentication.password = payload->key,
+        .session.disable_clean_session = true,
+        .network.timeout_ms = plan->timeout_ms,
+    };
+
+    char *message = malloc(batch_bytes);
+    if (!message) {
+        ESP_LOGE(UPTAG, "Memory allocation failed");
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(message, header, header_len);
+
+    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+    if (!client) {
+        ESP_LOGE(UPTAG, "Failed to initialize MQTT client");
+        free(message);
+        return ESP_FAIL;
+    }
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+
+    // The client task does the TLS handshake; full CPU speed until it is through
+    int64_t t_start = esp_timer_get_time();
+    power_lock_cpu();
+    esp_err_t ret = esp_mqtt_client_start(client);
+    if (ret != ESP_OK) {
+        power_unlock_cpu();
+        esp_mqtt_client_destroy(client);
+        free(message);
+        return ret;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(mqtt_events, MQTT_CONNECTED_BIT | MQTT_FAIL_BIT, pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(plan->timeout_ms));
+    power_unlock_cpu();
+    uint32_t handshake_ms = (esp_timer_get_time() - t_start) / 1000;
+    if (!(bits & MQTT_CONNECTED_BIT)) {
+        ESP_LOGE(UPTAG, "MQTT connect to %s failed", cfg->mqtt_uri);
+        esp_mqtt_client_stop(client);
+        esp_mqtt_client_destroy(client);
+        free(message);
+        link_record_attempt(payload->rows_len, handshake_ms, 0, false);
+        return ESP_FAIL;
+    }
+    int64_t t_connected = esp_timer_get_time();
+
+    int published = 0;
+    size_t offset = 0;
+    ret = ESP_OK;
+    while (offset < payload->rows_len) {
+        size_t len = payload->rows_len - offset;
+        if (len > rows_bytes) {
+            // Cut after the last complete row that fits
+            len = rows_bytes;
+            while (len > 0 && payload->rows[offset + len - 1] != '\n') len--;
+            if (len == 0) len = rows_bytes;
+        }
+
+        memcpy(message + header_len, payload->rows + offset, len);
+        if (esp_mqtt_client_publish(client, topic, message, header_len + len, 1, 0) < 0) {
+            ESP_LOGE(UPTAG, "MQTT publish failed");
+            ret = ESP_FAIL;
+            break;
+        }
+        published++;
+        offset += len;
+    }
+
+    // Every batch must be acknowledged before the rows count as delivered
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(plan->timeout_ms);
+    while (ret == ESP_OK && mqtt_acked < published) {
+        TickType_t now = xTaskGetTickCount();
+        if (now >= deadline) {
+            ESP_LOGE(UPTAG, "MQTT timed out waiting for PUBACK (%d/%d)", mqtt_acked, published);
+            ret = ESP_ERR_TIMEOUT;
+            break;
+        }
+        bits = xEventGroupWaitBits(mqtt_events, MQTT_ACK_BIT | MQTT_FAIL_BIT, pdTRUE, pdFALSE, deadline - now);
+        if (bits & MQTT_FAIL_BIT) ret = ESP_FAIL;
+    }
+
+    ESP_LOGI(UPTAG, "MQTT sent %u bytes in %d messages to %s", (unsigned)offset, published, topic);
+    link_record_attempt(payload->rows_len, handshake_ms, (esp_timer_get_time() - t_connected) / 1000, ret == ESP_OK);
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+    free(message);
+    return ret;
+}
+
+// lwIP caches the answer, so the connect after sampling skips the DNS round trip
+void uplink_resolve(void) {
+    const uplink_config_t *cfg = uplink_config();
+    const char *uri = cfg->transport == UPLINK_TRANSPORT_MQTT ? cfg->mqtt_uri :
+                      cfg->transport == UPLINK_TRANSPORT_COAP ? cfg->coap_uri : cfg->data_url;
+    const char *host = strstr(uri, "://");
+    if (!host) return;
+    host += 3;
+
+    char name[96];
+    size_t len = strcspn(host, ":/?");
+    if (len == 0 || len >= sizeof(name)) return;
+    memcpy(name, host, len);
+    name[len] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_INET};
+    struct addrinfo *res = NULL;
+    int err = getaddrinfo(name, NULL, &hints, &res);
+    if (err != 0 || !res) {
+        ESP_LOGW(UPTAG, "DNS lookup for %s failed: %d", name, err);
+        return;
+    }
+    freeaddrinfo(res);
+}
+
+static const uplink_transport_t transports[] = {
+    [UPLINK_TRANSPORT_HTTP] = {.name = "http", .send = http_send},
+    [UPLINK_TRANSPORT_MQTT] = {.name = "mqtt", .send = mqtt_send},
+    [UPLINK_TRANSPORT_COAP] = {.name = "coap", .send = coap_uplink_send},
+};
+
+esp_err_t uplink_send(const uplink_payload_t *payload, char *response_buf, size_t buf_size) {
+    const uplink_config_t *cfg = uplink_config();
+    uint8_t transport = cfg->transport;
+
+    if (transport >= sizeof(transports) / sizeof(transports[0])) {
+        ESP_LOGW(UPTAG, "Unknown transport %d, using HTTP", transport);
+        transport = UPLINK_TRANSPORT_HTTP;
+    }
+    if (transport == UPLINK_TRANSPORT_MQTT && strlen(cfg->mqtt_uri) == 0) {
+        ESP_LOGW(UPTAG, "No MQTT broker configured, using HTTP");
+        transport = UPLINK_TRANSPORT_HTTP;
+    }
+    if (transport == UPLINK_TRANSPORT_COAP && strlen(cfg->coap_uri) == 0) {
+        ESP_LOGW(UPTAG, "No CoAP server configured, using HTTP");
+        transport = UPLINK_TRANSPORT_HTTP;
+    }
+
+    ESP_LOGI(UPTAG, "Sending %u bytes of rows over %s", (unsigned)payload->rows_len, transports[transport].name);
+    return transports[transport].send(cfg, payload, response_buf, buf_size);
+}
@@ -0,0 +1,53 @@
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define UPLINK_TRANSPORT_HTTP 0
+#define UPLINK_TRANSPORT_MQTT 1
+#define UPLINK_TRANSPORT_COAP 2
+
+#define UPLINK_DEFAULT_DATA_URL     CONFIG_NODE_DATA_URL
+#define UPLINK_DEFAULT_REGISTER_URL CONFIG_NODE_REGISTER_URL
+#define UPLINK_DEFAULT_MQTT_TOPIC   "volsense"
+
+#define UPLINK_MQTT_BATCH_BYTES 1024    // Largest QoS1 publish, smaller on weak links
+
+// Endpoints, kept in the node config blob. Until one is saved the defaults above apply.
+typedef struct {
+    uint8_t transport;
+    char data_url[128];
+    char register_url[128];
+    char mqtt_uri[128];      // e.g. mqtts://broker.example.com:8883
+    char mqtt_topic[64];
+    char coap_uri[96];       // e.g. coap://ingest.example.com:5683
+} uplink_config_t;
+
+// One upload: device identity plus sample rows in the payload.txt row format
+typedef struct {
+    const char *key;
+    const char *sensor_id;
+    const char *geoutm;
+    const char *rows;
+    size_t rows_len;
+} uplink_payload_t;
+
+typedef struct {
+    const char *name;
+    esp_err_t (*send)(const uplink_config_t *cfg, const uplink_payload_t *payload, char *response_buf, size_t buf_size);
+} uplink_transport_t;
+
+esp_err_t uplink_load_config(uplink_config_t *cfg);
+esp_err_t uplink_save_config(const uplink_config_t *cfg);
+const uplink_config_t *uplink_config(void);
+
+// Looks up the configured endpoint's host ahead of the upload
+void uplink_resolve(void);
+
+// Sends through the configured transport. response_buf is left empty by transports without a reply body.
+esp_err_t uplink_send(const uplink_payload_t *payload, char *response_buf, size_t buf_size);
+
+#endif
@@ -3,21 +3,35 @@
 #include "lwip/netdb.h"
 #include <netdb.h>
 #include "wifi.h"
+#include "flashlog.h"
+#include "uplink.h"
+#include "sensors.h"
+#include "linkqual.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include <inttypes.h>
+#include "provision.h"
+#include "ota.h"
+#include "wakestub.h"
+#include "power.h"
+#include "dlog.h"
+#include "sdlog.h"
+
+#if FLASHLOG_ENABLED
+static RTC_DATA_ATTR uint16_t wakes_since_upload = 0;
+#endif
 
 // Enhanced callback function to handle HTTP events
 static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     switch (evt->event_id) {
         case HTTP_EVENT_ON_DATA:
-            ESP_LOGI(SENDTAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            if (!esp_http_client_is_chunked_response(evt->client)) {
-                ESP_LOG_BUFFER_HEXDUMP(SENDTAG, evt->data, evt->data_len, ESP_LOG_INFO);
-            }
+            DLOGD(DLOG_UPLOAD, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
             break;
         case HTTP_EVENT_ON_FINISH:
-            ESP_LOGI(SENDTAG, "HTTP_EVENT_ON_FINISH");
+            DLOGI(DLOG_UPLOAD, "HTTP_EVENT_ON_FINISH");
             break;
         case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGI(SENDTAG, "HTTP_EVENT_DISCONNECTED");
+            DLOGI(DLOG_UPLOAD, "HTTP_EVENT_DISCONNECTED");
             break;
         case HTTP_EVENT_ERROR:
             ESP_LOGE(SENDTAG, "HTTP_EVENT_ERROR");
@@ -28,38 +42,18 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     return ESP_OK;
 }
 
-// Enhanced file upload function with retry logic
-esp_err_t upload_file_to_server(const char *file_path, const char *url, char *response_buf, size_t buf_size) {
+// Multipart upload of an in-memory payload with retry logic.
+// Timeout, attempts and write size come from the current link plan.
+esp_err_t upload_buffer_to_server(const char *data, size_t data_len, const char *url, char *response_buf, size_t buf_size) {
     esp_err_t ret = ESP_FAIL;
+    const link_plan_t *plan = link_current_plan();
 
-    for (int retry = 0; retry < UPLOAD_RETRY_COUNT; retry++) {
+    for (int retry = 0; retry < plan->attempts; retry++) {
         if (retry > 0) {
-            ESP_LOGW(SENDTAG, "Retrying upload (%d/%d)...", retry, UPLOAD_RETRY_COUNT);
+            ESP_LOGW(SENDTAG, "Retrying upload (%d/%d)...", retry, plan->attempts);
             vTaskDelay(pdMS_TO_TICKS(UPLOAD_RETRY_DELAY_MS));
         }
 
-        // Open and read the full file
-        FILE *file = fopen(file_path, "rb");
-        if (!file) {
-            ESP_LOGE(SENDTAG, "Failed to open file: %s", file_path);
-            continue;
-        }
-
-        fseek(file, 0, SEEK_END);
-        long file_size = ftell(file);
-        fseek(file, 0, SEEK_SET);
-
-        char *file_content = malloc(file_size + 1);
-        if (!file_content) {
-            ESP_LOGE(SENDTAG, "Memory allocation failed");
-            fclose(file);
-            continue;
-        }
-
-        fread(file_content, 1, file_size, file);
-        file_content[file_size] = '\0';
-        fclose(file);
-
         // Create full multipart body
         const char *boundary = "----WebKitFormBoundary7MA4YWxkTrZuOgW";
         char *pre = NULL;
@@ -75,18 +69,19 @@ esp_err_t upload_file_to_server(const char *file_path, const char *url, char *re
             "\r\n--%s--\r\n",
             boundary);
 
-        int total_length = strlen(pre) + file_size + strlen(post);
+        int total_length = strlen(pre) + data_len + strlen(post);
         char *full_body = malloc(total_length + 1);
         if (!full_body) {
             ESP_LOGE(SENDTAG, "Memory allocation failed for full body");
-            free(file_content);
             free(pre);
             free(post);
             continue;
         }
 
-        sprintf(full_body, "%s%s%s", pre, file_content, post);
-        free(file_content);
+        size_t pre_len = strlen(pre);
+        memcpy(full_body, pre, pre_len);
+        memcpy(full_body + pre_len, data, data_len);
+        strcpy(full_body + pre_len + data_len, post);
         free(pre);
         free(post);
 
@@ -97,7 +92,7 @@ esp_err_t upload_file_to_server(const char *file_path, const char *url, char *re
             .transport_type = HTTP_TRANSPORT_OVER_SSL,
             .method = HTTP_METHOD_POST,
             .event_handler = http_event_handler,
-            .timeout_ms = 35000,
+            .timeout_ms = plan->timeout_ms,
         };
 
         ESP_LOGI(SENDTAG, "HTTPS upload to: %s", config.url);
@@ -115,18 +110,35 @@ esp_err_t upload_file_to_server(const char *file_path, const char *url, char *re
         esp_http_client_set_header(client, "Content-Type", content_type_header);
         esp_http_client_set_header(client, "Connection", "keep-alive");
 
-        if (esp_http_client_open(client, total_length) != ESP_OK) {
+        // Full CPU speed for the TLS handshake only, the body goes out in modem sleep
+        int64_t t_start = esp_timer_get_time();
+        power_lock_cpu();
+        esp_err_t open_err = esp_http_client_open(client, total_length);
+        power_unlock_cpu();
+        if (open_err != ESP_OK) {
             ESP_LOGE(SENDTAG, "Failed to open HTTP connection");
             esp_http_client_cleanup(client);
             free(full_body);
+            link_record_attempt(total_length, (esp_timer_get_time() - t_start) / 1000, 0, false);
             continue;
         }
+        uint32_t handshake_ms = (esp_timer_get_time() - t_start) / 1000;
+        int64_t t_open = esp_timer_get_time();
 
-        if (esp_http_client_write(client, full_body, total_length) < 0) {
+        int written = 0;
+        while (written < total_length) {
+            int n = total_length - written;
+            if (n > (int)plan->chunk_bytes) n = plan->chunk_bytes;
+            n = esp_http_client_write(client, full_body + written, n);
+            if (n <= 0) break;
+            written += n;
+        }
+        if (written < total_length) {
             ESP_LOGE(SENDTAG, "Failed to write request body");
             esp_http_client_close(client);
             esp_http_client_cleanup(client);
             free(full_body);
+            link_record_attempt(total_length, handshake_ms, 0, false);
             continue;
         }
 
@@ -138,6 +150,9 @@ esp_err_t upload_file_to_server(const char *file_path, const char *url, char *re
         int response_length = esp_http_client_get_content_length(client);
         ESP_LOGI(SENDTAG, "Upload complete. HTTP status: %d, Response length: %d", status_code, response_length);
 
+        if (response_length >= (int)buf_size && response_buf) {
+            ESP_LOGW(SENDTAG, "Response of %d bytes truncated to %u", response_length, (unsigned)buf_size - 1);
+        }
         if (response_length > 0 && response_buf && buf_size > 0) {
             int read_len = esp_http_client_read_response(client, response_buf, buf_size - 1);
             if (read_len >= 0) {
@@ -151,6 +166,7 @@ esp_err_t upload_file_to_server(const char *file_path, const char *url, char *re
 
         esp_http_client_close(client);
         esp_http_client_cleanup(client);
+        link_record_attempt(total_length, handshake_ms, (esp_timer_get_time() - t_open) / 1000, status_code == 200);
 
         if (status_code == 200) {
             ret = ESP_OK;
@@ -164,25 +180,282 @@ esp_err_t upload_file_to_server(const char *file_path, const char *url, char *re
     return ret;
 }
 
-void try_upload_now(void) {
-    if (!wifi_connected) {
+// Enhanced file upload function with retry logic
+esp_err_t upload_file_to_server(const char *file_path, const char *url, char *response_buf, size_t buf_size) {
+    // Open and read the full file
+    FILE *file = fopen(file_path, "rb");
+    if (!file) {
+        ESP_LOGE(SENDTAG, "Failed to open file: %s", file_path);
+        return ESP_FAIL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *file_content = malloc(file_size + 1);
+    if (!file_content) {
+        ESP_LOGE(SENDTAG, "Memory allocation failed");
+        fclose(file);
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t read_len = fread(file_content, 1, file_size, file);
+    file_content[read_len] = '\0';
+    fclose(file);
+
+    // Metadata files carry a CRC header for crash recovery, the server only gets the body
+    size_t skip = sd_atomic_header_skip(file_content, read_len);
+    esp_err_t ret = upload_buffer_to_server(file_content + skip, read_len - skip, url, response_buf, buf_size);
+    free(file_content);
+    return ret;
+}
+
+#if FLASHLOG_ENABLED
+// Renders the records the server hasn't acknowledged yet into payload rows, a batch at a time
+// until caught up or past what the link can carry in one upload. last_seq is the newest sent.
+static esp_err_t load_flashlog_rows(uint32_t *last_seq, char **rows, size_t *rows_len) {
+    static flashlog_record_t batch[UPLOAD_FLASHLOG_MAX_ROWS];
+    flashlog_flush();
+
+    size_t budget = link_upload_budget();
+    *last_seq = flashlog_acked_seq();
+    char *buf = malloc(1);
+    if (!buf) return ESP_ERR_NO_MEM;
+    size_t len = 0;
+    size_t count;
+    do {
+        esp_err_t ret = flashlog_read_since(*last_seq, batch, UPLOAD_FLASHLOG_MAX_ROWS, &count);
+        if (ret != ESP_OK) {
+            free(buf);
+            return ret;
+        }
+        if (count == 0) break;
+
+        size_t size = len + count * UPLOAD_FLASHLOG_ROW_MAX + 1;
+        char *grown = realloc(buf, size);
+        if (!grown) {
+            free(buf);
+            return ESP_ERR_NO_MEM;
+        }
+        buf = grown;
+        for (size_t i = 0; i < count && len < size; i++) {
+            len += flashlog_format_row(&batch[i], buf + len, size - len);
+        }
+        if (len >= size) len = size - 1;
+        *last_seq = batch[count - 1].seq;
+    } while (count == UPLOAD_FLASHLOG_MAX_ROWS && len + UPLOAD_FLASHLOG_MAX_ROWS * UPLOAD_FLASHLOG_ROW_MAX <= budget);
+    buf[len] = '\0';
+
+    *rows = buf;
+    *rows_len = len;
+    return ESP_OK;
+}
+#endif
+
+// Closed aggregation windows go ahead of any raw rows. sent is how many made it in.
+static esp_err_t prepend_aggregates(size_t *sent, char **rows, size_t *rows_len) {
+    const agg_window_t *windows;
+    size_t count = sensor_aggregates(&windows);
+    *sent = 0;
+    if (count == 0) return ESP_OK;
+
+    size_t size = count * AGG_ROW_MAX + *rows_len + 1;
+    char *buf = malloc(size);
+    if (!buf) return ESP_ERR_NO_MEM;
+
+    size_t len = 0;
+    for (; *sent < count; (*sent)++) {
+        int n = agg_format_row(&windows[*sent], buf + len, size - len - *rows_len);
+        if (n < 0 || (size_t)n >= size - len - *rows_len) break;
+        len += n;
+    }
+    memcpy(buf + len, *rows, *rows_len);
+    len += *rows_len;
+    buf[len] = '\0';
+
+    free(*rows);
+    *rows = buf;
+    *rows_len = len;
+    return ESP_OK;
+}
+
+#if !FLASHLOG_ENABLED
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+    time_t last;
+} backfill_rows_t;
+
+static bool add_backfill_row(const char *row, size_t len, time_t when, void *ctx) {
+    backfill_rows_t *out = ctx;
+    if (out->len + len >= out->size) return false;
+    memcpy(out->buf + out->len, row, len);
+    out->len += len;
+    out->last = when;
+    return true;
+}
+
+// History rows the server asked for go after this wake's rows. through is the time of the
+// last one sent, 0 if none.
+static esp_err_t append_backfill(uint32_t *through, char **rows, size_t *rows_len) {
+    uint32_t from, to;
+    *through = 0;
+    if (!sdlog_backfill_pending(&from, &to)) return ESP_OK;
+
+    char *buf = realloc(*rows, *rows_len + UPLOAD_BACKFILL_BYTES + 1);
+    if (!buf) return ESP_ERR_NO_MEM;
+    *rows = buf;
+
+    backfill_rows_t out = {.buf = buf, .len = *rows_len, .size = *rows_len + UPLOAD_BACKFILL_BYTES + 1};
+    esp_err_t ret = sdlog_query(from, to, add_backfill_row, &out);
+    if (ret == ESP_ERR_NOT_FOUND) {
+        // No history on this card, nothing to send
+        sdlog_backfill_sent(to);
+        return ESP_OK;
+    }
+    if (ret != ESP_OK) return ret;
+
+    buf[out.len] = '\0';
+    if (out.len == *rows_len) {
+        sdlog_backfill_sent(to);
+        return ESP_OK;
+    }
+    *through = (uint32_t)out.last;
+    DLOGI(DLOG_UPLOAD, "Backfill %u bytes up to %lu", (unsigned)(out.len - *rows_len), (unsigned long)*through);
+    *rows_len = out.len;
+    return ESP_OK;
+}
+#endif
+
+// Puts the applied config version ahead of the rows so the server knows the delta landed
+static esp_err_t prepend_cfg_ack(uint32_t version, char **rows, size_t *rows_len) {
+    char line[32];
+    int n = snprintf(line, sizeof(line), "cfg_version:'%" PRIu32 "'\n", version);
+
+    char *buf = malloc(n + *rows_len + 1);
+    if (!buf) return ESP_ERR_NO_MEM;
+    memcpy(buf, line, n);
+    memcpy(buf + n, *rows, *rows_len);
+    buf[n + *rows_len] = '\0';
+
+    free(*rows);
+    *rows = buf;
+    *rows_len += n;
+    return ESP_OK;
+}
+
+// ESP_OK only if the server took the upload. New firmware is kept or rolled back on that,
+// so an image on trial always uploads.
+esp_err_t try_upload_now(void) {
+    uint32_t ack_version = provision_ack_version();
+    bool must_upload = ack_version != 0 || ota_on_trial();
+
+#if FLASHLOG_ENABLED
+
+    // Samples wait in the flash log until acknowledged, so uploads can be spaced out.
+    // The SD payload file only holds the current wake, so there every wake uploads.
+    // Wakes the stub handled on its own count too
+    uint32_t wakes = wakes_since_upload + 1 + wakestub_taken();
+    wakes_since_upload = wakes < UINT16_MAX ? wakes : UINT16_MAX;
+    if (wakes_since_upload < node_policy()->upload_every && !must_upload) {
+        DLOGI(DLOG_UPLOAD, "Upload due in %d wakes", node_policy()->upload_every - wakes_since_upload);
+        return ESP_ERR_NOT_FINISHED;
+    }
+#endif
+
+    if (!wifi_is_connected()) {
         ESP_LOGW(SENDTAG, "No WiFi. Skipping upload.");
-        return;
+        return ESP_ERR_WIFI_NOT_CONNECT;
+    }
+
+    char key[64] = {0};
+    char sensorID[32] = {0};
+    char geoutm[128] = {0};
+    if (load_registration_metadata(key, sizeof(key), sensorID, sizeof(sensorID), geoutm, sizeof(geoutm)) != ESP_OK) {
+        ESP_LOGE(SENDTAG, "No registration metadata for upload");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // The latest sample may still be held by the deadband
+    sensor_flush_held(payloadpath);
+
+    char *rows = NULL;
+    size_t rows_len = 0;
+    // Samples in the flash log wait until acknowledged, so a weak link can put the upload off
+    bool may_defer = true;
+#if FLASHLOG_ENABLED
+    uint32_t last_seq = 0;
+    esp_err_t ret = load_flashlog_rows(&last_seq, &rows, &rows_len);
+#else
+    esp_err_t ret = sd_load_rows(payloadpath, &rows, &rows_len);
+    // payload.txt starts over next wake: only aggregates and backfill would still be there
+    may_defer = rows_len == 0;
+    uint32_t backfill_through = 0;
+    if (ret == ESP_OK) ret = append_backfill(&backfill_through, &rows, &rows_len);
+    must_upload = must_upload || backfill_through != 0;
+#endif
+    size_t agg_sent = 0;
+    if (ret == ESP_OK) ret = prepend_aggregates(&agg_sent, &rows, &rows_len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(SENDTAG, "Failed to load samples: %s", esp_err_to_name(ret));
+        free(rows);
+        return ret;
     }
 
-    const char *file_path = "/sdcard/payload.txt";
-    const char *url = "https://h2overwatch.ca/DesktopModules/ShiftUP_VolsenseMap/waterFile.ashx";
+    // Between window ends there may be nothing to send
+    if (rows_len == 0 && !must_upload) {
+        ESP_LOGI(SENDTAG, "No new samples to upload");
+        free(rows);
+        return ESP_ERR_NOT_FINISHED;
+    }
 
-    char response_buf[1024] = {0};
-    esp_err_t upload_ret = upload_file_to_server(file_path, url, response_buf, sizeof(response_buf));
+    if (ack_version && prepend_cfg_ack(ack_version, &rows, &rows_len) != ESP_OK) {
+        ack_version = 0;
+    }
+
+    // Size the attempt to the link, or skip it if it is very likely to fail. An ack or a
+    // first boot after an update goes out whatever the link.
+    const link_plan_t *plan = link_plan_upload(rows_len + 256, may_defer && !must_upload);
+    if (!plan->upload_now) {
+        ESP_LOGW(SENDTAG, "Weak link (RSSI %d). Deferring upload.", plan->rssi);
+        free(rows);
+        return ESP_ERR_NOT_FINISHED;
+    }
+
+    uplink_payload_t payload = {
+        .key = key,
+        .sensor_id = sensorID,
+        .geoutm = geoutm,
+        .rows = rows,
+        .rows_len = rows_len,
+    };
+
+    char response_buf[PROVISION_RESPONSE_MAX] = {0};
+    esp_err_t upload_ret = uplink_send(&payload, response_buf, sizeof(response_buf));
+    free(rows);
+    link_finish_upload(upload_ret == ESP_OK);
 
     if (upload_ret == ESP_OK) {
         ESP_LOGI(SENDTAG, "File uploaded successfully");
+#if FLASHLOG_ENABLED
+        if (last_seq > flashlog_acked_seq()) flashlog_ack(last_seq);
+        wakes_since_upload = 0;
+#else
+        if (backfill_through) sdlog_backfill_sent(backfill_through);
+#endif
+        sensor_aggregates_sent(agg_sent);
+        if (ack_version) provision_mark_acked(ack_version);
     } else {
         ESP_LOGE(SENDTAG, "File upload failed");
     }
 
     if (strlen(response_buf) > 0) {
         ESP_LOGI(SENDTAG, "Server response: %s", response_buf);
+        if (upload_ret == ESP_OK) {
+            provision_handle_reply(response_buf, strlen(response_buf));
+        }
     }
+    return upload_ret;
 }
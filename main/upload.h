@@ -1,6 +1,7 @@
 #ifndef HTTP_UPLOAD_H
 #define HTTP_UPLOAD_H
 
+#include "sdkconfig.h"
 #include "esp_http_client.h"
 #include "esp_log.h"
 #include "sdcard.h"
@@ -14,12 +15,15 @@
 
 
 #define SENDTAG "HTTPS_UPLOAD"
-#define UPLOAD_RETRY_COUNT 3
-#define UPLOAD_RETRY_DELAY_MS 2000
+#define UPLOAD_RETRY_DELAY_MS CONFIG_NODE_UPLOAD_RETRY_DELAY_MS
+#define UPLOAD_FLASHLOG_MAX_ROWS 64   // Flash log rows read per batch, as many batches as the link budget allows
+#define UPLOAD_FLASHLOG_ROW_MAX  96   // Longest row flashlog_format_row writes
+#define UPLOAD_BACKFILL_BYTES    4096 // SD history rows sent per upload for a server backfill
 
 // Function to upload a file to the server
+esp_err_t upload_buffer_to_server(const char *data, size_t data_len, const char *url, char *response_buf, size_t buf_size);
 esp_err_t upload_file_to_server(const char *file_path, const char *url, char *response_buf, size_t buf_size);
-void try_upload_now(void);
+esp_err_t try_upload_now(void);
 
 extern const char DigiCertGlobalRootG2_crt_pem_start[] asm("_binary_DigiCertGlobalRootG2_crt_pem_start");
 
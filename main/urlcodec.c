@@ -0,0 +1,121 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "urlcodec.h"
+
+// URL codec lookup tables: hex digit value plus one (0 = not a hex digit), and the
+// RFC 3986 unreserved set that url_encode passes through untouched
+static const uint8_t url_hex[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+};
+
+static const uint8_t url_unreserved[256] = {
+    ['0' ... '9'] = 1,
+    ['A' ... 'Z'] = 1,
+    ['a' ... 'z'] = 1,
+    ['-'] = 1, ['_'] = 1, ['.'] = 1, ['~'] = 1,
+};
+
+static inline bool url_is_escape(const char *p)
+{
+    // p[1] is checked first, so a '%' at the very end never reads past the terminator
+    return p[0] == '%' && url_hex[(uint8_t)p[1]] && url_hex[(uint8_t)p[2]];
+}
+
+size_t url_decoded_len(const char *input)
+{
+    size_t n = 0;
+    for (size_t i = 0; input[i]; n++)
+    {
+        i += url_is_escape(input + i) ? 3 : 1;
+    }
+    return n;
+}
+
+// Malformed escapes are copied literally. Returns ESP_ERR_INVALID_SIZE if the output was
+// cut short; it is always terminated.
+esp_err_t url_decode(const char *input, char *output, size_t buf_size)
+{
+    if (buf_size == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    size_t i = 0, j = 0;
+    while (input[i])
+    {
+        if (j + 1 >= buf_size)
+        {
+            output[j] = '\0';
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        if (url_is_escape(input + i))
+        {
+            output[j++] = (char)(((url_hex[(uint8_t)input[i + 1]] - 1) << 4) | (url_hex[(uint8_t)input[i + 2]] - 1));
+            i += 3;
+        }
+        else
+        {
+            output[j++] = input[i] == '+' ? ' ' : input[i];
+            i++;
+        }
+    }
+    output[j] = '\0';
+    return ESP_OK;
+}
+
+size_t url_encoded_len(const char *input)
+{
+    size_t n = 0;
+    for (size_t i = 0; input[i]; i++)
+    {
+        n += url_unreserved[(uint8_t)input[i]] ? 1 : 3;
+    }
+    return n;
+}
+
+// Escapes are never split. Returns ESP_ERR_INVALID_SIZE if the output was cut short;
+// it is always terminated.
+esp_err_t url_encode(const char *input, char *output, size_t buf_size)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    if (buf_size == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    size_t i = 0, j = 0;
+    while (input[i])
+    {
+        // Runs of unreserved bytes go across in one copy
+        size_t run = 0;
+        while (url_unreserved[(uint8_t)input[i + run]])
+            run++;
+        if (run > 0)
+        {
+            size_t room = buf_size - 1 - j;
+            if (run > room)
+            {
+                memcpy(output + j, input + i, room);
+                output[j + room] = '\0';
+                return ESP_ERR_INVALID_SIZE;
+            }
+            memcpy(output + j, input + i, run);
+            i += run;
+            j += run;
+            continue;
+        }
+
+        if (j + 3 >= buf_size)
+        {
+            output[j] = '\0';
+            return ESP_ERR_INVALID_SIZE;
+        }
+        uint8_t ch = (uint8_t)input[i++];
+        output[j++] = '%';
+        output[j++] = hex[ch >> 4];
+        output[j++] = hex[ch & 0xF];
+    }
+    output[j] = '\0';
+    return ESP_OK;
+}
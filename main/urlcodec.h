@@ -0,0 +1,14 @@
+#ifndef URLCODEC_H
+#define URLCODEC_H
+
+#include <stddef.h>
+#include "esp_err.h"
+
+// URL encoding/decoding. The _len functions give the exact output length, excluding the
+// terminator; the codecs return ESP_ERR_INVALID_SIZE when buf_size is too small.
+size_t url_decoded_len(const char *input);
+size_t url_encoded_len(const char *input);
+esp_err_t url_decode(const char *input, char *output, size_t buf_size);
+esp_err_t url_encode(const char *input, char *output, size_t buf_size);
+
+#endif
@@ -0,0 +1,52 @@
+#include "wakeplan.h"
+
+// Runs from RTC memory before the app is loaded: no library calls, no struct copies that
+// the compiler could turn into memcpy.
+
+void wakeplan_arm(wake_ring_t *ring, uint64_t period_us, uint16_t flush_at, uint16_t volt_raw_min, uint16_t volt_raw_max) {
+    if (flush_at > WAKE_RING_SIZE) flush_at = WAKE_RING_SIZE;
+    ring->period_us = period_us;
+    ring->flush_at = flush_at;
+    ring->volt_raw_min = volt_raw_min;
+    ring->volt_raw_max = volt_raw_max;
+    ring->count = 0;
+    ring->reason = WAKE_REASON_NONE;
+    ring->magic = WAKE_RING_MAGIC;
+}
+
+void wakeplan_disarm(wake_ring_t *ring) {
+    ring->magic = 0;
+    ring->count = 0;
+}
+
+bool wakeplan_armed(const wake_ring_t *ring) {
+    return ring->magic == WAKE_RING_MAGIC && ring->count <= WAKE_RING_SIZE &&
+           ring->flush_at > 0 && ring->flush_at <= WAKE_RING_SIZE && ring->period_us > 0;
+}
+
+static wake_action_t boot(wake_ring_t *ring, wake_reason_t reason) {
+    ring->reason = reason;
+    return WAKE_BOOT;
+}
+
+wake_action_t wakeplan_before_sample(wake_ring_t *ring) {
+    if (!wakeplan_armed(ring)) return boot(ring, WAKE_REASON_UNARMED);
+    if (ring->count >= ring->flush_at) return boot(ring, WAKE_REASON_FLUSH);
+    return WAKE_SLEEP;
+}
+
+wake_action_t wakeplan_after_sample(wake_ring_t *ring, const wake_sample_t *sample) {
+    if (sample->flags & WAKE_SAMPLE_PRESSURE_FAILED) return boot(ring, WAKE_REASON_SENSOR);
+    if (sample->volt_raw < ring->volt_raw_min || sample->volt_raw > ring->volt_raw_max) {
+        return boot(ring, WAKE_REASON_TIER);
+    }
+
+    if (ring->count >= WAKE_RING_SIZE) return boot(ring, WAKE_REASON_FLUSH);
+
+    wake_sample_t *slot = &ring->samples[ring->count];
+    slot->pressure = sample->pressure;
+    slot->volt_raw = sample->volt_raw;
+    slot->flags = sample->flags;
+    ring->count++;
+    return WAKE_SLEEP;
+}
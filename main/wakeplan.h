@@ -0,0 +1,58 @@
+#ifndef WAKEPLAN_H
+#define WAKEPLAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Samples taken by the deep-sleep wake stub between full boots, and the rules for when the
+// stub has to let the app boot. Plain C with no IDF dependencies: linker.lf places it in
+// RTC fast memory for the stub, and it builds unchanged on a host.
+
+#define WAKE_RING_MAGIC 0x4B415753   // "SWAK"
+#define WAKE_RING_SIZE  96           // Covers the largest upload_every
+
+#define WAKE_SAMPLE_PRESSURE_FAILED 0x0001
+
+typedef struct {
+    uint32_t pressure;      // PT928 raw reading
+    uint16_t volt_raw;      // ADC1 raw at the battery divider
+    uint16_t flags;
+} wake_sample_t;
+
+typedef enum {
+    WAKE_SLEEP,             // Keep the sample and go back to sleep
+    WAKE_BOOT,              // Fall through to the normal app boot
+} wake_action_t;
+
+typedef enum {
+    WAKE_REASON_NONE,
+    WAKE_REASON_UNARMED,    // No valid plan in RTC memory
+    WAKE_REASON_FLUSH,      // Ring holds flush_at samples, an upload is due
+    WAKE_REASON_TIER,       // Battery left the sleep tier the plan was made for
+    WAKE_REASON_SENSOR,     // A read failed, let the app retry with its drivers
+} wake_reason_t;
+
+// Written by the app before deep sleep, read and appended to by the stub.
+// Samples are evenly spaced period_us apart; the stub doesn't keep a clock.
+typedef struct {
+    uint32_t magic;
+    uint64_t period_us;
+    uint16_t flush_at;
+    uint16_t volt_raw_min;  // Battery tier bounds, inclusive
+    uint16_t volt_raw_max;
+    uint16_t count;
+    uint16_t reason;        // wake_reason_t of the last boot the stub let through
+    wake_sample_t samples[WAKE_RING_SIZE];
+} wake_ring_t;
+
+void wakeplan_arm(wake_ring_t *ring, uint64_t period_us, uint16_t flush_at, uint16_t volt_raw_min, uint16_t volt_raw_max);
+void wakeplan_disarm(wake_ring_t *ring);
+bool wakeplan_armed(const wake_ring_t *ring);
+
+// Before touching any sensor: WAKE_BOOT if there is no plan or the ring is due for upload
+wake_action_t wakeplan_before_sample(wake_ring_t *ring);
+// Stores the sample unless it failed or left the battery tier, in which case the app
+// boots and takes its own
+wake_action_t wakeplan_after_sample(wake_ring_t *ring, const wake_sample_t *sample);
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "wakestub.h"
+
+static RTC_DATA_ATTR wake_ring_t ring;
+static size_t taken = 0;
+
+void wakestub_arm(uint32_t period_s, uint16_t flush_at, uint16_t volt_raw_min, uint16_t volt_raw_max) {
+#if CONFIG_NODE_WAKE_STUB
+    wakeplan_arm(&ring, (uint64_t)period_s * 1000000ULL, flush_at, volt_raw_min, volt_raw_max);
+#else
+    wakeplan_disarm(&ring);
+#endif
+}
+
+void wakestub_disarm(void) {
+    wakeplan_disarm(&ring);
+}
+
+size_t wakestub_take(wake_sample_t *out, size_t max, uint32_t *period_s) {
+    size_t n = 0;
+    if (wakeplan_armed(&ring)) {
+        n = ring.count < max ? ring.count : max;
+        for (size_t i = 0; i < n; i++) {
+            out[i] = ring.samples[i];
+        }
+        *period_s = (uint32_t)(ring.period_us / 1000000ULL);
+    }
+    wakeplan_disarm(&ring);
+    taken = n;
+    return n;
+}
+
+size_t wakestub_taken(void) {
+    return taken;
+}
+
+wake_reason_t wakestub_boot_reason(void) {
+    return (wake_reason_t)ring.reason;
+}
+
+#if CONFIG_NODE_WAKE_STUB
+#include "esp_wake_stub.h"
+#include "esp_rom_sys.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+#include "soc/io_mux_reg.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/sens_struct.h"
+#include "sensors.h"
+#include "pt928.h"
+
+// Everything below runs before the app is loaded, from RTC fast memory: registers, ROM
+// functions and RTC data only. Pins are driven through GPIO_OUT/ENABLE, which cover GPIO0-31.
+#if VOLTSENS_ENABLE >= 32 || CONFIG_NODE_I2C_PIN_SCL >= 32 || CONFIG_NODE_I2C_PIN_SDA >= 32
+#error "Wake stub needs the battery divider and PT928 pins below GPIO32"
+#endif
+
+#define STUB_IO_MUX_REG(pin)  (REG_IO_MUX_BASE + 0x04 + 4 * (pin))   // ESP32-S3: GPIO0 at +0x04
+#define STUB_SCL              CONFIG_NODE_I2C_PIN_SCL
+#define STUB_SDA              CONFIG_NODE_I2C_PIN_SDA
+#define STUB_I2C_HALF_US      5       // ~100 kHz, as I2C_MASTER_FREQ_HZ
+#define STUB_SETTLE_US        (PT928_CONVERSION_MS * 1000)   // Also covers the divider's 20 ms
+#define STUB_ADC_SPINS        100000
+
+static void RTC_IRAM_ATTR pin_setup(int pin, bool pullup) {
+    uint32_t reg = STUB_IO_MUX_REG(pin);
+    PIN_FUNC_SELECT(reg, PIN_FUNC_GPIO);
+    PIN_INPUT_ENABLE(reg);
+    if (pullup) PIN_PULLUP_EN(reg);
+    REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + 4 * pin, SIG_GPIO_OUT_IDX);
+    REG_WRITE(GPIO_OUT_W1TC_REG, BIT(pin));
+}
+
+// Open drain by hand: low drives the pin, high releases it to the pull-up
+static void RTC_IRAM_ATTR line(int pin, int level) {
+    REG_WRITE(level ? GPIO_ENABLE_W1TC_REG : GPIO_ENABLE_W1TS_REG, BIT(pin));
+    esp_rom_delay_us(STUB_I2C_HALF_US);
+}
+
+static int RTC_IRAM_ATTR line_read(int pin) {
+    return (REG_READ(GPIO_IN_REG) >> pin) & 1;
+}
+
+static void RTC_IRAM_ATTR i2c_start(void) {
+    line(STUB_SDA, 1);
+    line(STUB_SCL, 1);
+    line(STUB_SDA, 0);
+    line(STUB_SCL, 0);
+}
+
+static void RTC_IRAM_ATTR i2c_stop(void) {
+    line(STUB_SDA, 0);
+    line(STUB_SCL, 1);
+    line(STUB_SDA, 1);
+}
+
+static bool RTC_IRAM_ATTR i2c_write(uint8_t byte) {
+    for (int i = 7; i >= 0; i--) {
+        line(STUB_SDA, (byte >> i) & 1);
+        line(STUB_SCL, 1);
+        line(STUB_SCL, 0);
+    }
+    line(STUB_SDA, 1);
+    line(STUB_SCL, 1);
+    bool ack = !line_read(STUB_SDA);
+    line(STUB_SCL, 0);
+    return ack;
+}
+
+static uint8_t RTC_IRAM_ATTR i2c_read(bool ack) {
+    uint8_t byte = 0;
+    line(STUB_SDA, 1);
+    for (int i = 0; i < 8; i++) {
+        line(STUB_SCL, 1);
+        byte = (byte << 1) | line_read(STUB_SDA);
+        line(STUB_SCL, 0);
+    }
+    line(STUB_SDA, !ack);
+    line(STUB_SCL, 1);
+    line(STUB_SCL, 0);
+    line(STUB_SDA, 1);
+    return byte;
+}
+
+// Same register sequence as pt928_read_pressure(), split so the conversion overlaps the ADC settling
+static bool RTC_IRAM_ATTR stub_pt928_trigger(void) {
+    i2c_start();
+    bool ok = i2c_write(PT928_SENSOR_ADDR << 1) && i2c_write(PT928_MEASURE_TYPE_ADDR) && i2c_write(0x01);
+    i2c_stop();
+    return ok;
+}
+
+static bool RTC_IRAM_ATTR stub_pt928_read(uint32_t *pressure) {
+    i2c_start();
+    bool ok = i2c_write(PT928_SENSOR_ADDR << 1) && i2c_write(PT928_PRES_OUT_1_REG_ADDR);
+    if (ok) {
+        i2c_start();
+        ok = i2c_write((PT928_SENSOR_ADDR << 1) | 1);
+    }
+    if (ok) {
+        uint32_t b0 = i2c_read(true);
+        uint32_t b1 = i2c_read(true);
+        uint32_t b2 = i2c_read(false);
+        *pressure = (b0 << 16) | (b1 << 8) | b2;
+    }
+    i2c_stop();
+    return ok;
+}
+
+// One ADC1 conversion through the RTC controller, following adc_ll's RTC path. The raw value
+// is converted by the app with the calibration of its last full reading.
+static uint16_t RTC_IRAM_ATTR stub_adc1_read(int channel, int atten) {
+    SENS.sar_peri_clk_gate_conf.saradc_clk_en = 1;
+    SENS.sar_power_xpd_sar.force_xpd_sar = 3;        // Powered up by software
+    SENS.sar_meas1_mux.sar1_dig_force = 0;           // RTC controller, not the digital one
+    SENS.sar_meas1_ctrl2.meas1_start_force = 1;
+    SENS.sar_meas1_ctrl2.sar1_en_pad_force = 1;
+    SENS.sar_atten1 = (SENS.sar_atten1 & ~(3u << (channel * 2))) | ((uint32_t)atten << (channel * 2));
+    SENS.sar_meas1_ctrl2.sar1_en_pad = 1 << channel;
+
+    SENS.sar_meas1_ctrl2.meas1_start_sar = 0;
+    SENS.sar_meas1_ctrl2.meas1_start_sar = 1;
+    uint16_t raw = 0;
+    for (int i = 0; i < STUB_ADC_SPINS; i++) {
+        if (SENS.sar_meas1_ctrl2.meas1_done_sar) {
+            raw = SENS.sar_meas1_ctrl2.meas1_data_sar;
+            break;
+        }
+    }
+
+    SENS.sar_power_xpd_sar.force_xpd_sar = 0;
+    return raw;
+}
+
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void) {
+    esp_default_wake_deep_sleep();
+    if (wakeplan_before_sample(&ring) == WAKE_BOOT) return;
+
+    pin_setup(VOLTSENS_ENABLE, false);
+    REG_WRITE(GPIO_OUT_W1TS_REG, BIT(VOLTSENS_ENABLE));
+    REG_WRITE(GPIO_ENABLE_W1TS_REG, BIT(VOLTSENS_ENABLE));
+    pin_setup(STUB_SCL, true);
+    pin_setup(STUB_SDA, true);
+
+    wake_sample_t sample = {0};
+    bool triggered = stub_pt928_trigger();
+    esp_rom_delay_us(STUB_SETTLE_US);
+
+    sample.volt_raw = stub_adc1_read(VOLTSENS_READCHANNEL, VOLTSENS_ATTEN);
+    REG_WRITE(GPIO_OUT_W1TC_REG, BIT(VOLTSENS_ENABLE));
+
+    if (!triggered || !stub_pt928_read(&sample.pressure) || sample.pressure == 0) {
+        sample.flags |= WAKE_SAMPLE_PRESSURE_FAILED;
+    }
+
+    if (wakeplan_after_sample(&ring, &sample) == WAKE_BOOT) return;
+
+    esp_wake_stub_set_wakeup_time(ring.period_us);
+    esp_wake_stub_sleep(&esp_wake_deep_sleep);
+}
+#endif
@@ -0,0 +1,22 @@
+#ifndef WAKESTUB_H
+#define WAKESTUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "wakeplan.h"
+
+// With CONFIG_NODE_WAKE_STUB, timer wakes between uploads are handled by esp_wake_deep_sleep()
+// in RTC memory: it reads the battery divider and the PT928, stores the raw values and
+// goes back to sleep without loading the app.
+
+// Plan for the coming deep sleep; the stub takes up to flush_at samples before the app boots
+void wakestub_arm(uint32_t period_s, uint16_t flush_at, uint16_t volt_raw_min, uint16_t volt_raw_max);
+void wakestub_disarm(void);
+
+// Moves the stub's samples out, oldest first, and disarms. Call once per boot.
+size_t wakestub_take(wake_sample_t *out, size_t max, uint32_t *period_s);
+// Samples handed out by wakestub_take() this boot, i.e. wakes that didn't reach the app
+size_t wakestub_taken(void);
+wake_reason_t wakestub_boot_reason(void);
+
+#endif
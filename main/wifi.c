@@ -1,52 +1,251 @@
 #include <string.h>
-#include <ctype.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <inttypes.h>
 #include "esp_event.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
 #include "nvs_flash.h"
 #include "esp_netif.h"
 #include "lwip/dns.h"
 #include "main.h"
 #include "wifi.h"
 #include "html.h"
+#include "portal.h"
 #include "sdcard.h"
 #include "upload.h"
 #include "cJSON.h"
 #include "sensors.h"
 #include "LED.h"
-
-#define WIFI_SSID "PCBees_AP1"
-#define WIFI_PASS "password123"
-#define MAX_APs 20
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#include "uplink.h"
+#include "esp_timer.h"
+#include "formparse.h"
+#include "provision.h"
+#include "nodecfg.h"
+#include "dataexport.h"
+#include "lwip/sockets.h"
+
+#define WIFI_SSID CONFIG_NODE_SOFTAP_SSID
+#define WIFI_PASS CONFIG_NODE_SOFTAP_PASSWORD
+#define MAX_APs PORTAL_MAX_APS
+#define MAX_SCAN_RECORDS 32         // Raw BSSIDs fetched per scan, before de-duplication
+#define SCAN_CACHE_MAX_AGE_MS 30000 // Page loads older than this start a fresh scan
 #define CONNECTION_TIMEOUT_MS 15000
+#define CONNECT_MAX_RETRIES 3
 #define RETRY_INTERVAL_MS 1000
 #define MAX_RETRY_DURATION_MS 10000
 
 static const char *WIFITAG = "WiFi_WebServer";
-static wifi_ap_record_t ap_list[MAX_APs];
+
+// Scan results, one entry per SSID. Written by the event task on WIFI_EVENT_SCAN_DONE and
+// copied out by the HTTP handlers, so nothing in httpd ever waits on the radio.
+static ap_entry_t ap_list[MAX_APs];
 static uint16_t ap_count = 0;
-bool wifi_connected = false;
+static int64_t ap_scan_ms = 0; // esp_timer time of the last completed scan, 0 if none
+static volatile int64_t portal_request_us = 0; // esp_timer time of the last portal request
+static volatile int portal_sessions = 0;        // Open connections to the portal
+static volatile bool portal_exit = false;       // Posted to /exit
+static volatile bool scan_running = false;
+static SemaphoreHandle_t ap_lock = NULL;
+static StaticSemaphore_t ap_lock_buf;
+
+// Event task only; kept off its small stack
+static wifi_ap_record_t scan_records[MAX_SCAN_RECORDS];
+static ap_entry_t scan_merged[MAX_APs];
+
+// Connection state machine. The event group is the source of truth and is what callers
+// wait on; the details reported on /status.json are guarded by conn_lock.
+#define WIFI_CONNECTED_BIT  BIT0
+#define WIFI_CONNECTING_BIT BIT1
+#define WIFI_FAIL_BIT       BIT2
+
+static EventGroupHandle_t wifi_events = NULL;
+static StaticEventGroup_t wifi_events_buf;
+static esp_timer_handle_t conn_timer = NULL;
+static portMUX_TYPE conn_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct
+{
+    char ssid[33];
+    char password[65];
+    bool save;       // Portal attempt: store the credentials once they work
+    uint8_t retries;
+    uint8_t reason;  // Last disconnect reason
+    uint32_t ip;
+} conn;
 
 char stored_ssid[33] = "";
 char stored_password[65] = "";
 
+static void handle_scan_done(void)
+{
+    uint16_t count = MAX_SCAN_RECORDS;
+    esp_err_t ret = esp_wifi_scan_get_ap_records(&count, scan_records);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(WIFITAG, "Failed to read scan results: %s", esp_err_to_name(ret));
+        count = 0;
+    }
+
+    uint16_t n = ap_merge_records(scan_records, count, scan_merged, MAX_APs);
+
+    if (ap_lock && xSemaphoreTake(ap_lock, portMAX_DELAY) == pdTRUE)
+    {
+        memcpy(ap_list, scan_merged, n * sizeof(ap_entry_t));
+        ap_count = n;
+        ap_scan_ms = esp_timer_get_time() / 1000;
+        xSemaphoreGive(ap_lock);
+    }
+    scan_running = false;
+    ESP_LOGI(WIFITAG, "Scan done: %d BSSIDs, %d networks", count, n);
+}
+
+// Copies the cached results out so they can be sent without holding the lock
+static uint16_t ap_snapshot(ap_entry_t *out, int64_t *scan_ms)
+{
+    uint16_t n = 0;
+    *scan_ms = 0;
+    if (ap_lock && xSemaphoreTake(ap_lock, portMAX_DELAY) == pdTRUE)
+    {
+        n = ap_count;
+        memcpy(out, ap_list, n * sizeof(ap_entry_t));
+        *scan_ms = ap_scan_ms;
+        xSemaphoreGive(ap_lock);
+    }
+    return n;
+}
+
+static void connect_failed(void)
+{
+    xEventGroupClearBits(wifi_events, WIFI_CONNECTING_BIT);
+    xEventGroupSetBits(wifi_events, WIFI_FAIL_BIT);
+    led_blink(LED_FULL, 0, 0, 150, 150, 6);   // Red
+}
+
+static void conn_timeout_cb(void *arg)
+{
+    if (xEventGroupGetBits(wifi_events) & WIFI_CONNECTING_BIT)
+    {
+        ESP_LOGW(WIFITAG, "Connection attempt timed out");
+        connect_failed();
+        esp_wifi_disconnect();
+    }
+}
+
+static void wifi_events_init(void)
+{
+    if (!wifi_events)
+    {
+        wifi_events = xEventGroupCreateStatic(&wifi_events_buf);
+    }
+    if (!conn_timer)
+    {
+        const esp_timer_create_args_t args = {.callback = conn_timeout_cb, .name = "wifi_conn"};
+        ESP_ERROR_CHECK(esp_timer_create(&args, &conn_timer));
+    }
+}
+
+// Starts a connection attempt and returns at once. Retries, the timeout and the outcome
+// are handled by the event handlers.
+static esp_err_t wifi_start_connect(const wifi_config_t *sta_config, bool save)
+{
+    if (!wifi_events)
+        return ESP_ERR_INVALID_STATE;
+
+    taskENTER_CRITICAL(&conn_lock);
+    strlcpy(conn.ssid, (const char *)sta_config->sta.ssid, sizeof(conn.ssid));
+    strlcpy(conn.password, (const char *)sta_config->sta.password, sizeof(conn.password));
+    conn.save = save;
+    conn.retries = 0;
+    conn.reason = 0;
+    conn.ip = 0;
+    taskEXIT_CRITICAL(&conn_lock);
+
+    // Drop the old link before the new attempt starts counting disconnects. Its event may
+    // still arrive after CONNECTING is set; the handler tells it apart and ignores it.
+    EventBits_t bits = xEventGroupClearBits(wifi_events, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT | WIFI_CONNECTING_BIT);
+    if (bits & (WIFI_CONNECTED_BIT | WIFI_CONNECTING_BIT))
+    {
+        esp_wifi_disconnect();
+    }
+    xEventGroupSetBits(wifi_events, WIFI_CONNECTING_BIT);
+
+    esp_err_t ret = esp_wifi_set_config(WIFI_IF_STA, (wifi_config_t *)sta_config);
+    if (ret == ESP_OK)
+    {
+        ret = esp_wifi_connect();
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(WIFITAG, "Connection attempt failed: %s", esp_err_to_name(ret));
+        connect_failed();
+        return ret;
+    }
+
+    esp_timer_stop(conn_timer);
+    esp_timer_start_once(conn_timer, CONNECTION_TIMEOUT_MS * 1000ULL);
+    return ESP_OK;
+}
+
+bool wifi_is_connected(void)
+{
+    return wifi_events && (xEventGroupGetBits(wifi_events) & WIFI_CONNECTED_BIT);
+}
+
+bool wifi_wait_connected(uint32_t timeout_ms, bool stop_on_fail)
+{
+    if (!wifi_events)
+        return false;
+
+    EventBits_t wait = WIFI_CONNECTED_BIT | (stop_on_fail ? WIFI_FAIL_BIT : 0);
+    EventBits_t bits = xEventGroupWaitBits(wifi_events, wait, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    return (bits & WIFI_CONNECTED_BIT) != 0;
+}
+
+wifi_conn_state_t wifi_conn_state(void)
+{
+    EventBits_t bits = wifi_events ? xEventGroupGetBits(wifi_events) : 0;
+    if (bits & WIFI_CONNECTED_BIT)
+        return WIFI_STATE_CONNECTED;
+    if (bits & WIFI_CONNECTING_BIT)
+        return WIFI_STATE_CONNECTING;
+    if (bits & WIFI_FAIL_BIT)
+        return WIFI_STATE_FAILED;
+    return WIFI_STATE_IDLE;
+}
+
 // Event Handlers
 static void esp_wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
-    if (event_id == WIFI_EVENT_STA_CONNECTED)
+    if (event_id == WIFI_EVENT_SCAN_DONE)
+    {
+        handle_scan_done();
+    }
+    else if (event_id == WIFI_EVENT_STA_CONNECTED)
     {
         ESP_LOGI(WIFITAG, "Connected to AP");
     }
     else if (event_id == WIFI_EVENT_STA_DISCONNECTED)
     {
-        wifi_connected = false;
         wifi_event_sta_disconnected_t *disc = (wifi_event_sta_disconnected_t *)event_data;
+
+        // Leaving the old network, or a late event from it, doesn't count against this attempt
+        taskENTER_CRITICAL(&conn_lock);
+        bool stale = disc->reason == WIFI_REASON_ASSOC_LEAVE || disc->ssid_len != strlen(conn.ssid) ||
+                     memcmp(disc->ssid, conn.ssid, disc->ssid_len) != 0;
+        taskEXIT_CRITICAL(&conn_lock);
+        if (stale && (xEventGroupGetBits(wifi_events) & WIFI_CONNECTING_BIT))
+        {
+            ESP_LOGI(WIFITAG, "Left %.*s, reason: %d", disc->ssid_len, (const char *)disc->ssid, disc->reason);
+            return;
+        }
+
+        EventBits_t bits = xEventGroupClearBits(wifi_events, WIFI_CONNECTED_BIT);
         ESP_LOGW(WIFITAG, "Disconnected from AP, reason: %d", disc->reason);
         switch (disc->reason)
         {
@@ -61,6 +260,25 @@ static void esp_wifi_event_handler(void *arg, esp_event_base_t event_base, int32
         default:
             break;
         }
+
+        taskENTER_CRITICAL(&conn_lock);
+        conn.reason = disc->reason;
+        bool retry = conn.retries++ < CONNECT_MAX_RETRIES;
+        taskEXIT_CRITICAL(&conn_lock);
+
+        if (bits & WIFI_CONNECTING_BIT)
+        {
+            if (retry)
+            {
+                ESP_LOGI(WIFITAG, "Retrying connection");
+                esp_wifi_connect();
+            }
+            else
+            {
+                esp_timer_stop(conn_timer);
+                connect_failed();
+            }
+        }
     }
 }
 
@@ -70,32 +288,66 @@ static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t eve
     {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
         ESP_LOGI(WIFITAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
-        wifi_connected = true;
+        esp_timer_stop(conn_timer);
+
+        char ssid[33];
+        char password[65];
+        taskENTER_CRITICAL(&conn_lock);
+        bool save = conn.save;
+        conn.save = false;
+        conn.ip = event->ip_info.ip.addr;
+        memcpy(ssid, conn.ssid, sizeof(ssid));
+        memcpy(password, conn.password, sizeof(password));
+        taskEXIT_CRITICAL(&conn_lock);
+
+        xEventGroupClearBits(wifi_events, WIFI_CONNECTING_BIT | WIFI_FAIL_BIT);
+        xEventGroupSetBits(wifi_events, WIFI_CONNECTED_BIT);
+
+        // Credentials entered in the portal are only kept once they have worked
+        if (save && save_wifi_credentials(ssid, password) != ESP_OK)
+        {
+            ESP_LOGE(WIFITAG, "Failed to save Wifi credentials to NVS");
+        }
+
         esp_netif_dns_info_t dns_info;
         esp_netif_get_dns_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"), ESP_NETIF_DNS_MAIN, &dns_info);
         ESP_LOGI(WIFITAG, "DNS Server: " IPSTR, IP2STR(&dns_info.ip.u_addr.ip4));
     }
 }
 
-esp_err_t retry_handler(httpd_req_t *req)
+static esp_err_t retry_handler(httpd_req_t *req)
 {
     ESP_LOGI(WIFITAG, "Manual retry requested via /retry");
 
-    // Disconnect first to clear previous state
-    esp_wifi_disconnect();
-    vTaskDelay(pdMS_TO_TICKS(500));
-
-    wifi_connect_stored(); // This now has 3-retry logic
+    wifi_connect_stored(); // Drops any current link and starts over
     httpd_resp_set_status(req, "303 See Other");
     httpd_resp_set_hdr(req, "Location", "/");
     httpd_resp_send(req, NULL, 0);
     return ESP_OK;
 }
 
-esp_err_t get_handler(httpd_req_t *req)
+// POST /exit: the technician is done, the node goes back to sampling
+static esp_err_t exit_handler(httpd_req_t *req)
+{
+    ESP_LOGI(WIFITAG, "Leaving config mode via /exit");
+    portal_exit = true;
+    httpd_resp_set_type(req, "text/plain");
+    return httpd_resp_sendstr(req, "Leaving config mode. The node goes back to sampling.");
+}
+
+static esp_err_t scan_json_handler(httpd_req_t *req)
+{
+    ap_entry_t aps[MAX_APs];
+    int64_t scan_ms;
+    uint16_t count = ap_snapshot(aps, &scan_ms);
+    long long age_ms = scan_ms ? esp_timer_get_time() / 1000 - scan_ms : -1;
+    return portal_send_scan_json(req, aps, count, scan_running, age_ms);
+}
+
+static esp_err_t get_handler(httpd_req_t *req)
 {
     char status_text[128] = "";
-    char status_color[16] = "black";
+    const char *status_color = "black";
     char query[128] = "";
 
     // Parse query parameters
@@ -105,88 +357,58 @@ esp_err_t get_handler(httpd_req_t *req)
         if (httpd_query_key_value(query, "error", param, sizeof(param)) == ESP_OK)
         {
             url_decode(param, status_text, sizeof(status_text));
-            strcpy(status_color, "red");
+            status_color = "red";
         }
         else if (httpd_query_key_value(query, "success", param, sizeof(param)) == ESP_OK)
         {
             url_decode(param, status_text, sizeof(status_text));
-            strcpy(status_color, "green");
+            status_color = "green";
         }
     }
 
-    char *options = generate_wifi_options();
-    if (!options)
-    {
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
-    }
+    ap_entry_t aps[MAX_APs];
+    int64_t scan_ms;
+    uint16_t count = ap_snapshot(aps, &scan_ms);
 
-    char *response = malloc(4096);
-    if (!response)
+    // Refresh stale results in the background; the page picks them up from /scan.json
+    if (scan_ms == 0 || esp_timer_get_time() / 1000 - scan_ms > SCAN_CACHE_MAX_AGE_MS)
     {
-        free(options);
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+        scan_wifi_networks();
     }
 
-    // Format the HTML content FIRST
-    int len = snprintf(response, 4096, HTML_PAGE, options, status_color, status_text);
-    if (len < 0 || len >= 4096)
+    if (portal_send_page(req, aps, count, scan_running, status_color, status_text) != ESP_OK)
     {
-        free(options);
-        free(response);
-        httpd_resp_send_500(req);
+        ESP_LOGW(WIFITAG, "Client went away while sending page");
         return ESP_FAIL;
     }
-
-    // Send the formatted response
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, response, len);
-
-    // Cleanup after sending
-    free(options);
-    free(response);
     return ESP_OK;
 }
 
-esp_err_t post_handler(httpd_req_t *req)
+static esp_err_t style_handler(httpd_req_t *req)
 {
-    char buf[128];           // Buffer for reading POST data in chunks
-    char ssid[33] = {0};     // SSID max 32 bytes + null terminator
-    char password[65] = {0}; // Password max 64 bytes + null terminator
-    int total_received = 0;
+    httpd_resp_set_type(req, "text/css");
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_hdr(req, "Cache-Control", "max-age=86400");
+    return httpd_resp_send(req, style_css_gz_start, style_css_gz_end - style_css_gz_start);
+}
 
-    // Read POST data in chunks
-    while (total_received < req->content_len)
-    {
-        int received = httpd_req_recv(req, buf, MIN(sizeof(buf), req->content_len - total_received));
-        if (received <= 0)
-        {
-            if (received == HTTPD_SOCK_ERR_TIMEOUT)
-                continue;
-            return ESP_FAIL;
-        }
-        total_received += received;
-        buf[received] = '\0';
+static esp_err_t post_handler(httpd_req_t *req)
+{
+    char ssid[33];     // SSID max 32 bytes + null terminator
+    char password[65]; // Password max 64 bytes + null terminator
+    form_field_t fields[] = {
+        {.name = "ssid", .value = ssid, .size = sizeof(ssid)},
+        {.name = "password", .value = password, .size = sizeof(password)},
+    };
 
-        // Parse SSID and password from the received data
-        char *token = strtok(buf, "&");
-        while (token)
-        {
-            if (strncmp(token, "ssid=", 5) == 0)
-            {
-                url_decode(token + 5, ssid, sizeof(ssid));
-            }
-            else if (strncmp(token, "password=", 9) == 0)
-            {
-                url_decode(token + 9, password, sizeof(password));
-            }
-            token = strtok(NULL, "&");
-        }
+    esp_err_t err = form_read_request(req, fields, sizeof(fields) / sizeof(fields[0]));
+    if (err == ESP_FAIL)
+    {
+        return ESP_FAIL;
     }
 
     // Validate input length
-    if (strlen(ssid) > 32 || strlen(password) > 64)
+    if (err == ESP_ERR_INVALID_SIZE)
     {
         httpd_resp_set_status(req, "303 See Other");
         httpd_resp_set_hdr(req, "Location", "/?error=SSID%20or%20Password%20Too%20Long");
@@ -200,69 +422,54 @@ esp_err_t post_handler(httpd_req_t *req)
     strlcpy((char *)sta_config.sta.password, password, sizeof(sta_config.sta.password));
     sta_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
 
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
-    esp_err_t ret = esp_wifi_connect();
-    
-
-    if (ret != ESP_OK)
+    // The page follows the attempt through /status.json
+    httpd_resp_set_status(req, "303 See Other");
+    if (wifi_start_connect(&sta_config, true) != ESP_OK)
     {
-        httpd_resp_set_status(req, "303 See Other");
         httpd_resp_set_hdr(req, "Location", "/?error=Connection%20Failed");
-        httpd_resp_send(req, NULL, 0);
-        return ESP_OK;
     }
-
-    // Wait for connection with event-based status
-    int timeout = CONNECTION_TIMEOUT_MS / 500;
-    wifi_connected = false;
-    vTaskDelay(1000); // Give some time for the connection to start
-    while (timeout-- > 0 && !wifi_connected)
+    else
     {
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        ESP_LOGI(WIFITAG, "Waiting for connection to AP");
-        
+        httpd_resp_set_hdr(req, "Location", "/?connecting=1");
     }
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+}
 
-    if (!wifi_connected)
-    {
-        httpd_resp_set_status(req, "303 See Other");
-        httpd_resp_set_hdr(req, "Location", "/?error=Connection%20Timeout");
-
-        vTaskDelay(1000);
-        if (!wifi_connected)
-        {
-            setColor(8191, 0, 0); // Red
-            vTaskDelay(1000);
-            setColor(0, 0, 8191); // Blue
-        }
-
-
-        httpd_resp_send(req, NULL, 0);
-        return ESP_OK;
-    }
+// {"state":"connecting","ssid":"...","retries":1,"reason":0,"ip":"0.0.0.0"}
+static esp_err_t status_handler(httpd_req_t *req)
+{
+    static const char *state_names[] = {
+        [WIFI_STATE_IDLE] = "idle",
+        [WIFI_STATE_CONNECTING] = "connecting",
+        [WIFI_STATE_CONNECTED] = "connected",
+        [WIFI_STATE_FAILED] = "failed",
+    };
 
-    if (wifi_connected)
+    char ssid[33];
+    taskENTER_CRITICAL(&conn_lock);
+    memcpy(ssid, conn.ssid, sizeof(ssid));
+    uint8_t retries = conn.retries;
+    uint8_t reason = conn.reason;
+    esp_ip4_addr_t ip = {.addr = conn.ip};
+    taskEXIT_CRITICAL(&conn_lock);
+
+    char line[96];
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    snprintf(line, sizeof(line), "{\"state\":\"%s\",\"ssid\":\"", state_names[wifi_conn_state()]);
+    if (httpd_resp_sendstr_chunk(req, line) != ESP_OK ||
+        portal_send_json_escaped(req, ssid, 32) != ESP_OK)
     {
-        if (save_wifi_credentials(ssid, password) != ESP_OK)
-        {
-            ESP_LOGE(WIFITAG, "Failed to save Wifi credentials to NVS");
-        }
+        return ESP_FAIL;
     }
-
-    // URL-encode SSID for the redirect
-    char encoded_ssid[65] = {0};
-    url_encode(ssid, encoded_ssid, sizeof(encoded_ssid));
-
-    // Build the Location header with a fixed-size buffer
-    char location[128]; // Fixed-size buffer for Location header
-    snprintf(location, sizeof(location), "/?success=Connected%%20to%%20%.32s", encoded_ssid);
-    httpd_resp_set_status(req, "303 See Other");
-    httpd_resp_set_hdr(req, "Location", location);
-    httpd_resp_send(req, NULL, 0);
-    return ESP_OK;
+    snprintf(line, sizeof(line), "\",\"retries\":%d,\"reason\":%d,\"ip\":\"" IPSTR "\"}", retries, reason, IP2STR(&ip));
+    if (httpd_resp_sendstr_chunk(req, line) != ESP_OK)
+        return ESP_FAIL;
+    return httpd_resp_sendstr_chunk(req, NULL);
 }
 
-esp_err_t scan_handler(httpd_req_t *req)
+static esp_err_t scan_handler(httpd_req_t *req)
 {
     scan_wifi_networks();
     httpd_resp_set_status(req, "303 See Other");
@@ -271,126 +478,94 @@ esp_err_t scan_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-esp_err_t register_handler(httpd_req_t *req)
+static esp_err_t register_handler(httpd_req_t *req)
 {
-    char buf[512];
-    int received = httpd_req_recv(req, buf, MIN(req->content_len, sizeof(buf) - 1));
-    if (received <= 0)
+    char key[64];
+    char sensorID[32];
+    char geoutm[128];
+    form_field_t fields[] = {
+        {.name = "key", .value = key, .size = sizeof(key)},
+        {.name = "sensorID", .value = sensorID, .size = sizeof(sensorID)},
+        {.name = "geoutm", .value = geoutm, .size = sizeof(geoutm)},
+    };
+
+    // Parse form input
+    esp_err_t err = form_read_request(req, fields, sizeof(fields) / sizeof(fields[0]));
+    if (err == ESP_ERR_INVALID_SIZE)
     {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read request body");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Registration field too long");
         return ESP_FAIL;
     }
-    buf[received] = '\0';
-
-    char key[64] = {0};
-    char sensorID[32] = {0};
-    char geoutm[128] = {0};
-
-    // Parse form input
-    char *token = strtok(buf, "&");
-    while (token)
+    if (err != ESP_OK)
     {
-        if (strncmp(token, "key=", 4) == 0)
-        {
-            url_decode(token + 4, key, sizeof(key));
-        }
-        else if (strncmp(token, "sensorID=", 9) == 0)
-        {
-            url_decode(token + 9, sensorID, sizeof(sensorID));
-        }
-        else if (strncmp(token, "geoutm=", 7) == 0)
-        {
-            url_decode(token + 7, geoutm, sizeof(geoutm));
-        }
-        token = strtok(NULL, "&");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read request body");
+        return ESP_FAIL;
     }
 
     // Write inputs to /sdcard/register.txt
-    const char *registerpath = "/sdcard/register.txt";
-    FILE *file = fopen(registerpath, "w");
-    if (!file)
+    char reg_data[256];
+    int reg_len = snprintf(reg_data, sizeof(reg_data), "key:'%s'\nsensorID:'%s'\ngeoutm:'%s'\n", key, sensorID, geoutm);
+    if (reg_len < 0 || (size_t)reg_len >= sizeof(reg_data) || sd_write_atomic(registerpath, reg_data, reg_len) != ESP_OK)
     {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write registration file");
         return ESP_FAIL;
     }
-    fprintf(file, "key:'%s'\nsensorID:'%s'\ngeoutm:'%s'\n", key, sensorID, geoutm);
-    fclose(file);
 
     // Log one sensor row to register.txt
     sensor_single_log(registerpath);
 
     // Upload to server
-    const char *url = "https://h2overwatch.ca/DesktopModules/ShiftUP_VolsenseMap/registerDevice.ashx";
-    char *server_response = malloc(1024);
+    const char *url = uplink_config()->register_url;
+    char *server_response = malloc(PROVISION_RESPONSE_MAX);
     if (!server_response)
     {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
         return ESP_FAIL;
     }
 
-    esp_err_t upload_status = upload_file_to_server(registerpath, url, server_response, 1024);
+    esp_err_t upload_status = upload_file_to_server(registerpath, url, server_response, PROVISION_RESPONSE_MAX);
     if (upload_status != ESP_OK || strlen(server_response) == 0)
     {
         free(server_response);
         httpd_resp_set_status(req, "303 See Other");
-        httpd_resp_set_hdr(req, "Location", "/?error=Registration%%20Upload%%20Failed");
+        httpd_resp_set_hdr(req, "Location", "/?error=Registration%20Upload%20Failed");
         httpd_resp_send(req, NULL, 0);
         return ESP_OK;
     }
 
-    // Line-by-line parser (handles \r\n and missing fields)
-    char parsed_key[64] = {0};
-    char parsed_sensorID[32] = {0};
-    char parsed_geoutm[128] = {0};
-
-    char *line = strtok(server_response, "\r\n");
-    while (line)
-    {
-        if (strncmp(line, "key:'", 5) == 0)
-        {
-            sscanf(line, "key:'%63[^']", parsed_key);
-        }
-        else if (strncmp(line, "sensorID:'", 10) == 0)
-        {
-            sscanf(line, "sensorID:'%31[^']", parsed_sensorID);
-        }
-        else if (strncmp(line, "geoutm:'", 8) == 0)
-        {
-            sscanf(line, "geoutm:'%127[^']", parsed_geoutm);
-        }
-        line = strtok(NULL, "\r\n");
-    }
+    // The reply confirms the registration and may carry provisioning parameters as well
+    provision_t prov;
+    esp_err_t parse_status = provision_parse(server_response, strlen(server_response), &prov);
+    free(server_response);
 
-    if (strlen(parsed_key) == 0 || strlen(parsed_sensorID) == 0 || strlen(parsed_geoutm) == 0)
+    if (parse_status != ESP_OK || (prov.present & PROV_HAS_REGISTRATION) != PROV_HAS_REGISTRATION)
     {
-        free(server_response);
         httpd_resp_set_status(req, "303 See Other");
-        httpd_resp_set_hdr(req, "Location", "/?error=Failed%%20to%%20parse%%20server%%20response");
+        httpd_resp_set_hdr(req, "Location", "/?error=Failed%20to%20parse%20server%20response");
         httpd_resp_send(req, NULL, 0);
         return ESP_OK;
     }
 
     ESP_LOGI("REG", "Parsed from server: key=%s, sensorID=%s, geoutm=%s",
-             parsed_key, parsed_sensorID, parsed_geoutm);
+             prov.key, prov.sensor_id, prov.geoutm);
 
     // Save confirmed values
-    save_registration_metadata(parsed_key, parsed_sensorID, parsed_geoutm);
-    sd_set_metadata(parsed_key, parsed_sensorID, parsed_geoutm);
-    free(server_response);
+    if (provision_apply(&prov) != ESP_OK)
+    {
+        ESP_LOGE(WIFITAG, "Failed to store provisioning data");
+    }
+    sd_set_metadata(prov.key, prov.sensor_id, prov.geoutm);
 
     httpd_resp_set_status(req, "303 See Other");
-    httpd_resp_set_hdr(req, "Location", "/?success=Device%%20Registered");
+    httpd_resp_set_hdr(req, "Location", "/?success=Device%20Registered");
     httpd_resp_send(req, NULL, 0);
     return ESP_OK;
 }
 
 void wifi_init_softap(void)
 {
-    configure_ledc(); // Configure the LED GPIO
-    if (init_nvs() != ESP_OK)
-    {
-        ESP_LOGE(WIFITAG, "Failed to initialize NVS");
-    }
+    ap_lock = xSemaphoreCreateMutexStatic(&ap_lock_buf);
+    wifi_events_init();
 
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -424,15 +599,15 @@ void wifi_init_softap(void)
     ESP_LOGI(WIFITAG, "Config page initialized successfully");
 
     wifi_connect_stored();
+    scan_wifi_networks(); // Results are usually in before the first page load
 }
 
-int compare_rssi(const void *a, const void *b)
-{
-    return ((wifi_ap_record_t *)b)->rssi - ((wifi_ap_record_t *)a)->rssi;
-}
-
+// Starts a background scan; results arrive with WIFI_EVENT_SCAN_DONE
 void scan_wifi_networks(void)
 {
+    if (scan_running)
+        return;
+
     wifi_scan_config_t scan_config = {
         .ssid = NULL,
         .bssid = NULL,
@@ -440,109 +615,13 @@ void scan_wifi_networks(void)
         .scan_type = WIFI_SCAN_TYPE_ACTIVE,
         .show_hidden = false};
 
-    esp_err_t ret = esp_wifi_scan_start(&scan_config, true);
+    scan_running = true;
+    esp_err_t ret = esp_wifi_scan_start(&scan_config, false);
     if (ret != ESP_OK)
     {
-        ESP_LOGE(WIFITAG, "Scan failed: %s", esp_err_to_name(ret));
-        return;
+        scan_running = false;
+        ESP_LOGE(WIFITAG, "Scan failed to start: %s", esp_err_to_name(ret));
     }
-
-    uint16_t max_aps = MAX_APs;
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&max_aps, ap_list));
-    ap_count = max_aps;
-    qsort(ap_list, ap_count, sizeof(wifi_ap_record_t), compare_rssi);
-    ESP_LOGI(WIFITAG, "Found %d access points (sorted by strength)", ap_count);
-}
-
-char *generate_wifi_options(void)
-{
-    const size_t buffer_size = 2048;
-    char *options = malloc(buffer_size);
-    if (!options)
-        return NULL;
-
-    size_t offset = 0;
-    for (int i = 0; i < ap_count && offset < buffer_size; i++)
-    {
-        size_t remaining = buffer_size - offset;
-        if (remaining <= 0)
-            break;
-        int written = snprintf(options + offset, buffer_size - offset,
-                               "<option value=\"%.32s\">%.32s (%ddBm)</option>",
-                               ap_list[i].ssid, ap_list[i].ssid, ap_list[i].rssi);
-        if (written >= remaining)
-        {
-            offset = buffer_size - 1;
-            options[offset] = '\0';
-            break;
-        }
-        else if (written > 0)
-        {
-            offset += written;
-        }
-    }
-
-    if (offset == 0)
-    {
-        snprintf(options, buffer_size, "<option disabled>No networks found. Please scan.</option>");
-    }
-    options[offset] = '\0';
-    return options;
-}
-
-void url_decode(const char *input, char *output, size_t buf_size)
-{
-    size_t i = 0, j = 0;
-    char ch;
-    while ((ch = input[i++]) && j < buf_size - 1)
-    {
-        if (ch == '+')
-        {
-            output[j++] = ' ';
-        }
-        else if (ch == '%')
-        {
-            if (!isxdigit((unsigned char)input[i]) || !isxdigit((unsigned char)input[i + 1]))
-            {
-                output[j++] = '%';
-            }
-            else
-            {
-                char hex[3] = {input[i], input[i + 1], 0};
-                output[j++] = (char)strtol(hex, NULL, 16);
-                i += 2;
-            }
-        }
-        else
-        {
-            output[j++] = ch;
-        }
-    }
-    output[j] = '\0';
-}
-
-void url_encode(const char *input, char *output, size_t buf_size)
-{
-    const char *hex = "0123456789ABCDEF";
-    size_t i = 0, j = 0;
-
-    while (input[i] && j < buf_size - 1)
-    {
-        if (isalnum((unsigned char)input[i]) || input[i] == '-' || input[i] == '_' || input[i] == '.' || input[i] == '~')
-        {
-            output[j++] = input[i++];
-        }
-        else
-        {
-            if (j + 3 >= buf_size)
-                break; // Ensure enough space for encoding
-            output[j++] = '%';
-            output[j++] = hex[(input[i] >> 4) & 0xF];
-            output[j++] = hex[input[i] & 0xF];
-            i++;
-        }
-    }
-    output[j] = '\0';
 }
 
 esp_err_t init_nvs()
@@ -558,58 +637,23 @@ esp_err_t init_nvs()
 
 esp_err_t save_wifi_credentials(const char *ssid, const char *password)
 {
-    nvs_handle_t handle;
-    esp_err_t err;
-
-    err = nvs_open("wifi_config", NVS_READWRITE, &handle);
-    if (err != ESP_OK)
-        return err;
-
-    err = nvs_set_str(handle, "ssid", ssid);
-    if (err != ESP_OK)
-    {
-        nvs_close(handle);
-        return err;
-    }
+    nodecfg_t cfg = *nodecfg();
+    strlcpy(cfg.ssid, ssid, sizeof(cfg.ssid));
+    strlcpy(cfg.password, password, sizeof(cfg.password));
+    cfg.present |= NODECFG_HAS_WIFI;
 
-    err = nvs_set_str(handle, "password", password);
-    if (err != ESP_OK)
-    {
-        nvs_close(handle);
-        return err;
-    }
     ESP_LOGI(WIFITAG, "Saving credentials - SSID: '%s', Password: %s", ssid, strlen(password) > 0 ? "[exists]" : "[empty]");
-    err = nvs_commit(handle);
-    nvs_close(handle);
-    return err;
+    return nodecfg_save(&cfg);
 }
 
 esp_err_t load_wifi_credentials(char *ssid, size_t ssid_size, char *password, size_t password_size)
 {
-    nvs_handle_t handle;
-    esp_err_t err;
+    const nodecfg_t *cfg = nodecfg();
+    if (!(cfg->present & NODECFG_HAS_WIFI))
+        return ESP_ERR_NVS_NOT_FOUND;
 
-    err = nvs_open("wifi_config", NVS_READONLY, &handle);
-    if (err != ESP_OK)
-        return err;
-
-    // Get SSID
-    err = nvs_get_str(handle, "ssid", ssid, &ssid_size);
-    if (err != ESP_OK)
-    {
-        nvs_close(handle);
-        return err;
-    }
-
-    // Get password
-    err = nvs_get_str(handle, "password", password, &password_size);
-    if (err != ESP_OK)
-    {
-        nvs_close(handle);
-        return err;
-    }
-
-    nvs_close(handle);
+    strlcpy(ssid, cfg->ssid, ssid_size);
+    strlcpy(password, cfg->password, password_size);
     return ESP_OK;
 }
 
@@ -656,61 +700,68 @@ void wifi_connect_stored()
         sta_config.sta.threshold.authmode = WIFI_AUTH_OPEN;
     }
 
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
-
-    ret = esp_wifi_connect();
-    if (ret != ESP_OK)
+    // Failures turn the LED red from the event handlers
+    if (wifi_start_connect(&sta_config, false) == ESP_OK)
     {
-        ESP_LOGE(WIFITAG, "Connection attempt failed: %s", esp_err_to_name(ret));
-        wifi_connected = false;
-        // Blink red to indicate connection failure
-        for (int i = 0; i < 3; i++)
-        {
-            setColor(8191, 0, 0);
-            vTaskDelay(pdMS_TO_TICKS(300));
-            setColor(0, 0, 0);
-            vTaskDelay(pdMS_TO_TICKS(300));
-        }
-        return;
+        ESP_LOGI(WIFITAG, "Connection started");
     }
-
-    ESP_LOGI(WIFITAG, "Successfully connected and got IP.");
-    return;
 }
 
 esp_err_t save_registration_metadata(const char *key, const char *sensorID, const char *geoutm)
 {
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open("registration", NVS_READWRITE, &handle);
-    if (err != ESP_OK)
-        return err;
+    nodecfg_t cfg = *nodecfg();
+    strlcpy(cfg.key, key, sizeof(cfg.key));
+    strlcpy(cfg.sensor_id, sensorID, sizeof(cfg.sensor_id));
+    strlcpy(cfg.geoutm, geoutm, sizeof(cfg.geoutm));
+    cfg.present |= NODECFG_HAS_REGISTRATION;
+    return nodecfg_save(&cfg);
+}
 
-    err |= nvs_set_str(handle, "key", key);
-    err |= nvs_set_str(handle, "sensorID", sensorID);
-    err |= nvs_set_str(handle, "geoutm", geoutm);
+esp_err_t load_registration_metadata(char *key, size_t key_size, char *sensorID, size_t id_size, char *geoutm, size_t geo_size)
+{
+    const nodecfg_t *cfg = nodecfg();
+    if (!(cfg->present & NODECFG_HAS_REGISTRATION))
+        return ESP_ERR_NVS_NOT_FOUND;
 
-    if (err == ESP_OK)
-    {
-        err = nvs_commit(handle);
-    }
+    strlcpy(key, cfg->key, key_size);
+    strlcpy(sensorID, cfg->sensor_id, id_size);
+    strlcpy(geoutm, cfg->geoutm, geo_size);
+    return ESP_OK;
+}
 
-    nvs_close(handle);
-    return err;
+// Every request goes through the URI match, so it marks the portal as in use
+static bool portal_uri_match(const char *uri_template, const char *uri_to_match, size_t match_upto)
+{
+    portal_request_us = esp_timer_get_time();
+    return httpd_uri_match_wildcard(uri_template, uri_to_match, match_upto);
 }
 
-esp_err_t load_registration_metadata(char *key, size_t key_size, char *sensorID, size_t id_size, char *geoutm, size_t geo_size)
+static esp_err_t portal_session_open(httpd_handle_t hd, int sockfd)
 {
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open("registration", NVS_READONLY, &handle);
-    if (err != ESP_OK)
-        return err;
+    portal_sessions++;
+    return ESP_OK;
+}
 
-    err |= nvs_get_str(handle, "key", key, &key_size);
-    err |= nvs_get_str(handle, "sensorID", sensorID, &id_size);
-    err |= nvs_get_str(handle, "geoutm", geoutm, &geo_size);
+// With a close_fn set the server leaves closing the socket to it
+static void portal_session_close(httpd_handle_t hd, int sockfd)
+{
+    portal_sessions--;
+    close(sockfd);
+}
 
-    nvs_close(handle);
-    return err;
+void portal_wait_done(uint32_t idle_ms, uint32_t max_ms)
+{
+    int64_t started = esp_timer_get_time();
+    portal_request_us = started;
+    while (!portal_exit && esp_timer_get_time() - started < (int64_t)max_ms * 1000)
+    {
+        wifi_sta_list_t stations;
+        if (portal_sessions > 0 || (esp_wifi_ap_get_sta_list(&stations) == ESP_OK && stations.num > 0))
+            portal_request_us = esp_timer_get_time();
+        else if (esp_timer_get_time() - portal_request_us >= (int64_t)idle_ms * 1000)
+            break;
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
 }
 
 httpd_handle_t start_webserver(void)
@@ -720,7 +771,9 @@ httpd_handle_t start_webserver(void)
     config.max_resp_headers = 40; // Increase header buffer size 32
     config.recv_wait_timeout = 10;
     config.send_wait_timeout = 10;
-    config.uri_match_fn = httpd_uri_match_wildcard;
+    config.uri_match_fn = portal_uri_match;
+    config.open_fn = portal_session_open;
+    config.close_fn = portal_session_close;
     config.stack_size = 8192;
     config.max_open_sockets = 7;
 
@@ -729,15 +782,29 @@ httpd_handle_t start_webserver(void)
     {
         httpd_uri_t uri_get = {.uri = "/", .method = HTTP_GET, .handler = get_handler};
         httpd_uri_t uri_scan = {.uri = "/scan", .method = HTTP_GET, .handler = scan_handler};
+        httpd_uri_t uri_scan_json = {.uri = "/scan.json", .method = HTTP_GET, .handler = scan_json_handler};
+        httpd_uri_t uri_status = {.uri = "/status.json", .method = HTTP_GET, .handler = status_handler};
         httpd_uri_t uri_post = {.uri = "/connect", .method = HTTP_POST, .handler = post_handler};
         httpd_uri_t retry_uri = {.uri = "/retry", .method = HTTP_POST, .handler = retry_handler};
         httpd_uri_t uri_register = {.uri = "/register", .method = HTTP_POST, .handler = register_handler};
+        httpd_uri_t uri_style = {.uri = "/style.css", .method = HTTP_GET, .handler = style_handler};
+        httpd_uri_t uri_history = {.uri = "/history", .method = HTTP_GET, .handler = history_handler};
+        httpd_uri_t uri_data = {.uri = "/data", .method = HTTP_GET, .handler = data_handler};
+        httpd_uri_t uri_data_csv = {.uri = "/data.csv", .method = HTTP_GET, .handler = data_csv_handler};
+        httpd_uri_t uri_exit = {.uri = "/exit", .method = HTTP_POST, .handler = exit_handler};
 
         httpd_register_uri_handler(server, &uri_register);
         httpd_register_uri_handler(server, &retry_uri);
         httpd_register_uri_handler(server, &uri_get);
         httpd_register_uri_handler(server, &uri_scan);
+        httpd_register_uri_handler(server, &uri_scan_json);
+        httpd_register_uri_handler(server, &uri_status);
         httpd_register_uri_handler(server, &uri_post);
+        httpd_register_uri_handler(server, &uri_style);
+        httpd_register_uri_handler(server, &uri_history);
+        httpd_register_uri_handler(server, &uri_data);
+        httpd_register_uri_handler(server, &uri_data_csv);
+        httpd_register_uri_handler(server, &uri_exit);
     }
     return server;
 }
@@ -745,6 +812,8 @@ httpd_handle_t start_webserver(void)
 // added to reconnect to wifi after deep sleep
 void wifi_init_sta_only(void)
 {
+    wifi_events_init();
+
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
@@ -757,6 +826,8 @@ void wifi_init_sta_only(void)
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_start());
+    // Radio off between DTIM beacons; with auto light sleep the chip sleeps along with it
+    esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
 
     wifi_connect_stored();
 }
@@ -7,25 +7,34 @@
 #include "esp_http_server.h"
 #include "esp_sleep.h"
 
+typedef enum
+{
+    WIFI_STATE_IDLE,
+    WIFI_STATE_CONNECTING,
+    WIFI_STATE_CONNECTED,
+    WIFI_STATE_FAILED,
+} wifi_conn_state_t;
+
 void wifi_init_softap(void);
 void scan_wifi_networks(void);
-char *generate_wifi_options(void);
-esp_err_t get_handler(httpd_req_t *req);
-esp_err_t post_handler(httpd_req_t *req);
-esp_err_t register_handler(httpd_req_t *req);
 httpd_handle_t start_webserver(void);
+// Blocks until /exit is posted, or no station has been on the softAP, no connection open and
+// no request made for idle_ms; max_ms at the most
+void portal_wait_done(uint32_t idle_ms, uint32_t max_ms);
 esp_err_t load_wifi_credentials(char *ssid, size_t ssid_size, char *password, size_t password_size);
 esp_err_t save_wifi_credentials(const char *ssid, const char *password);
 esp_err_t init_nvs();
 void wifi_connect_stored(void);
-esp_err_t retry_handler(httpd_req_t *req);
 void configure_softap_dns();
 void set_dns_for_sta();
 
 esp_err_t save_registration_metadata(const char *key, const char *sensorID, const char *geoutm);
 esp_err_t load_registration_metadata(char *key, size_t key_size,char *sensorID, size_t id_size,char *geoutm, size_t geo_size);
 
-extern bool wifi_connected;
+bool wifi_is_connected(void);
+// Blocks until the station has an IP, the timeout passes or, with stop_on_fail, the attempt gives up
+bool wifi_wait_connected(uint32_t timeout_ms, bool stop_on_fail);
+wifi_conn_state_t wifi_conn_state(void);
 extern char stored_ssid[33];
 extern char stored_password[65];
 
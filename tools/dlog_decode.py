@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Decode the deferred log (dlog.bin) written by main/dlog.c.
+
+Usage: dlog_decode.py build/monitoringnode.elf dlog.bin [dlog.old ...]
+
+Records only hold the address of their format string and the raw arguments, so the ELF
+must be the one the node was running. Needs pyelftools (pip install pyelftools).
+"""
+
+import hashlib
+import re
+import struct
+import sys
+
+from elftools.elf.constants import SH_FLAGS
+from elftools.elf.elffile import ELFFile
+
+CHUNK = struct.Struct("<4sHHI16s")      # dlog_chunk_t
+RECORD = struct.Struct("<IIHBB")        # dlog_record_t
+LEVELS = "NEWIDV"
+SPEC = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|j|z|t|L)?([diouxXcsfFeEgGaAp%])")
+
+
+class Image:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.sha256 = hashlib.sha256(f.read()).hexdigest()
+        self.elf = ELFFile(open(path, "rb"))
+        self.sections = [(s["sh_addr"], s.data()) for s in self.elf.iter_sections()
+                         if s["sh_flags"] & SH_FLAGS.SHF_ALLOC and s["sh_type"] != "SHT_NOBITS"]
+        self.modules = self._module_names()
+
+    def read(self, addr, size):
+        for base, data in self.sections:
+            if base <= addr and addr + size <= base + len(data):
+                return data[addr - base:addr - base + size]
+        return None
+
+    def string(self, addr):
+        for base, data in self.sections:
+            if base <= addr < base + len(data):
+                end = data.find(b"\0", addr - base)
+                return data[addr - base:end].decode("utf-8", "replace")
+        return None
+
+    def _module_names(self):
+        symtab = self.elf.get_section_by_name(".symtab")
+        syms = symtab.get_symbol_by_name("dlog_module_names") if symtab else None
+        if not syms:
+            return []
+        sym = syms[0]
+        table = self.read(sym["st_value"], sym["st_size"]) or b""
+        return [self.string(p) for (p,) in struct.iter_unpack("<I", table)]
+
+
+def format_record(image, fmt, args):
+    args = list(args)
+
+    def arg():
+        return args.pop(0) if args else 0
+
+    def convert(m):
+        flags, width, prec, length, conv = m.groups()
+        if conv == "%":
+            return "%"
+        if width == "*":
+            width = str(struct.unpack("<i", struct.pack("<I", arg() & 0xFFFFFFFF))[0])
+        if prec == "*":
+            prec = str(arg() & 0xFFFFFFFF)
+        spec = "%" + flags + (width or "") + ("." + prec if prec is not None else "")
+        raw = arg()
+        if conv in "fFeEgGaA":
+            value = struct.unpack("<d", struct.pack("<Q", raw))[0]
+            return (spec + ("g" if conv in "aA" else conv)) % value
+        if conv == "s":
+            return (spec + "s") % (image.string(raw) or "<0x%08x>" % raw)
+        if conv == "p":
+            return (spec + "s") % ("0x%08x" % raw)
+        if conv == "c":
+            return (spec + "c") % chr(raw & 0xFF)
+        # Integer slots are widened from long long; only %ll and %j use all 64 bits
+        bits = 64 if length in ("ll", "j") else 8 if length == "hh" else 16 if length == "h" else 32
+        raw &= (1 << bits) - 1
+        if conv in "di" and raw >> (bits - 1):
+            raw -= 1 << bits
+        return (spec + ("d" if conv == "i" else conv)) % raw
+
+    return SPEC.sub(convert, fmt)
+
+
+def decode(image, path):
+    with open(path, "rb") as f:
+        blob = f.read()
+    pos = 0
+    while pos + CHUNK.size <= len(blob):
+        magic, dropped, _, length, sha = CHUNK.unpack_from(blob, pos)
+        if magic != b"DLG1":
+            print("%s: bad chunk at offset %d" % (path, pos), file=sys.stderr)
+            return
+        pos += CHUNK.size
+        sha = sha.decode("ascii", "replace")
+        if not image.sha256.startswith(sha):
+            print("-- chunk from firmware %s, not this ELF; skipped" % sha)
+            pos += length
+            continue
+        if dropped:
+            print("-- %d records dropped before this flush" % dropped)
+        end = pos + length
+        while pos + RECORD.size <= end:
+            fmt, ms, boot, module, level_nargs = RECORD.unpack_from(blob, pos)
+            nargs = level_nargs & 0x0F
+            pos += RECORD.size
+            args = struct.unpack_from("<%dQ" % nargs, blob, pos)
+            pos += nargs * 8
+            text = image.string(fmt)
+            if text is None:
+                text = "<format at 0x%08x>" % fmt
+            name = image.modules[module] if module < len(image.modules) else str(module)
+            level = LEVELS[level_nargs >> 4] if level_nargs >> 4 < len(LEVELS) else "?"
+            print("%5d %s (%d) %s: %s" % (boot, level, ms, name, format_record(image, text, args)))
+        pos = end
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    image = Image(sys.argv[1])
+    for path in sys.argv[2:]:
+        decode(image, path)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())